@@ -69,6 +69,10 @@
 
 #define SO_RXQ_OVFL		40
 
+#define SO_BUSY_POLL		46
+
 #define SO_BPF_EXTENSIONS	48
 
+#define SO_ZEROCOPY		60
+
 #endif	/* _ASM_POWERPC_SOCKET_H */
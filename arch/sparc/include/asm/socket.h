@@ -58,6 +58,10 @@
 
 #define SO_RXQ_OVFL             0x0024
 
+#define SO_BUSY_POLL            0x0030
+
+#define SO_ZEROCOPY             0x003e
+
 /* Security levels - as per NRL IPv6 - don't actually do anything */
 #define SO_SECURITY_AUTHENTICATION		0x5001
 #define SO_SECURITY_ENCRYPTION_TRANSPORT	0x5002
@@ -0,0 +1,739 @@
+/* bpf_jit_comp.c : BPF JIT compiler
+ *
+ * Translates classic BPF socket filters (struct sock_filter) into native
+ * x86-64 code when they are attached, so the per packet cost is a direct
+ * call instead of a walk through the sk_run_filter() interpreter.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2
+ * of the License.
+ */
+#include <linux/module.h>
+#include <linux/moduleloader.h>
+#include <asm/cacheflush.h>
+#include <linux/netdevice.h>
+#include <linux/filter.h>
+#include <linux/if_vlan.h>
+#include <linux/workqueue.h>
+
+/*
+ * Conventions :
+ *  EAX : BPF A accumulator
+ *  EBX : BPF X accumulator
+ *  RDI : pointer to skb   (first argument given to JIT function)
+ *  RBP : frame pointer (even if CONFIG_FRAME_POINTER=n)
+ *  ECX,EDX,ESI : scratch registers
+ *  r9d : skb->len - skb->data_len (headlen)
+ *  r8  : skb->data
+ * -8(RBP) : saved RBX value
+ * -12(RBP) : scratch buffer for the skb_copy_bits() slow path
+ * -16(RBP)..-76(RBP) : BPF_MEMWORDS values
+ */
+int bpf_jit_enable __read_mostly;
+EXPORT_SYMBOL_GPL(bpf_jit_enable);
+
+/*
+ * assembly code in arch/x86/net/bpf_jit.S
+ */
+extern u8 sk_load_word[], sk_load_half[], sk_load_byte[], sk_load_byte_msh[];
+
+static inline u8 *emit_code(u8 *ptr, u32 bytes, unsigned int len)
+{
+	if (len == 1)
+		*ptr = bytes;
+	else if (len == 2)
+		*(u16 *)ptr = bytes;
+	else {
+		*(u32 *)ptr = bytes;
+		barrier();
+	}
+	return ptr + len;
+}
+
+#define EMIT(bytes, len)	do { prog = emit_code(prog, bytes, len); } while (0)
+
+#define EMIT1(b1)		EMIT(b1, 1)
+#define EMIT2(b1, b2)		EMIT((b1) + ((b2) << 8), 2)
+#define EMIT3(b1, b2, b3)	EMIT((b1) + ((b2) << 8) + ((b3) << 16), 3)
+#define EMIT4(b1, b2, b3, b4)   EMIT((b1) + ((b2) << 8) + ((b3) << 16) + ((b4) << 24), 4)
+#define EMIT1_off32(b1, off)	do { EMIT1(b1); EMIT(off, 4); } while (0)
+
+#define CLEAR_A() EMIT2(0x31, 0xc0) /* xor %eax,%eax */
+#define CLEAR_X() EMIT2(0x31, 0xdb) /* xor %ebx,%ebx */
+
+static inline bool is_imm8(int value)
+{
+	return value <= 127 && value >= -128;
+}
+
+static inline bool is_near(int offset)
+{
+	return offset <= 127 && offset >= -128;
+}
+
+#define EMIT_JMP(offset)						\
+do {									\
+	if (offset) {							\
+		if (is_near(offset))					\
+			EMIT2(0xeb, offset); /* jmp .+off8 */		\
+		else							\
+			EMIT1_off32(0xe9, offset); /* jmp .+off32 */	\
+	}								\
+} while (0)
+
+/* list of x86 cond jumps opcodes (. + s8)
+ * Add 0x10 (and an extra 0x0f) to generate far jumps (. + s32)
+ */
+#define X86_JB  0x72
+#define X86_JAE 0x73
+#define X86_JE  0x74
+#define X86_JNE 0x75
+#define X86_JBE 0x76
+#define X86_JA  0x77
+
+#define EMIT_COND_JMP(op, offset)				\
+do {								\
+	if (is_near(offset))					\
+		EMIT2(op, offset); /* jxx .+off8 */		\
+	else {							\
+		EMIT2(0x0f, op + 0x10);				\
+		EMIT(offset, 4); /* jxx .+off32 */		\
+	}							\
+} while (0)
+
+#define COND_SEL(CODE, TOP, FOP)	\
+	case CODE:			\
+		t_op = TOP;		\
+		f_op = FOP;		\
+		goto cond_branch
+
+/*
+ * Load a field of struct sk_buff (at offset OFF from %rdi) into %eax or
+ * %rax, picking the short displacement encoding when possible.
+ * OP8/OP32 are the opcode bytes (including the ModRM byte) for the
+ * off8(%rdi) and off32(%rdi) forms.
+ */
+#define EMIT_SKB_LOAD(OP, MODRM8, MODRM32, OFF)			\
+do {								\
+	if (is_imm8(OFF))					\
+		EMIT3(OP, MODRM8, OFF);				\
+	else {							\
+		EMIT2(OP, MODRM32);				\
+		EMIT(OFF, 4);					\
+	}							\
+} while (0)
+
+/* movzwl off(%rdi),%eax */
+#define EMIT_SKB_LOAD16(OFF)					\
+do {								\
+	EMIT1(0x0f);						\
+	EMIT_SKB_LOAD(0xb7, 0x47, 0x87, OFF);			\
+} while (0)
+
+#define SEEN_DATAREF 1 /* might call external helpers */
+#define SEEN_XREG    2 /* ebx is used */
+#define SEEN_MEM     4 /* use mem[] for temporary storage */
+
+/*
+ * A few sk_buff fields read by ancillary loads are bitfields, which
+ * offsetof() cannot take.  Their location is found at boot by setting the
+ * field in an otherwise zeroed sk_buff; -1 means "not found" and makes
+ * the JIT leave such filters to the interpreter.
+ */
+static int skb_protocol_off = -1;
+static int skb_queue_mapping_off = -1;
+static int skb_pkt_type_off = -1;
+static u8 skb_pkt_type_mask;
+
+static struct sk_buff bpf_jit_probe_skb __initdata;
+
+static int __init bpf_jit_probe_field(u8 *mask)
+{
+	const u8 *p = (const u8 *)&bpf_jit_probe_skb;
+	int i;
+
+	for (i = 0; i < sizeof(bpf_jit_probe_skb); i++)
+		if (p[i]) {
+			*mask = p[i];
+			return i;
+		}
+	return -1;
+}
+
+static int __init bpf_jit_init(void)
+{
+	struct sk_buff *skb = &bpf_jit_probe_skb;
+	u8 mask;
+
+	memset(skb, 0, sizeof(*skb));
+	skb->protocol = htons(0xffff);
+	skb_protocol_off = bpf_jit_probe_field(&mask);
+
+	memset(skb, 0, sizeof(*skb));
+	skb->queue_mapping = 0xffff;
+	skb_queue_mapping_off = bpf_jit_probe_field(&mask);
+
+	memset(skb, 0, sizeof(*skb));
+	skb->pkt_type = 7;
+	skb_pkt_type_off = bpf_jit_probe_field(&mask);
+	skb_pkt_type_mask = mask;
+
+	return 0;
+}
+late_initcall(bpf_jit_init);
+
+static inline void bpf_flush_icache(void *start, void *end)
+{
+	mm_segment_t old_fs = get_fs();
+
+	set_fs(KERNEL_DS);
+	smp_wmb();
+	flush_icache_range((unsigned long)start, (unsigned long)end);
+	set_fs(old_fs);
+}
+
+void bpf_jit_compile(struct sk_filter *fp)
+{
+	u8 temp[128];
+	u8 *prog;
+	unsigned int proglen, oldproglen = 0;
+	int ilen, i;
+	int t_offset, f_offset;
+	u8 t_op, f_op, seen = 0, pass;
+	u8 *image = NULL;
+	u8 *func;
+	unsigned int cleanup_addr; /* epilogue code offset */
+	unsigned int *addrs;
+	const struct sock_filter *filter = fp->insns;
+	int flen = fp->len;
+
+	if (!bpf_jit_enable)
+		return;
+
+	addrs = kmalloc(flen * sizeof(*addrs), GFP_KERNEL);
+	if (addrs == NULL)
+		return;
+
+	/* Before first pass, make a rough estimation of addrs[]
+	 * each bpf instruction is translated to less than 64 bytes
+	 */
+	for (proglen = 0, i = 0; i < flen; i++) {
+		proglen += 64;
+		addrs[i] = proglen;
+	}
+	cleanup_addr = proglen; /* epilogue address */
+
+	for (pass = 0; pass < 10; pass++) {
+		u8 seen_or_pass0 = (pass == 0) ?
+			(SEEN_XREG | SEEN_DATAREF | SEEN_MEM) : seen;
+
+		/* no prologue/epilogue for trivial filters (RET something) */
+		proglen = 0;
+		prog = temp;
+
+		if (seen_or_pass0) {
+			EMIT4(0x55, 0x48, 0x89, 0xe5); /* push %rbp; mov %rsp,%rbp */
+			EMIT4(0x48, 0x83, 0xec, 96);	/* subq  $96,%rsp	*/
+			/* note : must save %rbx in case bpf_error is hit */
+			if (seen_or_pass0 & (SEEN_XREG | SEEN_DATAREF))
+				EMIT4(0x48, 0x89, 0x5d, 0xf8); /* mov %rbx, -8(%rbp) */
+			if (seen_or_pass0 & SEEN_XREG)
+				CLEAR_X(); /* make sure we dont leek kernel memory */
+
+			/*
+			 * The interpreter reads never written mem[] slots
+			 * as 0, so clear them: -80(%rbp) .. -9(%rbp)
+			 */
+			if (seen_or_pass0 & SEEN_MEM) {
+				EMIT2(0x31, 0xd2); /* xor %edx,%edx */
+				for (i = 0xb0; i <= 0xf0; i += 8)
+					/* mov %rdx,off8(%rbp) */
+					EMIT4(0x48, 0x89, 0x55, i);
+			}
+
+			/*
+			 * If this filter needs to access skb data,
+			 * loads r9 and r8 with :
+			 *  r9 = skb->len - skb->data_len
+			 *  r8 = skb->data
+			 */
+			if (seen_or_pass0 & SEEN_DATAREF) {
+				if (offsetof(struct sk_buff, len) <= 127)
+					/* mov    off8(%rdi),%r9d */
+					EMIT4(0x44, 0x8b, 0x4f, offsetof(struct sk_buff, len));
+				else {
+					/* mov    off32(%rdi),%r9d */
+					EMIT3(0x44, 0x8b, 0x8f);
+					EMIT(offsetof(struct sk_buff, len), 4);
+				}
+				if (is_imm8(offsetof(struct sk_buff, data_len)))
+					/* sub    off8(%rdi),%r9d */
+					EMIT4(0x44, 0x2b, 0x4f, offsetof(struct sk_buff, data_len));
+				else {
+					EMIT3(0x44, 0x2b, 0x8f);
+					EMIT(offsetof(struct sk_buff, data_len), 4);
+				}
+
+				if (is_imm8(offsetof(struct sk_buff, data)))
+					/* mov off8(%rdi),%r8 */
+					EMIT4(0x4c, 0x8b, 0x47, offsetof(struct sk_buff, data));
+				else {
+					/* mov off32(%rdi),%r8 */
+					EMIT3(0x4c, 0x8b, 0x87);
+					EMIT(offsetof(struct sk_buff, data), 4);
+				}
+			}
+		}
+
+		for (i = 0; i < flen; i++) {
+			unsigned int K = filter[i].k;
+
+			switch (filter[i].code) {
+			case BPF_ALU|BPF_ADD|BPF_X: /* A += X; */
+				seen |= SEEN_XREG;
+				EMIT2(0x01, 0xd8);		/* add %ebx,%eax */
+				break;
+			case BPF_ALU|BPF_ADD|BPF_K: /* A += K; */
+				if (!K)
+					break;
+				if (is_imm8(K))
+					EMIT3(0x83, 0xc0, K);	/* add imm8,%eax */
+				else
+					EMIT1_off32(0x05, K);	/* add imm32,%eax */
+				break;
+			case BPF_ALU|BPF_SUB|BPF_X: /* A -= X; */
+				seen |= SEEN_XREG;
+				EMIT2(0x29, 0xd8);		/* sub    %ebx,%eax */
+				break;
+			case BPF_ALU|BPF_SUB|BPF_K: /* A -= K */
+				if (!K)
+					break;
+				if (is_imm8(K))
+					EMIT3(0x83, 0xe8, K); /* sub imm8,%eax */
+				else
+					EMIT1_off32(0x2d, K); /* sub imm32,%eax */
+				break;
+			case BPF_ALU|BPF_MUL|BPF_X: /* A *= X; */
+				seen |= SEEN_XREG;
+				EMIT3(0x0f, 0xaf, 0xc3);	/* imul %ebx,%eax */
+				break;
+			case BPF_ALU|BPF_MUL|BPF_K: /* A *= K */
+				if (is_imm8(K))
+					EMIT3(0x6b, 0xc0, K); /* imul imm8,%eax,%eax */
+				else {
+					EMIT2(0x69, 0xc0);		/* imul imm32,%eax */
+					EMIT(K, 4);
+				}
+				break;
+			case BPF_ALU|BPF_DIV|BPF_X: /* A /= X; */
+				seen |= SEEN_XREG;
+				EMIT2(0x85, 0xdb);	/* test %ebx,%ebx */
+				/* division by zero returns 0, as in sk_run_filter() */
+				EMIT_COND_JMP(X86_JNE, 2 + 5);
+				CLEAR_A();
+				EMIT1_off32(0xe9, cleanup_addr - (addrs[i] - 4)); /* jmp .+off32 */
+				EMIT4(0x31, 0xd2, 0xf7, 0xf3); /* xor %edx,%edx; div %ebx */
+				break;
+			case BPF_ALU|BPF_DIV|BPF_K: /* A /= K; K != 0 (sk_chk_filter) */
+				EMIT2(0x31, 0xd2);	/* xor %edx,%edx */
+				EMIT1_off32(0xb9, K);	/* mov $imm32,%ecx */
+				EMIT2(0xf7, 0xf1);	/* div %ecx */
+				break;
+			case BPF_ALU|BPF_AND|BPF_X:
+				seen |= SEEN_XREG;
+				EMIT2(0x21, 0xd8);		/* and %ebx,%eax */
+				break;
+			case BPF_ALU|BPF_AND|BPF_K:
+				if (K >= 0xFFFFFF00) {
+					EMIT2(0x24, K & 0xFF); /* and imm8,%al */
+				} else if (K >= 0xFFFF0000) {
+					EMIT2(0x66, 0x25);	/* and imm16,%ax */
+					EMIT(K, 2);
+				} else {
+					EMIT1_off32(0x25, K);	/* and imm32,%eax */
+				}
+				break;
+			case BPF_ALU|BPF_OR|BPF_X:
+				seen |= SEEN_XREG;
+				EMIT2(0x09, 0xd8);		/* or %ebx,%eax */
+				break;
+			case BPF_ALU|BPF_OR|BPF_K:
+				if (is_imm8(K))
+					EMIT3(0x83, 0xc8, K); /* or imm8,%eax */
+				else
+					EMIT1_off32(0x0d, K);	/* or imm32,%eax */
+				break;
+			case BPF_ALU|BPF_LSH|BPF_X: /* A <<= X; */
+				seen |= SEEN_XREG;
+				EMIT4(0x89, 0xd9, 0xd3, 0xe0);	/* mov %ebx,%ecx; shl %cl,%eax */
+				break;
+			case BPF_ALU|BPF_LSH|BPF_K:
+				if (K == 0)
+					break;
+				else if (K == 1)
+					EMIT2(0xd1, 0xe0); /* shl %eax */
+				else
+					EMIT3(0xc1, 0xe0, K);
+				break;
+			case BPF_ALU|BPF_RSH|BPF_X: /* A >>= X; */
+				seen |= SEEN_XREG;
+				EMIT4(0x89, 0xd9, 0xd3, 0xe8);	/* mov %ebx,%ecx; shr %cl,%eax */
+				break;
+			case BPF_ALU|BPF_RSH|BPF_K: /* A >>= K; */
+				if (K == 0)
+					break;
+				else if (K == 1)
+					EMIT2(0xd1, 0xe8); /* shr %eax */
+				else
+					EMIT3(0xc1, 0xe8, K);
+				break;
+			case BPF_ALU|BPF_NEG:
+				EMIT2(0xf7, 0xd8);		/* neg %eax */
+				break;
+			case BPF_RET|BPF_K:
+				if (!K)
+					CLEAR_A();
+				else
+					EMIT1_off32(0xb8, K);	/* mov $imm32,%eax */
+				/* fallinto */
+			case BPF_RET|BPF_A:
+				if (seen_or_pass0) {
+					if (i != flen - 1) {
+						EMIT_JMP(cleanup_addr - addrs[i]);
+						break;
+					}
+					if (seen_or_pass0 & SEEN_XREG)
+						EMIT4(0x48, 0x8b, 0x5d, 0xf8);  /* mov  -8(%rbp),%rbx */
+					EMIT1(0xc9);		/* leaveq */
+				}
+				EMIT1(0xc3);		/* ret */
+				break;
+			case BPF_MISC|BPF_TAX: /* X = A */
+				seen |= SEEN_XREG;
+				EMIT2(0x89, 0xc3);	/* mov    %eax,%ebx */
+				break;
+			case BPF_MISC|BPF_TXA: /* A = X */
+				seen |= SEEN_XREG;
+				EMIT2(0x89, 0xd8);	/* mov    %ebx,%eax */
+				break;
+			case BPF_LD|BPF_IMM: /* A = K */
+				if (!K)
+					CLEAR_A();
+				else
+					EMIT1_off32(0xb8, K); /* mov $imm32,%eax */
+				break;
+			case BPF_LDX|BPF_IMM: /* X = K */
+				seen |= SEEN_XREG;
+				if (!K)
+					CLEAR_X();
+				else
+					EMIT1_off32(0xbb, K); /* mov $imm32,%ebx */
+				break;
+			case BPF_LD|BPF_MEM: /* A = mem[K] : mov off8(%rbp),%eax */
+				seen |= SEEN_MEM;
+				EMIT3(0x8b, 0x45, 0xf0 - K*4);
+				break;
+			case BPF_LDX|BPF_MEM: /* X = mem[K] : mov off8(%rbp),%ebx */
+				seen |= SEEN_XREG | SEEN_MEM;
+				EMIT3(0x8b, 0x5d, 0xf0 - K*4);
+				break;
+			case BPF_ST: /* mem[K] = A : mov %eax,off8(%rbp) */
+				seen |= SEEN_MEM;
+				EMIT3(0x89, 0x45, 0xf0 - K*4);
+				break;
+			case BPF_STX: /* mem[K] = X : mov %ebx,off8(%rbp) */
+				seen |= SEEN_XREG | SEEN_MEM;
+				EMIT3(0x89, 0x5d, 0xf0 - K*4);
+				break;
+			case BPF_LD|BPF_W|BPF_LEN: /*	A = skb->len; */
+				BUILD_BUG_ON(FIELD_SIZEOF(struct sk_buff, len) != 4);
+				/* mov    off(%rdi),%eax */
+				EMIT_SKB_LOAD(0x8b, 0x47, 0x87,
+					      offsetof(struct sk_buff, len));
+				break;
+			case BPF_LDX|BPF_W|BPF_LEN: /* X = skb->len; */
+				seen |= SEEN_XREG;
+				/* mov off(%rdi),%ebx */
+				EMIT_SKB_LOAD(0x8b, 0x5f, 0x9f,
+					      offsetof(struct sk_buff, len));
+				break;
+			case BPF_LD|BPF_W|BPF_ABS:
+				func = sk_load_word;
+common_load:
+				if ((int)K < 0 && (int)K >= SKF_AD_OFF)
+					goto ancillary;
+				seen |= SEEN_DATAREF;
+				t_offset = func - (image + addrs[i]);
+				EMIT1_off32(0xbe, K); /* mov imm32,%esi */
+				EMIT1_off32(0xe8, t_offset); /* call */
+				break;
+			case BPF_LD|BPF_H|BPF_ABS:
+				func = sk_load_half;
+				goto common_load;
+			case BPF_LD|BPF_B|BPF_ABS:
+				func = sk_load_byte;
+				goto common_load;
+			case BPF_LDX|BPF_B|BPF_MSH:
+				seen |= SEEN_DATAREF | SEEN_XREG;
+				t_offset = sk_load_byte_msh - (image + addrs[i]);
+				EMIT1_off32(0xbe, K);	/* mov imm32,%esi */
+				EMIT1_off32(0xe8, t_offset); /* call sk_load_byte_msh */
+				break;
+			case BPF_LD|BPF_W|BPF_IND:
+				func = sk_load_word;
+common_load_ind:
+				seen |= SEEN_DATAREF | SEEN_XREG;
+				t_offset = func - (image + addrs[i]);
+				if (is_imm8(K)) {
+					/* lea off8(%rbx),%esi */
+					EMIT3(0x8d, 0x73, K);
+				} else {
+					/* lea off32(%rbx),%esi */
+					EMIT2(0x8d, 0xb3);
+					EMIT(K, 4);
+				}
+				EMIT1_off32(0xe8, t_offset);	/* call sk_load_xxx */
+				break;
+			case BPF_LD|BPF_H|BPF_IND:
+				func = sk_load_half;
+				goto common_load_ind;
+			case BPF_LD|BPF_B|BPF_IND:
+				func = sk_load_byte;
+				goto common_load_ind;
+			case BPF_JMP|BPF_JA:
+				t_offset = addrs[i + K] - addrs[i];
+				EMIT_JMP(t_offset);
+				break;
+			COND_SEL(BPF_JMP|BPF_JGT|BPF_K, X86_JA, X86_JBE);
+			COND_SEL(BPF_JMP|BPF_JGE|BPF_K, X86_JAE, X86_JB);
+			COND_SEL(BPF_JMP|BPF_JEQ|BPF_K, X86_JE, X86_JNE);
+			COND_SEL(BPF_JMP|BPF_JSET|BPF_K, X86_JNE, X86_JE);
+			COND_SEL(BPF_JMP|BPF_JGT|BPF_X, X86_JA, X86_JBE);
+			COND_SEL(BPF_JMP|BPF_JGE|BPF_X, X86_JAE, X86_JB);
+			COND_SEL(BPF_JMP|BPF_JEQ|BPF_X, X86_JE, X86_JNE);
+			COND_SEL(BPF_JMP|BPF_JSET|BPF_X, X86_JNE, X86_JE);
+
+cond_branch:			f_offset = addrs[i + filter[i].jf] - addrs[i];
+				t_offset = addrs[i + filter[i].jt] - addrs[i];
+
+				/* same targets, can avoid doing the test :) */
+				if (filter[i].jt == filter[i].jf) {
+					EMIT_JMP(t_offset);
+					break;
+				}
+
+				switch (filter[i].code) {
+				case BPF_JMP|BPF_JGT|BPF_X:
+				case BPF_JMP|BPF_JGE|BPF_X:
+				case BPF_JMP|BPF_JEQ|BPF_X:
+					seen |= SEEN_XREG;
+					EMIT2(0x39, 0xd8); /* cmp %ebx,%eax */
+					break;
+				case BPF_JMP|BPF_JSET|BPF_X:
+					seen |= SEEN_XREG;
+					EMIT2(0x85, 0xd8); /* test %ebx,%eax */
+					break;
+				case BPF_JMP|BPF_JEQ|BPF_K:
+					if (K == 0) {
+						EMIT2(0x85, 0xc0); /* test   %eax,%eax */
+						break;
+					}
+				case BPF_JMP|BPF_JGT|BPF_K:
+				case BPF_JMP|BPF_JGE|BPF_K:
+					if (K <= 127)
+						EMIT3(0x83, 0xf8, K); /* cmp imm8,%eax */
+					else
+						EMIT1_off32(0x3d, K); /* cmp imm32,%eax */
+					break;
+				case BPF_JMP|BPF_JSET|BPF_K:
+					if (K <= 0xFF)
+						EMIT2(0xa8, K); /* test imm8,%al */
+					else if (!(K & 0xFFFF00FF))
+						EMIT3(0xf6, 0xc4, K >> 8); /* test imm8,%ah */
+					else if (K <= 0xFFFF) {
+						EMIT2(0x66, 0xa9); /* test imm16,%ax */
+						EMIT(K, 2);
+					} else {
+						EMIT1_off32(0xa9, K); /* test imm32,%eax */
+					}
+					break;
+				}
+				if (filter[i].jt != 0) {
+					if (filter[i].jf && f_offset)
+						t_offset += is_near(f_offset) ? 2 : 5;
+					EMIT_COND_JMP(t_op, t_offset);
+					if (filter[i].jf)
+						EMIT_JMP(f_offset);
+					break;
+				}
+				EMIT_COND_JMP(f_op, f_offset);
+				break;
+			default:
+				/* hmm, too complex filter, give up with jit compiler */
+				goto out;
+			}
+			goto next;
+
+ancillary:
+			/*
+			 * Absolute loads from SKF_AD_OFF + x read skb
+			 * metadata rather than packet bytes, whatever
+			 * their width.
+			 */
+			switch ((int)K - SKF_AD_OFF) {
+			case SKF_AD_PROTOCOL: /* A = ntohs(skb->protocol); */
+				if (skb_protocol_off < 0)
+					goto out;
+				EMIT_SKB_LOAD16(skb_protocol_off);
+				EMIT4(0x66, 0xc1, 0xc0, 0x08); /* rol $8,%ax */
+				break;
+			case SKF_AD_PKTTYPE: /* A = skb->pkt_type; */
+				if (skb_pkt_type_off < 0)
+					goto out;
+				/* movzbl off(%rdi),%eax */
+				EMIT1(0x0f);
+				EMIT_SKB_LOAD(0xb6, 0x47, 0x87, skb_pkt_type_off);
+				EMIT1_off32(0x25, skb_pkt_type_mask); /* and imm32,%eax */
+				if (__ffs(skb_pkt_type_mask))
+					/* shr $imm8,%eax */
+					EMIT3(0xc1, 0xe8, __ffs(skb_pkt_type_mask));
+				break;
+			case SKF_AD_IFINDEX: /* A = skb->dev->ifindex; */
+			case SKF_AD_HATYPE: /* A = skb->dev->type; */
+				/* movq off(%rdi),%rax */
+				EMIT1(0x48);
+				EMIT_SKB_LOAD(0x8b, 0x47, 0x87,
+					      offsetof(struct sk_buff, dev));
+				EMIT3(0x48, 0x85, 0xc0);	/* test %rax,%rax */
+				if ((int)K - SKF_AD_OFF == SKF_AD_IFINDEX) {
+					/* no device: return 0, %eax is 0 */
+					EMIT_COND_JMP(X86_JE, cleanup_addr - (addrs[i] - 6));
+					BUILD_BUG_ON(FIELD_SIZEOF(struct net_device, ifindex) != 4);
+					EMIT2(0x8b, 0x80);	/* mov off32(%rax),%eax */
+					EMIT(offsetof(struct net_device, ifindex), 4);
+				} else {
+					EMIT_COND_JMP(X86_JE, cleanup_addr - (addrs[i] - 7));
+					BUILD_BUG_ON(FIELD_SIZEOF(struct net_device, type) != 2);
+					EMIT3(0x0f, 0xb7, 0x80); /* movzwl off32(%rax),%eax */
+					EMIT(offsetof(struct net_device, type), 4);
+				}
+				break;
+			case SKF_AD_MARK: /* A = skb->mark; */
+				BUILD_BUG_ON(FIELD_SIZEOF(struct sk_buff, mark) != 4);
+				EMIT_SKB_LOAD(0x8b, 0x47, 0x87,
+					      offsetof(struct sk_buff, mark));
+				break;
+			case SKF_AD_QUEUE: /* A = skb->queue_mapping; */
+				if (skb_queue_mapping_off < 0)
+					goto out;
+				EMIT_SKB_LOAD16(skb_queue_mapping_off);
+				break;
+			case SKF_AD_RXHASH: /* A = skb->rxhash; */
+				BUILD_BUG_ON(FIELD_SIZEOF(struct sk_buff, rxhash) != 2);
+				EMIT_SKB_LOAD16(offsetof(struct sk_buff, rxhash));
+				break;
+			case SKF_AD_CPU: /* A = raw_smp_processor_id(); */
+#ifdef CONFIG_SMP
+				EMIT4(0x65, 0x8b, 0x04, 0x25); /* mov %gs:off32,%eax */
+				EMIT((u32)(unsigned long)&per_cpu_var(cpu_number), 4);
+#else
+				CLEAR_A();
+#endif
+				break;
+			case SKF_AD_ALU_XOR_X: /* A ^= X; */
+				seen |= SEEN_XREG;
+				EMIT2(0x31, 0xd8);		/* xor %ebx,%eax */
+				break;
+			case SKF_AD_VLAN_TAG: /* A = vlan_tx_tag_get(skb); */
+			case SKF_AD_VLAN_TAG_PRESENT:
+				BUILD_BUG_ON(FIELD_SIZEOF(struct sk_buff, vlan_tci) != 2);
+				EMIT_SKB_LOAD16(offsetof(struct sk_buff, vlan_tci));
+				if ((int)K - SKF_AD_OFF == SKF_AD_VLAN_TAG) {
+					/* and imm32,%eax */
+					EMIT1_off32(0x25, ~VLAN_TAG_PRESENT & 0xffff);
+				} else {
+					BUILD_BUG_ON(VLAN_TAG_PRESENT != 0x1000);
+					EMIT3(0xc1, 0xe8, 12); /* shr $12,%eax */
+					EMIT3(0x83, 0xe0, 1);  /* and $1,%eax */
+				}
+				break;
+			default:
+				/* netlink attribute lookups stay interpreted */
+				goto out;
+			}
+next:
+			ilen = prog - temp;
+			if (image) {
+				if (unlikely(proglen + ilen > oldproglen)) {
+					pr_err("bpb_jit_compile fatal error\n");
+					kfree(addrs);
+					module_free(NULL, image);
+					return;
+				}
+				memcpy(image + proglen, temp, ilen);
+			}
+			proglen += ilen;
+			addrs[i] = proglen;
+			prog = temp;
+		}
+		/* last bpf instruction is always a RET :
+		 * use it to give the cleanup instruction(s) addr
+		 */
+		cleanup_addr = proglen - 1; /* ret */
+		if (seen_or_pass0)
+			cleanup_addr -= 1; /* leaveq */
+		if (seen_or_pass0 & SEEN_XREG)
+			cleanup_addr -= 4; /* mov  -8(%rbp),%rbx */
+
+		if (image) {
+			if (proglen != oldproglen)
+				pr_err("bpb_jit_compile proglen=%u != oldproglen=%u\n", proglen, oldproglen);
+			break;
+		}
+		if (proglen == oldproglen) {
+			image = module_alloc(max_t(unsigned int,
+						   proglen,
+						   sizeof(struct work_struct)));
+			if (!image)
+				goto out;
+		}
+		oldproglen = proglen;
+	}
+	if (bpf_jit_enable > 1)
+		pr_err("flen=%d proglen=%u pass=%d image=%p\n",
+		       flen, proglen, pass, image);
+
+	if (image) {
+		if (bpf_jit_enable > 1)
+			print_hex_dump(KERN_ERR, "JIT code: ", DUMP_PREFIX_ADDRESS,
+				       16, 1, image, proglen, false);
+
+		bpf_flush_icache(image, image + proglen);
+
+		fp->bpf_func = (void *)image;
+	}
+out:
+	kfree(addrs);
+	return;
+}
+EXPORT_SYMBOL_GPL(bpf_jit_compile);
+
+static void jit_free_defer(struct work_struct *arg)
+{
+	module_free(NULL, arg);
+}
+
+/* run from softirq, we must use a work_struct to call
+ * module_free() from process context
+ */
+void bpf_jit_free(struct sk_filter *fp)
+{
+	if (fp->bpf_func != sk_run_filter) {
+		struct work_struct *work = (struct work_struct *)fp->bpf_func;
+
+		INIT_WORK(work, jit_free_defer);
+		schedule_work(work);
+	}
+}
+EXPORT_SYMBOL_GPL(bpf_jit_free);
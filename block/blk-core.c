@@ -71,6 +71,7 @@ static void drive_stat_acct(struct request *rq, int new_io)
 	else {
 		part_round_stats(cpu, part);
 		part_inc_in_flight(part, rw);
+		rq->stat_start_ns = ktime_to_ns(ktime_get());
 	}
 
 	part_stat_unlock();
@@ -608,7 +609,14 @@ struct request_queue *blk_alloc_queue_node(gfp_t gfp_mask, int node_id)
 		return NULL;
 	}
 
+	q->lat_stats = alloc_percpu(struct blk_lat_stats);
+	if (!q->lat_stats) {
+		kmem_cache_free(blk_requestq_cachep, q);
+		return NULL;
+	}
+
 	if (blk_throtl_init(q)) {
+		free_percpu(q->lat_stats);
 		kmem_cache_free(blk_requestq_cachep, q);
 		return NULL;
 	}
@@ -2002,14 +2010,25 @@ static void blk_account_io_done(struct request *req)
 	if (blk_do_io_stat(req) && !(req->cmd_flags & REQ_FLUSH_SEQ)) {
 		unsigned long duration = jiffies - req->start_time;
 		const int rw = rq_data_dir(req);
+		const int op = blk_lat_op(req);
+		struct request_queue *q = req->q;
 		struct hd_struct *part;
-		int cpu;
+		int cpu, bucket;
+
+		/* requests never accounted as queued end up in the last bucket */
+		bucket = BLK_LAT_BUCKETS - 1;
+		if (req->stat_start_ns)
+			bucket = blk_lat_bucket(ktime_to_ns(ktime_get()) -
+						req->stat_start_ns);
 
 		cpu = part_stat_lock();
 		part = disk_map_sector_rcu(req->rq_disk, blk_rq_pos(req));
 
 		part_stat_inc(cpu, part, ios[rw]);
 		part_stat_add(cpu, part, ticks[rw], duration);
+		part_stat_inc(cpu, part, lat.hist[op][bucket]);
+		if (q->lat_stats)
+			per_cpu_ptr(q->lat_stats, cpu)->hist[op][bucket]++;
 		part_round_stats(cpu, part);
 		part_dec_in_flight(part, rw);
 
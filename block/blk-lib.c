@@ -10,12 +10,6 @@
 
 #include "blk.h"
 
-struct bio_batch {
-	atomic_t		done;
-	unsigned long		flags;
-	struct completion	*wait;
-};
-
 static void bio_batch_end_io(struct bio *bio, int err)
 {
 	struct bio_batch *bb = bio->bi_private;
@@ -28,25 +22,65 @@ static void bio_batch_end_io(struct bio *bio, int err)
 }
 
 /**
- * blkdev_issue_discard - queue a discard
+ * bio_batch_init - prepare a batch for asynchronous submission
+ * @bb:		batch to initialise
+ * @wait:	completion signalled once every bio in the batch has ended
+ *
+ * Description:
+ *    The batch holds a reference of its own until bio_batch_wait() is
+ *    called, so @wait cannot fire while bios are still being added.
+ */
+void bio_batch_init(struct bio_batch *bb, struct completion *wait)
+{
+	atomic_set(&bb->done, 1);
+	bb->flags = 1 << BIO_UPTODATE;
+	bb->wait = wait;
+}
+EXPORT_SYMBOL(bio_batch_init);
+
+/**
+ * bio_batch_wait - wait for all bios of a batch to complete
+ * @bb:		batch set up with bio_batch_init()
+ *
+ * Description:
+ *    Drops the reference taken by bio_batch_init() and sleeps until every
+ *    bio added to @bb has completed. Returns -EIO if any of them failed.
+ */
+int bio_batch_wait(struct bio_batch *bb)
+{
+	/* Wait for bios in-flight */
+	if (!atomic_dec_and_test(&bb->done))
+		wait_for_completion(bb->wait);
+
+	if (!test_bit(BIO_UPTODATE, &bb->flags))
+		return -EIO;
+	return 0;
+}
+EXPORT_SYMBOL(bio_batch_wait);
+
+/**
+ * __blkdev_issue_discard - submit a discard without waiting for it
  * @bdev:	blockdev to issue discard for
  * @sector:	start sector
  * @nr_sects:	number of sectors to discard
  * @gfp_mask:	memory allocation flags (for bio_alloc)
  * @flags:	BLKDEV_IFL_* flags to control behaviour
+ * @bb:		batch the discard bios are accounted to
  *
  * Description:
- *    Issue a discard request for the sectors in question.
+ *    Like blkdev_issue_discard(), but only submits the bios. Callers may
+ *    queue many ranges against the same batch and then wait for all of
+ *    them at once with bio_batch_wait(), which keeps the device queue
+ *    busy instead of serialising one discard per round trip.
  */
-int blkdev_issue_discard(struct block_device *bdev, sector_t sector,
-		sector_t nr_sects, gfp_t gfp_mask, int flags)
+int __blkdev_issue_discard(struct block_device *bdev, sector_t sector,
+		sector_t nr_sects, gfp_t gfp_mask, int flags,
+		struct bio_batch *bb)
 {
-	DECLARE_COMPLETION_ONSTACK(wait);
 	struct request_queue *q = bdev_get_queue(bdev);
 	int type = (1 << BIO_RW) | (1 << BIO_RW_DISCARD);
 	sector_t max_discard_sectors;
 	sector_t granularity, alignment;
-	struct bio_batch bb;
 	struct bio *bio;
 	int ret = 0;
 
@@ -80,10 +114,6 @@ int blkdev_issue_discard(struct block_device *bdev, sector_t sector,
 		return -EOPNOTSUPP;
 	}
 
-	atomic_set(&bb.done, 1);
-	bb.flags = 1 << BIO_UPTODATE;
-	bb.wait = &wait;
-
 	while (nr_sects) {
 		unsigned int req_sects;
 		sector_t end_sect, tmp;
@@ -113,24 +143,44 @@ int blkdev_issue_discard(struct block_device *bdev, sector_t sector,
 		bio->bi_sector = sector;
 		bio->bi_end_io = bio_batch_end_io;
 		bio->bi_bdev = bdev;
-		bio->bi_private = &bb;
+		bio->bi_private = bb;
 
 		bio->bi_size = req_sects << 9;
 		nr_sects -= req_sects;
 		sector = end_sect;
 
-		atomic_inc(&bb.done);
+		atomic_inc(&bb->done);
 		submit_bio(type, bio);
 	}
 
-	/* Wait for bios in-flight */
-	if (!atomic_dec_and_test(&bb.done))
-		wait_for_completion(&wait);
+	return ret;
+}
+EXPORT_SYMBOL(__blkdev_issue_discard);
 
-	if (!test_bit(BIO_UPTODATE, &bb.flags))
-		ret = -EIO;
+/**
+ * blkdev_issue_discard - queue a discard
+ * @bdev:	blockdev to issue discard for
+ * @sector:	start sector
+ * @nr_sects:	number of sectors to discard
+ * @gfp_mask:	memory allocation flags (for bio_alloc)
+ * @flags:	BLKDEV_IFL_* flags to control behaviour
+ *
+ * Description:
+ *    Issue a discard request for the sectors in question.
+ */
+int blkdev_issue_discard(struct block_device *bdev, sector_t sector,
+		sector_t nr_sects, gfp_t gfp_mask, int flags)
+{
+	DECLARE_COMPLETION_ONSTACK(wait);
+	struct bio_batch bb;
+	int ret, err;
 
-	return ret;
+	bio_batch_init(&bb, &wait);
+	ret = __blkdev_issue_discard(bdev, sector, nr_sects, gfp_mask,
+				     flags, &bb);
+	err = bio_batch_wait(&bb);
+
+	return ret ? ret : err;
 }
 EXPORT_SYMBOL(blkdev_issue_discard);
 
@@ -154,9 +204,7 @@ int blkdev_issue_zeroout(struct block_device *bdev, sector_t sector,
 	unsigned int sz;
 	DECLARE_COMPLETION_ONSTACK(wait);
 
-	atomic_set(&bb.done, 1);
-	bb.flags = 1 << BIO_UPTODATE;
-	bb.wait = &wait;
+	bio_batch_init(&bb, &wait);
 
 	ret = 0;
 	while (nr_sects != 0) {
@@ -185,12 +233,8 @@ int blkdev_issue_zeroout(struct block_device *bdev, sector_t sector,
 		submit_bio(WRITE, bio);
 	}
 
-	/* Wait for bios in-flight */
-	if (!atomic_dec_and_test(&bb.done))
-		wait_for_completion(&wait);
-
-	if (!test_bit(BIO_UPTODATE, &bb.flags))
-		/* One of bios in the batch was completed with error.*/
+	/* One of bios in the batch was completed with error.*/
+	if (bio_batch_wait(&bb))
 		ret = -EIO;
 
 	return ret;
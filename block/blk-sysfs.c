@@ -321,6 +321,42 @@ static ssize_t queue_iostats_store(struct request_queue *q, const char *page,
 	return ret;
 }
 
+/*
+ * Completion latency histograms of the queue, one line per operation type,
+ * see struct blk_lat_stats for the bucket layout.
+ */
+static ssize_t queue_stats_show(struct request_queue *q, char *page)
+{
+	ssize_t len = 0;
+	int op, i, cpu;
+
+	for (op = 0; op < BLK_LAT_NR_OPS; op++) {
+		len += sprintf(page + len, "%s", blk_lat_op_name[op]);
+		for (i = 0; i < BLK_LAT_BUCKETS; i++) {
+			unsigned long sum = 0;
+
+			for_each_possible_cpu(cpu)
+				sum += per_cpu_ptr(q->lat_stats, cpu)->hist[op][i];
+			len += sprintf(page + len, " %lu", sum);
+		}
+		len += sprintf(page + len, "\n");
+	}
+
+	return len;
+}
+
+static ssize_t queue_stats_store(struct request_queue *q, const char *page,
+				 size_t count)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		memset(per_cpu_ptr(q->lat_stats, cpu), 0,
+		       sizeof(struct blk_lat_stats));
+
+	return count;
+}
+
 static struct queue_sysfs_entry queue_requests_entry = {
 	.attr = {.name = "nr_requests", .mode = S_IRUGO | S_IWUSR },
 	.show = queue_requests_show,
@@ -430,6 +466,12 @@ static struct queue_sysfs_entry queue_iostats_entry = {
 	.store = queue_iostats_store,
 };
 
+static struct queue_sysfs_entry queue_stats_entry = {
+	.attr = {.name = "stats", .mode = S_IRUGO | S_IWUSR },
+	.show = queue_stats_show,
+	.store = queue_stats_store,
+};
+
 static struct queue_sysfs_entry queue_random_entry = {
 	.attr = {.name = "add_random", .mode = S_IRUGO | S_IWUSR },
 	.show = queue_random_show,
@@ -457,6 +499,7 @@ static struct attribute *default_attrs[] = {
 	&queue_nomerges_entry.attr,
 	&queue_rq_affinity_entry.attr,
 	&queue_iostats_entry.attr,
+	&queue_stats_entry.attr,
 	&queue_random_entry.attr,
 	NULL,
 };
@@ -541,6 +584,7 @@ static void blk_release_queue(struct kobject *kobj)
 
 	blk_throtl_release(q);
 	blk_trace_shutdown(q);
+	free_percpu(q->lat_stats);
 
 	bdi_destroy(&q->backing_dev_info);
 	kmem_cache_free(blk_requestq_cachep, q);
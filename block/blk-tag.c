@@ -5,6 +5,7 @@
 #include <linux/module.h>
 #include <linux/bio.h>
 #include <linux/blkdev.h>
+#include <linux/percpu_ida.h>
 
 #include "blk.h"
 
@@ -47,6 +48,13 @@ static int __blk_free_tags(struct blk_queue_tag *bqt)
 		kfree(bqt->tag_map);
 		bqt->tag_map = NULL;
 
+		percpu_ida_destroy(bqt->tag_pool);
+		kfree(bqt->tag_pool);
+		bqt->tag_pool = NULL;
+
+		kfree(bqt->pool_map);
+		bqt->pool_map = NULL;
+
 		kfree(bqt);
 	}
 
@@ -136,6 +144,49 @@ fail:
 	return -ENOMEM;
 }
 
+/*
+ * Replace the tag allocator of @tags with one handing out tags in
+ * [0, depth).  Tags that are busy in tag_map stay allocated and go back
+ * to the new pool when they complete; ones that fall outside the new
+ * range are simply not returned.  Called with the queue lock held when
+ * resizing.
+ */
+static int blk_resize_tag_pool(struct blk_queue_tag *tags, int depth)
+{
+	struct percpu_ida *pool, *old = tags->tag_pool;
+	unsigned long *pool_map;
+	int nbits = min(depth, tags->real_max_depth);
+
+	pool_map = kcalloc(BITS_TO_LONGS(depth), sizeof(unsigned long),
+			   GFP_ATOMIC);
+	if (!pool_map)
+		return -ENOMEM;
+
+	pool = kmalloc(sizeof(*pool), GFP_ATOMIC);
+	if (!pool)
+		goto fail;
+
+	if (percpu_ida_init(pool, depth, GFP_ATOMIC)) {
+		kfree(pool);
+		goto fail;
+	}
+
+	percpu_ida_mark_busy(pool, tags->tag_map, nbits);
+	bitmap_copy(pool_map, tags->tag_map, nbits);
+	tags->tag_pool = pool;
+	kfree(tags->pool_map);
+	tags->pool_map = pool_map;
+
+	if (old) {
+		percpu_ida_destroy(old);
+		kfree(old);
+	}
+	return 0;
+fail:
+	kfree(pool_map);
+	return -ENOMEM;
+}
+
 static struct blk_queue_tag *__blk_queue_init_tags(struct request_queue *q,
 						   int depth)
 {
@@ -148,6 +199,14 @@ static struct blk_queue_tag *__blk_queue_init_tags(struct request_queue *q,
 	if (init_tag_map(q, tags, depth))
 		goto fail;
 
+	tags->tag_pool = NULL;
+	tags->pool_map = NULL;
+	if (blk_resize_tag_pool(tags, tags->max_depth)) {
+		kfree(tags->tag_index);
+		kfree(tags->tag_map);
+		goto fail;
+	}
+
 	atomic_set(&tags->refcnt, 1);
 	return tags;
 fail:
@@ -221,7 +280,7 @@ int blk_queue_resize_tags(struct request_queue *q, int new_depth)
 	struct blk_queue_tag *bqt = q->queue_tags;
 	struct request **tag_index;
 	unsigned long *tag_map;
-	int max_depth, nr_ulongs;
+	int max_depth, old_depth, nr_ulongs;
 
 	if (!bqt)
 		return -ENXIO;
@@ -233,6 +292,13 @@ int blk_queue_resize_tags(struct request_queue *q, int new_depth)
 	 * map can not be shrunk blindly here.
 	 */
 	if (new_depth <= bqt->real_max_depth) {
+		/*
+		 * A shared map keeps its allocator; blk_queue_start_tag()
+		 * rejects tags beyond max_depth instead.
+		 */
+		if (atomic_read(&bqt->refcnt) == 1 &&
+		    blk_resize_tag_pool(bqt, new_depth))
+			return -ENOMEM;
 		bqt->max_depth = new_depth;
 		return 0;
 	}
@@ -250,6 +316,7 @@ int blk_queue_resize_tags(struct request_queue *q, int new_depth)
 	tag_index = bqt->tag_index;
 	tag_map = bqt->tag_map;
 	max_depth = bqt->real_max_depth;
+	old_depth = bqt->max_depth;
 
 	if (init_tag_map(q, bqt, new_depth))
 		return -ENOMEM;
@@ -258,6 +325,16 @@ int blk_queue_resize_tags(struct request_queue *q, int new_depth)
 	nr_ulongs = ALIGN(max_depth, BITS_PER_LONG) / BITS_PER_LONG;
 	memcpy(bqt->tag_map, tag_map, nr_ulongs * sizeof(unsigned long));
 
+	if (blk_resize_tag_pool(bqt, bqt->max_depth)) {
+		kfree(bqt->tag_index);
+		kfree(bqt->tag_map);
+		bqt->tag_index = tag_index;
+		bqt->tag_map = tag_map;
+		bqt->real_max_depth = max_depth;
+		bqt->max_depth = old_depth;
+		return -ENOMEM;
+	}
+
 	kfree(tag_index);
 	kfree(tag_map);
 	return 0;
@@ -312,6 +389,11 @@ void blk_queue_end_tag(struct request_queue *q, struct request *rq)
 	 * unlock memory barrier semantics.
 	 */
 	clear_bit_unlock(tag, bqt->tag_map);
+
+	/* only tags the pool has handed out go back to it */
+	if (tag < bqt->tag_pool->nr_tags &&
+	    test_and_clear_bit(tag, bqt->pool_map))
+		percpu_ida_free(bqt->tag_pool, tag);
 }
 EXPORT_SYMBOL(blk_queue_end_tag);
 
@@ -363,12 +445,32 @@ int blk_queue_start_tag(struct request_queue *q, struct request *rq)
 			return 1;
 	}
 
-	do {
-		tag = find_first_zero_bit(bqt->tag_map, max_depth);
+	/*
+	 * Tags come from a per-cpu cache instead of a scan of tag_map.  The
+	 * cached tag can still be out of range for this request (async I/O,
+	 * a shrunk map), or be held by a driver that claims tag_map bits
+	 * directly.  A busy tag is not put back in the cache, where it
+	 * would be handed out again at once: its pool_map bit is set so
+	 * that blk_queue_end_tag() returns it when the holder is done.  An
+	 * out of range tag is free and goes straight back.  Either way, fall
+	 * back to scanning tag_map for a usable tag.
+	 */
+	tag = percpu_ida_alloc(bqt->tag_pool, GFP_ATOMIC);
+	if (likely(tag >= 0 && tag < max_depth &&
+		   !test_and_set_bit_lock(tag, bqt->tag_map))) {
+		set_bit(tag, bqt->pool_map);
+	} else {
 		if (tag >= max_depth)
-			return 1;
-
-	} while (test_and_set_bit_lock(tag, bqt->tag_map));
+			percpu_ida_free(bqt->tag_pool, tag);
+		else if (tag >= 0)
+			set_bit(tag, bqt->pool_map);
+
+		do {
+			tag = find_first_zero_bit(bqt->tag_map, max_depth);
+			if (tag >= max_depth)
+				return 1;
+		} while (test_and_set_bit_lock(tag, bqt->tag_map));
+	}
 	/*
 	 * We need lock ordering semantics given by test_and_set_bit_lock.
 	 * See blk_queue_end_tag for details.
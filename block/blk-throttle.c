@@ -56,6 +56,19 @@ struct throtl_grp {
 	atomic_t ref;
 	unsigned int flags;
 
+	/*
+	 * Group of the parent cgroup on the same queue. Holds a reference
+	 * which is dropped when this group is freed. NULL for root group.
+	 */
+	struct throtl_grp *parent;
+
+	/*
+	 * Whether this group or any of its ancestors has a READ/WRITE
+	 * limit. Read locklessly in the bio submission fast path, updated
+	 * under queue lock.
+	 */
+	bool has_rules[2];
+
 	/* Two lists for READ and WRITE */
 	struct bio_list bio_lists[2];
 
@@ -169,6 +182,10 @@ static void throtl_put_tg(struct throtl_grp *tg)
 	if (!atomic_dec_and_test(&tg->ref))
 		return;
 
+	/* Drop the reference this group held on its parent */
+	if (tg->parent)
+		throtl_put_tg(tg->parent);
+
 	/*
 	 * A group is freed in rcu manner. But having an rcu lock does not
 	 * mean that one can access all the fields of blkg and assume these
@@ -181,6 +198,50 @@ static void throtl_put_tg(struct throtl_grp *tg)
 	call_rcu(&tg->rcu_head, throtl_free_tg);
 }
 
+/* Free a group which never got published on td and cgroup lists */
+static void throtl_free_unused_tg(struct throtl_grp *tg)
+{
+	if (!tg)
+		return;
+
+	free_percpu(tg->blkg.stats_cpu);
+	kfree(tg);
+}
+
+static inline struct blkio_cgroup *blkcg_parent(struct blkio_cgroup *blkcg)
+{
+	struct cgroup *parent = blkcg->css.cgroup->parent;
+
+	return parent ? cgroup_to_blkio_cgroup(parent) : NULL;
+}
+
+static bool tg_no_rule_group(struct throtl_grp *tg, bool rw) {
+	if (tg->bps[rw] == -1 && tg->iops[rw] == -1)
+		return 1;
+	return 0;
+}
+
+/*
+ * Recompute whether IO in @tg can be subject to throttling, either by
+ * limits of the group itself or by the limits of one of its ancestors.
+ * Should be called with queue lock held.
+ */
+static void throtl_tg_update_has_rules(struct throtl_grp *tg)
+{
+	struct throtl_grp *pos;
+	int rw;
+
+	for (rw = READ; rw <= WRITE; rw++) {
+		tg->has_rules[rw] = false;
+		for (pos = tg; pos; pos = pos->parent) {
+			if (!tg_no_rule_group(pos, rw)) {
+				tg->has_rules[rw] = true;
+				break;
+			}
+		}
+	}
+}
+
 static void throtl_init_group(struct throtl_grp *tg)
 {
 	INIT_HLIST_NODE(&tg->tg_node);
@@ -246,11 +307,45 @@ throtl_tg_fill_dev_details(struct throtl_data *td, struct throtl_grp *tg)
 	spin_unlock_irq(td->queue->queue_lock);
 }
 
+static struct
+throtl_grp *throtl_find_tg(struct throtl_data *td, struct blkio_cgroup *blkcg)
+{
+	struct throtl_grp *tg = NULL;
+	void *key = td;
+
+	/*
+	 * This is the common case when there are no blkio cgroups.
+ 	 * Avoid lookup in this case
+ 	 */
+	if (blkcg == &blkio_root_cgroup)
+		tg = td->root_tg;
+	else
+		tg = tg_of_blkg(blkiocg_lookup_group(blkcg, key));
+
+	__throtl_tg_fill_dev_details(td, tg);
+	return tg;
+}
+
 static void throtl_init_add_tg_lists(struct throtl_data *td,
 			struct throtl_grp *tg, struct blkio_cgroup *blkcg)
 {
+	struct blkio_cgroup *parent_blkcg = blkcg_parent(blkcg);
+
 	__throtl_tg_fill_dev_details(td, tg);
 
+	/*
+	 * Groups are created top-down (see throtl_get_tg()), so the group
+	 * of the parent cgroup is already there. Link to it so that limits
+	 * of ancestors apply to IO of the whole subtree.
+	 */
+	if (parent_blkcg) {
+		struct throtl_grp *ptg = throtl_find_tg(td, parent_blkcg);
+
+		if (!ptg)
+			ptg = td->root_tg;
+		tg->parent = throtl_ref_get_tg(ptg);
+	}
+
 	/* Add group onto cgroup list */
 	blkiocg_add_blkio_group(blkcg, &tg->blkg, (void *)td,
 				tg->blkg.dev, BLKIO_POLICY_THROTL);
@@ -259,6 +354,7 @@ static void throtl_init_add_tg_lists(struct throtl_data *td,
 	tg->bps[WRITE] = blkcg_get_write_bps(blkcg, tg->blkg.dev);
 	tg->iops[READ] = blkcg_get_read_iops(blkcg, tg->blkg.dev);
 	tg->iops[WRITE] = blkcg_get_write_iops(blkcg, tg->blkg.dev);
+	throtl_tg_update_has_rules(tg);
 
 	throtl_add_group_to_td_list(td, tg);
 }
@@ -284,48 +380,26 @@ static struct throtl_grp *throtl_alloc_tg(struct throtl_data *td)
 	return tg;
 }
 
-static struct
-throtl_grp *throtl_find_tg(struct throtl_data *td, struct blkio_cgroup *blkcg)
-{
-	struct throtl_grp *tg = NULL;
-	void *key = td;
-
-	/*
-	 * This is the common case when there are no blkio cgroups.
- 	 * Avoid lookup in this case
- 	 */
-	if (blkcg == &blkio_root_cgroup)
-		tg = td->root_tg;
-	else
-		tg = tg_of_blkg(blkiocg_lookup_group(blkcg, key));
-
-	__throtl_tg_fill_dev_details(td, tg);
-	return tg;
-}
-
-static struct throtl_grp * throtl_get_tg(struct throtl_data *td)
+/*
+ * Allocate the group of @blkcg on @td and add it to the td and cgroup lists.
+ * Called with queue lock and rcu read lock held. Allocation of a group
+ * needs allocation of per cpu stats which in-turn takes a mutex() and can
+ * block, hence both locks are dropped and re-acquired around it. A css
+ * reference keeps @blkcg from being destroyed meanwhile.
+ *
+ * Returns 0 if the group exists on return, -ENOMEM if it could not be
+ * allocated and -ENODEV if the queue died while the lock was dropped.
+ */
+static int throtl_create_tg(struct throtl_data *td, struct blkio_cgroup *blkcg)
 {
-	struct throtl_grp *tg = NULL, *__tg = NULL;
-	struct blkio_cgroup *blkcg;
 	struct request_queue *q = td->queue;
+	struct throtl_grp *tg;
+	int ret = 0;
 
-	/* no throttling for dead queue */
-	if (unlikely(blk_queue_dead(q)))
-		return NULL;
-
-	rcu_read_lock();
-	blkcg = task_blkio_cgroup(current);
-	tg = throtl_find_tg(td, blkcg);
-	if (tg) {
-		rcu_read_unlock();
-		return tg;
-	}
+	/* cgroup is going away, caller will re-read the task's cgroup */
+	if (!css_tryget(&blkcg->css))
+		return 0;
 
-	/*
-	 * Need to allocate a group. Allocation of group also needs allocation
-	 * of per cpu stats which in-turn takes a mutex() and can block. Hence
-	 * we need to drop rcu lock and queue_lock before we call alloc.
-	 */
 	rcu_read_unlock();
 	spin_unlock_irq(q->queue_lock);
 
@@ -333,38 +407,78 @@ static struct throtl_grp * throtl_get_tg(struct throtl_data *td)
 
 	/* Group allocated and queue is still alive. take the lock */
 	spin_lock_irq(q->queue_lock);
+	rcu_read_lock();
 
 	/* Make sure @q is still alive */
 	if (unlikely(blk_queue_dead(q))) {
-		kfree(tg);
-		return NULL;
+		throtl_free_unused_tg(tg);
+		ret = -ENODEV;
+		goto out;
 	}
 
 	/*
-	 * Initialize the new group. After sleeping, read the blkcg again.
+	 * If some other thread already allocated the group while we were
+	 * not holding queue lock, free up the group
 	 */
+	if (throtl_find_tg(td, blkcg)) {
+		throtl_free_unused_tg(tg);
+		goto out;
+	}
+
+	if (!tg) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	throtl_init_add_tg_lists(td, tg, blkcg);
+out:
+	css_put(&blkcg->css);
+	return ret;
+}
+
+static struct throtl_grp * throtl_get_tg(struct throtl_data *td)
+{
+	struct throtl_grp *tg = NULL;
+	struct blkio_cgroup *blkcg, *pos, *parent;
+	struct request_queue *q = td->queue;
+	int ret;
+
+	/* no throttling for dead queue */
+	if (unlikely(blk_queue_dead(q)))
+		return NULL;
+
 	rcu_read_lock();
 	blkcg = task_blkio_cgroup(current);
+	tg = throtl_find_tg(td, blkcg);
 
 	/*
-	 * If some other thread already allocated the group while we were
-	 * not holding queue lock, free up the group
+	 * Create missing groups starting from the top-most ancestor without
+	 * a group on this queue, so that every group can be linked to its
+	 * parent at creation time. The task's cgroup is read again after
+	 * every allocation as the task might have moved while we slept.
 	 */
-	__tg = throtl_find_tg(td, blkcg);
+	while (!tg) {
+		pos = blkcg;
+		while ((parent = blkcg_parent(pos)) &&
+		       !throtl_find_tg(td, parent))
+			pos = parent;
+
+		ret = throtl_create_tg(td, pos);
+		if (ret == -ENODEV) {
+			rcu_read_unlock();
+			return NULL;
+		}
 
-	if (__tg) {
-		kfree(tg);
-		rcu_read_unlock();
-		return __tg;
-	}
+		/* Group allocation failed. Account the IO to root group */
+		if (ret == -ENOMEM) {
+			tg = td->root_tg;
+			break;
+		}
 
-	/* Group allocation failed. Account the IO to root group */
-	if (!tg) {
-		tg = td->root_tg;
-		return tg;
+		blkcg = task_blkio_cgroup(current);
+		tg = throtl_find_tg(td, blkcg);
 	}
 
-	throtl_init_add_tg_lists(td, tg, blkcg);
 	rcu_read_unlock();
 	return tg;
 }
@@ -673,30 +787,16 @@ static bool tg_with_in_bps_limit(struct throtl_data *td, struct throtl_grp *tg,
 	return 0;
 }
 
-static bool tg_no_rule_group(struct throtl_grp *tg, bool rw) {
-	if (tg->bps[rw] == -1 && tg->iops[rw] == -1)
-		return 1;
-	return 0;
-}
-
 /*
  * Returns whether one can dispatch a bio or not. Also returns approx number
  * of jiffies to wait before this bio is with-in IO rate and can be dispatched
  */
-static bool tg_may_dispatch(struct throtl_data *td, struct throtl_grp *tg,
+static bool __tg_may_dispatch(struct throtl_data *td, struct throtl_grp *tg,
 				struct bio *bio, unsigned long *wait)
 {
 	bool rw = bio_data_dir(bio);
 	unsigned long bps_wait = 0, iops_wait = 0, max_wait = 0;
 
-	/*
- 	 * Currently whole state machine of group depends on first bio
-	 * queued in the group bio list. So one should not be calling
-	 * this function with a different bio if there are other bios
-	 * queued.
-	 */
-	BUG_ON(tg->nr_queued[rw] && bio != bio_list_peek(&tg->bio_lists[rw]));
-
 	/* If tg->bps = -1, then BW is unlimited */
 	if (tg->bps[rw] == -1 && tg->iops[rw] == -1) {
 		if (wait)
@@ -734,18 +834,75 @@ static bool tg_may_dispatch(struct throtl_data *td, struct throtl_grp *tg,
 	return 0;
 }
 
+/*
+ * A bio can be dispatched only if it is with-in the limits of its group and
+ * of all the ancestors of the group. Returned wait time is the one of the
+ * most restrictive group in the chain.
+ */
+static bool tg_may_dispatch(struct throtl_data *td, struct throtl_grp *tg,
+				struct bio *bio, unsigned long *wait)
+{
+	bool rw = bio_data_dir(bio);
+	unsigned long tg_wait, max_wait = 0;
+	struct throtl_grp *pos;
+
+	/*
+ 	 * Currently whole state machine of group depends on first bio
+	 * queued in the group bio list. So one should not be calling
+	 * this function with a different bio if there are other bios
+	 * queued.
+	 */
+	BUG_ON(tg->nr_queued[rw] && bio != bio_list_peek(&tg->bio_lists[rw]));
+
+	if (!tg->has_rules[rw] && tg_no_rule_group(tg, rw)) {
+		if (wait)
+			*wait = 0;
+		return 1;
+	}
+
+	for (pos = tg; pos; pos = pos->parent) {
+		if (!__tg_may_dispatch(td, pos, bio, &tg_wait))
+			max_wait = max(max_wait, tg_wait);
+	}
+
+	if (wait)
+		*wait = max_wait;
+
+	return !max_wait;
+}
+
 static void throtl_charge_bio(struct throtl_grp *tg, struct bio *bio)
 {
 	bool rw = bio_data_dir(bio);
 	bool sync = bio->bi_rw & REQ_SYNC;
+	struct throtl_grp *pos;
 
-	/* Charge the bio to the group */
-	tg->bytes_disp[rw] += bio->bi_size;
-	tg->io_disp[rw]++;
+	/*
+	 * Charge the bio to the group and to all the limited ancestors.
+	 * Unlimited groups start a fresh slice once a limit gets configured,
+	 * so there is no need to dirty their counters.
+	 */
+	for (pos = tg; pos; pos = pos->parent) {
+		if (tg_no_rule_group(pos, rw))
+			continue;
+		pos->bytes_disp[rw] += bio->bi_size;
+		pos->io_disp[rw]++;
+	}
 
 	blkiocg_update_dispatch_stats(&tg->blkg, bio->bi_size, rw, sync);
 }
 
+static void
+throtl_trim_slice_hier(struct throtl_data *td, struct throtl_grp *tg, bool rw)
+{
+	struct throtl_grp *pos;
+
+	for (pos = tg; pos; pos = pos->parent) {
+		if (!tg_no_rule_group(pos, rw))
+			throtl_trim_slice(td, pos, rw);
+	}
+}
+
 static void throtl_add_bio_tg(struct throtl_data *td, struct throtl_grp *tg,
 			struct bio *bio)
 {
@@ -796,7 +953,7 @@ static void tg_dispatch_one_bio(struct throtl_data *td, struct throtl_grp *tg,
 	bio_list_add(bl, bio);
 	bio->bi_rw |= (1 << BIO_RW_THROTTLED);
 
-	throtl_trim_slice(td, tg, rw);
+	throtl_trim_slice_hier(td, tg, rw);
 }
 
 static int throtl_dispatch_tg(struct throtl_data *td, struct throtl_grp *tg,
@@ -876,9 +1033,20 @@ static void throtl_process_limit_change(struct throtl_data *td)
 
 	throtl_log(td, "limits changed");
 
+	/*
+	 * A limit change of a group affects all its descendants, refresh
+	 * the rule state of every group before restarting slices.
+	 */
+	hlist_for_each_entry(tg, pos, &td->tg_list, tg_node)
+		throtl_tg_update_has_rules(tg);
+
 	hlist_for_each_entry_safe(tg, pos, n, &td->tg_list, tg_node) {
-		if (!tg->limits_changed)
+		if (!tg->limits_changed) {
+			/* Ancestor limits might have changed, recompute wait */
+			if (throtl_tg_on_rr(tg))
+				tg_update_disptime(td, tg);
 			continue;
+		}
 
 		if (!xchg(&tg->limits_changed, false))
 			continue;
@@ -1125,8 +1293,10 @@ bool blk_throtl_bio(struct request_queue *q, struct bio *bio)
 
 	/*
 	 * A throtl_grp pointer retrieved under rcu can be used to access
-	 * basic fields like stats and io rates. If a group has no rules,
-	 * just update the dispatch stats in lockless manner and return.
+	 * basic fields like stats and io rates. If neither the group nor
+	 * any of its ancestors has rules, just update the per cpu dispatch
+	 * stats in lockless manner and return. Own limits are checked too
+	 * as has_rules is refreshed asynchronously after a limit update.
 	 */
 
 	rcu_read_lock();
@@ -1135,7 +1305,7 @@ bool blk_throtl_bio(struct request_queue *q, struct bio *bio)
 	if (tg) {
 		throtl_tg_fill_dev_details(td, tg);
 
-		if (tg_no_rule_group(tg, rw)) {
+		if (!tg->has_rules[rw] && tg_no_rule_group(tg, rw)) {
 			blkiocg_update_dispatch_stats(&tg->blkg, bio->bi_size,
 					rw, bio->bi_rw & REQ_SYNC);
 			rcu_read_unlock();
@@ -1178,7 +1348,7 @@ bool blk_throtl_bio(struct request_queue *q, struct bio *bio)
 		 *
 		 * So keep on trimming slice even if bio is not queued.
 		 */
-		throtl_trim_slice(td, tg, rw);
+		throtl_trim_slice_hier(td, tg, rw);
 		goto out_unlock;
 	}
 
@@ -196,6 +196,25 @@ static inline int blk_do_io_stat(struct request *rq)
 		(rq->cmd_type == REQ_TYPE_FS);
 }
 
+static inline int blk_lat_op(struct request *rq)
+{
+	if (rq->cmd_flags & REQ_DISCARD)
+		return BLK_LAT_DISCARD;
+	if (rq->cmd_flags & REQ_FLUSH)
+		return BLK_LAT_FLUSH;
+	return rq_data_dir(rq) == READ ? BLK_LAT_READ : BLK_LAT_WRITE;
+}
+
+/* log2 histogram bucket of a latency, see struct blk_lat_stats */
+static inline int blk_lat_bucket(u64 lat_ns)
+{
+	u64 usecs = div_u64(lat_ns, NSEC_PER_USEC);
+
+	if (!usecs)
+		return 0;
+	return min_t(int, ilog2(usecs) + 1, BLK_LAT_BUCKETS - 1);
+}
+
 #ifdef CONFIG_BLK_DEV_THROTTLING
 extern bool blk_throtl_bio(struct request_queue *q, struct bio *bio);
 extern void blk_throtl_drain(struct request_queue *q);
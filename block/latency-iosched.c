@@ -0,0 +1,601 @@
+/*
+ *  Latency target i/o scheduler.
+ *
+ *  A deadline style scheduler for devices without seek penalty. Requests
+ *  are split in sync, async and discard classes which are dispatched in
+ *  fifo order. Instead of idling or sorting, the scheduler measures the
+ *  completion latency of every request and limits the number of requests
+ *  each class may have in flight so that reads and writes complete within
+ *  a configurable latency target.
+ *
+ *  Based on the deadline i/o scheduler,
+ *  Copyright (C) 2002 Jens Axboe <axboe@kernel.dk>
+ */
+#include <linux/kernel.h>
+#include <linux/fs.h>
+#include <linux/blkdev.h>
+#include <linux/elevator.h>
+#include <linux/bio.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/init.h>
+#include <linux/compiler.h>
+#include <linux/rbtree.h>
+#include <linux/ktime.h>
+#include <linux/log2.h>
+
+/*
+ * See Documentation/block/latency-iosched.txt
+ */
+static const int read_lat_target = 2000;	/* target read latency in usecs */
+static const int write_lat_target = 10000;	/* ditto for writes */
+static const int sync_expire = HZ / 4;	/* max time before a sync rq is submitted */
+static const int async_expire = 2 * HZ;	/* ditto for async, these limits are SOFT! */
+static const int discard_expire = 5 * HZ;	/* ditto for discards */
+static const int lat_window = HZ / 10;	/* latency sampling window */
+static const int min_sync_depth = 4;	/* sync depth is never throttled below */
+
+enum lat_class {
+	LAT_SYNC = 0,
+	LAT_ASYNC,
+	LAT_DISCARD,
+	LAT_NR_CLASSES,
+};
+
+static const char *lat_class_name[LAT_NR_CLASSES] = {
+	[LAT_SYNC]	= "sync",
+	[LAT_ASYNC]	= "async",
+	[LAT_DISCARD]	= "discard",
+};
+
+/*
+ * Completion latencies are accounted in log2 buckets of microseconds, the
+ * last bucket collects everything above 2^(LAT_HIST_BUCKETS - 2) usecs.
+ */
+#define LAT_HIST_BUCKETS	20
+
+struct latency_data {
+	/*
+	 * run time data
+	 */
+
+	/*
+	 * requests are present on both sort_list (for merging) and on the
+	 * fifo list of their class (for dispatching)
+	 */
+	struct rb_root sort_list[2];
+	struct list_head fifo_list[LAT_NR_CLASSES];
+
+	/* requests dispatched and not yet completed, per class */
+	unsigned int in_flight[LAT_NR_CLASSES];
+	/* current in flight limit, per class */
+	unsigned int depth[LAT_NR_CLASSES];
+
+	/* samples and target misses in the current window, per direction */
+	unsigned int win_samples[2];
+	unsigned int win_missed[2];
+	unsigned long win_end;
+
+	u64 lat_hist[LAT_NR_CLASSES][LAT_HIST_BUCKETS];
+
+	/* dispatch was refused because of depth limits */
+	int throttled;
+	struct work_struct unplug_work;
+	struct request_queue *queue;
+
+	/*
+	 * settings that change how the i/o scheduler behaves
+	 */
+	int lat_target[2];
+	int fifo_expire[LAT_NR_CLASSES];
+	int front_merges;
+};
+
+static inline enum lat_class lat_rq_class(struct request *rq)
+{
+	if (rq->cmd_flags & REQ_DISCARD)
+		return LAT_DISCARD;
+	if (rq_is_sync(rq))
+		return LAT_SYNC;
+	return LAT_ASYNC;
+}
+
+static inline struct rb_root *
+lat_rb_root(struct latency_data *ld, struct request *rq)
+{
+	return &ld->sort_list[rq_data_dir(rq)];
+}
+
+/*
+ * The dispatch time of a request is kept in usecs in its first elevator
+ * private pointer. A NULL value means the request was not dispatched by
+ * us and must not be accounted at completion.
+ */
+static inline void lat_set_dispatch_time(struct request *rq)
+{
+	unsigned long now = ktime_to_us(ktime_get());
+
+	rq->elevator_private[0] = (void *)(now ? now : 1);
+}
+
+static inline unsigned long lat_dispatch_time(struct request *rq)
+{
+	return (unsigned long)rq->elevator_private[0];
+}
+
+/*
+ * add rq to rbtree and fifo
+ */
+static void
+lat_add_request(struct request_queue *q, struct request *rq)
+{
+	struct latency_data *ld = q->elevator->elevator_data;
+	enum lat_class class = lat_rq_class(rq);
+
+	elv_rb_add(lat_rb_root(ld, rq), rq);
+
+	/*
+	 * set expire time and add to fifo list
+	 */
+	rq_set_fifo_time(rq, jiffies + ld->fifo_expire[class]);
+	list_add_tail(&rq->queuelist, &ld->fifo_list[class]);
+}
+
+/*
+ * remove rq from rbtree and fifo.
+ */
+static void lat_remove_request(struct request_queue *q, struct request *rq)
+{
+	struct latency_data *ld = q->elevator->elevator_data;
+
+	rq_fifo_clear(rq);
+	elv_rb_del(lat_rb_root(ld, rq), rq);
+}
+
+static int
+lat_merge(struct request_queue *q, struct request **req, struct bio *bio)
+{
+	struct latency_data *ld = q->elevator->elevator_data;
+	struct request *__rq;
+
+	/*
+	 * check for front merge
+	 */
+	if (ld->front_merges) {
+		sector_t sector = bio->bi_sector + bio_sectors(bio);
+
+		__rq = elv_rb_find(&ld->sort_list[bio_data_dir(bio)], sector);
+		if (__rq) {
+			BUG_ON(sector != blk_rq_pos(__rq));
+
+			if (elv_rq_merge_ok(__rq, bio)) {
+				*req = __rq;
+				return ELEVATOR_FRONT_MERGE;
+			}
+		}
+	}
+
+	return ELEVATOR_NO_MERGE;
+}
+
+static void lat_merged_request(struct request_queue *q,
+			       struct request *req, int type)
+{
+	struct latency_data *ld = q->elevator->elevator_data;
+
+	/*
+	 * if the merge was a front merge, we need to reposition request
+	 */
+	if (type == ELEVATOR_FRONT_MERGE) {
+		elv_rb_del(lat_rb_root(ld, req), req);
+		elv_rb_add(lat_rb_root(ld, req), req);
+	}
+}
+
+static void
+lat_merged_requests(struct request_queue *q, struct request *req,
+		    struct request *next)
+{
+	/*
+	 * if next expires before rq and both are in the same class, assign
+	 * its expire time to rq and move into next position (next will be
+	 * deleted) in fifo
+	 */
+	if (!list_empty(&req->queuelist) && !list_empty(&next->queuelist) &&
+	    lat_rq_class(req) == lat_rq_class(next)) {
+		if (time_before(rq_fifo_time(next), rq_fifo_time(req))) {
+			list_move(&req->queuelist, &next->queuelist);
+			rq_set_fifo_time(req, rq_fifo_time(next));
+		}
+	}
+
+	/*
+	 * kill knowledge of next, this one is a goner
+	 */
+	lat_remove_request(q, next);
+}
+
+/*
+ * move request from sort list and fifo to dispatch queue.
+ */
+static void lat_move_to_dispatch(struct latency_data *ld, struct request *rq)
+{
+	struct request_queue *q = rq->q;
+
+	lat_remove_request(q, rq);
+	ld->in_flight[lat_rq_class(rq)]++;
+	lat_set_dispatch_time(rq);
+	elv_dispatch_add_tail(q, rq);
+}
+
+static inline bool lat_class_may_dispatch(struct latency_data *ld, int class)
+{
+	return !list_empty(&ld->fifo_list[class]) &&
+		ld->in_flight[class] < ld->depth[class];
+}
+
+static inline bool lat_class_expired(struct latency_data *ld, int class)
+{
+	struct request *rq = rq_entry_fifo(ld->fifo_list[class].next);
+
+	return time_after(jiffies, rq_fifo_time(rq));
+}
+
+static int lat_queue_empty(struct request_queue *q)
+{
+	struct latency_data *ld = q->elevator->elevator_data;
+	int class;
+
+	for (class = 0; class < LAT_NR_CLASSES; class++)
+		if (!list_empty(&ld->fifo_list[class]))
+			return 0;
+
+	return 1;
+}
+
+/*
+ * lat_dispatch_requests selects the next class with room left in its depth
+ * budget. Classes with expired requests go first, then sync before async
+ * before discard. Requests of a class are dispatched in fifo order.
+ */
+static int lat_dispatch_requests(struct request_queue *q, int force)
+{
+	struct latency_data *ld = q->elevator->elevator_data;
+	struct request *rq;
+	int class, dispatched = 0;
+
+	if (unlikely(force)) {
+		for (class = 0; class < LAT_NR_CLASSES; class++) {
+			while (!list_empty(&ld->fifo_list[class])) {
+				rq = rq_entry_fifo(ld->fifo_list[class].next);
+				lat_move_to_dispatch(ld, rq);
+				dispatched++;
+			}
+		}
+		return dispatched;
+	}
+
+	for (class = 0; class < LAT_NR_CLASSES; class++) {
+		if (lat_class_may_dispatch(ld, class) &&
+		    lat_class_expired(ld, class))
+			goto dispatch_request;
+	}
+
+	for (class = 0; class < LAT_NR_CLASSES; class++) {
+		if (lat_class_may_dispatch(ld, class))
+			goto dispatch_request;
+	}
+
+	if (!lat_queue_empty(q))
+		ld->throttled = 1;
+	return 0;
+
+dispatch_request:
+	rq = rq_entry_fifo(ld->fifo_list[class].next);
+	lat_move_to_dispatch(ld, rq);
+	return 1;
+}
+
+/*
+ * At the end of every sampling window, shrink the depth of the lower
+ * priority classes if reads or writes missed their latency target in more
+ * than 1/8th of completions, otherwise let all classes grow again. Sync
+ * depth is only throttled once async and discard are down to a single
+ * request in flight.
+ */
+static void lat_adjust_depth(struct latency_data *ld)
+{
+	unsigned int max_depth = ld->queue->nr_requests;
+	bool missed = false;
+	int dir, class;
+
+	for (dir = READ; dir <= WRITE; dir++) {
+		if (ld->win_missed[dir] &&
+		    ld->win_missed[dir] >= ld->win_samples[dir] / 8)
+			missed = true;
+		ld->win_samples[dir] = ld->win_missed[dir] = 0;
+	}
+
+	ld->win_end = jiffies + lat_window;
+
+	if (missed) {
+		if (ld->depth[LAT_ASYNC] == 1 && ld->depth[LAT_DISCARD] == 1) {
+			ld->depth[LAT_SYNC] = max_t(unsigned int, min_sync_depth,
+						    ld->depth[LAT_SYNC] / 2);
+			return;
+		}
+		ld->depth[LAT_ASYNC] = max(1U, ld->depth[LAT_ASYNC] / 2);
+		ld->depth[LAT_DISCARD] = max(1U, ld->depth[LAT_DISCARD] / 2);
+		return;
+	}
+
+	for (class = 0; class < LAT_NR_CLASSES; class++) {
+		ld->depth[class] += max(1U, ld->depth[class] / 4);
+		ld->depth[class] = min(ld->depth[class], max_depth);
+	}
+}
+
+static void lat_completed_request(struct request_queue *q, struct request *rq)
+{
+	struct latency_data *ld = q->elevator->elevator_data;
+	enum lat_class class = lat_rq_class(rq);
+	unsigned long lat, start = lat_dispatch_time(rq);
+	int dir = rq_data_dir(rq), bucket;
+
+	if (!start)
+		return;
+
+	WARN_ON(!ld->in_flight[class]);
+	ld->in_flight[class]--;
+	rq->elevator_private[0] = NULL;
+
+	lat = (unsigned long)ktime_to_us(ktime_get()) - start;
+	bucket = lat ? min(ilog2(lat) + 1, LAT_HIST_BUCKETS - 1) : 0;
+	ld->lat_hist[class][bucket]++;
+
+	/* discards are slow on most devices, don't let them drive depths */
+	if (class != LAT_DISCARD) {
+		ld->win_samples[dir]++;
+		if (lat > ld->lat_target[dir])
+			ld->win_missed[dir]++;
+	}
+
+	if (time_after(jiffies, ld->win_end))
+		lat_adjust_depth(ld);
+
+	/*
+	 * Requests were held back by depth limits, the driver might not
+	 * restart queueing by itself.
+	 */
+	if (ld->throttled) {
+		ld->throttled = 0;
+		kblockd_schedule_work(q, &ld->unplug_work);
+	}
+}
+
+/*
+ * Requests which were dispatched but never completed by the driver (e.g.
+ * killed in prep) still have to give back their depth budget.
+ */
+static void lat_put_request(struct request *rq)
+{
+	struct latency_data *ld = rq->q->elevator->elevator_data;
+
+	if (!lat_dispatch_time(rq))
+		return;
+
+	ld->in_flight[lat_rq_class(rq)]--;
+	rq->elevator_private[0] = NULL;
+}
+
+static void lat_kick_queue(struct work_struct *work)
+{
+	struct latency_data *ld =
+		container_of(work, struct latency_data, unplug_work);
+	struct request_queue *q = ld->queue;
+
+	spin_lock_irq(q->queue_lock);
+	__blk_run_queue(q);
+	spin_unlock_irq(q->queue_lock);
+}
+
+static void lat_exit_queue(struct elevator_queue *e)
+{
+	struct latency_data *ld = e->elevator_data;
+	int class;
+
+	cancel_work_sync(&ld->unplug_work);
+
+	for (class = 0; class < LAT_NR_CLASSES; class++)
+		BUG_ON(!list_empty(&ld->fifo_list[class]));
+
+	kfree(ld);
+}
+
+/*
+ * initialize elevator private data (latency_data).
+ */
+static void *lat_init_queue(struct request_queue *q)
+{
+	struct latency_data *ld;
+	int class;
+
+	ld = kmalloc_node(sizeof(*ld), GFP_KERNEL | __GFP_ZERO, q->node);
+	if (!ld)
+		return NULL;
+
+	for (class = 0; class < LAT_NR_CLASSES; class++) {
+		INIT_LIST_HEAD(&ld->fifo_list[class]);
+		ld->depth[class] = q->nr_requests;
+	}
+	ld->sort_list[READ] = RB_ROOT;
+	ld->sort_list[WRITE] = RB_ROOT;
+	ld->queue = q;
+	INIT_WORK(&ld->unplug_work, lat_kick_queue);
+	ld->win_end = jiffies + lat_window;
+	ld->lat_target[READ] = read_lat_target;
+	ld->lat_target[WRITE] = write_lat_target;
+	ld->fifo_expire[LAT_SYNC] = sync_expire;
+	ld->fifo_expire[LAT_ASYNC] = async_expire;
+	ld->fifo_expire[LAT_DISCARD] = discard_expire;
+	ld->front_merges = 1;
+	return ld;
+}
+
+/*
+ * sysfs parts below
+ */
+
+static ssize_t
+lat_var_show(int var, char *page)
+{
+	return sprintf(page, "%d\n", var);
+}
+
+static ssize_t
+lat_var_store(int *var, const char *page, size_t count)
+{
+	char *p = (char *) page;
+
+	*var = simple_strtol(p, &p, 10);
+	return count;
+}
+
+#define SHOW_FUNCTION(__FUNC, __VAR, __CONV)				\
+static ssize_t __FUNC(struct elevator_queue *e, char *page)		\
+{									\
+	struct latency_data *ld = e->elevator_data;			\
+	int __data = __VAR;						\
+	if (__CONV)							\
+		__data = jiffies_to_msecs(__data);			\
+	return lat_var_show(__data, (page));				\
+}
+SHOW_FUNCTION(lat_read_lat_target_show, ld->lat_target[READ], 0);
+SHOW_FUNCTION(lat_write_lat_target_show, ld->lat_target[WRITE], 0);
+SHOW_FUNCTION(lat_sync_expire_show, ld->fifo_expire[LAT_SYNC], 1);
+SHOW_FUNCTION(lat_async_expire_show, ld->fifo_expire[LAT_ASYNC], 1);
+SHOW_FUNCTION(lat_discard_expire_show, ld->fifo_expire[LAT_DISCARD], 1);
+SHOW_FUNCTION(lat_front_merges_show, ld->front_merges, 0);
+SHOW_FUNCTION(lat_sync_depth_show, ld->depth[LAT_SYNC], 0);
+SHOW_FUNCTION(lat_async_depth_show, ld->depth[LAT_ASYNC], 0);
+SHOW_FUNCTION(lat_discard_depth_show, ld->depth[LAT_DISCARD], 0);
+#undef SHOW_FUNCTION
+
+#define STORE_FUNCTION(__FUNC, __PTR, MIN, MAX, __CONV)			\
+static ssize_t __FUNC(struct elevator_queue *e, const char *page, size_t count)	\
+{									\
+	struct latency_data *ld = e->elevator_data;			\
+	int __data;							\
+	int ret = lat_var_store(&__data, (page), count);		\
+	if (__data < (MIN))						\
+		__data = (MIN);						\
+	else if (__data > (MAX))					\
+		__data = (MAX);						\
+	if (__CONV)							\
+		*(__PTR) = msecs_to_jiffies(__data);			\
+	else								\
+		*(__PTR) = __data;					\
+	return ret;							\
+}
+STORE_FUNCTION(lat_read_lat_target_store, &ld->lat_target[READ], 1, INT_MAX, 0);
+STORE_FUNCTION(lat_write_lat_target_store, &ld->lat_target[WRITE], 1, INT_MAX, 0);
+STORE_FUNCTION(lat_sync_expire_store, &ld->fifo_expire[LAT_SYNC], 0, INT_MAX, 1);
+STORE_FUNCTION(lat_async_expire_store, &ld->fifo_expire[LAT_ASYNC], 0, INT_MAX, 1);
+STORE_FUNCTION(lat_discard_expire_store, &ld->fifo_expire[LAT_DISCARD], 0, INT_MAX, 1);
+STORE_FUNCTION(lat_front_merges_store, &ld->front_merges, 0, 1, 0);
+#undef STORE_FUNCTION
+
+/*
+ * Latency histograms: one line per class, "<class> <count>..." with bucket
+ * i counting completions in [2^(i-1), 2^i) usecs. Writing anything resets
+ * the counters.
+ */
+static ssize_t lat_latency_hist_show(struct elevator_queue *e, char *page)
+{
+	struct latency_data *ld = e->elevator_data;
+	ssize_t len = 0;
+	int class, i;
+
+	for (class = 0; class < LAT_NR_CLASSES; class++) {
+		len += sprintf(page + len, "%s", lat_class_name[class]);
+		for (i = 0; i < LAT_HIST_BUCKETS; i++)
+			len += sprintf(page + len, " %llu",
+				(unsigned long long)ld->lat_hist[class][i]);
+		len += sprintf(page + len, "\n");
+	}
+
+	return len;
+}
+
+static ssize_t
+lat_latency_hist_store(struct elevator_queue *e, const char *page, size_t count)
+{
+	struct latency_data *ld = e->elevator_data;
+	struct request_queue *q = ld->queue;
+
+	spin_lock_irq(q->queue_lock);
+	memset(ld->lat_hist, 0, sizeof(ld->lat_hist));
+	spin_unlock_irq(q->queue_lock);
+
+	return count;
+}
+
+#define LAT_ATTR(name) \
+	__ATTR(name, S_IRUGO|S_IWUSR, lat_##name##_show, \
+				      lat_##name##_store)
+
+#define LAT_ATTR_RO(name) \
+	__ATTR(name, S_IRUGO, lat_##name##_show, NULL)
+
+static struct elv_fs_entry lat_attrs[] = {
+	LAT_ATTR(read_lat_target),
+	LAT_ATTR(write_lat_target),
+	LAT_ATTR(sync_expire),
+	LAT_ATTR(async_expire),
+	LAT_ATTR(discard_expire),
+	LAT_ATTR(front_merges),
+	LAT_ATTR_RO(sync_depth),
+	LAT_ATTR_RO(async_depth),
+	LAT_ATTR_RO(discard_depth),
+	LAT_ATTR(latency_hist),
+	__ATTR_NULL
+};
+
+static struct elevator_type iosched_latency = {
+	.ops = {
+		.elevator_merge_fn = 		lat_merge,
+		.elevator_merged_fn =		lat_merged_request,
+		.elevator_merge_req_fn =	lat_merged_requests,
+		.elevator_dispatch_fn =		lat_dispatch_requests,
+		.elevator_add_req_fn =		lat_add_request,
+		.elevator_completed_req_fn =	lat_completed_request,
+		.elevator_put_req_fn =		lat_put_request,
+		.elevator_queue_empty_fn =	lat_queue_empty,
+		.elevator_former_req_fn =	elv_rb_former_request,
+		.elevator_latter_req_fn =	elv_rb_latter_request,
+		.elevator_init_fn =		lat_init_queue,
+		.elevator_exit_fn =		lat_exit_queue,
+	},
+
+	.elevator_attrs = lat_attrs,
+	.elevator_name = "latency",
+	.elevator_owner = THIS_MODULE,
+};
+
+static int __init latency_init(void)
+{
+	elv_register(&iosched_latency);
+
+	return 0;
+}
+
+static void __exit latency_exit(void)
+{
+	elv_unregister(&iosched_latency);
+}
+
+module_init(latency_init);
+module_exit(latency_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("latency target IO scheduler");
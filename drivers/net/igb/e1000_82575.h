@@ -200,6 +200,8 @@ struct e1000_adv_tx_context_desc {
 #define E1000_FTQF_MASK                0xF0000000
 #define E1000_FTQF_MASK_PROTO_BP       0x10000000
 #define E1000_FTQF_MASK_SOURCE_PORT_BP 0x80000000
+#define E1000_FTQF_QUEUE_ENABLE        0x00000100
+#define E1000_FTQF_QUEUE_SHIFT         16
 
 #define E1000_NVM_APME_82575          0x0400
 #define MAX_NUM_VFS                   8
@@ -315,6 +315,11 @@ static inline int igb_desc_unused(struct igb_ring *ring)
 	return ring->count + ring->next_to_clean - ring->next_to_use - 1;
 }
 
+static inline struct netdev_queue *txring_txq(const struct igb_ring *tx_ring)
+{
+	return netdev_get_tx_queue(tx_ring->netdev, tx_ring->queue_index);
+}
+
 #ifdef CONFIG_IGB_HWMON
 
 #define IGB_HWMON_TYPE_LOC	0
@@ -338,6 +343,21 @@ struct hwmon_buff {
 
 #define IGB_RETA_SIZE	128
 
+/* 82576 5-tuple queue filters, the one PTP uses is left alone */
+#define IGB_MAX_RFS_FILTERS	8
+#define IGB_PTP_RFS_FILTER	3
+
+struct igb_rfs_filter {
+	__be32 saddr;
+	__be32 daddr;
+	__be16 sport;
+	__be16 dport;
+	u8 proto;
+	bool used;
+	u16 queue;
+	u32 flow_id;	/* RFS flow the filter was installed for */
+};
+
 /* board specific private data structure */
 struct igb_adapter {
 	struct net_device *netdev;
@@ -439,6 +459,12 @@ struct igb_adapter {
 	u8 rss_indir_tbl[IGB_RETA_SIZE];
 
 	unsigned long link_check_timeout;
+
+	struct igb_rfs_filter rfs_filter[IGB_MAX_RFS_FILTERS];
+	spinlock_t rfs_lock;
+	u32 rfs_steered;
+	u32 rfs_steer_failed;
+	u32 rfs_expired;
 };
 
 #define IGB_FLAG_HAS_MSI		(1 << 0)
@@ -95,6 +95,9 @@ static const struct igb_stats igb_gstrings_stats[] = {
 	IGB_STAT("os2bmc_rx_by_host", stats.b2ogprc),
 	IGB_STAT("tx_hwtstamp_timeouts", tx_hwtstamp_timeouts),
 	IGB_STAT("rx_hwtstamp_cleared", rx_hwtstamp_cleared),
+	IGB_STAT("rfs_steered", rfs_steered),
+	IGB_STAT("rfs_steer_failed", rfs_steer_failed),
+	IGB_STAT("rfs_expired", rfs_expired),
 };
 
 #define IGB_NETDEV_STAT(_net_stat) { \
@@ -1853,6 +1856,8 @@ static int igb_clean_test_rings(struct igb_ring *rx_ring,
 		rx_desc = IGB_RX_DESC(rx_ring, rx_ntc);
 	}
 
+	netdev_tx_reset_queue(txring_txq(tx_ring));
+
 	/* re-map buffers to ring, store next to clean values */
 	igb_alloc_rx_buffers(rx_ring, count);
 	rx_ring->next_to_clean = rx_ntc;
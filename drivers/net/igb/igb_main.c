@@ -52,6 +52,7 @@
 #include <linux/aer.h>
 #include <linux/prefetch.h>
 #include <linux/pm_runtime.h>
+#include <linux/cpu_rmap.h>
 #ifdef CONFIG_IGB_DCA
 #include <linux/dca.h>
 #endif
@@ -928,6 +929,42 @@ static void igb_configure_msix(struct igb_adapter *adapter)
 	wrfl();
 }
 
+#ifdef CONFIG_RFS_ACCEL
+/**
+ *  igb_init_rx_cpu_rmap - map CPUs to the Rx queues they are closest to
+ *  @adapter: board private structure
+ *
+ *  Failing to build the map only leaves accelerated RFS turned off.
+ **/
+static void igb_init_rx_cpu_rmap(struct igb_adapter *adapter)
+{
+	struct netdev_rfs_info *rfinfo =
+				&netdev_extended(adapter->netdev)->rfs_data;
+	int i, v;
+
+	if (adapter->hw.mac.type != e1000_82576)
+		return;
+
+	rfinfo->rx_cpu_rmap = alloc_irq_cpu_rmap(adapter->num_rx_queues);
+	if (!rfinfo->rx_cpu_rmap)
+		return;
+
+	/* the map is indexed by Rx queue, vector 0 is the "other" cause */
+	for (i = 0; i < adapter->num_rx_queues; i++) {
+		for (v = 0; v < adapter->num_q_vectors; v++)
+			if (adapter->q_vector[v] == adapter->rx_ring[i]->q_vector)
+				break;
+		if (v == adapter->num_q_vectors ||
+		    irq_cpu_rmap_add(rfinfo->rx_cpu_rmap,
+				     adapter->msix_entries[v + 1].vector)) {
+			free_irq_cpu_rmap(rfinfo->rx_cpu_rmap);
+			rfinfo->rx_cpu_rmap = NULL;
+			return;
+		}
+	}
+}
+
+#endif /* CONFIG_RFS_ACCEL */
 /**
  *  igb_request_msix - Initialize MSI-X interrupts
  *  @adapter: board private structure to initialize
@@ -973,6 +1010,9 @@ static int igb_request_msix(struct igb_adapter *adapter)
 	}
 
 	igb_configure_msix(adapter);
+#ifdef CONFIG_RFS_ACCEL
+	igb_init_rx_cpu_rmap(adapter);
+#endif
 	return 0;
 
 err_free:
@@ -1420,6 +1460,11 @@ static void igb_free_irq(struct igb_adapter *adapter)
 	if (adapter->msix_entries) {
 		int vector = 0, i;
 
+#ifdef CONFIG_RFS_ACCEL
+		free_irq_cpu_rmap(
+			netdev_extended(adapter->netdev)->rfs_data.rx_cpu_rmap);
+		netdev_extended(adapter->netdev)->rfs_data.rx_cpu_rmap = NULL;
+#endif
 		free_irq(adapter->msix_entries[vector++].vector, adapter);
 
 		for (i = 0; i < adapter->num_q_vectors; i++)
@@ -1556,6 +1601,162 @@ static void igb_get_hw_control(struct igb_adapter *adapter)
 			ctrl_ext | E1000_CTRL_EXT_DRV_LOAD);
 }
 
+#ifdef CONFIG_RFS_ACCEL
+/**
+ *  igb_write_rfs_filter - program one 5-tuple queue filter
+ *  @adapter: board private structure
+ *  @i: filter index
+ **/
+static void igb_write_rfs_filter(struct igb_adapter *adapter, int i)
+{
+	struct igb_rfs_filter *filter = &adapter->rfs_filter[i];
+	struct e1000_hw *hw = &adapter->hw;
+	u32 ftqf;
+
+	if (!filter->used) {
+		wr32(E1000_FTQF(i), E1000_FTQF_MASK);
+		return;
+	}
+
+	wr32(E1000_SAQF(i), (__force u32)filter->saddr);
+	wr32(E1000_DAQF(i), (__force u32)filter->daddr);
+	wr32(E1000_SPQF(i), (__force u16)filter->sport);
+	wr32(E1000_IMIR(i), (__force u16)filter->dport);
+	wr32(E1000_IMIREXT(i),
+	     (E1000_IMIREXT_SIZE_BP | E1000_IMIREXT_CTRL_BP));
+
+	/* compare all five fields and deliver to the ring's queue */
+	ftqf = filter->proto | E1000_FTQF_VF_BP | E1000_FTQF_QUEUE_ENABLE |
+	       (adapter->rx_ring[filter->queue]->reg_idx <<
+		E1000_FTQF_QUEUE_SHIFT);
+	wr32(E1000_FTQF(i), ftqf);
+}
+
+/**
+ *  igb_restore_rfs_filters - reprogram the filters after a reset
+ *  @adapter: board private structure
+ **/
+static void igb_restore_rfs_filters(struct igb_adapter *adapter)
+{
+	int i;
+
+	if (adapter->hw.mac.type != e1000_82576)
+		return;
+
+	spin_lock_bh(&adapter->rfs_lock);
+	for (i = 0; i < IGB_MAX_RFS_FILTERS; i++)
+		if (adapter->rfs_filter[i].used)
+			igb_write_rfs_filter(adapter, i);
+	spin_unlock_bh(&adapter->rfs_lock);
+}
+
+/**
+ *  igb_rx_flow_steer - steer a flow to the queue of its consuming CPU
+ *  @netdev: network interface device structure
+ *  @skb: packet of the flow, with its network header at skb->data
+ *  @rxq_index: Rx queue the flow should be delivered to
+ *  @flow_id: RFS flow id, handed back to rps_may_expire_flow() later
+ *
+ *  Only the 82576 can queue on the full IPv4 TCP/UDP 5-tuple, and it has
+ *  just a handful of filters, so the flows that ask first get them until
+ *  they are expired.  Returns the filter index.
+ **/
+static int igb_rx_flow_steer(struct net_device *netdev,
+			     const struct sk_buff *skb,
+			     u16 rxq_index, u32 flow_id)
+{
+	struct igb_adapter *adapter = netdev_priv(netdev);
+	struct igb_rfs_filter *filter;
+	const struct iphdr *iph;
+	const __be16 *ports;
+	int i, idx = -1;
+
+	if (adapter->hw.mac.type != e1000_82576 ||
+	    adapter->vfs_allocated_count ||
+	    rxq_index >= adapter->num_rx_queues)
+		return -EOPNOTSUPP;
+
+	if (skb->protocol != htons(ETH_P_IP) ||
+	    skb_headlen(skb) < sizeof(struct iphdr))
+		return -EPROTONOSUPPORT;
+	iph = (const struct iphdr *)skb->data;
+	if ((iph->frag_off & htons(IP_MF | IP_OFFSET)) ||
+	    skb_headlen(skb) < iph->ihl * 4 + 4 ||
+	    (iph->protocol != IPPROTO_TCP && iph->protocol != IPPROTO_UDP))
+		return -EPROTONOSUPPORT;
+	ports = (const __be16 *)(skb->data + iph->ihl * 4);
+
+	spin_lock(&adapter->rfs_lock);
+
+	for (i = 0; i < IGB_MAX_RFS_FILTERS; i++) {
+		filter = &adapter->rfs_filter[i];
+		if (i == IGB_PTP_RFS_FILTER)
+			continue;
+		if (!filter->used) {
+			if (idx < 0)
+				idx = i;
+			continue;
+		}
+		if (filter->saddr == iph->saddr &&
+		    filter->daddr == iph->daddr &&
+		    filter->sport == ports[0] &&
+		    filter->dport == ports[1] &&
+		    filter->proto == iph->protocol) {
+			idx = i;
+			break;
+		}
+	}
+
+	if (idx < 0) {
+		adapter->rfs_steer_failed++;
+		spin_unlock(&adapter->rfs_lock);
+		return -EBUSY;
+	}
+
+	filter = &adapter->rfs_filter[idx];
+	filter->saddr = iph->saddr;
+	filter->daddr = iph->daddr;
+	filter->sport = ports[0];
+	filter->dport = ports[1];
+	filter->proto = iph->protocol;
+	filter->queue = rxq_index;
+	filter->flow_id = flow_id;
+	filter->used = true;
+	igb_write_rfs_filter(adapter, idx);
+	adapter->rfs_steered++;
+
+	spin_unlock(&adapter->rfs_lock);
+
+	return idx;
+}
+
+/**
+ *  igb_rfs_expire - remove filters of flows RFS no longer steers
+ *  @adapter: board private structure
+ **/
+static void igb_rfs_expire(struct igb_adapter *adapter)
+{
+	struct igb_rfs_filter *filter;
+	int i;
+
+	if (adapter->hw.mac.type != e1000_82576)
+		return;
+
+	spin_lock_bh(&adapter->rfs_lock);
+	for (i = 0; i < IGB_MAX_RFS_FILTERS; i++) {
+		filter = &adapter->rfs_filter[i];
+		if (!filter->used ||
+		    !rps_may_expire_flow(adapter->netdev, filter->queue,
+					 filter->flow_id, i))
+			continue;
+		filter->used = false;
+		igb_write_rfs_filter(adapter, i);
+		adapter->rfs_expired++;
+	}
+	spin_unlock_bh(&adapter->rfs_lock);
+}
+
+#endif /* CONFIG_RFS_ACCEL */
 /**
  *  igb_configure - configure the hardware for RX and TX
  *  @adapter: private board structure
@@ -1576,6 +1777,9 @@ static void igb_configure(struct igb_adapter *adapter)
 
 	igb_configure_tx(adapter);
 	igb_configure_rx(adapter);
+#ifdef CONFIG_RFS_ACCEL
+	igb_restore_rfs_filters(adapter);
+#endif
 
 	igb_rx_fifo_flush_82575(&adapter->hw);
 
@@ -2064,6 +2268,9 @@ static int __devinit igb_probe(struct pci_dev *pdev,
 		goto err_ioremap;
 
 	netdev->netdev_ops = &igb_netdev_ops;
+#ifdef CONFIG_RFS_ACCEL
+	netdev_extended(netdev)->rfs_data.ndo_rx_flow_steer = igb_rx_flow_steer;
+#endif
 	igb_set_ethtool_ops(netdev);
 	netdev->watchdog_timeo = 5 * HZ;
 
@@ -2139,6 +2346,10 @@ static int __devinit igb_probe(struct pci_dev *pdev,
 	if (hw->mac.type >= e1000_82576)
 		netdev->features |= NETIF_F_SCTP_CSUM;
 
+	/* 5-tuple queue filters, used by accelerated RFS */
+	if (hw->mac.type == e1000_82576)
+		netdev->features |= NETIF_F_NTUPLE;
+
 	adapter->en_mng_pt = igb_enable_mng_pass_thru(hw);
 
 	/* before reading the NVM, reset the controller to put the device in a
@@ -2681,6 +2892,8 @@ static int __devinit igb_sw_init(struct igb_adapter *adapter)
 	/* set default work limits */
 	adapter->tx_work_limit = IGB_DEFAULT_TX_WORK;
 
+	spin_lock_init(&adapter->rfs_lock);
+
 	adapter->max_frame_size = netdev->mtu + ETH_HLEN + ETH_FCS_LEN +
 				  VLAN_HLEN;
 	adapter->min_frame_size = ETH_ZLEN + ETH_FCS_LEN;
@@ -2867,6 +3080,11 @@ static int __igb_close(struct net_device *netdev, bool suspending)
 	igb_down(adapter);
 	igb_free_irq(adapter);
 
+	/* the queue layout may change before the next open */
+	spin_lock_bh(&adapter->rfs_lock);
+	memset(adapter->rfs_filter, 0, sizeof(adapter->rfs_filter));
+	spin_unlock_bh(&adapter->rfs_lock);
+
 	igb_free_all_tx_resources(adapter);
 	igb_free_all_rx_resources(adapter);
 
@@ -3459,6 +3677,8 @@ static void igb_clean_tx_ring(struct igb_ring *tx_ring)
 		igb_unmap_and_free_tx_resource(tx_ring, buffer_info);
 	}
 
+	netdev_tx_reset_queue(txring_txq(tx_ring));
+
 	size = sizeof(struct igb_tx_buffer) * tx_ring->count;
 	memset(tx_ring->tx_buffer_info, 0, size);
 
@@ -3979,6 +4199,9 @@ static void igb_watchdog_task(struct work_struct *work)
 	}
 
 	igb_update_stats(adapter);
+#ifdef CONFIG_RFS_ACCEL
+	igb_rfs_expire(adapter);
+#endif
 
 	for (i = 0; i < adapter->num_tx_queues; i++) {
 		struct igb_ring *tx_ring = adapter->tx_ring[i];
@@ -4513,6 +4736,8 @@ static void igb_tx_map(struct igb_ring *tx_ring, struct sk_buff *skb,
 	cmd_type |= size | IGB_TXD_DCMD;
 	tx_desc->read.cmd_type_len = cpu_to_le32(cmd_type);
 
+	netdev_tx_sent_queue(txring_txq(tx_ring), first->bytecount);
+
 	/* set the timestamp */
 	first->time_stamp = jiffies;
 
@@ -6028,6 +6253,8 @@ static bool igb_clean_tx_irq(struct igb_q_vector *q_vector)
 	tx_ring->tx_stats.packets += total_packets;
 	q_vector->tx.total_bytes += total_bytes;
 	q_vector->tx.total_packets += total_packets;
+	netdev_tx_completed_queue(txring_txq(tx_ring),
+				  total_packets, total_bytes);
 
 	if (test_bit(IGB_RING_FLAG_TX_DETECT_HANG, &tx_ring->flags)) {
 		struct e1000_hw *hw = &adapter->hw;
@@ -87,6 +87,9 @@ static struct ixgbe_stats ixgbe_gstrings_stats[] = {
 	{"fdir_match", IXGBE_STAT(stats.fdirmatch)},
 	{"fdir_miss", IXGBE_STAT(stats.fdirmiss)},
 	{"fdir_overflow", IXGBE_STAT(fdir_overflow)},
+	{"rfs_steered", IXGBE_STAT(rfs_steered)},
+	{"rfs_steer_failed", IXGBE_STAT(rfs_steer_failed)},
+	{"rfs_expired", IXGBE_STAT(rfs_expired)},
 	{"rx_fifo_errors", IXGBE_NETDEV_STAT(stats.rx_fifo_errors)},
 	{"rx_missed_errors", IXGBE_NETDEV_STAT(stats.rx_missed_errors)},
 	{"tx_aborted_errors", IXGBE_NETDEV_STAT(stats.tx_aborted_errors)},
@@ -1846,6 +1849,8 @@ static u16 ixgbe_clean_test_rings(struct ixgbe_ring *rx_ring,
 		rx_desc = IXGBE_RX_DESC(rx_ring, rx_ntc);
 	}
 
+	netdev_tx_reset_queue(txring_txq(tx_ring));
+
 	/* re-map buffers to ring, store next to clean values */
 	ixgbe_alloc_rx_buffers(rx_ring, count);
 	rx_ring->next_to_clean = rx_ntc;
@@ -2345,7 +2350,8 @@ static int ixgbe_get_ethtool_fdir_entry(struct ixgbe_adapter *adapter,
 			break;
 	}
 
-	if (!rule || fsp->location != rule->sw_idx)
+	/* filters installed by accelerated RFS are not ethtool rules */
+	if (!rule || fsp->location != rule->sw_idx || rule->rfs)
 		return -EINVAL;
 
 	/* fill out the flow spec entry */
@@ -2409,6 +2415,8 @@ static int ixgbe_get_ethtool_fdir_all(struct ixgbe_adapter *adapter,
 
 	hlist_for_each_entry_safe(rule, node, node2,
 				  &adapter->fdir_filter_list, fdir_node) {
+		if (rule->rfs)
+			continue;
 		if (cnt == cmd->rule_cnt)
 			return -EMSGSIZE;
 		rule_locs[cnt] = rule->sw_idx;
@@ -2470,15 +2478,20 @@ static int ixgbe_get_rxnfc(struct net_device *dev, struct ethtool_rxnfc *cmd,
 		ret = 0;
 		break;
 	case ETHTOOL_GRXCLSRLCNT:
-		cmd->rule_cnt = adapter->fdir_filter_count;
+		cmd->rule_cnt = adapter->fdir_filter_count -
+				adapter->fdir_rfs_count;
 		ret = 0;
 		break;
 	case ETHTOOL_GRXCLSRULE:
+		spin_lock_bh(&adapter->fdir_perfect_lock);
 		ret = ixgbe_get_ethtool_fdir_entry(adapter, cmd);
+		spin_unlock_bh(&adapter->fdir_perfect_lock);
 		break;
 	case ETHTOOL_GRXCLSRLALL:
+		spin_lock_bh(&adapter->fdir_perfect_lock);
 		ret = ixgbe_get_ethtool_fdir_all(adapter, cmd,
 						 (u32 *)rule_locs);
+		spin_unlock_bh(&adapter->fdir_perfect_lock);
 		break;
 	case ETHTOOL_GRXFH:
 		ret = ixgbe_get_rss_hash_opts(adapter, cmd);
@@ -2520,6 +2533,8 @@ static int ixgbe_update_ethtool_fdir_entry(struct ixgbe_adapter *adapter,
 		}
 
 		hlist_del(&rule->fdir_node);
+		if (rule->rfs)
+			adapter->fdir_rfs_count--;
 		kfree(rule);
 		adapter->fdir_filter_count--;
 	}
@@ -2587,6 +2602,30 @@ static int ixgbe_flowspec_to_flow_type(struct ethtool_rx_flow_spec *fsp,
 	return 1;
 }
 
+/*
+ * Accelerated RFS filters share the perfect filter table and its single
+ * input mask with ethtool rules.  Drop them so that a user rule can set
+ * a different mask; their flows fall back to RSS until steered again.
+ */
+static void ixgbe_flush_rfs_fdir_filters(struct ixgbe_adapter *adapter)
+{
+	struct ixgbe_hw *hw = &adapter->hw;
+	struct hlist_node *node, *node2;
+	struct ixgbe_fdir_filter *rule;
+
+	hlist_for_each_entry_safe(rule, node, node2,
+				  &adapter->fdir_filter_list, fdir_node) {
+		if (!rule->rfs)
+			continue;
+		ixgbe_fdir_erase_perfect_filter_82599(hw, &rule->filter,
+						      rule->sw_idx);
+		hlist_del(&rule->fdir_node);
+		kfree(rule);
+		adapter->fdir_filter_count--;
+		adapter->fdir_rfs_count--;
+	}
+}
+
 static int ixgbe_add_ethtool_fdir_entry(struct ixgbe_adapter *adapter,
 					struct ethtool_rxnfc *cmd)
 {
@@ -2664,7 +2703,11 @@ static int ixgbe_add_ethtool_fdir_entry(struct ixgbe_adapter *adapter,
 	else
 		input->action = fsp->ring_cookie;
 
-	spin_lock(&adapter->fdir_perfect_lock);
+	spin_lock_bh(&adapter->fdir_perfect_lock);
+
+	if (adapter->fdir_filter_count == adapter->fdir_rfs_count &&
+	    memcmp(&adapter->fdir_mask, &mask, sizeof(mask)))
+		ixgbe_flush_rfs_fdir_filters(adapter);
 
 	if (hlist_empty(&adapter->fdir_filter_list)) {
 		/* save mask and program input mask into HW */
@@ -2693,11 +2736,11 @@ static int ixgbe_add_ethtool_fdir_entry(struct ixgbe_adapter *adapter,
 
 	ixgbe_update_ethtool_fdir_entry(adapter, input, input->sw_idx);
 
-	spin_unlock(&adapter->fdir_perfect_lock);
+	spin_unlock_bh(&adapter->fdir_perfect_lock);
 
 	return err;
 err_out_w_lock:
-	spin_unlock(&adapter->fdir_perfect_lock);
+	spin_unlock_bh(&adapter->fdir_perfect_lock);
 err_out:
 	kfree(input);
 	return -EINVAL;
@@ -2710,9 +2753,9 @@ static int ixgbe_del_ethtool_fdir_entry(struct ixgbe_adapter *adapter,
 		(struct ethtool_rx_flow_spec *)&cmd->fs;
 	int err;
 
-	spin_lock(&adapter->fdir_perfect_lock);
+	spin_lock_bh(&adapter->fdir_perfect_lock);
 	err = ixgbe_update_ethtool_fdir_entry(adapter, NULL, fsp->location);
-	spin_unlock(&adapter->fdir_perfect_lock);
+	spin_unlock_bh(&adapter->fdir_perfect_lock);
 
 	return err;
 }
@@ -43,6 +43,7 @@
 #include <linux/ethtool.h>
 #include <linux/if_vlan.h>
 #include <linux/prefetch.h>
+#include <linux/cpu_rmap.h>
 #include <scsi/fc/fc_fcoe.h>
 
 #include "ixgbe.h"
@@ -948,6 +949,9 @@ static bool ixgbe_clean_tx_irq(struct ixgbe_q_vector *q_vector,
 	q_vector->tx.total_bytes += total_bytes;
 	q_vector->tx.total_packets += total_packets;
 
+	netdev_tx_completed_queue(txring_txq(tx_ring),
+				  total_packets, total_bytes);
+
 	if (check_for_tx_hang(tx_ring) && ixgbe_check_tx_hang(tx_ring)) {
 		/* schedule immediate reset if we believe we hung */
 		struct ixgbe_hw *hw = &adapter->hw;
@@ -1496,11 +1500,21 @@ static void ixgbe_rx_skb(struct ixgbe_q_vector *q_vector,
 	struct net_device *dev = skb->dev;
 
 	if (!(adapter->flags & IXGBE_FLAG_IN_NETPOLL)) {
+		/* a busy polling socket wants its packet now, skip GRO */
+		bool busy = ixgbe_qv_busy_polling(q_vector);
+
 		if ((dev->features & NETIF_F_HW_VLAN_RX) &&
 		    ixgbe_test_staterr(rx_desc, IXGBE_RXD_STAT_VP)) {
 			u16 vid = le16_to_cpu(rx_desc->wb.upper.vlan);
-			vlan_gro_receive(&q_vector->napi, adapter->vlgrp, vid, skb);
+			if (busy)
+				vlan_hwaccel_receive_skb(skb, adapter->vlgrp,
+							 vid);
+			else
+				vlan_gro_receive(&q_vector->napi,
+						 adapter->vlgrp, vid, skb);
 		}
+		else if (busy)
+			netif_receive_skb(skb);
 		else
 			napi_gro_receive(&q_vector->napi, skb);
 	} else {
@@ -1887,9 +1901,9 @@ dma_sync:
  * expensive overhead for IOMMU access this provides a means of avoiding
  * it by maintaining the mapping of the page to the syste.
  *
- * Returns true if all work is completed without reaching budget
+ * Returns amount of work completed
  **/
-static bool ixgbe_clean_rx_irq(struct ixgbe_q_vector *q_vector,
+static int ixgbe_clean_rx_irq(struct ixgbe_q_vector *q_vector,
 			       struct ixgbe_ring *rx_ring,
 			       const int budget)
 {
@@ -1971,6 +1985,7 @@ static bool ixgbe_clean_rx_irq(struct ixgbe_q_vector *q_vector,
 		}
 
 #endif /* IXGBE_FCOE */
+		skb_mark_napi_id(skb, &q_vector->napi);
 		ixgbe_rx_skb(q_vector, skb, rx_desc);
 
 		/* update budget accounting */
@@ -1985,7 +2000,7 @@ static bool ixgbe_clean_rx_irq(struct ixgbe_q_vector *q_vector,
 	if (cleaned_count)
 		ixgbe_alloc_rx_buffers(rx_ring, cleaned_count);
 
-	return (total_rx_packets < budget);
+	return total_rx_packets;
 }
 
 /**
@@ -2554,10 +2569,15 @@ int ixgbe_poll(struct napi_struct *napi, int budget)
 	else
 		per_ring_budget = budget;
 
+	/* Exit if we are called by netpoll or busy polling is active */
+	if (!ixgbe_qv_lock_napi(q_vector))
+		return budget;
+
 	ixgbe_for_each_ring(ring, q_vector->rx)
-		clean_complete &= ixgbe_clean_rx_irq(q_vector, ring,
-						     per_ring_budget);
+		clean_complete &= (ixgbe_clean_rx_irq(q_vector, ring,
+				   per_ring_budget) < per_ring_budget);
 
+	ixgbe_qv_unlock_napi(q_vector);
 	/* If all work not completed, return budget and keep polling */
 	if (!clean_complete)
 		return budget;
@@ -2572,6 +2592,68 @@ int ixgbe_poll(struct napi_struct *napi, int budget)
 	return 0;
 }
 
+#ifdef CONFIG_NET_RX_BUSY_POLL
+/* must be called with local_bh_disable()d */
+static int ixgbe_low_latency_recv(struct napi_struct *napi)
+{
+	struct ixgbe_q_vector *q_vector =
+			container_of(napi, struct ixgbe_q_vector, napi);
+	struct ixgbe_adapter *adapter = q_vector->adapter;
+	struct ixgbe_ring  *ring;
+	int found = 0;
+
+	if (test_bit(__IXGBE_DOWN, &adapter->state))
+		return LL_FLUSH_FAILED;
+
+	if (!ixgbe_qv_lock_poll(q_vector))
+		return LL_FLUSH_BUSY;
+
+	ixgbe_for_each_ring(ring, q_vector->rx) {
+		found = ixgbe_clean_rx_irq(q_vector, ring, 4);
+		if (found)
+			break;
+	}
+
+	ixgbe_qv_unlock_poll(q_vector);
+
+	return found;
+}
+#endif	/* CONFIG_NET_RX_BUSY_POLL */
+
+#ifdef CONFIG_RFS_ACCEL
+/**
+ * ixgbe_init_rx_cpu_rmap - map CPUs to the Rx queues they are closest to
+ * @adapter: board private structure
+ *
+ * The map is indexed by Rx queue, so it can only be built when every
+ * queue has a vector of its own.  Without it accelerated RFS stays off.
+ **/
+static void ixgbe_init_rx_cpu_rmap(struct ixgbe_adapter *adapter)
+{
+	struct netdev_rfs_info *rfinfo =
+				&netdev_extended(adapter->netdev)->rfs_data;
+	int i;
+
+	if (adapter->num_rx_queues > adapter->num_q_vectors)
+		return;
+
+	rfinfo->rx_cpu_rmap = alloc_irq_cpu_rmap(adapter->num_rx_queues);
+	if (!rfinfo->rx_cpu_rmap)
+		return;
+
+	for (i = 0; i < adapter->num_rx_queues; i++) {
+		struct ixgbe_q_vector *q_vector = adapter->rx_ring[i]->q_vector;
+
+		if (irq_cpu_rmap_add(rfinfo->rx_cpu_rmap,
+			adapter->msix_entries[q_vector->v_idx].vector)) {
+			free_irq_cpu_rmap(rfinfo->rx_cpu_rmap);
+			rfinfo->rx_cpu_rmap = NULL;
+			return;
+		}
+	}
+}
+
+#endif /* CONFIG_RFS_ACCEL */
 /**
  * ixgbe_request_msix_irqs - Initialize MSI-X interrupts
  * @adapter: board private structure
@@ -2625,6 +2707,9 @@ static int ixgbe_request_msix_irqs(struct ixgbe_adapter *adapter)
 		goto free_queue_irqs;
 	}
 
+#ifdef CONFIG_RFS_ACCEL
+	ixgbe_init_rx_cpu_rmap(adapter);
+#endif
 	return 0;
 
 free_queue_irqs:
@@ -2748,6 +2833,10 @@ static void ixgbe_free_irq(struct ixgbe_adapter *adapter)
 		return;
 	}
 
+#ifdef CONFIG_RFS_ACCEL
+	free_irq_cpu_rmap(netdev_extended(adapter->netdev)->rfs_data.rx_cpu_rmap);
+	netdev_extended(adapter->netdev)->rfs_data.rx_cpu_rmap = NULL;
+#endif
 	for (vector = 0; vector < adapter->num_q_vectors; vector++) {
 		struct ixgbe_q_vector *q_vector = adapter->q_vector[vector];
 		struct msix_entry *entry = &adapter->msix_entries[vector];
@@ -3763,16 +3852,21 @@ static void ixgbe_napi_enable_all(struct ixgbe_adapter *adapter)
 {
 	int q_idx;
 
-	for (q_idx = 0; q_idx < adapter->num_q_vectors; q_idx++)
+	for (q_idx = 0; q_idx < adapter->num_q_vectors; q_idx++) {
+		ixgbe_qv_init_lock(adapter->q_vector[q_idx]);
 		napi_enable(&adapter->q_vector[q_idx]->napi);
+	}
 }
 
 static void ixgbe_napi_disable_all(struct ixgbe_adapter *adapter)
 {
 	int q_idx;
 
-	for (q_idx = 0; q_idx < adapter->num_q_vectors; q_idx++)
+	for (q_idx = 0; q_idx < adapter->num_q_vectors; q_idx++) {
 		napi_disable(&adapter->q_vector[q_idx]->napi);
+		while (!ixgbe_qv_disable(adapter->q_vector[q_idx]))
+			usleep_range(1000, 20000);
+	}
 }
 
 #ifdef CONFIG_IXGBE_DCB
@@ -3971,7 +4065,7 @@ static void ixgbe_fdir_filter_restore(struct ixgbe_adapter *adapter)
 	struct hlist_node *node, *node2;
 	struct ixgbe_fdir_filter *filter;
 
-	spin_lock(&adapter->fdir_perfect_lock);
+	spin_lock_bh(&adapter->fdir_perfect_lock);
 
 	if (!hlist_empty(&adapter->fdir_filter_list))
 		ixgbe_fdir_set_input_mask_82599(hw, &adapter->fdir_mask);
@@ -3986,7 +4080,7 @@ static void ixgbe_fdir_filter_restore(struct ixgbe_adapter *adapter)
 				adapter->rx_ring[filter->action]->reg_idx);
 	}
 
-	spin_unlock(&adapter->fdir_perfect_lock);
+	spin_unlock_bh(&adapter->fdir_perfect_lock);
 }
 
 static void ixgbe_configure(struct ixgbe_adapter *adapter)
@@ -4400,6 +4494,8 @@ static void ixgbe_clean_tx_ring(struct ixgbe_ring *tx_ring)
 	size = sizeof(struct ixgbe_tx_buffer) * tx_ring->count;
 	memset(tx_ring->tx_buffer_info, 0, size);
 
+	netdev_tx_reset_queue(txring_txq(tx_ring));
+
 	/* Zero out the descriptor ring */
 	memset(tx_ring->desc, 0, tx_ring->size);
 
@@ -4436,7 +4532,7 @@ static void ixgbe_fdir_filter_exit(struct ixgbe_adapter *adapter)
 	struct hlist_node *node, *node2;
 	struct ixgbe_fdir_filter *filter;
 
-	spin_lock(&adapter->fdir_perfect_lock);
+	spin_lock_bh(&adapter->fdir_perfect_lock);
 
 	hlist_for_each_entry_safe(filter, node, node2,
 				  &adapter->fdir_filter_list, fdir_node) {
@@ -4444,9 +4540,199 @@ static void ixgbe_fdir_filter_exit(struct ixgbe_adapter *adapter)
 		kfree(filter);
 	}
 	adapter->fdir_filter_count = 0;
+	adapter->fdir_rfs_count = 0;
 
+	spin_unlock_bh(&adapter->fdir_perfect_lock);
+}
+
+#ifdef CONFIG_RFS_ACCEL
+/**
+ * ixgbe_rx_flow_steer - steer a flow to the queue of its consuming CPU
+ * @netdev: network interface device structure
+ * @skb: packet of the flow, with its network header at skb->data
+ * @rxq_index: Rx queue the flow should be delivered to
+ * @flow_id: RFS flow id, handed back to rps_may_expire_flow() later
+ *
+ * Installs (or moves) a Flow Director perfect filter for the IPv4
+ * TCP/UDP 4-tuple of the packet.  The filters share the table and the
+ * single input mask with the ethtool n-tuple rules, so steering is only
+ * possible in perfect filter mode and while any ethtool rules present
+ * match on the full 4-tuple as well.  Returns the filter's soft index.
+ **/
+static int ixgbe_rx_flow_steer(struct net_device *netdev,
+			       const struct sk_buff *skb,
+			       u16 rxq_index, u32 flow_id)
+{
+	struct ixgbe_adapter *adapter = netdev_priv(netdev);
+	struct ixgbe_hw *hw = &adapter->hw;
+	struct ixgbe_fdir_filter *rule, *input = NULL;
+	struct hlist_node *node, *parent = NULL;
+	union ixgbe_atr_input filter, mask;
+	const struct iphdr *iph;
+	const __be16 *ports;
+	u16 sw_idx = 0;
+	bool idx_found = false;
+	int err;
+
+	if (!(adapter->flags & IXGBE_FLAG_FDIR_PERFECT_CAPABLE) ||
+	    rxq_index >= adapter->num_rx_queues)
+		return -EOPNOTSUPP;
+
+	if (skb->protocol != htons(ETH_P_IP) ||
+	    skb_headlen(skb) < sizeof(struct iphdr))
+		return -EPROTONOSUPPORT;
+	iph = (const struct iphdr *)skb->data;
+	if ((iph->frag_off & htons(IP_MF | IP_OFFSET)) ||
+	    skb_headlen(skb) < iph->ihl * 4 + 4)
+		return -EPROTONOSUPPORT;
+	ports = (const __be16 *)(skb->data + iph->ihl * 4);
+
+	memset(&filter, 0, sizeof(filter));
+	switch (iph->protocol) {
+	case IPPROTO_TCP:
+		filter.formatted.flow_type = IXGBE_ATR_FLOW_TYPE_TCPV4;
+		break;
+	case IPPROTO_UDP:
+		filter.formatted.flow_type = IXGBE_ATR_FLOW_TYPE_UDPV4;
+		break;
+	default:
+		return -EPROTONOSUPPORT;
+	}
+	filter.formatted.src_ip[0] = iph->saddr;
+	filter.formatted.dst_ip[0] = iph->daddr;
+	filter.formatted.src_port = ports[0];
+	filter.formatted.dst_port = ports[1];
+
+	memset(&mask, 0, sizeof(mask));
+	mask.formatted.flow_type = IXGBE_ATR_L4TYPE_IPV6_MASK |
+				   IXGBE_ATR_L4TYPE_MASK;
+	mask.formatted.src_ip[0] = htonl(0xFFFFFFFF);
+	mask.formatted.dst_ip[0] = htonl(0xFFFFFFFF);
+	mask.formatted.src_port = htons(0xFFFF);
+	mask.formatted.dst_port = htons(0xFFFF);
+
+	ixgbe_atr_compute_perfect_hash_82599(&filter, &mask);
+
+	spin_lock(&adapter->fdir_perfect_lock);
+
+	/* look for the flow, and for the lowest free index in case it is new */
+	hlist_for_each_entry(rule, node, &adapter->fdir_filter_list,
+			     fdir_node) {
+		if (rule->rfs &&
+		    !memcmp(&rule->filter, &filter, sizeof(filter))) {
+			input = rule;
+			break;
+		}
+		if (!idx_found) {
+			if (rule->sw_idx == sw_idx) {
+				sw_idx++;
+				parent = node;
+			} else {
+				idx_found = true;
+			}
+		}
+	}
+
+	if (input) {
+		/* the flow moved to another CPU, retarget its filter */
+		err = ixgbe_fdir_write_perfect_filter_82599(hw, &input->filter,
+				input->sw_idx,
+				adapter->rx_ring[rxq_index]->reg_idx);
+		if (err)
+			goto err_out;
+		input->action = rxq_index;
+		input->flow_id = flow_id;
+		goto out;
+	}
+
+	/* leave at least half of the table to ethtool rules */
+	if (adapter->fdir_rfs_count >= (512 << adapter->fdir_pballoc) ||
+	    sw_idx >= (1024 << adapter->fdir_pballoc) - 2)
+		goto err_out;
+
+	if (hlist_empty(&adapter->fdir_filter_list)) {
+		memcpy(&adapter->fdir_mask, &mask, sizeof(mask));
+		if (ixgbe_fdir_set_input_mask_82599(hw, &mask))
+			goto err_out;
+	} else if (memcmp(&adapter->fdir_mask, &mask, sizeof(mask))) {
+		goto err_out;
+	}
+
+	input = kzalloc(sizeof(*input), GFP_ATOMIC);
+	if (!input)
+		goto err_out;
+	memcpy(&input->filter, &filter, sizeof(filter));
+	input->sw_idx = sw_idx;
+	input->action = rxq_index;
+	input->flow_id = flow_id;
+	input->rfs = true;
+
+	if (ixgbe_fdir_write_perfect_filter_82599(hw, &input->filter, sw_idx,
+				adapter->rx_ring[rxq_index]->reg_idx)) {
+		kfree(input);
+		goto err_out;
+	}
+
+	if (parent)
+		hlist_add_after(parent, &input->fdir_node);
+	else
+		hlist_add_head(&input->fdir_node, &adapter->fdir_filter_list);
+	adapter->fdir_filter_count++;
+	adapter->fdir_rfs_count++;
+out:
+	adapter->rfs_steered++;
+	spin_unlock(&adapter->fdir_perfect_lock);
+
+	return input->sw_idx;
+err_out:
+	adapter->rfs_steer_failed++;
 	spin_unlock(&adapter->fdir_perfect_lock);
+
+	return -EBUSY;
+}
+
+/**
+ * ixgbe_rfs_expire_subtask - remove filters of flows RFS no longer steers
+ * @adapter: pointer to the device adapter structure
+ **/
+static void ixgbe_rfs_expire_subtask(struct ixgbe_adapter *adapter)
+{
+	struct ixgbe_hw *hw = &adapter->hw;
+	struct hlist_node *node, *node2;
+	struct ixgbe_fdir_filter *rule;
+	bool perfect;
+
+	if (!adapter->fdir_rfs_count ||
+	    test_bit(__IXGBE_DOWN, &adapter->state) ||
+	    test_bit(__IXGBE_RESETTING, &adapter->state))
+		return;
+
+	/* once n-tuple is turned off the filters are gone from hardware */
+	perfect = !!(adapter->flags & IXGBE_FLAG_FDIR_PERFECT_CAPABLE);
+
+	spin_lock_bh(&adapter->fdir_perfect_lock);
+
+	hlist_for_each_entry_safe(rule, node, node2,
+				  &adapter->fdir_filter_list, fdir_node) {
+		if (!rule->rfs)
+			continue;
+		if (perfect &&
+		    !rps_may_expire_flow(adapter->netdev, rule->action,
+					 rule->flow_id, rule->sw_idx))
+			continue;
+		if (perfect)
+			ixgbe_fdir_erase_perfect_filter_82599(hw, &rule->filter,
+							      rule->sw_idx);
+		hlist_del(&rule->fdir_node);
+		kfree(rule);
+		adapter->fdir_filter_count--;
+		adapter->fdir_rfs_count--;
+		adapter->rfs_expired++;
+	}
+
+	spin_unlock_bh(&adapter->fdir_perfect_lock);
 }
+#endif /* CONFIG_RFS_ACCEL */
 
 void ixgbe_down(struct ixgbe_adapter *adapter)
 {
@@ -5994,6 +6280,9 @@ static void ixgbe_service_task(struct work_struct *work)
 	ixgbe_check_overtemp_subtask(adapter);
 	ixgbe_watchdog_subtask(adapter);
 	ixgbe_fdir_reinit_subtask(adapter);
+#ifdef CONFIG_RFS_ACCEL
+	ixgbe_rfs_expire_subtask(adapter);
+#endif
 	ixgbe_check_hang_subtask(adapter);
 
 #ifdef CONFIG_IXGBE_PTP
@@ -6293,6 +6582,8 @@ static void ixgbe_tx_map(struct ixgbe_ring *tx_ring,
 	cmd_type |= size | IXGBE_TXD_CMD;
 	tx_desc->read.cmd_type_len = cpu_to_le32(cmd_type);
 
+	netdev_tx_sent_queue(txring_txq(tx_ring), first->bytecount);
+
 	/* set the timestamp */
 	first->time_stamp = jiffies;
 
@@ -7110,6 +7401,13 @@ static int ixgbe_probe(struct pci_dev *pdev, const struct pci_device_id *ent)
 #ifdef IXGBE_FCOE
 	netdev_extended(netdev)->ndo_fcoe_get_hbainfo = ixgbe_fcoe_get_hbainfo;
 #endif /* IXGBE_FCOE */
+#ifdef CONFIG_NET_RX_BUSY_POLL
+	netdev_extended(netdev)->ndo_busy_poll = ixgbe_low_latency_recv;
+#endif
+#ifdef CONFIG_RFS_ACCEL
+	netdev_extended(netdev)->rfs_data.ndo_rx_flow_steer =
+						ixgbe_rx_flow_steer;
+#endif
 	ixgbe_set_ethtool_ops(netdev);
 	netdev->watchdog_timeo = 5 * HZ;
 	strncpy(netdev->name, pci_name(pdev), sizeof(netdev->name) - 1);
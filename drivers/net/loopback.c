@@ -83,6 +83,13 @@ static netdev_tx_t loopback_xmit(struct sk_buff *skb,
 	pcpu_lstats = dev->ml_priv;
 	lb_stats = per_cpu_ptr(pcpu_lstats, smp_processor_id());
 
+	/* Do not let a local reader pin MSG_ZEROCOPY buffers */
+	if (unlikely(skb_orphan_frags_rx(skb, GFP_ATOMIC))) {
+		kfree_skb(skb);
+		lb_stats->drops++;
+		return NETDEV_TX_OK;
+	}
+
 	len = skb->len;
 	if (likely(netif_rx(skb) == NET_RX_SUCCESS)) {
 		lb_stats->bytes += len;
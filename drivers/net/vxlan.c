@@ -915,6 +915,62 @@ error:
 	return 1;
 }
 
+static struct sk_buff **vxlan_gro_receive(struct sk_buff **head,
+					  struct sk_buff *skb)
+{
+	struct sk_buff **pp = NULL;
+	struct vxlanhdr *vh;
+	struct sk_buff *p;
+	unsigned int hlen, off;
+	int flush = 1;
+	__wsum csum;
+
+	off = skb_gro_offset(skb);
+	hlen = off + sizeof(*vh);
+	vh = skb_gro_header_fast(skb, off);
+	if (skb_gro_header_hard(skb, hlen)) {
+		vh = skb_gro_header_slow(skb, hlen, off);
+		if (unlikely(!vh))
+			goto out;
+	}
+
+	/* Leave malformed headers to vxlan_udp_encap_recv() */
+	if (vh->vx_flags != htonl(VXLAN_FLAGS) || (vh->vx_vni & htonl(0xff)))
+		goto out;
+
+	flush = 0;
+
+	for (p = *head; p; p = p->next) {
+		struct vxlanhdr *vh2;
+
+		if (!NAPI_GRO_CB(p)->same_flow)
+			continue;
+
+		vh2 = skb_gro_held_header(p, skb, off);
+		if (vh->vx_vni != vh2->vx_vni)
+			NAPI_GRO_CB(p)->same_flow = 0;
+	}
+
+	skb_gro_pull(skb, sizeof(*vh));
+
+	csum = skb->csum;
+	skb_postpull_rcsum(skb, vh, sizeof(*vh));
+
+	pp = eth_gro_receive(head, skb);
+
+	skb->csum = csum;
+out:
+	NAPI_GRO_CB(skb)->flush |= flush;
+
+	return pp;
+}
+
+static int vxlan_gro_complete(struct sk_buff *skb)
+{
+	NAPI_GRO_CB(skb)->nhoff += sizeof(struct vxlanhdr);
+	return eth_gro_complete(skb);
+}
+
 static void vxlan_rcv(struct vxlan_sock *vs,
 		      struct sk_buff *skb, __be32 vx_vni)
 {
@@ -950,9 +1006,12 @@ static void vxlan_rcv(struct vxlan_sock *vs,
 	 * CHECKSUM_UNNECESSARY and Rx checksum feature is enabled,
 	 * leave the CHECKSUM_UNNECESSARY, the device checksummed it
 	 * for us. Otherwise force the upper layers to verify it.
+	 * GRO aggregated packets had their inner checksum verified in
+	 * vxlan_gro_receive() and keep CHECKSUM_PARTIAL.
 	 */
-	if (skb->ip_summed != CHECKSUM_UNNECESSARY || !skb->encapsulation ||
-	    !(vxlan->dev->features & NETIF_F_RXCSUM))
+	if (skb->ip_summed != CHECKSUM_PARTIAL &&
+	    (skb->ip_summed != CHECKSUM_UNNECESSARY || !skb->encapsulation ||
+	     !(vxlan->dev->features & NETIF_F_RXCSUM)))
 		skb->ip_summed = CHECKSUM_NONE;
 
 	skb->encapsulation = 0;
@@ -1739,6 +1798,7 @@ static void vxlan_del_work(struct work_struct *work)
 {
 	struct vxlan_sock *vs = container_of(work, struct vxlan_sock, del_work);
 
+	udp_del_offload(&vs->udp_offloads);
 	sk_release_kernel(vs->sock->sk);
 	kfree_rcu(vs, rcu);
 }
@@ -1802,6 +1862,11 @@ static struct vxlan_sock *vxlan_socket_create(struct net *net, __be16 port,
 	/* Mark socket as an encapsulation socket. */
 	udp_sk(sk)->encap_type = 1;
 	udp_sk(sk)->encap_rcv = vxlan_udp_encap_recv;
+
+	vs->udp_offloads.port = port;
+	vs->udp_offloads.gro_receive = vxlan_gro_receive;
+	vs->udp_offloads.gro_complete = vxlan_gro_complete;
+	udp_add_offload(&vs->udp_offloads);
 	return vs;
 }
 
@@ -436,6 +436,8 @@ int ext4_claim_free_blocks(struct ext4_sb_info *sbi,
  */
 int ext4_should_retry_alloc(struct super_block *sb, int *retries)
 {
+	int ret;
+
 	if (!ext4_has_free_blocks(EXT4_SB(sb), 1, 0) ||
 	    (*retries)++ > 3 ||
 	    !EXT4_SB(sb)->s_journal)
@@ -443,7 +445,11 @@ int ext4_should_retry_alloc(struct super_block *sb, int *retries)
 
 	jbd_debug(1, "%s: retrying operation after ENOSPC\n", sb->s_id);
 
-	return jbd2_journal_force_commit_nested(EXT4_SB(sb)->s_journal);
+	ret = jbd2_journal_force_commit_nested(EXT4_SB(sb)->s_journal);
+	/* blocks freed by the commit are reusable only once discarded */
+	if (test_opt(sb, DISCARD))
+		ext4_mb_flush_discard(sb);
+	return ret;
 }
 
 /*
@@ -1141,6 +1141,8 @@ struct ext4_sb_info {
 	unsigned int s_mb_stats;
 	unsigned int s_mb_order2_reqs;
 	unsigned int s_mb_group_prealloc;
+	unsigned int s_mb_discard_batch;
+	unsigned int s_mb_discard_rate;
 	unsigned int s_max_writeback_mb_bump;
 	/* where last allocation was done - for stream allocation */
 	unsigned long s_mb_last_group;
@@ -1176,6 +1178,15 @@ struct ext4_sb_info {
 	/* workqueue for dio unwritten */
 	struct workqueue_struct *dio_unwritten_wq;
 
+	/* extents freed by committed transactions, waiting for discard */
+	struct super_block *s_sb;
+	spinlock_t s_discard_lock;
+	struct list_head s_discard_list;
+	struct work_struct s_discard_work;
+	unsigned long s_discard_window;	/* start of the rate limit second */
+	unsigned int s_discard_issued;	/* discards issued in that second */
+	atomic_t s_discard_flushers;	/* waiters that bypass the limit */
+
 	/* Lazy inode table initialization info */
 	struct ext4_li_request *s_li_request;
 	/* Wait multiplier for lazy initialization thread */
@@ -1656,6 +1667,7 @@ extern long ext4_mb_stats;
 extern long ext4_mb_max_to_scan;
 extern int ext4_mb_init(struct super_block *, int);
 extern int ext4_mb_release(struct super_block *);
+extern void ext4_mb_flush_discard(struct super_block *);
 extern ext4_fsblk_t ext4_mb_new_blocks(handle_t *,
 				struct ext4_allocation_request *, int *);
 extern int ext4_mb_reserve_blocks(struct super_block *, int);
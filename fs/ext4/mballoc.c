@@ -23,6 +23,7 @@
 
 #include "mballoc.h"
 #include <linux/debugfs.h>
+#include <linux/list_sort.h>
 #include <trace/events/ext4.h>
 
 /*
@@ -337,11 +338,13 @@
 static struct kmem_cache *ext4_pspace_cachep;
 static struct kmem_cache *ext4_ac_cachep;
 static struct kmem_cache *ext4_free_ext_cachep;
+static struct workqueue_struct *ext4_discard_wq;
 static void ext4_mb_generate_from_pa(struct super_block *sb, void *bitmap,
 					ext4_group_t group);
 static void ext4_mb_generate_from_freelist(struct super_block *sb, void *bitmap,
 						ext4_group_t group);
 static void release_blocks_on_commit(journal_t *journal, transaction_t *txn);
+static void ext4_discard_work(struct work_struct *work);
 
 static inline void *mb_correct_addr_and_bit(int *bit, void *addr)
 {
@@ -2401,6 +2404,15 @@ int ext4_mb_init(struct super_block *sb, int needs_recovery)
 	sbi->s_mb_stream_request = MB_DEFAULT_STREAM_THRESHOLD;
 	sbi->s_mb_order2_reqs = MB_DEFAULT_ORDER2_REQS;
 	sbi->s_mb_group_prealloc = MB_DEFAULT_GROUP_PREALLOC;
+	sbi->s_mb_discard_batch = MB_DEFAULT_DISCARD_BATCH;
+	sbi->s_mb_discard_rate = MB_DEFAULT_DISCARD_RATE;
+
+	spin_lock_init(&sbi->s_discard_lock);
+	INIT_LIST_HEAD(&sbi->s_discard_list);
+	INIT_WORK(&sbi->s_discard_work, ext4_discard_work);
+	sbi->s_discard_window = jiffies;
+	sbi->s_discard_issued = 0;
+	atomic_set(&sbi->s_discard_flushers, 0);
 
 	sbi->s_locality_groups = alloc_percpu(struct ext4_locality_group);
 	if (sbi->s_locality_groups == NULL) {
@@ -2452,6 +2464,9 @@ int ext4_mb_release(struct super_block *sb)
 	struct ext4_group_info *grinfo;
 	struct ext4_sb_info *sbi = EXT4_SB(sb);
 
+	/* blocks still waiting for discard are pinned in the buddy cache */
+	ext4_mb_flush_discard(sb);
+
 	if (sbi->s_proc)
 		remove_proc_entry("mb_groups", sbi->s_proc);
 
@@ -2518,28 +2533,23 @@ static inline int ext4_issue_discard(struct super_block *sb,
 }
 
 /*
- * This function is called by the jbd2 layer once the commit has finished,
- * so we know we can free the blocks that were released with that commit.
+ * Return the extents on @list to the buddy allocator and free the
+ * ext4_free_data entries.
  */
-static void release_blocks_on_commit(journal_t *journal, transaction_t *txn)
+static void ext4_free_data_list(struct super_block *sb, struct list_head *list)
 {
-	struct super_block *sb = journal->j_private;
 	struct ext4_buddy e4b;
 	struct ext4_group_info *db;
 	int err, count = 0, count2 = 0;
 	struct ext4_free_data *entry;
 	struct list_head *l, *ltmp;
 
-	list_for_each_safe(l, ltmp, &txn->t_private_list) {
+	list_for_each_safe(l, ltmp, list) {
 		entry = list_entry(l, struct ext4_free_data, list);
 
 		mb_debug(1, "gonna free %u blocks in group %u (0x%p):",
 			 entry->count, entry->group, entry);
 
-		if (test_opt(sb, DISCARD))
-			ext4_issue_discard(sb, entry->group,
-					   entry->start_blk, entry->count);
-
 		err = ext4_mb_load_buddy(sb, entry->group, &e4b);
 		/* we expect to find existing buddy because it's pinned */
 		BUG_ON(err != 0);
@@ -2577,6 +2587,164 @@ static void release_blocks_on_commit(journal_t *journal, transaction_t *txn)
 	mb_debug(1, "freed %u blocks in %u structures\n", count, count2);
 }
 
+static int ext4_free_data_cmp(void *priv, struct list_head *a,
+			      struct list_head *b)
+{
+	struct ext4_free_data *fa, *fb;
+
+	fa = list_entry(a, struct ext4_free_data, list);
+	fb = list_entry(b, struct ext4_free_data, list);
+
+	if (fa->group != fb->group)
+		return fa->group < fb->group ? -1 : 1;
+	if (fa->start_blk != fb->start_blk)
+		return fa->start_blk < fb->start_blk ? -1 : 1;
+	return 0;
+}
+
+/*
+ * Submit discards for every extent on @list, merging physically
+ * contiguous extents into a single range, and wait for all of them
+ * at once.  @list must be sorted by ext4_free_data_cmp().  Returns the
+ * number of discard requests issued.
+ */
+static unsigned int ext4_discard_data_list(struct super_block *sb,
+					   struct list_head *list)
+{
+	DECLARE_COMPLETION_ONSTACK(wait);
+	struct ext4_free_data *entry;
+	struct bio_batch bb;
+	ext4_fsblk_t start = 0, block;
+	ext4_fsblk_t len = 0;	/* merged ranges can span groups */
+	unsigned int issued = 0;
+
+	bio_batch_init(&bb, &wait);
+	list_for_each_entry(entry, list, list) {
+		block = entry->start_blk +
+			ext4_group_first_block_no(sb, entry->group);
+		if (len && block == start + len) {
+			len += entry->count;
+			continue;
+		}
+		if (len) {
+			trace_ext4_discard_blocks(sb,
+					(unsigned long long) start, len);
+			__sb_issue_discard(sb, start, len, GFP_NOFS, &bb);
+			issued++;
+		}
+		start = block;
+		len = entry->count;
+	}
+	if (len) {
+		trace_ext4_discard_blocks(sb, (unsigned long long) start, len);
+		__sb_issue_discard(sb, start, len, GFP_NOFS, &bb);
+		issued++;
+	}
+	bio_batch_wait(&bb);
+	return issued;
+}
+
+/*
+ * Charge @issued discards against s_mb_discard_rate and sleep out the
+ * rest of each second whose budget is used up.  Anyone waiting in
+ * ext4_mb_flush_discard() (ENOSPC retry, unmount) lifts the limit.
+ */
+static void ext4_discard_throttle(struct ext4_sb_info *sbi,
+				  unsigned int issued)
+{
+	unsigned int rate = sbi->s_mb_discard_rate;
+	long left;
+
+	if (!rate)
+		return;
+	if (time_after_eq(jiffies, sbi->s_discard_window + HZ)) {
+		sbi->s_discard_window = jiffies;
+		sbi->s_discard_issued = 0;
+	}
+	sbi->s_discard_issued += issued;
+	while (sbi->s_discard_issued >= rate &&
+	       !atomic_read(&sbi->s_discard_flushers)) {
+		left = (long)(sbi->s_discard_window + HZ - jiffies);
+		if (left > 0)
+			schedule_timeout_uninterruptible(left);
+		sbi->s_discard_window += HZ;
+		sbi->s_discard_issued -= rate;
+	}
+}
+
+/*
+ * Discard the extents released by committed transactions and only then
+ * hand them back to the allocator, so that a block is never reused
+ * while a discard for it is still in flight.  At most
+ * s_mb_discard_batch extents are outstanding at a time, and batches are
+ * paced by ext4_discard_throttle().
+ */
+static void ext4_discard_work(struct work_struct *work)
+{
+	struct ext4_sb_info *sbi = container_of(work, struct ext4_sb_info,
+						s_discard_work);
+	struct super_block *sb = sbi->s_sb;
+	struct ext4_free_data *entry, *tmp;
+	LIST_HEAD(pending);
+	LIST_HEAD(batch);
+	unsigned int nr, issued;
+
+	spin_lock(&sbi->s_discard_lock);
+	list_splice_init(&sbi->s_discard_list, &pending);
+	spin_unlock(&sbi->s_discard_lock);
+
+	list_sort(NULL, &pending, ext4_free_data_cmp);
+
+	while (!list_empty(&pending)) {
+		nr = 0;
+		list_for_each_entry_safe(entry, tmp, &pending, list) {
+			list_move_tail(&entry->list, &batch);
+			if (++nr >= max(sbi->s_mb_discard_batch, 1U))
+				break;
+		}
+		issued = ext4_discard_data_list(sb, &batch);
+		ext4_free_data_list(sb, &batch);
+		ext4_discard_throttle(sbi, issued);
+		cond_resched();
+	}
+}
+
+/*
+ * Wait until every extent queued for discard has been returned to the
+ * buddy allocator.
+ */
+void ext4_mb_flush_discard(struct super_block *sb)
+{
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+
+	atomic_inc(&sbi->s_discard_flushers);
+	flush_work(&sbi->s_discard_work);
+	atomic_dec(&sbi->s_discard_flushers);
+}
+
+/*
+ * This function is called by the jbd2 layer once the commit has finished,
+ * so we know we can free the blocks that were released with that commit.
+ * With -o discard the blocks are first discarded asynchronously from
+ * ext4_discard_work(), which keeps the commit path off the device.
+ */
+static void release_blocks_on_commit(journal_t *journal, transaction_t *txn)
+{
+	struct super_block *sb = journal->j_private;
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+
+	if (test_opt(sb, DISCARD) && !list_empty(&txn->t_private_list)) {
+		spin_lock(&sbi->s_discard_lock);
+		list_splice_tail_init(&txn->t_private_list,
+				      &sbi->s_discard_list);
+		spin_unlock(&sbi->s_discard_lock);
+		queue_work(ext4_discard_wq, &sbi->s_discard_work);
+		return;
+	}
+
+	ext4_free_data_list(sb, &txn->t_private_list);
+}
+
 #ifdef CONFIG_EXT4_DEBUG
 u8 mb_enable_debug __read_mostly;
 
@@ -2638,6 +2806,18 @@ int __init init_ext4_mballoc(void)
 		kmem_cache_destroy(ext4_ac_cachep);
 		return -ENOMEM;
 	}
+
+	/*
+	 * A single thread, so that flush_work() in ext4_mb_flush_discard()
+	 * sees every running instance and a work never runs on two CPUs.
+	 */
+	ext4_discard_wq = create_singlethread_workqueue("ext4-discard");
+	if (ext4_discard_wq == NULL) {
+		kmem_cache_destroy(ext4_pspace_cachep);
+		kmem_cache_destroy(ext4_ac_cachep);
+		kmem_cache_destroy(ext4_free_ext_cachep);
+		return -ENOMEM;
+	}
 	ext4_create_debugfs_entry();
 	return 0;
 }
@@ -2652,6 +2832,7 @@ void exit_ext4_mballoc(void)
 	kmem_cache_destroy(ext4_pspace_cachep);
 	kmem_cache_destroy(ext4_ac_cachep);
 	kmem_cache_destroy(ext4_free_ext_cachep);
+	destroy_workqueue(ext4_discard_wq);
 	ext4_remove_debugfs_entry();
 }
 
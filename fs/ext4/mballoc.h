@@ -95,6 +95,20 @@ extern u8 mb_enable_debug;
  */
 #define MB_DEFAULT_GROUP_PREALLOC	512
 
+/*
+ * with -o discard, how many freed extents are discarded in parallel
+ * before they are returned to the allocator
+ * (/sys/fs/ext4/<partition>/mb_discard_batch)
+ */
+#define MB_DEFAULT_DISCARD_BATCH	64
+
+/*
+ * with -o discard, how many discard requests may be sent to the device
+ * per second, 0 for no limit
+ * (/sys/fs/ext4/<partition>/mb_discard_rate)
+ */
+#define MB_DEFAULT_DISCARD_RATE		0
+
 
 struct ext4_free_data {
 	/* this links the free block information from group_info */
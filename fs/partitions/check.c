@@ -268,6 +268,32 @@ ssize_t part_inflight_show(struct device *dev,
 	return sprintf(buf, "%8u %8u\n", p->in_flight[0], p->in_flight[1]);
 }
 
+ssize_t part_latency_hist_show(struct device *dev,
+			struct device_attribute *attr, char *buf)
+{
+	struct hd_struct *p = dev_to_part(dev);
+	ssize_t len = 0;
+	int op, i;
+
+	for (op = 0; op < BLK_LAT_NR_OPS; op++) {
+		len += sprintf(buf + len, "%s", blk_lat_op_name[op]);
+		for (i = 0; i < BLK_LAT_BUCKETS; i++)
+			len += sprintf(buf + len, " %lu",
+				       part_stat_read(p, lat.hist[op][i]));
+		len += sprintf(buf + len, "\n");
+	}
+
+	return len;
+}
+
+ssize_t part_latency_hist_store(struct device *dev,
+			struct device_attribute *attr,
+			const char *buf, size_t count)
+{
+	part_stat_reset_lat(dev_to_part(dev));
+	return count;
+}
+
 #ifdef CONFIG_FAIL_MAKE_REQUEST
 ssize_t part_fail_show(struct device *dev,
 		       struct device_attribute *attr, char *buf)
@@ -299,6 +325,8 @@ static DEVICE_ATTR(discard_alignment, S_IRUGO, part_discard_alignment_show,
 		   NULL);
 static DEVICE_ATTR(stat, S_IRUGO, part_stat_show, NULL);
 static DEVICE_ATTR(inflight, S_IRUGO, part_inflight_show, NULL);
+static DEVICE_ATTR(latency_hist, S_IRUGO|S_IWUSR, part_latency_hist_show,
+		   part_latency_hist_store);
 #ifdef CONFIG_FAIL_MAKE_REQUEST
 static struct device_attribute dev_attr_fail =
 	__ATTR(make-it-fail, S_IRUGO|S_IWUSR, part_fail_show, part_fail_store);
@@ -312,6 +340,7 @@ static struct attribute *part_attrs[] = {
 	&dev_attr_discard_alignment.attr,
 	&dev_attr_stat.attr,
 	&dev_attr_inflight.attr,
+	&dev_attr_latency_hist.attr,
 #ifdef CONFIG_FAIL_MAKE_REQUEST
 	&dev_attr_fail.attr,
 #endif
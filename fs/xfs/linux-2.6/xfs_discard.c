@@ -207,30 +207,56 @@ xfs_ioc_trim(
 	return 0;
 }
 
+/*
+ * Discard the busy extents of a committed checkpoint.  The list is sorted
+ * by xfs_alloc_busy_sort(), so adjacent extents are merged into a single
+ * range and all ranges are submitted before waiting once for the whole
+ * batch, rather than waiting for each extent in turn.
+ */
 int
 xfs_discard_extents(
 	struct xfs_mount	*mp,
 	struct list_head	*list)
 {
+	DECLARE_COMPLETION_ONSTACK(wait);
+	struct block_device	*bdev = mp->m_ddev_targp->bt_bdev;
 	struct xfs_busy_extent	*busyp;
+	struct bio_batch	bb;
+	xfs_daddr_t		start = 0, daddr;
+	xfs_daddr_t		len = 0;
 	int			error = 0;
 
+	bio_batch_init(&bb, &wait);
 	list_for_each_entry(busyp, list, list) {
 		trace_xfs_discard_extent(mp, busyp->agno, busyp->bno,
 					 busyp->length);
 
-		error = -blkdev_issue_discard(mp->m_ddev_targp->bt_bdev,
-				XFS_AGB_TO_DADDR(mp, busyp->agno, busyp->bno),
-				XFS_FSB_TO_BB(mp, busyp->length),
-				GFP_NOFS, 0);
-		if (error && error != EOPNOTSUPP) {
-			xfs_info(mp,
-	 "discard failed for extent [0x%llu,%u], error %d",
-				 (unsigned long long)busyp->bno,
-				 busyp->length,
-				 error);
-			return error;
+		daddr = XFS_AGB_TO_DADDR(mp, busyp->agno, busyp->bno);
+		if (len && daddr == start + len) {
+			len += XFS_FSB_TO_BB(mp, busyp->length);
+			continue;
 		}
+		if (len) {
+			error = -__blkdev_issue_discard(bdev, start, len,
+							GFP_NOFS, 0, &bb);
+			if (error)
+				break;
+		}
+		start = daddr;
+		len = XFS_FSB_TO_BB(mp, busyp->length);
+	}
+	if (len && !error)
+		error = -__blkdev_issue_discard(bdev, start, len,
+						GFP_NOFS, 0, &bb);
+	if (!error)
+		error = -bio_batch_wait(&bb);
+	else
+		bio_batch_wait(&bb);
+
+	if (error && error != EOPNOTSUPP) {
+		xfs_info(mp, "discard failed for extents at daddr 0x%llx, error %d",
+			 (unsigned long long)start, error);
+		return error;
 	}
 
 	return 0;
@@ -65,6 +65,10 @@
 
 #define SO_RXQ_OVFL		40
 
+#define SO_BUSY_POLL		46
+
 #define SO_BPF_EXTENSIONS	48
 
+#define SO_ZEROCOPY		60
+
 #endif /* __ASM_GENERIC_SOCKET_H */
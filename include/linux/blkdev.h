@@ -190,6 +190,10 @@ struct request {
 	struct request *next_rq;
 	/* For future extensions */
 	void *pad;
+#ifndef __GENKSYMS__
+	/* when the request was accounted as queued, for latency histograms */
+	u64 stat_start_ns;
+#endif
 };
 
 static inline unsigned short req_get_ioprio(struct request *req)
@@ -252,6 +256,10 @@ struct blk_queue_tag {
 	int max_depth;			/* what we will send to device */
 	int real_max_depth;		/* what the array can hold */
 	atomic_t refcnt;		/* map can be shared */
+#ifndef __GENKSYMS__
+	struct percpu_ida *tag_pool;	/* per-cpu cached free tags */
+	unsigned long *pool_map;	/* busy tags taken from tag_pool */
+#endif
 };
 
 #define BLK_SCSI_MAX_CMDS	(256)
@@ -431,6 +439,9 @@ struct request_queue
 	struct delayed_work	delay_work;
 
 	unsigned char		sgio_type;
+
+	/* per cpu completion latency histograms, see queue/stats */
+	struct blk_lat_stats __percpu *lat_stats;
 #endif /* __GENKSYMS__ */
 };
 
@@ -1029,6 +1040,19 @@ extern int blkdev_issue_flush(struct block_device *, sector_t *);
 #define DISCARD_FL_BARRIER	0x02	/* issue DISCARD_BARRIER request */
 extern int blkdev_issue_discard(struct block_device *bdev, sector_t sector,
 		sector_t nr_sects, gfp_t gfp_mask, int flags);
+
+/* a set of bios submitted together and waited for once */
+struct bio_batch {
+	atomic_t		done;
+	unsigned long		flags;
+	struct completion	*wait;
+};
+
+extern void bio_batch_init(struct bio_batch *bb, struct completion *wait);
+extern int bio_batch_wait(struct bio_batch *bb);
+extern int __blkdev_issue_discard(struct block_device *bdev, sector_t sector,
+		sector_t nr_sects, gfp_t gfp_mask, int flags,
+		struct bio_batch *bb);
 extern int blkdev_issue_zeroout(struct block_device *bdev, sector_t sector,
 		sector_t nr_sects, gfp_t gfp_mask);
 
@@ -1039,6 +1063,14 @@ static inline int sb_issue_discard(struct super_block *sb, sector_t block,
 				    nr_blocks << (sb->s_blocksize_bits - 9),
 				    gfp_mask, flags);
 }
+static inline int __sb_issue_discard(struct super_block *sb, sector_t block,
+		sector_t nr_blocks, gfp_t gfp_mask, struct bio_batch *bb)
+{
+	return __blkdev_issue_discard(sb->s_bdev,
+				      block << (sb->s_blocksize_bits - 9),
+				      nr_blocks << (sb->s_blocksize_bits - 9),
+				      gfp_mask, 0, bb);
+}
 static inline int sb_issue_zeroout(struct super_block *sb, sector_t block,
 		sector_t nr_blocks, gfp_t gfp_mask)
 {
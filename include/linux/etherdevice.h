@@ -47,6 +47,9 @@ extern void eth_commit_mac_addr_change(struct net_device *dev, void *p);
 extern int eth_mac_addr(struct net_device *dev, void *p);
 extern int eth_change_mtu(struct net_device *dev, int new_mtu);
 extern int eth_validate_addr(struct net_device *dev);
+extern struct sk_buff **eth_gro_receive(struct sk_buff **head,
+					struct sk_buff *skb);
+extern int eth_gro_complete(struct sk_buff *skb);
 
 
 
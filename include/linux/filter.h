@@ -136,11 +136,20 @@ struct sock_fprog	/* Required for SO_ATTACH_FILTER. */
 #define SKF_LL_OFF    (-0x200000)
 
 #ifdef __KERNEL__
+struct sk_buff;
+struct sock;
+
 struct sk_filter
 {
 	atomic_t		refcnt;
 	unsigned int         	len;	/* Number of filter blocks */
 	struct rcu_head		rcu;
+#ifndef __GENKSYMS__
+	/* sk_run_filter() or the JIT compiled image of insns */
+	unsigned int		(*bpf_func)(struct sk_buff *skb,
+					    struct sock_filter *filter,
+					    int flen);
+#endif
 	struct sock_filter     	insns[0];
 };
 
@@ -149,15 +158,30 @@ static inline unsigned int sk_filter_len(const struct sk_filter *fp)
 	return fp->len * sizeof(struct sock_filter) + sizeof(*fp);
 }
 
-struct sk_buff;
-struct sock;
-
 extern int sk_filter(struct sock *sk, struct sk_buff *skb);
 extern unsigned int sk_run_filter(struct sk_buff *skb,
 				  struct sock_filter *filter, int flen);
 extern int sk_attach_filter(struct sock_fprog *fprog, struct sock *sk);
 extern int sk_detach_filter(struct sock *sk);
 extern int sk_chk_filter(struct sock_filter *filter, int flen);
+extern void *bpf_internal_load_pointer_neg_helper(const struct sk_buff *skb,
+						  int k, unsigned int size);
+
+#ifdef CONFIG_BPF_JIT
+extern void bpf_jit_compile(struct sk_filter *fp);
+extern void bpf_jit_free(struct sk_filter *fp);
+extern int bpf_jit_enable;
+#else
+static inline void bpf_jit_compile(struct sk_filter *fp)
+{
+}
+static inline void bpf_jit_free(struct sk_filter *fp)
+{
+}
+#endif
+
+#define SK_RUN_FILTER(FILTER, SKB) \
+	(*(FILTER)->bpf_func)(SKB, (FILTER)->insns, (FILTER)->len)
 
 static inline int bpf_tell_extensions(void)
 {
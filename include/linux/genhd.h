@@ -78,6 +78,27 @@ struct partition {
 	__le32 nr_sects;		/* nr of sectors in partition */
 } __attribute__((packed));
 
+/*
+ * Completion latency histograms. Bucket i counts requests which completed
+ * in [2^(i-1), 2^i) microseconds after being queued, bucket 0 those below
+ * one microsecond and the last bucket everything above.
+ */
+enum {
+	BLK_LAT_READ = 0,
+	BLK_LAT_WRITE,
+	BLK_LAT_DISCARD,
+	BLK_LAT_FLUSH,
+	BLK_LAT_NR_OPS,
+};
+
+#define BLK_LAT_BUCKETS		20
+
+struct blk_lat_stats {
+	unsigned long hist[BLK_LAT_NR_OPS][BLK_LAT_BUCKETS];
+};
+
+extern const char *const blk_lat_op_name[BLK_LAT_NR_OPS];
+
 struct disk_stats {
 	unsigned long sectors[2];	/* READs and WRITEs */
 	unsigned long ios[2];
@@ -85,6 +106,9 @@ struct disk_stats {
 	unsigned long ticks[2];
 	unsigned long io_ticks;
 	unsigned long time_in_queue;
+#ifndef __GENKSYMS__
+	struct blk_lat_stats lat;
+#endif
 };
 	
 struct hd_struct {
@@ -274,6 +298,15 @@ static inline void part_stat_set_all(struct hd_struct *part, int value)
 				sizeof(struct disk_stats));
 }
 
+static inline void part_stat_reset_lat(struct hd_struct *part)
+{
+	int i;
+
+	for_each_possible_cpu(i)
+		memset(&per_cpu_ptr(part->dkstats, i)->lat, 0,
+				sizeof(struct blk_lat_stats));
+}
+
 static inline int init_part_stats(struct hd_struct *part)
 {
 	part->dkstats = alloc_percpu(struct disk_stats);
@@ -301,6 +334,11 @@ static inline void part_stat_set_all(struct hd_struct *part, int value)
 	memset(&part->dkstats, value, sizeof(struct disk_stats));
 }
 
+static inline void part_stat_reset_lat(struct hd_struct *part)
+{
+	memset(&part->dkstats.lat, 0, sizeof(struct blk_lat_stats));
+}
+
 static inline int init_part_stats(struct hd_struct *part)
 {
 	return 1;
@@ -557,6 +595,11 @@ extern ssize_t part_stat_show(struct device *dev,
 			      struct device_attribute *attr, char *buf);
 extern ssize_t part_inflight_show(struct device *dev,
 			      struct device_attribute *attr, char *buf);
+extern ssize_t part_latency_hist_show(struct device *dev,
+			      struct device_attribute *attr, char *buf);
+extern ssize_t part_latency_hist_store(struct device *dev,
+			      struct device_attribute *attr,
+			      const char *buf, size_t count);
 #ifdef CONFIG_FAIL_MAKE_REQUEST
 extern ssize_t part_fail_show(struct device *dev,
 			      struct device_attribute *attr, char *buf);
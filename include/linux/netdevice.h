@@ -53,6 +53,7 @@
 #ifndef __GENKSYMS__
 #include <net/netprio_cgroup.h>
 #include <linux/neighbour.h>
+#include <linux/dynamic_queue_limits.h>
 #endif
 
 struct vlan_group;
@@ -360,6 +361,14 @@ struct napi_struct {
 	struct list_head	dev_list;
 	struct sk_buff		*gro_list;
 	struct sk_buff		*skb;
+#ifndef __GENKSYMS__
+	/*
+	 * Only valid once the driver called napi_hash_add(), drivers
+	 * built against the old layout never touch these.
+	 */
+	struct hlist_node	napi_hash_node;
+	unsigned int		napi_id;
+#endif
 };
 
 enum
@@ -367,6 +376,7 @@ enum
 	NAPI_STATE_SCHED,	/* Poll is scheduled */
 	NAPI_STATE_DISABLE,	/* Disable pending */
 	NAPI_STATE_NPSVC,	/* Netpoll - don't dequeue from poll_list */
+	NAPI_STATE_HASHED,	/* In NAPI hash */
 };
 
 enum gro_result {
@@ -491,10 +501,16 @@ static inline void napi_synchronize(const struct napi_struct *n)
 
 enum netdev_queue_state_t
 {
-	__QUEUE_STATE_XOFF,
+	__QUEUE_STATE_XOFF,		/* stopped by the driver */
 	__QUEUE_STATE_FROZEN,
+	__QUEUE_STATE_STACK_XOFF,	/* stopped by byte queue limits */
 };
 
+#define QUEUE_STATE_ANY_XOFF	((1 << __QUEUE_STATE_XOFF) |		\
+				 (1 << __QUEUE_STATE_STACK_XOFF))
+#define QUEUE_STATE_ANY_XOFF_OR_FROZEN	(QUEUE_STATE_ANY_XOFF |		\
+					 (1 << __QUEUE_STATE_FROZEN))
+
 struct netdev_queue {
 /*
  * read mostly part
@@ -771,6 +787,12 @@ struct netdev_fcoe_hbainfo {
  *		       struct net_device *dev, int idx)
  *	Used to add FDB entries to dump requests. Implementers should add
  *	entries to skb and update idx with the number of entries.
+ *
+ * int (*ndo_busy_poll)(struct napi_struct *dev);
+ *	Called from the socket layer to poll a napi context for new packets
+ *	without waiting for an interrupt (see SO_BUSY_POLL).  Returns the
+ *	number of packets delivered, or LL_FLUSH_FAILED/LL_FLUSH_BUSY when the
+ *	context could not be polled.  Lives in struct net_device_extended.
  */
 #define HAVE_NET_DEVICE_OPS
 struct net_device_ops {
@@ -1172,6 +1194,9 @@ struct net_device
 struct netdev_tx_queue_extended {
 	struct netdev_queue	*q;
 	struct kobject		kobj;
+#ifdef CONFIG_BQL
+	struct dql		dql;
+#endif
 };
 
 struct netdev_rps_info {
@@ -1260,6 +1285,14 @@ struct net_device_extended {
 	struct netdev_rfs_info			rfs_data;
 #define GSO_MAX_SEGS		65535
 	u16			gso_max_segs;
+#ifdef CONFIG_NET_RX_BUSY_POLL
+	int			(*ndo_busy_poll)(struct napi_struct *dev);
+#endif
+	/* Features valid for skb->encapsulation packets.  There are no
+	 * inner header marks in struct sk_buff, drivers offloading
+	 * tunnels locate the inner transport header from skb->csum_start.
+	 */
+	unsigned long		hw_enc_features;
 };
 
 #define NET_DEVICE_EXTENDED_SIZE \
@@ -1363,6 +1396,14 @@ struct netdev_queue *netdev_get_tx_queue(const struct net_device *dev,
 	return &dev->_tx[index];
 }
 
+static inline
+struct netdev_tx_queue_extended *netdev_queue_extended(const struct netdev_queue *txq)
+{
+	struct net_device *dev = txq->dev;
+
+	return netdev_extended(dev)->_tx_ext + (txq - dev->_tx);
+}
+
 static inline void netdev_for_each_tx_queue(struct net_device *dev,
 					    void (*f)(struct net_device *,
 						      struct netdev_queue *,
@@ -1469,6 +1510,25 @@ void netif_napi_add(struct net_device *dev, struct napi_struct *napi,
  */
 void netif_napi_del(struct napi_struct *napi);
 
+/**
+ *	napi_hash_add - add a NAPI to global hashtable
+ *	@napi: napi context
+ *
+ * generate a new napi_id and store a @napi under it in napi_hash
+ */
+void napi_hash_add(struct napi_struct *napi);
+
+/**
+ *	napi_hash_del - remove a NAPI from global table
+ *	@napi: napi context
+ *
+ * Warning: caller must observe rcu grace period
+ * before freeing memory containing @napi
+ */
+void napi_hash_del(struct napi_struct *napi);
+
+struct napi_struct *napi_by_id(unsigned int napi_id);
+
 struct napi_gro_cb {
 	/* Virtual address of skb_shinfo(skb)->frags[0].page + offset. */
 	void *frag0;
@@ -1490,6 +1550,17 @@ struct napi_gro_cb {
 
 	/* Free the skb? */
 	int free;
+
+	/* Offset of the header whose gro_complete handler is running,
+	 * relative to skb->data.  Encapsulation layers advance it past
+	 * their own header before completing the inner one.
+	 */
+	int nhoff;
+
+	/* Set once a tunnel header has been parsed, GSO can only undo
+	 * a single level of encapsulation.
+	 */
+	int encap_mark;
 };
 
 #define NAPI_GRO_CB(skb) ((struct napi_gro_cb *)(skb)->cb)
@@ -1569,6 +1640,8 @@ extern void		__dev_remove_pack(struct packet_type *pt);
 extern void		dev_add_offload(struct packet_offload *po);
 extern void		dev_remove_offload(struct packet_offload *po);
 extern void		__dev_remove_offload(struct packet_offload *po);
+extern struct packet_offload *gro_find_receive_by_type(__be16 type);
+extern struct packet_offload *gro_find_complete_by_type(__be16 type);
 
 extern struct net_device	*dev_get_by_flags(struct net *net, unsigned short flags,
 						  unsigned short mask);
@@ -1650,6 +1723,19 @@ static inline void *skb_gro_network_header(struct sk_buff *skb)
 	       skb_network_offset(skb);
 }
 
+/*
+ * Header of held packet @p at the position of GRO offset @off in @skb.
+ * A held napi_gro_frags packet has had its link-layer header pulled by
+ * napi_frags_finish() while the new one has not, so both are measured
+ * from the MAC header.
+ */
+static inline void *skb_gro_held_header(struct sk_buff *p,
+					const struct sk_buff *skb,
+					unsigned int off)
+{
+	return skb_mac_header(p) + (skb->data - skb_mac_header(skb)) + off;
+}
+
 static inline int dev_hard_header(struct sk_buff *skb, struct net_device *dev,
 				  unsigned short type,
 				  const void *daddr, const void *saddr,
@@ -1709,7 +1795,7 @@ extern void __netif_schedule(struct Qdisc *q);
 
 static inline void netif_schedule_queue(struct netdev_queue *txq)
 {
-	if (!test_bit(__QUEUE_STATE_XOFF, &txq->state))
+	if (!(txq->state & QUEUE_STATE_ANY_XOFF))
 		__netif_schedule(txq->qdisc);
 }
 
@@ -1829,6 +1915,126 @@ static inline int netif_tx_queue_frozen(const struct netdev_queue *dev_queue)
 	return test_bit(__QUEUE_STATE_FROZEN, &dev_queue->state);
 }
 
+/*
+ * The stack (qdisc layer, netpoll, pktgen) must use these instead of
+ * netif_tx_queue_stopped(), which only reports the driver's own flow
+ * control and not a queue stopped by byte queue limits.
+ */
+static inline bool netif_xmit_stopped(const struct netdev_queue *dev_queue)
+{
+	return dev_queue->state & QUEUE_STATE_ANY_XOFF;
+}
+
+static inline bool
+netif_xmit_frozen_or_stopped(const struct netdev_queue *dev_queue)
+{
+	return dev_queue->state & QUEUE_STATE_ANY_XOFF_OR_FROZEN;
+}
+
+/**
+ *	netdev_tx_sent_queue - report the number of bytes queued to hardware
+ *	@dev_queue: network device queue
+ *	@bytes: number of bytes queued to the hardware
+ *
+ *	Called by a driver from its ndo_start_xmit once a packet has been
+ *	posted to the transmit ring.  Stops the queue when the number of
+ *	bytes in flight exceeds the dynamic limit.
+ */
+static inline void netdev_tx_sent_queue(struct netdev_queue *dev_queue,
+					unsigned int bytes)
+{
+#ifdef CONFIG_BQL
+	struct dql *dql = &netdev_queue_extended(dev_queue)->dql;
+
+	dql_queued(dql, bytes);
+
+	if (likely(dql_avail(dql) >= 0))
+		return;
+
+	set_bit(__QUEUE_STATE_STACK_XOFF, &dev_queue->state);
+
+	/*
+	 * The XOFF flag must be set before checking the dql_avail below,
+	 * because in netdev_tx_completed_queue we update the dql_completed
+	 * before checking the XOFF flag.
+	 */
+	smp_mb();
+
+	/* check again in case another CPU has just made room avail */
+	if (unlikely(dql_avail(dql) >= 0))
+		clear_bit(__QUEUE_STATE_STACK_XOFF, &dev_queue->state);
+#endif
+}
+
+static inline void netdev_sent_queue(struct net_device *dev, unsigned int bytes)
+{
+	netdev_tx_sent_queue(netdev_get_tx_queue(dev, 0), bytes);
+}
+
+/**
+ *	netdev_tx_completed_queue - report bytes completed by hardware
+ *	@dev_queue: network device queue
+ *	@pkts: number of packets completed (currently unused)
+ *	@bytes: number of bytes completed
+ *
+ *	Called by a driver from its transmit completion handler.  Recomputes
+ *	the limit and restarts a queue that was stopped by
+ *	netdev_tx_sent_queue() once enough bytes have drained.
+ */
+static inline void netdev_tx_completed_queue(struct netdev_queue *dev_queue,
+					     unsigned int pkts,
+					     unsigned int bytes)
+{
+#ifdef CONFIG_BQL
+	struct dql *dql;
+
+	if (unlikely(!bytes))
+		return;
+
+	dql = &netdev_queue_extended(dev_queue)->dql;
+	dql_completed(dql, bytes);
+
+	/*
+	 * Without the memory barrier there is a small possiblity that
+	 * netdev_tx_sent_queue will miss the update and cause the queue to
+	 * be stopped forever
+	 */
+	smp_mb();
+
+	if (dql_avail(dql) < 0)
+		return;
+
+	if (test_and_clear_bit(__QUEUE_STATE_STACK_XOFF, &dev_queue->state))
+		netif_schedule_queue(dev_queue);
+#endif
+}
+
+static inline void netdev_completed_queue(struct net_device *dev,
+					  unsigned int pkts, unsigned int bytes)
+{
+	netdev_tx_completed_queue(netdev_get_tx_queue(dev, 0), pkts, bytes);
+}
+
+/**
+ *	netdev_tx_reset_queue - reset the byte queue limit state
+ *	@q: network device queue
+ *
+ *	Must be called whenever a driver discards its transmit ring without
+ *	reporting the completions, e.g. when cleaning up on ifdown or reset.
+ */
+static inline void netdev_tx_reset_queue(struct netdev_queue *q)
+{
+#ifdef CONFIG_BQL
+	clear_bit(__QUEUE_STATE_STACK_XOFF, &q->state);
+	dql_reset(&netdev_queue_extended(q)->dql);
+#endif
+}
+
+static inline void netdev_reset_queue(struct net_device *dev_queue)
+{
+	netdev_tx_reset_queue(netdev_get_tx_queue(dev_queue, 0));
+}
+
 /**
  *	netif_running - test if up
  *	@dev: network device
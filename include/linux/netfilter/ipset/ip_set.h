@@ -104,6 +104,9 @@ enum {
 	IPSET_ATTR_NAMEREF,
 	IPSET_ATTR_IP2,
 	IPSET_ATTR_CIDR2,
+	/* 22-23: reserved */
+	IPSET_ATTR_BYTES = IPSET_ATTR_CIDR2 + 3,	/* 24 */
+	IPSET_ATTR_PACKETS,	/* 25 */
 	__IPSET_ATTR_ADT_MAX,
 };
 #define IPSET_ATTR_ADT_MAX	(__IPSET_ATTR_ADT_MAX - 1)
@@ -148,6 +151,8 @@ enum ipset_cmd_flags {
 enum ipset_cadt_flags {
 	IPSET_FLAG_BIT_BEFORE	= 0,
 	IPSET_FLAG_BEFORE	= (1 << IPSET_FLAG_BIT_BEFORE),
+	IPSET_FLAG_BIT_WITH_COUNTERS = 3,
+	IPSET_FLAG_WITH_COUNTERS = (1 << IPSET_FLAG_BIT_WITH_COUNTERS),
 };
 
 /* Commands with settype-specific attributes */
@@ -253,6 +258,9 @@ struct ip_set_type_variant {
 	/* Return true if "b" set is the same as "a"
 	 * according to the create set parameters */
 	bool (*same_set)(const struct ip_set *a, const struct ip_set *b);
+
+	/* Kernelspace test needs rcu_read_lock_bh() only, not the set lock */
+	bool lockless_test;
 };
 
 /* The core set type structure */
@@ -375,6 +383,65 @@ ip_set_get_h16(const struct nlattr *attr)
 #define ipset_nest_start(skb, attr) nla_nest_start(skb, attr | NLA_F_NESTED)
 #define ipset_nest_end(skb, start)  nla_nest_end(skb, start)
 
+/* Packet and byte counters of an element */
+struct ip_set_counter {
+	atomic64_t bytes;
+	atomic64_t packets;
+};
+
+static inline void
+ip_set_init_counter(struct ip_set_counter *counter, u64 bytes, u64 packets)
+{
+	atomic64_set(&counter->bytes, bytes);
+	atomic64_set(&counter->packets, packets);
+}
+
+static inline void
+ip_set_copy_counter(struct ip_set_counter *dst, struct ip_set_counter *src)
+{
+	ip_set_init_counter(dst, atomic64_read(&src->bytes),
+			    atomic64_read(&src->packets));
+}
+
+static inline void
+ip_set_update_counter(struct ip_set_counter *counter,
+		      const struct sk_buff *skb)
+{
+	atomic64_add(skb->len, &counter->bytes);
+	atomic64_inc(&counter->packets);
+}
+
+/* Initial counters of an element from the userspace attributes */
+static inline int
+ip_set_get_counter(struct nlattr *tb[], struct ip_set_counter *counter)
+{
+	u64 bytes = 0, packets = 0;
+
+	if (unlikely(!ip_set_optattr_netorder(tb, IPSET_ATTR_BYTES) ||
+		     !ip_set_optattr_netorder(tb, IPSET_ATTR_PACKETS)))
+		return -IPSET_ERR_PROTOCOL;
+
+	if (tb[IPSET_ATTR_BYTES])
+		bytes = be64_to_cpu(nla_get_be64(tb[IPSET_ATTR_BYTES]));
+	if (tb[IPSET_ATTR_PACKETS])
+		packets = be64_to_cpu(nla_get_be64(tb[IPSET_ATTR_PACKETS]));
+	ip_set_init_counter(counter, bytes, packets);
+	return 0;
+}
+
+static inline bool
+ip_set_put_counter(struct sk_buff *skb, struct ip_set_counter *counter)
+{
+	NLA_PUT_NET64(skb, IPSET_ATTR_BYTES,
+		      cpu_to_be64(atomic64_read(&counter->bytes)));
+	NLA_PUT_NET64(skb, IPSET_ATTR_PACKETS,
+		      cpu_to_be64(atomic64_read(&counter->packets)));
+	return 0;
+
+nla_put_failure:
+	return 1;
+}
+
 #define NLA_PUT_IPADDR4(skb, type, ipaddr)			\
 do {								\
 	struct nlattr *__nested = ipset_nest_start(skb, type);	\
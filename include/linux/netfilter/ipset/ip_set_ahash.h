@@ -3,6 +3,8 @@
 
 #include <linux/rcupdate.h>
 #include <linux/jhash.h>
+#include <linux/bitops.h>
+#include <linux/prefetch.h>
 #include <linux/netfilter/ipset/ip_set_timeout.h>
 
 /* Hashing which uses arrays to resolve clashing. The hash table is resized
@@ -12,33 +14,47 @@
  * the timeout field must be the last one in the data structure - that field
  * is ignored when computing the hash key.
  *
- * Readers and resizing
+ * Readers and writers
+ *
+ * The kernel side test runs under rcu_read_lock_bh() only, without
+ * taking the set lock. Writers hold the set lock for writing: new
+ * elements are appended to the array of the bucket and become visible
+ * when the position of the first free entry is increased, other
+ * changes replace the whole bucket and the old one is freed after a
+ * grace period. Re-adding an existing element is the only change made in
+ * place: it stores the single word timeout and resets the atomic64
+ * counters, so a reader sees either the old or the new value of each.
  *
  * Resizing can be triggered by userspace command only, and those
  * are serialized by the nfnl mutex. During resizing the set is
  * read-locked, so the only possible concurrent operations are
- * the kernel side readers. Those must be protected by proper RCU locking.
+ * the kernel side readers.
  */
 
 /* Number of elements to store in an initial array block */
 #define AHASH_INIT_SIZE			4
 /* Max number of elements to store in an array block */
 #define AHASH_MAX_SIZE			(3*4)
+/* Number of prefix lengths looked up in one batch */
+#define AHASH_CIDR_BATCH		8
 
-/* A hash bucket */
+/* A hash bucket: the array of the values, followed by the array of
+ * the packet counters when the set has counters */
 struct hbucket {
-	void *value;		/* the array of the values */
+	struct rcu_head rcu;	/* freeing the replaced bucket */
 	u8 size;		/* size of the array */
 	u8 pos;			/* position of the first free entry */
+	unsigned char value[0]	/* the array of the values */
+		__attribute__ ((aligned(__alignof__(u64))));
 };
 
 /* The hash table: the table size stored here in order to make resizing easy */
 struct htable {
 	u8 htable_bits;		/* size of hash table == 2^htable_bits */
-	struct hbucket bucket[0]; /* hashtable buckets */
+	struct hbucket *bucket[0]; /* hashtable buckets */
 };
 
-#define hbucket(h, i)		&((h)->bucket[i])
+#define hbucket(h, i)		rcu_dereference((h)->bucket[i])
 
 /* Book-keeping of the prefixes added to the set */
 struct ip_set_hash_nets {
@@ -53,11 +69,16 @@ struct ip_set_hash {
 	u32 elements;		/* current element (vs timeout) */
 	u32 initval;		/* random jhash init value */
 	u32 timeout;		/* timeout value, if enabled */
+	bool counters;		/* packet counters per element */
+	/* counters of the element being added, set by kadt/uadt */
+	struct ip_set_counter add_counter;
 	struct timer_list gc;	/* garbage collection when timeout enabled */
 #ifdef IP_SET_HASH_WITH_NETMASK
 	u8 netmask;		/* netmask value for subnets to store */
 #endif
 #ifdef IP_SET_HASH_WITH_NETS
+	/* the cidr values in the set, for the readers */
+	unsigned long cidr_map[BITS_TO_LONGS(128 + 1)];
 	struct ip_set_hash_nets nets[0]; /* book-keeping of prefixes */
 #endif
 };
@@ -71,11 +92,11 @@ htable_size(u8 hbits)
 	if (hbits > 31)
 		return 0;
 	hsize = jhash_size(hbits);
-	if ((((size_t)-1) - sizeof(struct htable))/sizeof(struct hbucket)
+	if ((((size_t)-1) - sizeof(struct htable))/sizeof(struct hbucket *)
 	    < hsize)
 		return 0;
 
-	return hsize * sizeof(struct hbucket) + sizeof(struct htable);
+	return hsize * sizeof(struct hbucket *) + sizeof(struct htable);
 }
 
 /* Compute htable_bits from the user input parameter hashsize */
@@ -109,6 +130,8 @@ add_cidr(struct ip_set_hash *h, u8 cidr, u8 host_mask)
 	if (h->nets[cidr-1].nets > 1)
 		return;
 
+	set_bit(cidr, h->cidr_map);
+
 	/* New cidr size */
 	for (i = 0; i < host_mask && h->nets[i].cidr; i++) {
 		/* Add in increasing prefix order, so larger cidr first */
@@ -131,6 +154,8 @@ del_cidr(struct ip_set_hash *h, u8 cidr, u8 host_mask)
 	if (h->nets[cidr-1].nets != 0)
 		return;
 
+	clear_bit(cidr, h->cidr_map);
+
 	/* All entries with this cidr size deleted, so cleanup h->cidr[] */
 	for (i = 0; i < host_mask - 1 && h->nets[i].cidr; i++) {
 		if (h->nets[i].cidr == cidr)
@@ -138,21 +163,194 @@ del_cidr(struct ip_set_hash *h, u8 cidr, u8 host_mask)
 	}
 	h->nets[i - 1].cidr = 0;
 }
+
+/* Collect the cidr values in the set for the readers, larger cidr first.
+ * The nets[] array is reordered in place by the writers, the bitmap
+ * changes one bit at a time, so concurrent readers can't miss a cidr
+ * value which is not being added or deleted. */
+static int
+ahash_cidrs(const struct ip_set_hash *h, u8 *cidrs, u8 host_mask)
+{
+	unsigned long word;
+	int i, bit, nr = 0;
+
+	for (i = BITS_TO_LONGS(host_mask + 1) - 1; i >= 0; i--) {
+		word = ACCESS_ONCE(h->cidr_map[i]);
+		while (word) {
+			bit = __fls(word);
+			word &= ~(1UL << bit);
+			cidrs[nr++] = i * BITS_PER_LONG + bit;
+		}
+	}
+	return nr;
+}
 #endif
 
+/* Size of the array of the values in a bucket, rounded up for the
+ * counters following it */
+static inline size_t
+ahash_values_size(u8 size, size_t dsize)
+{
+	return ALIGN(size * dsize, __alignof__(u64));
+}
+
+#define ahash_value(n, i, dsize)	\
+	((void *)((n)->value + (i) * (dsize)))
+
+static inline struct ip_set_counter *
+ahash_counter(const struct hbucket *n, u8 i, size_t dsize)
+{
+	return (struct ip_set_counter *)
+		((void *)n->value + ahash_values_size(n->size, dsize)) + i;
+}
+
+static struct hbucket *
+ahash_bucket_alloc(u8 size, size_t dsize, bool counters)
+{
+	size_t len = sizeof(struct hbucket) + ahash_values_size(size, dsize);
+
+	if (counters)
+		len += size * sizeof(struct ip_set_counter);
+	return kzalloc(len, GFP_ATOMIC);
+}
+
+static void
+ahash_bucket_rcu_free(struct rcu_head *head)
+{
+	kfree(container_of(head, struct hbucket, rcu));
+}
+
+/* Publish the new bucket n (or none) at index i and free the old one
+ * when the readers are done with it */
+static void
+ahash_bucket_replace(struct htable *t, u32 i, struct hbucket *n)
+{
+	struct hbucket *old = t->bucket[i];
+
+	rcu_assign_pointer(t->bucket[i], n);
+	if (old)
+		call_rcu_bh(&old->rcu, ahash_bucket_rcu_free);
+}
+
+/* Copy the element at position i of src to position j of dst */
+static void
+ahash_bucket_copy(struct hbucket *dst, u8 j, const struct hbucket *src, u8 i,
+		  size_t dsize, bool counters)
+{
+	memcpy(ahash_value(dst, j, dsize), ahash_value(src, i, dsize), dsize);
+	if (counters)
+		ip_set_copy_counter(ahash_counter(dst, j, dsize),
+				    ahash_counter(src, i, dsize));
+}
+
+/* Number of the elements in a bucket, as seen by the readers */
+static inline u8
+ahash_bucket_pos(const struct hbucket *n)
+{
+	u8 pos = ACCESS_ONCE(n->pos);
+
+	/* Pairs with smp_wmb() in ahash_bucket_append() */
+	smp_rmb();
+	return pos;
+}
+
+/* Add an element to bucket i: in place when there is room in the array,
+ * otherwise by replacing the bucket with a larger one. The element
+ * starts with the given counters, if the set has counters. Returns the
+ * position of the element or the error code. */
+static int
+ahash_bucket_append(struct htable *t, u32 i, const void *value,
+		    size_t dsize, struct ip_set_counter *counter)
+{
+	struct hbucket *n = t->bucket[i], *tmp;
+	bool counters = counter != NULL;
+	u8 j;
+
+	if (n && n->pos < n->size) {
+		memcpy(ahash_value(n, n->pos, dsize), value, dsize);
+		if (counters)
+			ip_set_copy_counter(ahash_counter(n, n->pos, dsize),
+					    counter);
+		/* The element must be complete before the readers see it */
+		smp_wmb();
+		return n->pos++;
+	}
+	if (n && n->size >= AHASH_MAX_SIZE)
+		/* Trigger rehashing */
+		return -EAGAIN;
+
+	tmp = ahash_bucket_alloc((n ? n->size : 0) + AHASH_INIT_SIZE,
+				 dsize, counters);
+	if (!tmp)
+		return -ENOMEM;
+	for (j = 0; n && j < n->pos; j++)
+		ahash_bucket_copy(tmp, tmp->pos++, n, j, dsize, counters);
+	memcpy(ahash_value(tmp, tmp->pos, dsize), value, dsize);
+	if (counters)
+		ip_set_copy_counter(ahash_counter(tmp, tmp->pos, dsize),
+				    counter);
+	tmp->pos++;
+	ahash_bucket_replace(t, i, tmp);
+
+	return tmp->pos - 1;
+}
+
+/* Replace the element at position j of bucket i with a new one */
+static int
+ahash_bucket_set(struct htable *t, u32 i, u8 j, const void *value,
+		 size_t dsize, struct ip_set_counter *counter)
+{
+	struct hbucket *n = t->bucket[i], *tmp;
+	bool counters = counter != NULL;
+	u8 k;
+
+	tmp = ahash_bucket_alloc(n->size, dsize, counters);
+	if (!tmp)
+		return -ENOMEM;
+	for (k = 0; k < n->pos; k++)
+		if (k != j)
+			ahash_bucket_copy(tmp, k, n, k, dsize, counters);
+	memcpy(ahash_value(tmp, j, dsize), value, dsize);
+	if (counters)
+		ip_set_copy_counter(ahash_counter(tmp, j, dsize), counter);
+	tmp->pos = n->pos;
+	ahash_bucket_replace(t, i, tmp);
+
+	return 0;
+}
+
+/* Delete the element at position j of bucket i: replace the bucket
+ * with a copy without the element and free up space if possible */
+static int
+ahash_bucket_del(struct htable *t, u32 i, u8 j, size_t dsize, bool counters)
+{
+	struct hbucket *n = t->bucket[i], *tmp = NULL;
+	u8 k, size = n->size;
+
+	if (n->pos > 1) {
+		if (n->pos - 1 + AHASH_INIT_SIZE < size)
+			size -= AHASH_INIT_SIZE;
+		tmp = ahash_bucket_alloc(size, dsize, counters);
+		if (!tmp)
+			return -ENOMEM;
+		for (k = 0; k < n->pos; k++)
+			if (k != j)
+				ahash_bucket_copy(tmp, tmp->pos++, n, k,
+						  dsize, counters);
+	}
+	ahash_bucket_replace(t, i, tmp);
+
+	return 0;
+}
+
 /* Destroy the hashtable part of the set */
 static void
 ahash_destroy(struct htable *t)
 {
-	struct hbucket *n;
 	u32 i;
 
-	for (i = 0; i < jhash_size(t->htable_bits); i++) {
-		n = hbucket(t, i);
-		if (n->size)
-			/* FIXME: use slab cache */
-			kfree(n->value);
-	}
+	for (i = 0; i < jhash_size(t->htable_bits); i++)
+		kfree(t->bucket[i]);
 
 	ip_set_free(t);
 }
@@ -163,15 +361,22 @@ ahash_memsize(const struct ip_set_hash *h, size_t dsize, u8 host_mask)
 {
 	u32 i;
 	struct htable *t = h->table;
+	struct hbucket *n;
 	size_t memsize = sizeof(*h)
 			 + sizeof(*t)
 #ifdef IP_SET_HASH_WITH_NETS
 			 + sizeof(struct ip_set_hash_nets) * host_mask
 #endif
-			 + jhash_size(t->htable_bits) * sizeof(struct hbucket);
+			 + jhash_size(t->htable_bits) * sizeof(struct hbucket *);
 
-	for (i = 0; i < jhash_size(t->htable_bits); i++)
-			memsize += t->bucket[i].size * dsize;
+	for (i = 0; i < jhash_size(t->htable_bits); i++) {
+		n = t->bucket[i];
+		if (!n)
+			continue;
+		memsize += sizeof(*n) + ahash_values_size(n->size, dsize);
+		if (h->counters)
+			memsize += n->size * sizeof(struct ip_set_counter);
+	}
 
 	return memsize;
 }
@@ -182,18 +387,13 @@ ip_set_hash_flush(struct ip_set *set)
 {
 	struct ip_set_hash *h = set->data;
 	struct htable *t = h->table;
-	struct hbucket *n;
 	u32 i;
 
-	for (i = 0; i < jhash_size(t->htable_bits); i++) {
-		n = hbucket(t, i);
-		if (n->size) {
-			n->size = n->pos = 0;
-			/* FIXME: use slab cache */
-			kfree(n->value);
-		}
-	}
+	for (i = 0; i < jhash_size(t->htable_bits); i++)
+		if (t->bucket[i])
+			ahash_bucket_replace(t, i, NULL);
 #ifdef IP_SET_HASH_WITH_NETS
+	bitmap_zero(h->cidr_map, SET_HOST_MASK(set->family) + 1);
 	memset(h->nets, 0, sizeof(struct ip_set_hash_nets)
 			   * SET_HOST_MASK(set->family));
 #endif
@@ -240,18 +440,20 @@ ip_set_hash_destroy(struct ip_set *set)
 #define type_pf_data_expired	TOKEN(TYPE, PF, _data_expired)
 #define type_pf_data_timeout_set TOKEN(TYPE, PF, _data_timeout_set)
 
-#define type_pf_elem_add	TOKEN(TYPE, PF, _elem_add)
+#define type_pf_find_in		TOKEN(TYPE, PF, _find_in)
+#define type_pf_find		TOKEN(TYPE, PF, _find)
+#define type_pf_find_cidrs	TOKEN(TYPE, PF, _find_cidrs)
+#define type_pf_rehash		TOKEN(TYPE, PF, _rehash)
+#define type_pf_list_counter	TOKEN(TYPE, PF, _list_counter)
+
 #define type_pf_add		TOKEN(TYPE, PF, _add)
 #define type_pf_del		TOKEN(TYPE, PF, _del)
-#define type_pf_test_cidrs	TOKEN(TYPE, PF, _test_cidrs)
 #define type_pf_test		TOKEN(TYPE, PF, _test)
+#define type_pf_ctest		TOKEN(TYPE, PF, _ctest)
 
-#define type_pf_elem_tadd	TOKEN(TYPE, PF, _elem_tadd)
-#define type_pf_del_telem	TOKEN(TYPE, PF, _ahash_del_telem)
 #define type_pf_expire		TOKEN(TYPE, PF, _expire)
 #define type_pf_tadd		TOKEN(TYPE, PF, _tadd)
 #define type_pf_tdel		TOKEN(TYPE, PF, _tdel)
-#define type_pf_ttest_cidrs	TOKEN(TYPE, PF, _ahash_ttest_cidrs)
 #define type_pf_ttest		TOKEN(TYPE, PF, _ahash_ttest)
 
 #define type_pf_resize		TOKEN(TYPE, PF, _resize)
@@ -269,54 +471,150 @@ ip_set_hash_destroy(struct ip_set *set)
 #define type_pf_variant		TOKEN(TYPE, PF, _variant)
 #define type_pf_tvariant	TOKEN(TYPE, PF, _tvariant)
 
-/* Flavour without timeout */
-
 /* Get the ith element from the array block n */
 #define ahash_data(n, i)	\
-	((struct type_pf_elem *)((n)->value) + (i))
+	((struct type_pf_elem *)ahash_value(n, i, sizeof(struct type_pf_elem)))
+#define ahash_tdata(n, i)	\
+	((struct type_pf_elem *)ahash_value(n, i, sizeof(struct type_pf_telem)))
 
-/* Add an element to the hash table when resizing the set:
- * we spare the maintenance of the internal counters. */
-static int
-type_pf_elem_add(struct hbucket *n, const struct type_pf_elem *value)
+static inline u32
+type_pf_data_timeout(const struct type_pf_elem *data)
 {
-	if (n->pos >= n->size) {
-		void *tmp;
+	const struct type_pf_telem *tdata =
+		(const struct type_pf_telem *) data;
 
-		if (n->size >= AHASH_MAX_SIZE)
-			/* Trigger rehashing */
-			return -EAGAIN;
+	return tdata->timeout;
+}
 
-		tmp = kzalloc((n->size + AHASH_INIT_SIZE)
-			      * sizeof(struct type_pf_elem),
-			      GFP_ATOMIC);
-		if (!tmp)
-			return -ENOMEM;
-		if (n->size) {
-			memcpy(tmp, n->value,
-			       sizeof(struct type_pf_elem) * n->size);
-			kfree(n->value);
+static inline bool
+type_pf_data_expired(const struct type_pf_elem *data)
+{
+	const struct type_pf_telem *tdata =
+		(const struct type_pf_telem *) data;
+
+	return ip_set_timeout_expired(tdata->timeout);
+}
+
+static inline void
+type_pf_data_timeout_set(struct type_pf_elem *data, u32 timeout)
+{
+	struct type_pf_telem *tdata = (struct type_pf_telem *) data;
+
+	tdata->timeout = ip_set_timeout_set(timeout);
+}
+
+/* Lookup functions shared by both flavours: dsize is the size of
+ * the stored elements, expired elements are skipped when timeout is set */
+
+static bool
+type_pf_find_in(const struct hbucket *n, const struct type_pf_elem *d,
+		size_t dsize, bool timeout, int *pos)
+{
+	const struct type_pf_elem *data;
+	u8 i, size = ahash_bucket_pos(n);
+
+	for (i = 0; i < size; i++) {
+		data = ahash_value(n, i, dsize);
+		if (!type_pf_data_equal(data, d))
+			continue;
+		if (timeout && type_pf_data_expired(data))
+			return false;
+		*pos = i;
+		return true;
+	}
+	return false;
+}
+
+static struct hbucket *
+type_pf_find(const struct ip_set_hash *h, const struct htable *t,
+	     const struct type_pf_elem *d, size_t dsize, bool timeout,
+	     int *pos)
+{
+	struct hbucket *n = hbucket(t, HKEY(d, h->initval, t->htable_bits));
+
+	if (n && type_pf_find_in(n, d, dsize, timeout, pos))
+		return n;
+	return NULL;
+}
+
+#ifdef IP_SET_HASH_WITH_NETS
+/* Special lookup function which takes into account the different network
+ * sizes added to the set. The buckets of a batch of network sizes are
+ * looked up and prefetched before any of them is searched, so that the
+ * cache misses overlap instead of following each other. */
+static struct hbucket *
+type_pf_find_cidrs(const struct ip_set_hash *h, const struct htable *t,
+		   struct type_pf_elem *d, size_t dsize, bool timeout,
+		   int *pos)
+{
+	struct type_pf_elem m = *d;
+	struct hbucket *n[AHASH_CIDR_BATCH];
+	u8 cidrs[HOST_MASK];
+	int nr, i, j, k;
+
+	pr_debug("test by nets\n");
+	nr = ahash_cidrs(h, cidrs, HOST_MASK);
+	for (i = 0; i < nr; i += AHASH_CIDR_BATCH) {
+		k = min_t(int, nr - i, AHASH_CIDR_BATCH);
+		for (j = 0; j < k; j++) {
+			type_pf_data_netmask(&m, cidrs[i + j]);
+			n[j] = hbucket(t, HKEY(&m, h->initval,
+					       t->htable_bits));
+			if (n[j])
+				prefetch(n[j]);
+		}
+		for (j = 0; j < k; j++) {
+			type_pf_data_netmask(d, cidrs[i + j]);
+			if (n[j] &&
+			    type_pf_find_in(n[j], d, dsize, timeout, pos))
+				return n[j];
 		}
-		n->value = tmp;
-		n->size += AHASH_INIT_SIZE;
 	}
-	type_pf_data_copy(ahash_data(n, n->pos++), value);
-	return 0;
+	return NULL;
+}
+#endif
+
+/* Kernel side test of a set with counters: account the packet to
+ * the matching element. The counters of a bucket which is being
+ * replaced concurrently may miss the packet. */
+static inline int
+type_pf_ctest(struct ip_set *set, struct type_pf_elem *d,
+	      const struct sk_buff *skb)
+{
+	const struct ip_set_hash *h = set->data;
+	const struct htable *t = rcu_dereference(h->table);
+	bool timeout = with_timeout(h->timeout);
+	size_t dsize = timeout ? sizeof(struct type_pf_telem)
+			       : sizeof(struct type_pf_elem);
+	struct hbucket *n;
+	int i;
+
+#ifdef IP_SET_HASH_WITH_NETS
+	if (d->cidr == SET_HOST_MASK(set->family))
+		n = type_pf_find_cidrs(h, t, d, dsize, timeout, &i);
+	else
+#endif
+		n = type_pf_find(h, t, d, dsize, timeout, &i);
+	if (!n)
+		return 0;
+
+	ip_set_update_counter(ahash_counter(n, i, dsize), skb);
+	return 1;
 }
 
 /* Resize a hash: create a new hash table with doubling the hashsize
  * and inserting the elements to it. Repeat until we succeed or
  * fail due to memory pressures. */
 static int
-type_pf_resize(struct ip_set *set, bool retried)
+type_pf_rehash(struct ip_set *set, size_t dsize)
 {
 	struct ip_set_hash *h = set->data;
 	struct htable *t, *orig = h->table;
 	u8 htable_bits = orig->htable_bits;
 	const struct type_pf_elem *data;
-	struct hbucket *n, *m;
-	u32 i, j;
-	int ret;
+	struct hbucket *n;
+	u32 i, key;
+	int j, ret;
 
 retry:
 	ret = 0;
@@ -327,18 +625,20 @@ retry:
 		/* In case we have plenty of memory :-) */
 		return -IPSET_ERR_HASH_FULL;
 	t = ip_set_alloc(sizeof(*t)
-			 + jhash_size(htable_bits) * sizeof(struct hbucket));
+			 + jhash_size(htable_bits) * sizeof(struct hbucket *));
 	if (!t)
 		return -ENOMEM;
 	t->htable_bits = htable_bits;
 
 	read_lock_bh(&set->lock);
 	for (i = 0; i < jhash_size(orig->htable_bits); i++) {
-		n = hbucket(orig, i);
-		for (j = 0; j < n->pos; j++) {
-			data = ahash_data(n, j);
-			m = hbucket(t, HKEY(data, h->initval, htable_bits));
-			ret = type_pf_elem_add(m, data);
+		n = orig->bucket[i];
+		for (j = 0; n && j < n->pos; j++) {
+			data = ahash_value(n, j, dsize);
+			key = HKEY(data, h->initval, htable_bits);
+			ret = ahash_bucket_append(t, key, data, dsize,
+				h->counters ? ahash_counter(n, j, dsize)
+					    : NULL);
 			if (ret < 0) {
 				read_unlock_bh(&set->lock);
 				ahash_destroy(t);
@@ -362,47 +662,59 @@ retry:
 	return 0;
 }
 
+static bool
+type_pf_list_counter(const struct ip_set_hash *h, struct sk_buff *skb,
+		     const struct hbucket *n, u8 i, size_t dsize)
+{
+	return h->counters &&
+	       ip_set_put_counter(skb, ahash_counter(n, i, dsize));
+}
+
+/* Flavour without timeout */
+
+static int
+type_pf_resize(struct ip_set *set, bool retried)
+{
+	return type_pf_rehash(set, sizeof(struct type_pf_elem));
+}
+
 /* Add an element to a hash and update the internal counters when succeeded,
  * otherwise report the proper error code. */
 static int
 type_pf_add(struct ip_set *set, void *value, u32 timeout, u32 flags)
 {
 	struct ip_set_hash *h = set->data;
-	struct htable *t;
+	struct htable *t = h->table;
 	const struct type_pf_elem *d = value;
+	struct type_pf_elem e;
 	struct hbucket *n;
-	int i, ret = 0;
+	int i, ret;
 	u32 key;
 
 	if (h->elements >= h->maxelem)
 		return -IPSET_ERR_HASH_FULL;
 
-	rcu_read_lock_bh();
-	t = rcu_dereference(h->table);
 	key = HKEY(value, h->initval, t->htable_bits);
-	n = hbucket(t, key);
-	for (i = 0; i < n->pos; i++)
-		if (type_pf_data_equal(ahash_data(n, i), d)) {
-			ret = -IPSET_ERR_EXIST;
-			goto out;
-		}
+	n = t->bucket[key];
+	for (i = 0; n && i < n->pos; i++)
+		if (type_pf_data_equal(ahash_data(n, i), d))
+			return -IPSET_ERR_EXIST;
 
-	ret = type_pf_elem_add(n, value);
-	if (ret != 0)
-		goto out;
+	memset(&e, 0, sizeof(e));
+	type_pf_data_copy(&e, d);
+	ret = ahash_bucket_append(t, key, &e, sizeof(e),
+				  h->counters ? &h->add_counter : NULL);
+	if (ret < 0)
+		return ret;
 
 #ifdef IP_SET_HASH_WITH_NETS
 	add_cidr(h, d->cidr, HOST_MASK);
 #endif
 	h->elements++;
-out:
-	rcu_read_unlock_bh();
-	return ret;
+	return 0;
 }
 
-/* Delete an element from the hash: swap it with the last element
- * and free up space if possible.
- */
+/* Delete an element from the hash */
 static int
 type_pf_del(struct ip_set *set, void *value, u32 timeout, u32 flags)
 {
@@ -410,100 +722,48 @@ type_pf_del(struct ip_set *set, void *value, u32 timeout, u32 flags)
 	struct htable *t = h->table;
 	const struct type_pf_elem *d = value;
 	struct hbucket *n;
-	int i;
-	struct type_pf_elem *data;
+	int i, ret;
 	u32 key;
 
 	key = HKEY(value, h->initval, t->htable_bits);
-	n = hbucket(t, key);
-	for (i = 0; i < n->pos; i++) {
-		data = ahash_data(n, i);
-		if (!type_pf_data_equal(data, d))
+	n = t->bucket[key];
+	for (i = 0; n && i < n->pos; i++) {
+		if (!type_pf_data_equal(ahash_data(n, i), d))
 			continue;
-		if (i != n->pos - 1)
-			/* Not last one */
-			type_pf_data_copy(data, ahash_data(n, n->pos - 1));
+		ret = ahash_bucket_del(t, key, i, sizeof(struct type_pf_elem),
+				       h->counters);
+		if (ret)
+			return ret;
 
-		n->pos--;
 		h->elements--;
 #ifdef IP_SET_HASH_WITH_NETS
 		del_cidr(h, d->cidr, HOST_MASK);
 #endif
-		if (n->pos + AHASH_INIT_SIZE < n->size) {
-			void *tmp = kzalloc((n->size - AHASH_INIT_SIZE)
-					    * sizeof(struct type_pf_elem),
-					    GFP_ATOMIC);
-			if (!tmp)
-				return 0;
-			n->size -= AHASH_INIT_SIZE;
-			memcpy(tmp, n->value,
-			       n->size * sizeof(struct type_pf_elem));
-			kfree(n->value);
-			n->value = tmp;
-		}
 		return 0;
 	}
 
 	return -IPSET_ERR_EXIST;
 }
 
-#ifdef IP_SET_HASH_WITH_NETS
-
-/* Special test function which takes into account the different network
- * sizes added to the set */
-static int
-type_pf_test_cidrs(struct ip_set *set, struct type_pf_elem *d, u32 timeout)
-{
-	struct ip_set_hash *h = set->data;
-	struct htable *t = h->table;
-	struct hbucket *n;
-	const struct type_pf_elem *data;
-	int i, j = 0;
-	u32 key;
-	u8 host_mask = SET_HOST_MASK(set->family);
-
-	pr_debug("test by nets\n");
-	for (; j < host_mask && h->nets[j].cidr; j++) {
-		type_pf_data_netmask(d, h->nets[j].cidr);
-		key = HKEY(d, h->initval, t->htable_bits);
-		n = hbucket(t, key);
-		for (i = 0; i < n->pos; i++) {
-			data = ahash_data(n, i);
-			if (type_pf_data_equal(data, d))
-				return 1;
-		}
-	}
-	return 0;
-}
-#endif
-
 /* Test whether the element is added to the set */
 static int
 type_pf_test(struct ip_set *set, void *value, u32 timeout, u32 flags)
 {
 	struct ip_set_hash *h = set->data;
-	struct htable *t = h->table;
+	struct htable *t = rcu_dereference(h->table);
 	struct type_pf_elem *d = value;
-	struct hbucket *n;
-	const struct type_pf_elem *data;
 	int i;
-	u32 key;
 
 #ifdef IP_SET_HASH_WITH_NETS
 	/* If we test an IP address and not a network address,
 	 * try all possible network sizes */
 	if (d->cidr == SET_HOST_MASK(set->family))
-		return type_pf_test_cidrs(set, d, timeout);
+		return type_pf_find_cidrs(h, t, d, sizeof(struct type_pf_elem),
+					  false, &i) != NULL;
 #endif
 
-	key = HKEY(d, h->initval, t->htable_bits);
-	n = hbucket(t, key);
-	for (i = 0; i < n->pos; i++) {
-		data = ahash_data(n, i);
-		if (type_pf_data_equal(data, d))
-			return 1;
-	}
-	return 0;
+	return type_pf_find(h, t, d, sizeof(struct type_pf_elem),
+			    false, &i) != NULL;
 }
 
 /* Reply a HEADER request: fill out the header part of the set */
@@ -535,6 +795,9 @@ type_pf_head(struct ip_set *set, struct sk_buff *skb)
 	NLA_PUT_NET32(skb, IPSET_ATTR_MEMSIZE, htonl(memsize));
 	if (with_timeout(h->timeout))
 		NLA_PUT_NET32(skb, IPSET_ATTR_TIMEOUT, htonl(h->timeout));
+	if (h->counters)
+		NLA_PUT_NET32(skb, IPSET_ATTR_CADT_FLAGS,
+			      htonl(IPSET_FLAG_WITH_COUNTERS));
 	ipset_nest_end(skb, nested);
 
 	return 0;
@@ -563,9 +826,9 @@ type_pf_list(const struct ip_set *set,
 	pr_debug("list hash set %s\n", set->name);
 	for (; cb->args[2] < jhash_size(t->htable_bits); cb->args[2]++) {
 		incomplete = skb_tail_pointer(skb);
-		n = hbucket(t, cb->args[2]);
+		n = t->bucket[cb->args[2]];
 		pr_debug("cb->args[2]: %lu, t %p n %p\n", cb->args[2], t, n);
-		for (i = 0; i < n->pos; i++) {
+		for (i = 0; n && i < n->pos; i++) {
 			data = ahash_data(n, i);
 			pr_debug("list hash %lu hbucket %p i %u, data %p\n",
 				 cb->args[2], n, i, data);
@@ -577,7 +840,9 @@ type_pf_list(const struct ip_set *set,
 				} else
 					goto nla_put_failure;
 			}
-			if (type_pf_data_list(skb, data))
+			if (type_pf_data_list(skb, data) ||
+			    type_pf_list_counter(h, skb, n, i,
+						 sizeof(struct type_pf_elem)))
 				goto nla_put_failure;
 			ipset_nest_end(skb, nested);
 		}
@@ -621,111 +886,58 @@ static const struct ip_set_type_variant type_pf_variant = {
 	.list	= type_pf_list,
 	.resize	= type_pf_resize,
 	.same_set = type_pf_same_set,
+	.lockless_test = true,
 };
 
 /* Flavour with timeout support */
 
-#define ahash_tdata(n, i) \
-	(struct type_pf_elem *)((struct type_pf_telem *)((n)->value) + (i))
-
-static inline u32
-type_pf_data_timeout(const struct type_pf_elem *data)
-{
-	const struct type_pf_telem *tdata =
-		(const struct type_pf_telem *) data;
-
-	return tdata->timeout;
-}
-
-static inline bool
-type_pf_data_expired(const struct type_pf_elem *data)
-{
-	const struct type_pf_telem *tdata =
-		(const struct type_pf_telem *) data;
-
-	return ip_set_timeout_expired(tdata->timeout);
-}
-
-static inline void
-type_pf_data_timeout_set(struct type_pf_elem *data, u32 timeout)
-{
-	struct type_pf_telem *tdata = (struct type_pf_telem *) data;
-
-	tdata->timeout = ip_set_timeout_set(timeout);
-}
-
-static int
-type_pf_elem_tadd(struct hbucket *n, const struct type_pf_elem *value,
-		  u32 timeout)
-{
-	struct type_pf_elem *data;
-
-	if (n->pos >= n->size) {
-		void *tmp;
-
-		if (n->size >= AHASH_MAX_SIZE)
-			/* Trigger rehashing */
-			return -EAGAIN;
-
-		tmp = kzalloc((n->size + AHASH_INIT_SIZE)
-			      * sizeof(struct type_pf_telem),
-			      GFP_ATOMIC);
-		if (!tmp)
-			return -ENOMEM;
-		if (n->size) {
-			memcpy(tmp, n->value,
-			       sizeof(struct type_pf_telem) * n->size);
-			kfree(n->value);
-		}
-		n->value = tmp;
-		n->size += AHASH_INIT_SIZE;
-	}
-	data = ahash_tdata(n, n->pos++);
-	type_pf_data_copy(data, value);
-	type_pf_data_timeout_set(data, timeout);
-	return 0;
-}
-
 /* Delete expired elements from the hashtable */
 static void
 type_pf_expire(struct ip_set_hash *h)
 {
 	struct htable *t = h->table;
-	struct hbucket *n;
+	struct hbucket *n, *tmp;
 	struct type_pf_elem *data;
 	u32 i;
-	int j;
+	u8 j, expired, size;
 
 	for (i = 0; i < jhash_size(t->htable_bits); i++) {
-		n = hbucket(t, i);
+		n = t->bucket[i];
+		if (!n)
+			continue;
+		for (expired = 0, j = 0; j < n->pos; j++)
+			if (type_pf_data_expired(ahash_tdata(n, j)))
+				expired++;
+		if (!expired)
+			continue;
+
+		tmp = NULL;
+		if (expired < n->pos) {
+			size = n->size;
+			if (n->pos - expired + AHASH_INIT_SIZE < size)
+				size -= AHASH_INIT_SIZE;
+			tmp = ahash_bucket_alloc(size,
+						 sizeof(struct type_pf_telem),
+						 h->counters);
+			if (!tmp)
+				/* Try again at the next run */
+				continue;
+		}
 		for (j = 0; j < n->pos; j++) {
 			data = ahash_tdata(n, j);
-			if (type_pf_data_expired(data)) {
-				pr_debug("expired %u/%u\n", i, j);
+			if (!type_pf_data_expired(data)) {
+				ahash_bucket_copy(tmp, tmp->pos++, n, j,
+						  sizeof(struct type_pf_telem),
+						  h->counters);
+				continue;
+			}
+			pr_debug("expired %u/%u\n", i, j);
 #ifdef IP_SET_HASH_WITH_NETS
-				del_cidr(h, data->cidr, HOST_MASK);
+			del_cidr(h, data->cidr, HOST_MASK);
 #endif
-				if (j != n->pos - 1)
-					/* Not last one */
-					type_pf_data_copy(data,
-						ahash_tdata(n, n->pos - 1));
-				n->pos--;
-				h->elements--;
-			}
-		}
-		if (n->pos + AHASH_INIT_SIZE < n->size) {
-			void *tmp = kzalloc((n->size - AHASH_INIT_SIZE)
-					    * sizeof(struct type_pf_telem),
-					    GFP_ATOMIC);
-			if (!tmp)
-				/* Still try to delete expired elements */
-				continue;
-			n->size -= AHASH_INIT_SIZE;
-			memcpy(tmp, n->value,
-			       n->size * sizeof(struct type_pf_telem));
-			kfree(n->value);
-			n->value = tmp;
+			h->elements--;
 		}
+		ahash_bucket_replace(t, i, tmp);
 	}
 }
 
@@ -733,12 +945,7 @@ static int
 type_pf_tresize(struct ip_set *set, bool retried)
 {
 	struct ip_set_hash *h = set->data;
-	struct htable *t, *orig = h->table;
-	u8 htable_bits = orig->htable_bits;
-	const struct type_pf_elem *data;
-	struct hbucket *n, *m;
-	u32 i, j;
-	int ret;
+	u32 i;
 
 	/* Try to cleanup once */
 	if (!retried) {
@@ -750,45 +957,7 @@ type_pf_tresize(struct ip_set *set, bool retried)
 			return 0;
 	}
 
-retry:
-	ret = 0;
-	htable_bits++;
-	if (!htable_bits)
-		/* In case we have plenty of memory :-) */
-		return -IPSET_ERR_HASH_FULL;
-	t = ip_set_alloc(sizeof(*t)
-			 + jhash_size(htable_bits) * sizeof(struct hbucket));
-	if (!t)
-		return -ENOMEM;
-	t->htable_bits = htable_bits;
-
-	read_lock_bh(&set->lock);
-	for (i = 0; i < jhash_size(orig->htable_bits); i++) {
-		n = hbucket(orig, i);
-		for (j = 0; j < n->pos; j++) {
-			data = ahash_tdata(n, j);
-			m = hbucket(t, HKEY(data, h->initval, htable_bits));
-			ret = type_pf_elem_tadd(m, data,
-						type_pf_data_timeout(data));
-			if (ret < 0) {
-				read_unlock_bh(&set->lock);
-				ahash_destroy(t);
-				if (ret == -EAGAIN)
-					goto retry;
-				return ret;
-			}
-		}
-	}
-
-	rcu_assign_pointer(h->table, t);
-	read_unlock_bh(&set->lock);
-
-	/* Give time to other readers of the set */
-	synchronize_rcu_bh();
-
-	ahash_destroy(orig);
-
-	return 0;
+	return type_pf_rehash(set, sizeof(struct type_pf_telem));
 }
 
 static int
@@ -797,9 +966,10 @@ type_pf_tadd(struct ip_set *set, void *value, u32 timeout, u32 flags)
 	struct ip_set_hash *h = set->data;
 	struct htable *t = h->table;
 	const struct type_pf_elem *d = value;
+	struct type_pf_telem e;
 	struct hbucket *n;
 	struct type_pf_elem *data;
-	int ret = 0, i, j = AHASH_MAX_SIZE + 1;
+	int ret, i, j = AHASH_MAX_SIZE + 1;
 	bool flag_exist = flags & IPSET_FLAG_EXIST;
 	u32 key;
 
@@ -809,44 +979,54 @@ type_pf_tadd(struct ip_set *set, void *value, u32 timeout, u32 flags)
 	if (h->elements >= h->maxelem)
 		return -IPSET_ERR_HASH_FULL;
 
-	rcu_read_lock_bh();
-	t = rcu_dereference(h->table);
 	key = HKEY(d, h->initval, t->htable_bits);
-	n = hbucket(t, key);
-	for (i = 0; i < n->pos; i++) {
+	n = t->bucket[key];
+	for (i = 0; n && i < n->pos; i++) {
 		data = ahash_tdata(n, i);
 		if (type_pf_data_equal(data, d)) {
-			if (type_pf_data_expired(data) || flag_exist)
-				j = i;
-			else {
-				ret = -IPSET_ERR_EXIST;
-				goto out;
-			}
+			if (!type_pf_data_expired(data) && !flag_exist)
+				return -IPSET_ERR_EXIST;
+			/* The same element: just refresh it in place */
+			if (h->counters && type_pf_data_expired(data))
+				ip_set_copy_counter(ahash_counter(n, i,
+					sizeof(struct type_pf_telem)),
+					&h->add_counter);
+			type_pf_data_timeout_set(data, timeout);
+			return 0;
 		} else if (j == AHASH_MAX_SIZE + 1 &&
 			   type_pf_data_expired(data))
 			j = i;
 	}
+
+	memset(&e, 0, sizeof(e));
+	type_pf_data_copy((struct type_pf_elem *)&e, d);
+	type_pf_data_timeout_set((struct type_pf_elem *)&e, timeout);
+
 	if (j != AHASH_MAX_SIZE + 1) {
-		data = ahash_tdata(n, j);
+		/* Reuse the place of an expired element */
 #ifdef IP_SET_HASH_WITH_NETS
-		del_cidr(h, data->cidr, HOST_MASK);
+		u8 cidr = ahash_tdata(n, j)->cidr;
+#endif
+		ret = ahash_bucket_set(t, key, j, &e, sizeof(e),
+				       h->counters ? &h->add_counter : NULL);
+		if (ret != 0)
+			return ret;
+#ifdef IP_SET_HASH_WITH_NETS
+		del_cidr(h, cidr, HOST_MASK);
 		add_cidr(h, d->cidr, HOST_MASK);
 #endif
-		type_pf_data_copy(data, d);
-		type_pf_data_timeout_set(data, timeout);
-		goto out;
+		return 0;
 	}
-	ret = type_pf_elem_tadd(n, d, timeout);
-	if (ret != 0)
-		goto out;
+	ret = ahash_bucket_append(t, key, &e, sizeof(e),
+				  h->counters ? &h->add_counter : NULL);
+	if (ret < 0)
+		return ret;
 
 #ifdef IP_SET_HASH_WITH_NETS
 	add_cidr(h, d->cidr, HOST_MASK);
 #endif
 	h->elements++;
-out:
-	rcu_read_unlock_bh();
-	return ret;
+	return 0;
 }
 
 static int
@@ -856,93 +1036,48 @@ type_pf_tdel(struct ip_set *set, void *value, u32 timeout, u32 flags)
 	struct htable *t = h->table;
 	const struct type_pf_elem *d = value;
 	struct hbucket *n;
-	int i;
 	struct type_pf_elem *data;
+	int i, ret;
 	u32 key;
 
 	key = HKEY(value, h->initval, t->htable_bits);
-	n = hbucket(t, key);
-	for (i = 0; i < n->pos; i++) {
+	n = t->bucket[key];
+	for (i = 0; n && i < n->pos; i++) {
 		data = ahash_tdata(n, i);
 		if (!type_pf_data_equal(data, d))
 			continue;
 		if (type_pf_data_expired(data))
 			return -IPSET_ERR_EXIST;
-		if (i != n->pos - 1)
-			/* Not last one */
-			type_pf_data_copy(data, ahash_tdata(n, n->pos - 1));
+		ret = ahash_bucket_del(t, key, i, sizeof(struct type_pf_telem),
+				       h->counters);
+		if (ret)
+			return ret;
 
-		n->pos--;
 		h->elements--;
 #ifdef IP_SET_HASH_WITH_NETS
 		del_cidr(h, d->cidr, HOST_MASK);
 #endif
-		if (n->pos + AHASH_INIT_SIZE < n->size) {
-			void *tmp = kzalloc((n->size - AHASH_INIT_SIZE)
-					    * sizeof(struct type_pf_telem),
-					    GFP_ATOMIC);
-			if (!tmp)
-				return 0;
-			n->size -= AHASH_INIT_SIZE;
-			memcpy(tmp, n->value,
-			       n->size * sizeof(struct type_pf_telem));
-			kfree(n->value);
-			n->value = tmp;
-		}
 		return 0;
 	}
 
 	return -IPSET_ERR_EXIST;
 }
 
-#ifdef IP_SET_HASH_WITH_NETS
-static int
-type_pf_ttest_cidrs(struct ip_set *set, struct type_pf_elem *d, u32 timeout)
-{
-	struct ip_set_hash *h = set->data;
-	struct htable *t = h->table;
-	struct type_pf_elem *data;
-	struct hbucket *n;
-	int i, j = 0;
-	u32 key;
-	u8 host_mask = SET_HOST_MASK(set->family);
-
-	for (; j < host_mask && h->nets[j].cidr; j++) {
-		type_pf_data_netmask(d, h->nets[j].cidr);
-		key = HKEY(d, h->initval, t->htable_bits);
-		n = hbucket(t, key);
-		for (i = 0; i < n->pos; i++) {
-			data = ahash_tdata(n, i);
-			if (type_pf_data_equal(data, d))
-				return !type_pf_data_expired(data);
-		}
-	}
-	return 0;
-}
-#endif
-
 static int
 type_pf_ttest(struct ip_set *set, void *value, u32 timeout, u32 flags)
 {
 	struct ip_set_hash *h = set->data;
-	struct htable *t = h->table;
-	struct type_pf_elem *data, *d = value;
-	struct hbucket *n;
+	struct htable *t = rcu_dereference(h->table);
+	struct type_pf_elem *d = value;
 	int i;
-	u32 key;
 
 #ifdef IP_SET_HASH_WITH_NETS
 	if (d->cidr == SET_HOST_MASK(set->family))
-		return type_pf_ttest_cidrs(set, d, timeout);
+		return type_pf_find_cidrs(h, t, d, sizeof(struct type_pf_telem),
+					  true, &i) != NULL;
 #endif
-	key = HKEY(d, h->initval, t->htable_bits);
-	n = hbucket(t, key);
-	for (i = 0; i < n->pos; i++) {
-		data = ahash_tdata(n, i);
-		if (type_pf_data_equal(data, d))
-			return !type_pf_data_expired(data);
-	}
-	return 0;
+	return type_pf_find(h, t, d, sizeof(struct type_pf_telem),
+			    true, &i) != NULL;
 }
 
 static int
@@ -964,8 +1099,8 @@ type_pf_tlist(const struct ip_set *set,
 		return -EMSGSIZE;
 	for (; cb->args[2] < jhash_size(t->htable_bits); cb->args[2]++) {
 		incomplete = skb_tail_pointer(skb);
-		n = hbucket(t, cb->args[2]);
-		for (i = 0; i < n->pos; i++) {
+		n = t->bucket[cb->args[2]];
+		for (i = 0; n && i < n->pos; i++) {
 			data = ahash_tdata(n, i);
 			pr_debug("list %p %u\n", n, i);
 			if (type_pf_data_expired(data))
@@ -979,7 +1114,9 @@ type_pf_tlist(const struct ip_set *set,
 				} else
 					goto nla_put_failure;
 			}
-			if (type_pf_data_tlist(skb, data))
+			if (type_pf_data_tlist(skb, data) ||
+			    type_pf_list_counter(h, skb, n, i,
+						 sizeof(struct type_pf_telem)))
 				goto nla_put_failure;
 			ipset_nest_end(skb, nested);
 		}
@@ -1016,6 +1153,7 @@ static const struct ip_set_type_variant type_pf_tvariant = {
 	.list	= type_pf_tlist,
 	.resize	= type_pf_tresize,
 	.same_set = type_pf_same_set,
+	.lockless_test = true,
 };
 
 static void
@@ -1061,17 +1199,20 @@ type_pf_gc_init(struct ip_set *set)
 #undef type_pf_data_netmask
 #undef type_pf_data_timeout_set
 
-#undef type_pf_elem_add
+#undef type_pf_find_in
+#undef type_pf_find
+#undef type_pf_find_cidrs
+#undef type_pf_rehash
+#undef type_pf_list_counter
+
 #undef type_pf_add
 #undef type_pf_del
-#undef type_pf_test_cidrs
 #undef type_pf_test
+#undef type_pf_ctest
 
-#undef type_pf_elem_tadd
 #undef type_pf_expire
 #undef type_pf_tadd
 #undef type_pf_tdel
-#undef type_pf_ttest_cidrs
 #undef type_pf_ttest
 
 #undef type_pf_resize
@@ -236,6 +236,27 @@ struct ubuf_info {
 	unsigned long desc;
 };
 
+#ifndef __GENKSYMS__
+/*
+ * MSG_ZEROCOPY state for a run of sendmsg() calls on one socket.  It lives
+ * in the cb[] of the skb that is queued on the socket error queue as the
+ * completion notification.  Every skb whose frags point into the pinned
+ * user pages holds a reference; the callback drops it and the notification
+ * for ids [id, id + len) goes out once the last reference is gone.
+ */
+struct ubuf_info_msgzc {
+	struct ubuf_info	ubuf;
+	u32			id;
+	u16			len;
+	u16			zerocopy:1;
+	u32			bytelen;
+	atomic_t		refcnt;
+};
+
+#define uarg_to_msgzc(ubuf_ptr)	\
+	container_of((ubuf_ptr), struct ubuf_info_msgzc, ubuf)
+#endif
+
 /* This data is invariant across clones and lives at
  * the end of the header data, ie. at skb->end.
  */
@@ -355,6 +376,7 @@ typedef unsigned char *sk_buff_data_t;
  *	@tc_index: Traffic control index
  *	@tc_verd: traffic control verdict
  *	@ndisc_nodetype: router type (from link layer)
+ *	@napi_id: id of the NAPI struct this skb came from
  *	@dma_cookie: a cookie to one of several possible DMA operations
  *		done by skb DMA functions
  *	@secmark: security marking
@@ -441,14 +463,24 @@ struct sk_buff {
 	 * headers if needed
 	 */
 	__u8			encapsulation:1;
+	__u8			head_frag:1;
 #endif
 	kmemcheck_bitfield_end(flags2);
 
 	/* 0/13 bit hole */
 
+#ifndef __GENKSYMS__
+#if defined(CONFIG_NET_DMA) || defined(CONFIG_NET_RX_BUSY_POLL)
+	union {
+		unsigned int	napi_id;
+		dma_cookie_t	dma_cookie;
+	};
+#endif
+#else
 #ifdef CONFIG_NET_DMA
 	dma_cookie_t		dma_cookie;
 #endif
+#endif
 #ifdef CONFIG_NETWORK_SECMARK
 	__u32			secmark;
 #endif
@@ -502,6 +534,7 @@ extern void	       __kfree_skb(struct sk_buff *skb);
 extern struct sk_buff *__alloc_skb(unsigned int size,
 				   gfp_t priority, int fclone, int node);
 extern struct sk_buff *build_skb(void *data);
+extern struct sk_buff *__build_skb(void *data, unsigned int frag_size);
 static inline struct sk_buff *alloc_skb(unsigned int size,
 					gfp_t priority)
 {
@@ -597,6 +630,57 @@ static inline union skb_shared_tx *skb_tx(struct sk_buff *skb)
 	return &skb_shinfo(skb)->tx_flags;
 }
 
+#ifndef __GENKSYMS__
+extern struct ubuf_info_msgzc *sock_zerocopy_alloc(struct sock *sk,
+						   size_t size);
+extern struct ubuf_info_msgzc *sock_zerocopy_realloc(struct sock *sk,
+						     size_t size,
+						     struct ubuf_info_msgzc *uarg);
+extern void sock_zerocopy_callback(void *arg);
+extern void sock_zerocopy_put(struct ubuf_info_msgzc *uarg);
+extern void sock_zerocopy_put_abort(struct ubuf_info_msgzc *uarg);
+extern int skb_zerocopy_iter_stream(struct sock *sk, struct sk_buff *skb,
+				    const void __user *from, int len,
+				    struct ubuf_info_msgzc *uarg);
+extern int skb_orphan_frags_rx(struct sk_buff *skb, gfp_t gfp_mask);
+
+/**
+ * skb_zcopy_sock - MSG_ZEROCOPY state of an skb
+ * @skb: buffer to check
+ *
+ * Returns the notification state if the frags of @skb were pinned by a
+ * MSG_ZEROCOPY send, NULL otherwise (including vhost/macvtap zerocopy
+ * buffers, which use their own ubuf_info callbacks).
+ */
+static inline struct ubuf_info_msgzc *skb_zcopy_sock(struct sk_buff *skb)
+{
+	struct ubuf_info *uarg;
+
+	if (likely(!skb_tx(skb)->dev_zerocopy))
+		return NULL;
+
+	uarg = skb_shinfo(skb)->destructor_arg;
+	if (uarg->callback != sock_zerocopy_callback)
+		return NULL;
+
+	return uarg_to_msgzc(uarg);
+}
+
+static inline void sock_zerocopy_get(struct ubuf_info_msgzc *uarg)
+{
+	atomic_inc(&uarg->refcnt);
+}
+
+/* Attach @uarg to @skb, the skb takes its own reference. */
+static inline void skb_zcopy_set(struct sk_buff *skb,
+				 struct ubuf_info_msgzc *uarg)
+{
+	sock_zerocopy_get(uarg);
+	skb_shinfo(skb)->destructor_arg = &uarg->ubuf;
+	skb_tx(skb)->dev_zerocopy = 1;
+}
+#endif
+
 /**
  *	skb_queue_empty - check if a queue is empty
  *	@list: queue head
@@ -1604,6 +1688,7 @@ static inline struct sk_buff *netdev_alloc_skb(struct net_device *dev,
 }
 
 extern struct page *__netdev_alloc_page(struct net_device *dev, gfp_t gfp_mask);
+extern void *netdev_alloc_frag(unsigned int fragsz);
 
 static inline struct sk_buff *__netdev_alloc_skb_ip_align(struct net_device *dev,
 		unsigned int length, gfp_t gfp)
@@ -2332,6 +2417,14 @@ static inline void skb_record_rx_queue(struct sk_buff *skb, u16 rx_queue)
 	skb->queue_mapping = rx_queue + 1;
 }
 
+extern u16 __skb_get_rxhash(struct sk_buff *skb);
+static inline u16 skb_get_rxhash(struct sk_buff *skb)
+{
+	if (!skb->rxhash)
+		return __skb_get_rxhash(skb);
+	return skb->rxhash;
+}
+
 static inline u16 skb_get_rx_queue(const struct sk_buff *skb)
 {
 	return skb->queue_mapping - 1;
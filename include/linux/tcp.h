@@ -99,6 +99,7 @@ enum {
 #define TCP_THIN_LINEAR_TIMEOUTS 16      /* Use linear timeouts for thin streams*/
 #define TCP_THIN_DUPACK         17      /* Fast retrans. after 1 dupack */
 #define TCP_USER_TIMEOUT	18	/* How long for loss retry before timeout */
+#define TCP_FASTOPEN		23	/* Enable FastOpen on listeners */
 
 #define TCPI_OPT_TIMESTAMPS	1
 #define TCPI_OPT_SACK		2
@@ -232,6 +233,26 @@ struct tcp_options_received {
  * only four options will fit in a standard TCP header */
 #define TCP_NUM_SACKS 4
 
+/* TCP Fast Open */
+#define TCP_FASTOPEN_COOKIE_MIN	4	/* Min Fast Open Cookie size in bytes */
+#define TCP_FASTOPEN_COOKIE_MAX	16	/* Max Fast Open Cookie size in bytes */
+#define TCP_FASTOPEN_COOKIE_SIZE 8	/* the size employed by this impl. */
+
+/* TCP Fast Open Cookie as stored in memory */
+struct tcp_fastopen_cookie {
+	s8	len;
+	u8	val[TCP_FASTOPEN_COOKIE_MAX];
+	bool	exp;	/* In RFC6994 experimental option format */
+};
+
+/* This structure contains the info for a client TFO connection */
+struct tcp_fastopen_request {
+	/* Fast Open cookie. Size 0 means a cookie request */
+	struct tcp_fastopen_cookie	cookie;
+	struct msghdr			*data;  /* data in MSG_FASTOPEN */
+	u16				copied;	/* queued in tcp_connect() */
+};
+
 struct tcp_request_sock {
 	struct inet_request_sock 	req;
 #ifdef CONFIG_TCP_MD5SIG
@@ -241,6 +262,13 @@ struct tcp_request_sock {
 	u32			 	rcv_isn;
 	u32			 	snt_isn;
 	u32				snt_synack; /* synack sent time */
+#ifndef __GENKSYMS__
+	struct sock			*listener; /* needed for TFO */
+	u32				rcv_nxt; /* the ack # by SYNACK. For
+						  * FastOpen it's the seq#
+						  * after data-in-SYN.
+						  */
+#endif
 };
 
 static inline struct tcp_request_sock *tcp_rsk(const struct request_sock *req)
@@ -414,7 +442,11 @@ struct tcp_sock {
 #ifndef __GENKSYMS__
 	u8	thin_lto    : 1,/* Use linear timeouts for thin streams */
 		thin_dupack : 1,/* Fast retransmit on first dupack      */
-		unused      : 6;
+		syn_fastopen:1,	/* SYN includes Fast Open option */
+		syn_data:1,	/* SYN includes data */
+		syn_data_acked:1,/* data in SYN is acked by SYN-ACK */
+		do_early_retrans:1,/* Enable RFC5827 early-retransmit  */
+		unused      : 2;
 
 	u32	prior_cwnd;	/* Congestion window at start of Recovery. */
 	u32	prr_delivered;	/* Number of newly delivered packets to
@@ -422,6 +454,15 @@ struct tcp_sock {
 	u32	prr_out;	/* Total number of pkts sent during Recovery. */
 	struct list_head tsq_node; /* anchor in tsq_tasklet.head list */
 	unsigned long	tsq_flags;
+
+	/* TCP fastopen related information */
+	struct tcp_fastopen_request *fastopen_req;
+	/* fastopen_rsk points to request_sock that resulted in this big
+	 * socket. Used to retransmit SYNACKs etc.
+	 */
+	struct request_sock *fastopen_rsk;
+
+	u32	tlp_high_seq;	/* snd_nxt at the time of TLP retransmit. */
 #endif
 };
 
@@ -454,6 +495,32 @@ static inline struct tcp_timewait_sock *tcp_twsk(const struct sock *sk)
 	return (struct tcp_timewait_sock *)sk;
 }
 
+static inline bool tcp_passive_fastopen(const struct sock *sk)
+{
+	return (sk->sk_state == TCP_SYN_RECV &&
+		tcp_sk(sk)->fastopen_rsk != NULL);
+}
+
+extern void tcp_sock_destruct(struct sock *sk);
+
+static inline int fastopen_init_queue(struct sock *sk, int backlog)
+{
+	struct fastopen_queue *fastopenq = sk_extended(sk)->fastopenq;
+
+	if (fastopenq == NULL) {
+		fastopenq = kzalloc(sizeof(struct fastopen_queue),
+				    sk->sk_allocation);
+		if (fastopenq == NULL)
+			return -ENOMEM;
+
+		spin_lock_init(&fastopenq->lock);
+		sk->sk_destruct = tcp_sock_destruct;
+		sk_extended(sk)->fastopenq = fastopenq;
+	}
+	fastopenq->max_qlen = backlog;
+	return 0;
+}
+
 #endif
 
 #endif	/* _LINUX_TCP_H */
@@ -78,6 +78,14 @@ struct udp_sock {
 	 * For encapsulation sockets.
 	 */
 	int (*encap_rcv)(struct sock *sk, struct sk_buff *skb);
+#ifndef __GENKSYMS__
+	/*
+	 * Secondary hash, keyed on (local address, local port), see
+	 * udp_table.hash2.
+	 */
+	struct hlist_nulls_node	udp_portaddr_node;
+	unsigned int	 udp_portaddr_hash;
+#endif
 };
 
 static inline struct udp_sock *udp_sk(const struct sock *sk)
@@ -85,6 +93,12 @@ static inline struct udp_sock *udp_sk(const struct sock *sk)
 	return (struct udp_sock *)sk;
 }
 
+#define udp_portaddr_for_each_entry(__up, node, list) \
+	hlist_nulls_for_each_entry(__up, node, list, udp_portaddr_node)
+
+#define udp_portaddr_for_each_entry_rcu(__up, node, list) \
+	hlist_nulls_for_each_entry_rcu(__up, node, list, udp_portaddr_node)
+
 #define IS_UDPLITE(__sk) (udp_sk(__sk)->pcflag)
 
 #endif
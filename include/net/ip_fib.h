@@ -44,6 +44,11 @@ struct fib_config {
  };
 
 struct fib_info;
+struct rtable;
+
+/* Forwarded routes cached per nexthop, hashed by input ifindex and,
+ * for directly connected hosts, destination */
+#define FIB_NH_RTH_INPUT	16
 
 struct fib_nh {
 	struct net_device	*nh_dev;
@@ -60,6 +65,9 @@ struct fib_nh {
 #endif
 	int			nh_oif;
 	__be32			nh_gw;
+#ifndef __GENKSYMS__
+	struct rtable		*nh_rth_input[FIB_NH_RTH_INPUT];
+#endif
 };
 
 /*
@@ -16,6 +16,8 @@
 #include <linux/sysctl.h>               /* for ctl_path */
 #include <linux/list.h>                 /* for struct list_head */
 #include <linux/spinlock.h>             /* for struct rwlock_t */
+#include <linux/rcupdate.h>
+#include <linux/u64_stats_sync.h>
 #include <asm/atomic.h>                 /* for struct atomic_t */
 #include <linux/compiler.h>
 #include <linux/timer.h>
@@ -276,12 +278,24 @@ struct ip_vs_estimator {
 	u32			outbps;
 };
 
+/*
+ *	Counters updated by the packet path, one copy per cpu
+ */
+struct ip_vs_cpu_stats {
+	struct ip_vs_stats_user	ustats;
+	struct u64_stats_sync	syncp;
+};
+
 struct ip_vs_stats
 {
 	struct ip_vs_stats_user	ustats;         /* statistics */
 	struct ip_vs_estimator	est;		/* estimator */
 
 	spinlock_t              lock;           /* spin lock */
+#ifndef __GENKSYMS__
+	struct ip_vs_cpu_stats	*cpustats;	/* per cpu counters */
+	struct ip_vs_stats_user	ustats0;	/* sums at the last reset */
+#endif
 };
 
 struct dst_entry;
@@ -373,7 +387,11 @@ struct ip_vs_conn_param {
  *	IP_VS structure allocated for each dynamically scheduled connection
  */
 struct ip_vs_conn {
+#ifndef __GENKSYMS__
+	struct hlist_node	c_list;		/* hashed list heads */
+#else
 	struct list_head        c_list;         /* hashed list heads */
+#endif
 
 	/* Protocol, addresses and port numbers */
 	u16                      af;		/* address family */
@@ -440,6 +458,8 @@ struct ip_vs_conn {
 	const struct ip_vs_pe	*pe;
 	char			*pe_data;
 	__u8			pe_data_len;
+
+	struct rcu_head		rcu_head;	/* lookups are lockless */
 #endif /* __GENKSYMS__ */
 };
 
@@ -1026,6 +1046,7 @@ extern void ip_vs_estimator_cleanup(void);
 extern void ip_vs_new_estimator(struct ip_vs_stats *stats);
 extern void ip_vs_kill_estimator(struct ip_vs_stats *stats);
 extern void ip_vs_zero_estimator(struct ip_vs_stats *stats);
+extern void ip_vs_read_cpu_stats(struct ip_vs_stats *stats);
 
 /*
  *	Various IPVS packet transmitters (from ip_vs_xmit.c)
@@ -99,6 +99,9 @@ struct net {
 #endif
 #endif
 	unsigned int		proc_inum;
+#if defined(CONFIG_NF_CONNTRACK) || defined(CONFIG_NF_CONNTRACK_MODULE)
+	struct ct_pcpu __percpu	*ct_pcpu_lists;
+#endif
 #endif
 };
 
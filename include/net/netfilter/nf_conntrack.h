@@ -135,6 +135,9 @@ struct nf_conn {
 #ifndef __GENKSYMS__
 	/* Extra storage reserved for other modules: */
 	struct nf_conntrack_proto_ext proto_ext;
+
+	/* cpu whose unconfirmed or dying list holds us */
+	u16 cpu;
 #endif
 };
 
@@ -213,6 +216,7 @@ extern struct nf_conntrack_tuple_hash *
 __nf_conntrack_find(struct net *net, const struct nf_conntrack_tuple *tuple);
 
 extern void nf_conntrack_hash_insert(struct nf_conn *ct);
+extern int nf_conntrack_hash_check_insert(struct nf_conn *ct);
 extern void nf_ct_delete_from_lists(struct nf_conn *ct);
 extern void nf_ct_insert_dying_list(struct nf_conn *ct);
 
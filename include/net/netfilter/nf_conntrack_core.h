@@ -75,6 +75,14 @@ print_tuple(struct seq_file *s, const struct nf_conntrack_tuple *tuple,
             const struct nf_conntrack_l3proto *l3proto,
             const struct nf_conntrack_l4proto *proto);
 
+/* Protects expectations and helper assignment.  The hash chains are
+ * protected by nf_conntrack_locks[], taken after nf_conntrack_lock.
+ */
 extern spinlock_t nf_conntrack_lock ;
 
+#define CONNTRACK_LOCKS 1024
+
+extern spinlock_t nf_conntrack_locks[CONNTRACK_LOCKS];
+extern void nf_conntrack_bucket_lock(spinlock_t *lock);
+
 #endif /* _NF_CONNTRACK_CORE_H */
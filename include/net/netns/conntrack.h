@@ -3,11 +3,19 @@
 
 #include <linux/list.h>
 #include <linux/list_nulls.h>
+#include <linux/spinlock.h>
 #include <asm/atomic.h>
 
 struct ctl_table_header;
 struct nf_conntrack_ecache;
 
+/* Per-cpu lists of conntracks not (or no longer) in the hash table. */
+struct ct_pcpu {
+	spinlock_t		lock;
+	struct hlist_nulls_head	unconfirmed;
+	struct hlist_nulls_head	dying;
+};
+
 struct netns_ct {
 	atomic_t		count;
 	unsigned int		expect_count;
@@ -15,8 +23,8 @@ struct netns_ct {
 	struct kmem_cache	*nf_conntrack_cachep;
 	struct hlist_nulls_head	*hash;
 	struct hlist_head	*expect_hash;
-	struct hlist_nulls_head	unconfirmed;
-	struct hlist_nulls_head	dying;
+	struct hlist_nulls_head	unconfirmed;	/* unused, see ct_pcpu_lists */
+	struct hlist_nulls_head	dying;		/* unused, see ct_pcpu_lists */
 	struct ip_conntrack_stat *stat;
 	int			sysctl_events;
 	unsigned int		sysctl_events_retry_timeout;
@@ -101,6 +101,7 @@ typedef struct {
 struct sock;
 struct proto;
 struct net;
+struct fastopen_queue;
 
 /**
  *	struct sock_common - minimal network layer representation of sockets
@@ -371,6 +372,12 @@ struct sock_extended {
 	u16			sk_gso_max_segs;
 	u32			sk_pacing_rate; /* bytes per second */
 	struct inet_cork_extended	inet_cork_ext;
+#ifdef CONFIG_NET_RX_BUSY_POLL
+	unsigned int		sk_napi_id;
+	unsigned int		sk_ll_usec;
+#endif
+	struct fastopen_queue	*fastopenq; /* TCP Fast Open listener state */
+	atomic_t		sk_zckey; /* next MSG_ZEROCOPY notification id */
 };
 
 #define __sk_tx_queue_mapping(sk) \
@@ -743,6 +750,7 @@ struct raw_hashinfo;
 
 /* RHEL specific flags to signal presence of extended members */
 #define RHEL_PROTO_HAS_RELEASE_CB	1
+#define RHEL_PROTO_HAS_REHASH		2
 
 
 /* Networking protocol blocks we attach to sockets.
@@ -850,11 +858,26 @@ struct proto {
 	 */
 	void		(*release_cb)(struct sock *sk);
 	u32			rhel_flags;
+	void		(*rehash)(struct sock *sk);
 
 	/* Add additional members here and add a new RHEL_PROTO_ flag */
 #endif
 };
 
+static inline bool proto_has_rhel_ext(const struct proto *prot, int flag)
+{
+	return (prot->slab_flags & RHEL_EXTENDED_PROTO) &&
+	       (prot->rhel_flags & flag);
+}
+
+/* The local address of a bound socket changed, let the protocol rehash it */
+static inline void sk_rehash_local(struct sock *sk)
+{
+	if (proto_has_rhel_ext(sk->sk_prot, RHEL_PROTO_HAS_REHASH) &&
+	    sk->sk_prot->rehash)
+		sk->sk_prot->rehash(sk);
+}
+
 static inline struct sock_extended *sk_extended(const struct sock *sk)
 {
 	unsigned int obj_size = sk->sk_prot_creator->obj_size;
@@ -1234,8 +1257,10 @@ extern void sock_init_data(struct socket *sock, struct sock *sk);
 
 static inline void sk_filter_release(struct sk_filter *fp)
 {
-	if (atomic_dec_and_test(&fp->refcnt))
+	if (atomic_dec_and_test(&fp->refcnt)) {
+		bpf_jit_free(fp);
 		kfree(fp);
+	}
 }
 
 static inline void sk_filter_uncharge(struct sock *sk, struct sk_filter *fp)
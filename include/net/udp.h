@@ -50,15 +50,49 @@ struct udp_skb_cb {
 };
 #define UDP_SKB_CB(__skb)	((struct udp_skb_cb *)((__skb)->cb))
 
+/**
+ *	struct udp_hslot - UDP hash slot
+ *
+ *	@head:	head of list of sockets
+ *	@lock:	spinlock protecting changes to head/count
+ *	@count:	number of sockets in 'head' list
+ */
 struct udp_hslot {
 	struct hlist_nulls_head	head;
 	spinlock_t		lock;
+#ifndef __GENKSYMS__
+	int			count;
+#endif
 } __attribute__((aligned(2 * sizeof(long))));
+
+/**
+ *	struct udp_table - UDP table
+ *
+ *	@hash:	hash table, sockets are hashed on local port
+ *	@hash2:	hash table, sockets are hashed on (local port, local address)
+ *	@mask2:	number of slots in hash2 minus 1
+ */
 struct udp_table {
 	struct udp_hslot	hash[UDP_HTABLE_SIZE];
+#ifndef __GENKSYMS__
+	struct udp_hslot	*hash2;
+	unsigned int		mask2;
+#endif
 };
 extern struct udp_table udp_table;
-extern void udp_table_init(struct udp_table *);
+extern void udp_table_init(struct udp_table *, const char *);
+
+static inline struct udp_hslot *udp_hashslot2(struct udp_table *table,
+					      unsigned int hash)
+{
+	return &table->hash2[hash & table->mask2];
+}
+
+/*
+ * The port chain is only bypassed in favour of hash2 once it gets longer
+ * than this, short chains are cheaper to walk than to hash twice.
+ */
+#define UDP_HSLOT2_THRESHOLD	10
 
 
 /* Note: this must match 'valbool' in sock_setsockopt */
@@ -129,6 +163,7 @@ static inline void udp_lib_hash(struct sock *sk)
 }
 
 extern void udp_lib_unhash(struct sock *sk);
+extern void udp_lib_rehash(struct sock *sk, unsigned int new_hash);
 
 static inline void udp_lib_close(struct sock *sk, long timeout)
 {
@@ -225,4 +260,26 @@ extern void udp_init(void);
 
 extern int udp4_ufo_send_check(struct sk_buff *skb);
 extern struct sk_buff *udp4_ufo_fragment(struct sk_buff *skb, int features);
+
+/**
+ *	struct udp_offload - GRO handlers of a UDP encapsulation
+ *
+ *	@port:		 destination port the encapsulation listens on
+ *	@gro_receive:	 called with the UDP header pulled
+ *	@gro_complete:	 called with NAPI_GRO_CB(skb)->nhoff at the
+ *			 encapsulation header
+ */
+struct udp_offload {
+	__be16			port;
+	struct sk_buff		**(*gro_receive)(struct sk_buff **head,
+						 struct sk_buff *skb);
+	int			(*gro_complete)(struct sk_buff *skb);
+	struct list_head	list;
+};
+
+extern void udp_add_offload(struct udp_offload *uo);
+extern void udp_del_offload(struct udp_offload *uo);
+extern struct sk_buff **udp4_gro_receive(struct sk_buff **head,
+					 struct sk_buff *skb);
+extern int udp4_gro_complete(struct sk_buff *skb);
 #endif	/* _UDP_H */
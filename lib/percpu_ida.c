@@ -0,0 +1,355 @@
+/*
+ * Percpu IDA library
+ *
+ * Allocates small integer tags (e.g. for request or command tags) out of
+ * a fixed sized pool.  Each CPU keeps a small cache of free tags, so the
+ * common allocate/free cycle touches only CPU local data; the global
+ * freelist is only hit when a cache runs empty or overflows, and tags are
+ * stolen from other CPUs' caches before an allocation is allowed to fail
+ * or sleep.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ */
+
+#include <linux/bitops.h>
+#include <linux/bug.h>
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/spinlock.h>
+#include <linux/percpu_ida.h>
+
+static inline struct percpu_ida_cpu *pool_cpu(struct percpu_ida *pool,
+					      unsigned cpu)
+{
+	return &pool->tag_cpu[cpu];
+}
+
+static inline void move_tags(unsigned *dst, unsigned *dst_nr,
+			     unsigned *src, unsigned *src_nr,
+			     unsigned nr)
+{
+	*src_nr -= nr;
+	memcpy(dst + *dst_nr, src + *src_nr, sizeof(unsigned) * nr);
+	*dst_nr += nr;
+}
+
+/*
+ * Try to steal tags from a remote cpu's percpu freelist.
+ *
+ * Every cpu that may hold tags is tried in turn, starting after the one
+ * we last stole from, so an allocation only fails when the pool really
+ * is empty (or the remaining tags are in the middle of being freed).
+ *
+ * Caller must hold pool->lock with irqs disabled.
+ */
+static inline void steal_tags(struct percpu_ida *pool,
+			      struct percpu_ida_cpu *tags)
+{
+	unsigned cpus_have_tags, cpu = pool->cpu_last_stolen;
+	struct percpu_ida_cpu *remote;
+
+	for (cpus_have_tags = cpumask_weight(&pool->cpus_have_tags);
+	     cpus_have_tags; cpus_have_tags--) {
+		cpu = cpumask_next(cpu, &pool->cpus_have_tags);
+
+		if (cpu >= nr_cpu_ids) {
+			cpu = cpumask_first(&pool->cpus_have_tags);
+			if (cpu >= nr_cpu_ids)
+				BUG();
+		}
+
+		pool->cpu_last_stolen = cpu;
+		remote = pool_cpu(pool, cpu);
+
+		cpumask_clear_cpu(cpu, &pool->cpus_have_tags);
+
+		if (remote == tags)
+			continue;
+
+		spin_lock(&remote->lock);
+
+		if (remote->nr_free) {
+			memcpy(tags->freelist,
+			       remote->freelist,
+			       sizeof(unsigned) * remote->nr_free);
+
+			tags->nr_free = remote->nr_free;
+			remote->nr_free = 0;
+		}
+
+		spin_unlock(&remote->lock);
+
+		if (tags->nr_free)
+			break;
+	}
+}
+
+/*
+ * Pop up to percpu_batch_size tags off the global freelist and move them
+ * to our percpu freelist.  Caller must hold pool->lock.
+ */
+static inline void alloc_global_tags(struct percpu_ida *pool,
+				     struct percpu_ida_cpu *tags)
+{
+	move_tags(tags->freelist, &tags->nr_free,
+		  pool->freelist, &pool->nr_free,
+		  min(pool->nr_free, pool->percpu_batch_size));
+}
+
+static inline int alloc_local_tag(struct percpu_ida_cpu *tags)
+{
+	int tag = -ENOSPC;
+
+	spin_lock(&tags->lock);
+	if (tags->nr_free)
+		tag = tags->freelist[--tags->nr_free];
+	spin_unlock(&tags->lock);
+
+	return tag;
+}
+
+/**
+ * percpu_ida_alloc - allocate a tag
+ * @pool: pool to allocate from
+ * @gfp: gfp flags
+ *
+ * Returns a tag - an integer in the range [0..nr_tags) (passed to
+ * percpu_ida_init()), or otherwise -ENOSPC on allocation failure.
+ *
+ * Safe to be called from interrupt context (assuming it isn't passed
+ * __GFP_WAIT, of course).
+ *
+ * If @gfp contains __GFP_WAIT, the allocation sleeps uninterruptibly
+ * until a tag is freed; it never fails.
+ */
+int percpu_ida_alloc(struct percpu_ida *pool, gfp_t gfp)
+{
+	DEFINE_WAIT(wait);
+	struct percpu_ida_cpu *tags;
+	unsigned long flags;
+	unsigned cpu;
+	int tag;
+
+	local_irq_save(flags);
+	tags = pool_cpu(pool, smp_processor_id());
+
+	/* Fastpath */
+	tag = alloc_local_tag(tags);
+	if (likely(tag >= 0)) {
+		local_irq_restore(flags);
+		return tag;
+	}
+
+	while (1) {
+		spin_lock(&pool->lock);
+
+		/*
+		 * prepare_to_wait() must come before steal_tags(), in case
+		 * percpu_ida_free() on another cpu flips a bit in
+		 * cpus_have_tags
+		 *
+		 * global lock held and irqs disabled, don't need percpu lock
+		 */
+		if (gfp & __GFP_WAIT)
+			prepare_to_wait(&pool->wait, &wait,
+					TASK_UNINTERRUPTIBLE);
+
+		if (!tags->nr_free)
+			alloc_global_tags(pool, tags);
+		if (!tags->nr_free)
+			steal_tags(pool, tags);
+
+		if (tags->nr_free) {
+			tag = tags->freelist[--tags->nr_free];
+			if (tags->nr_free) {
+				cpu = smp_processor_id();
+				cpumask_set_cpu(cpu, &pool->cpus_have_tags);
+			}
+		}
+
+		spin_unlock(&pool->lock);
+		local_irq_restore(flags);
+
+		if (tag >= 0 || !(gfp & __GFP_WAIT))
+			break;
+
+		schedule();
+
+		local_irq_save(flags);
+		tags = pool_cpu(pool, smp_processor_id());
+	}
+	if (gfp & __GFP_WAIT)
+		finish_wait(&pool->wait, &wait);
+
+	return tag;
+}
+EXPORT_SYMBOL_GPL(percpu_ida_alloc);
+
+/**
+ * percpu_ida_free - free a tag
+ * @pool: pool @tag was allocated from
+ * @tag: a tag previously allocated with percpu_ida_alloc()
+ *
+ * Safe to be called from interrupt context.
+ */
+void percpu_ida_free(struct percpu_ida *pool, unsigned tag)
+{
+	struct percpu_ida_cpu *tags;
+	unsigned long flags;
+	unsigned nr_free;
+
+	BUG_ON(tag >= pool->nr_tags);
+
+	local_irq_save(flags);
+	tags = pool_cpu(pool, smp_processor_id());
+
+	spin_lock(&tags->lock);
+	tags->freelist[tags->nr_free++] = tag;
+
+	nr_free = tags->nr_free;
+	spin_unlock(&tags->lock);
+
+	if (nr_free == 1) {
+		cpumask_set_cpu(smp_processor_id(),
+				&pool->cpus_have_tags);
+		wake_up(&pool->wait);
+	}
+
+	if (nr_free == pool->percpu_max_size) {
+		spin_lock(&pool->lock);
+
+		/*
+		 * Global lock held and irqs disabled, don't need percpu
+		 * lock
+		 */
+		if (tags->nr_free == pool->percpu_max_size) {
+			move_tags(pool->freelist, &pool->nr_free,
+				  tags->freelist, &tags->nr_free,
+				  pool->percpu_batch_size);
+
+			wake_up(&pool->wait);
+		}
+		spin_unlock(&pool->lock);
+	}
+
+	local_irq_restore(flags);
+}
+EXPORT_SYMBOL_GPL(percpu_ida_free);
+
+/**
+ * percpu_ida_destroy - release a tag pool's resources
+ * @pool: pool to free
+ *
+ * Frees the resources allocated by percpu_ida_init().
+ */
+void percpu_ida_destroy(struct percpu_ida *pool)
+{
+	kfree(pool->tag_cpu);
+	kfree(pool->freelist);
+}
+EXPORT_SYMBOL_GPL(percpu_ida_destroy);
+
+/**
+ * percpu_ida_init - initialize a percpu tag pool
+ * @pool: pool to initialize
+ * @nr_tags: number of tags that will be available for allocation
+ * @gfp: allocation flags for the pool's own memory
+ *
+ * Initializes @pool so that it can be used to allocate tags - integers in the
+ * range [0, nr_tags). Typically, they'll be used by driver code to refer to a
+ * preallocated array of tag structures.
+ *
+ * The per-CPU caches are sized so that roughly half of the tags at most
+ * are parked on CPUs; anything stranded there is stolen back on demand.
+ * Since the memory is not allocated with alloc_percpu(), @gfp may be
+ * GFP_ATOMIC and the pool can be (re)built under a spinlock.
+ *
+ * Tags are handed out lowest first while the pool is lightly used.
+ */
+int percpu_ida_init(struct percpu_ida *pool, unsigned long nr_tags, gfp_t gfp)
+{
+	unsigned i, cpu;
+
+	memset(pool, 0, sizeof(*pool));
+
+	init_waitqueue_head(&pool->wait);
+	spin_lock_init(&pool->lock);
+	pool->nr_tags = nr_tags;
+
+	pool->percpu_max_size = nr_tags / (2 * num_possible_cpus());
+	pool->percpu_max_size = clamp_t(unsigned, pool->percpu_max_size,
+					2, IDA_PCPU_SIZE);
+	pool->percpu_batch_size = max(pool->percpu_max_size / 2, 1U);
+
+	/* Guard against overflow */
+	if (nr_tags > (unsigned) INT_MAX + 1) {
+		printk(KERN_ERR "percpu_ida_init(): nr_tags too large\n");
+		return -EINVAL;
+	}
+
+	pool->freelist = kmalloc(sizeof(unsigned) * nr_tags, gfp);
+	if (!pool->freelist)
+		return -ENOMEM;
+
+	/* the freelist is a stack: put the lowest tags on top */
+	for (i = 0; i < nr_tags; i++)
+		pool->freelist[i] = nr_tags - 1 - i;
+
+	pool->nr_free = nr_tags;
+
+	pool->tag_cpu = kcalloc(nr_cpu_ids, sizeof(struct percpu_ida_cpu),
+				gfp);
+	if (!pool->tag_cpu)
+		goto err;
+
+	for_each_possible_cpu(cpu)
+		spin_lock_init(&pool_cpu(pool, cpu)->lock);
+
+	return 0;
+err:
+	percpu_ida_destroy(pool);
+	return -ENOMEM;
+}
+EXPORT_SYMBOL_GPL(percpu_ida_init);
+
+/**
+ * percpu_ida_mark_busy - remove tags that are already in use from a pool
+ * @pool: freshly initialized pool
+ * @map: bitmap of tags in use
+ * @nbits: number of bits in @map
+ *
+ * Used when a pool replaces an older one while tags handed out by the old
+ * pool are still outstanding; those tags may later be freed to @pool.
+ * Must be called before any tag is allocated from @pool.
+ */
+void percpu_ida_mark_busy(struct percpu_ida *pool, const unsigned long *map,
+			  unsigned long nbits)
+{
+	unsigned long flags;
+	unsigned i, nr = 0;
+
+	nbits = min_t(unsigned long, nbits, pool->nr_tags);
+
+	spin_lock_irqsave(&pool->lock, flags);
+	for (i = 0; i < pool->nr_free; i++) {
+		unsigned tag = pool->freelist[i];
+
+		if (tag < nbits && test_bit(tag, map))
+			continue;
+		pool->freelist[nr++] = tag;
+	}
+	pool->nr_free = nr;
+	spin_unlock_irqrestore(&pool->lock, flags);
+}
+EXPORT_SYMBOL_GPL(percpu_ida_mark_busy);
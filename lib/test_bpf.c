@@ -0,0 +1,357 @@
+/*
+ * Cross-check the BPF JIT compiler against the sk_run_filter() interpreter.
+ *
+ * Every filter of the corpus below is compiled, then run on a few
+ * packets (linear, paged and truncated) through both the interpreter and
+ * the generated code; any difference in the return value is reported.
+ * Filters the JIT must leave to the interpreter are checked for that.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2
+ * of the License.
+ */
+#include <linux/init.h>
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/skbuff.h>
+#include <linux/netdevice.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+#include <linux/if_vlan.h>
+#include <linux/filter.h>
+#include <net/net_namespace.h>
+
+#define MAX_INSNS	32
+
+struct bpf_test {
+	const char *descr;
+	struct sock_filter insns[MAX_INSNS];
+	int len;
+};
+
+#define BPF_TEST(name, ...)						\
+	{								\
+		.descr = name,						\
+		.insns = { __VA_ARGS__ },				\
+		.len = ARRAY_SIZE(((struct sock_filter []){ __VA_ARGS__ })), \
+	}
+
+#define LD_AD(ad)	BPF_STMT(BPF_LD|BPF_W|BPF_ABS, SKF_AD_OFF + (ad))
+
+static struct bpf_test tests[] __initdata = {
+	BPF_TEST("ret_k",
+		BPF_STMT(BPF_RET|BPF_K, 0xffff)),
+	/* tcpdump -dd "ip and tcp dst port 22" */
+	BPF_TEST("ip_tcp_port_22",
+		BPF_STMT(BPF_LD|BPF_H|BPF_ABS, 12),
+		BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, ETH_P_IP, 0, 8),
+		BPF_STMT(BPF_LD|BPF_B|BPF_ABS, 23),
+		BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, IPPROTO_TCP, 0, 6),
+		BPF_STMT(BPF_LD|BPF_H|BPF_ABS, 20),
+		BPF_JUMP(BPF_JMP|BPF_JSET|BPF_K, 0x1fff, 4, 0),
+		BPF_STMT(BPF_LDX|BPF_B|BPF_MSH, 14),
+		BPF_STMT(BPF_LD|BPF_H|BPF_IND, 16),
+		BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, 22, 0, 1),
+		BPF_STMT(BPF_RET|BPF_K, 0xffff),
+		BPF_STMT(BPF_RET|BPF_K, 0)),
+	BPF_TEST("alu_k",
+		BPF_STMT(BPF_LD|BPF_IMM, 0x12345678),
+		BPF_STMT(BPF_ALU|BPF_ADD|BPF_K, 0x11),
+		BPF_STMT(BPF_ALU|BPF_SUB|BPF_K, 0x1000),
+		BPF_STMT(BPF_ALU|BPF_MUL|BPF_K, 3),
+		BPF_STMT(BPF_ALU|BPF_MUL|BPF_K, 0x10001),
+		BPF_STMT(BPF_ALU|BPF_DIV|BPF_K, 7),
+		BPF_STMT(BPF_ALU|BPF_AND|BPF_K, 0xfff0ff),
+		BPF_STMT(BPF_ALU|BPF_OR|BPF_K, 0x80000000),
+		BPF_STMT(BPF_ALU|BPF_LSH|BPF_K, 3),
+		BPF_STMT(BPF_ALU|BPF_RSH|BPF_K, 5),
+		BPF_STMT(BPF_ALU|BPF_AND|BPF_K, 0xffffff0f),
+		BPF_STMT(BPF_ALU|BPF_NEG, 0),
+		BPF_STMT(BPF_RET|BPF_A, 0)),
+	BPF_TEST("alu_x",
+		BPF_STMT(BPF_LDX|BPF_IMM, 7),
+		BPF_STMT(BPF_LD|BPF_W|BPF_LEN, 0),
+		BPF_STMT(BPF_ALU|BPF_ADD|BPF_X, 0),
+		BPF_STMT(BPF_MISC|BPF_TAX, 0),
+		BPF_STMT(BPF_LD|BPF_IMM, 100000),
+		BPF_STMT(BPF_ALU|BPF_MUL|BPF_X, 0),
+		BPF_STMT(BPF_ALU|BPF_SUB|BPF_X, 0),
+		BPF_STMT(BPF_ALU|BPF_DIV|BPF_X, 0),
+		BPF_STMT(BPF_ALU|BPF_OR|BPF_X, 0),
+		BPF_STMT(BPF_ALU|BPF_AND|BPF_X, 0),
+		BPF_STMT(BPF_LDX|BPF_IMM, 4),
+		BPF_STMT(BPF_ALU|BPF_LSH|BPF_X, 0),
+		BPF_STMT(BPF_LDX|BPF_IMM, 2),
+		BPF_STMT(BPF_ALU|BPF_RSH|BPF_X, 0),
+		BPF_STMT(BPF_MISC|BPF_TXA, 0),
+		BPF_STMT(BPF_RET|BPF_A, 0)),
+	BPF_TEST("div_x_zero",
+		BPF_STMT(BPF_LDX|BPF_IMM, 0),
+		BPF_STMT(BPF_LD|BPF_IMM, 10),
+		BPF_STMT(BPF_ALU|BPF_DIV|BPF_X, 0),
+		BPF_STMT(BPF_RET|BPF_K, 1)),
+	BPF_TEST("mem",
+		BPF_STMT(BPF_LD|BPF_IMM, 5),
+		BPF_STMT(BPF_ST, 0),
+		BPF_STMT(BPF_LDX|BPF_IMM, 9),
+		BPF_STMT(BPF_STX, 15),
+		BPF_STMT(BPF_LD|BPF_MEM, 3),	/* never written: 0 */
+		BPF_STMT(BPF_MISC|BPF_TAX, 0),
+		BPF_STMT(BPF_LD|BPF_MEM, 0),
+		BPF_STMT(BPF_ALU|BPF_ADD|BPF_X, 0),
+		BPF_STMT(BPF_LDX|BPF_MEM, 15),
+		BPF_STMT(BPF_ALU|BPF_ADD|BPF_X, 0),
+		BPF_STMT(BPF_RET|BPF_A, 0)),
+	BPF_TEST("jmp_k",
+		BPF_STMT(BPF_LD|BPF_W|BPF_LEN, 0),
+		BPF_JUMP(BPF_JMP|BPF_JGE|BPF_K, 60, 1, 0),
+		BPF_STMT(BPF_JMP|BPF_JA, 2),
+		BPF_STMT(BPF_LD|BPF_IMM, 1),
+		BPF_STMT(BPF_RET|BPF_A, 0),
+		BPF_STMT(BPF_LD|BPF_IMM, 2),
+		BPF_STMT(BPF_RET|BPF_A, 0)),
+	BPF_TEST("jmp_x",
+		BPF_STMT(BPF_LDX|BPF_W|BPF_LEN, 0),
+		BPF_STMT(BPF_LD|BPF_IMM, 60),
+		BPF_JUMP(BPF_JMP|BPF_JGT|BPF_X, 0, 3, 0),
+		BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_X, 0, 1, 0),
+		BPF_STMT(BPF_RET|BPF_K, 1),
+		BPF_STMT(BPF_RET|BPF_K, 2),
+		BPF_STMT(BPF_RET|BPF_K, 3)),
+	BPF_TEST("jset_jge_x",
+		BPF_STMT(BPF_LD|BPF_B|BPF_ABS, 14),
+		BPF_STMT(BPF_LDX|BPF_IMM, 0x40),
+		BPF_JUMP(BPF_JMP|BPF_JSET|BPF_X, 0, 1, 0),
+		BPF_STMT(BPF_RET|BPF_K, 7),
+		BPF_JUMP(BPF_JMP|BPF_JGE|BPF_X, 0, 0, 1),
+		BPF_STMT(BPF_RET|BPF_K, 9),
+		BPF_STMT(BPF_RET|BPF_K, 10)),
+	BPF_TEST("ld_out_of_bounds",
+		BPF_STMT(BPF_LD|BPF_W|BPF_ABS, 1000),
+		BPF_STMT(BPF_RET|BPF_K, 1)),
+	BPF_TEST("ld_ind_out_of_bounds",
+		BPF_STMT(BPF_LDX|BPF_IMM, 58),
+		BPF_STMT(BPF_LD|BPF_H|BPF_IND, 1),
+		BPF_STMT(BPF_RET|BPF_K, 1)),
+	BPF_TEST("ld_ind",
+		BPF_STMT(BPF_LDX|BPF_IMM, 14),
+		BPF_STMT(BPF_LD|BPF_B|BPF_IND, 9),
+		BPF_STMT(BPF_ST, 1),
+		BPF_STMT(BPF_LD|BPF_W|BPF_IND, 12),
+		BPF_STMT(BPF_LDX|BPF_MEM, 1),
+		BPF_STMT(BPF_ALU|BPF_ADD|BPF_X, 0),
+		BPF_STMT(BPF_RET|BPF_A, 0)),
+	BPF_TEST("ld_msh",
+		BPF_STMT(BPF_LD|BPF_IMM, 0x55),
+		BPF_STMT(BPF_LDX|BPF_B|BPF_MSH, 14),
+		BPF_STMT(BPF_ALU|BPF_ADD|BPF_X, 0),
+		BPF_STMT(BPF_RET|BPF_A, 0)),
+	BPF_TEST("ld_negative_offsets",
+		BPF_STMT(BPF_LD|BPF_W|BPF_ABS, SKF_NET_OFF + 12),
+		BPF_STMT(BPF_MISC|BPF_TAX, 0),
+		BPF_STMT(BPF_LD|BPF_B|BPF_ABS, SKF_LL_OFF + 13),
+		BPF_STMT(BPF_ALU|BPF_ADD|BPF_X, 0),
+		BPF_STMT(BPF_RET|BPF_A, 0)),
+	BPF_TEST("ld_ancillary",
+		LD_AD(SKF_AD_PROTOCOL),
+		BPF_STMT(BPF_MISC|BPF_TAX, 0),
+		LD_AD(SKF_AD_PKTTYPE),
+		BPF_STMT(BPF_ALU|BPF_LSH|BPF_K, 16),
+		BPF_STMT(BPF_ALU|BPF_ADD|BPF_X, 0),
+		BPF_STMT(BPF_MISC|BPF_TAX, 0),
+		LD_AD(SKF_AD_MARK),
+		BPF_STMT(BPF_ALU|BPF_ADD|BPF_X, 0),
+		BPF_STMT(BPF_MISC|BPF_TAX, 0),
+		LD_AD(SKF_AD_QUEUE),
+		BPF_STMT(BPF_ALU|BPF_ADD|BPF_X, 0),
+		BPF_STMT(BPF_MISC|BPF_TAX, 0),
+		LD_AD(SKF_AD_RXHASH),
+		BPF_STMT(BPF_ALU|BPF_ADD|BPF_X, 0),
+		BPF_STMT(BPF_MISC|BPF_TAX, 0),
+		LD_AD(SKF_AD_VLAN_TAG),
+		BPF_STMT(BPF_ALU|BPF_ADD|BPF_X, 0),
+		BPF_STMT(BPF_MISC|BPF_TAX, 0),
+		LD_AD(SKF_AD_VLAN_TAG_PRESENT),
+		BPF_STMT(BPF_ALU|BPF_ADD|BPF_X, 0),
+		BPF_STMT(BPF_MISC|BPF_TAX, 0),
+		LD_AD(SKF_AD_CPU),
+		BPF_STMT(BPF_ALU|BPF_ADD|BPF_X, 0),
+		BPF_STMT(BPF_MISC|BPF_TAX, 0),
+		BPF_STMT(BPF_LD|BPF_IMM, 0xa5a5a5a5),
+		LD_AD(SKF_AD_ALU_XOR_X),
+		BPF_STMT(BPF_RET|BPF_A, 0)),
+	BPF_TEST("ld_ancillary_dev",
+		LD_AD(SKF_AD_IFINDEX),
+		BPF_STMT(BPF_MISC|BPF_TAX, 0),
+		LD_AD(SKF_AD_HATYPE),
+		BPF_STMT(BPF_ALU|BPF_ADD|BPF_X, 0),
+		BPF_STMT(BPF_RET|BPF_A, 0)),
+	/* X + K in the ancillary range is a failed load, not metadata */
+	BPF_TEST("ld_ind_ancillary",
+		BPF_STMT(BPF_LDX|BPF_IMM, 0),
+		BPF_STMT(BPF_LD|BPF_W|BPF_IND, SKF_AD_OFF + SKF_AD_PROTOCOL),
+		BPF_STMT(BPF_RET|BPF_A, 0)),
+	BPF_TEST("ld_ind_ancillary_x",
+		BPF_STMT(BPF_LDX|BPF_IMM, SKF_AD_OFF),
+		BPF_STMT(BPF_LD|BPF_H|BPF_IND, SKF_AD_PROTOCOL),
+		BPF_STMT(BPF_RET|BPF_K, 1)),
+};
+
+/* Ethernet + IPv4 + TCP header, 10.0.0.1:1234 -> 10.0.0.2:22 */
+static const u8 test_pkt[60] __initconst = {
+	0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77,
+	0x88, 0x99, 0xaa, 0xbb, 0x08, 0x00, 0x45, 0x00,
+	0x00, 0x2e, 0x12, 0x34, 0x40, 0x00, 0x40, 0x06,
+	0x00, 0x00, 0x0a, 0x00, 0x00, 0x01, 0x0a, 0x00,
+	0x00, 0x02, 0x04, 0xd2, 0x00, 0x16, 0x00, 0x00,
+	0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x50, 0x02,
+	0x20, 0x00, 0x00, 0x00, 0x00, 0x00, 0xde, 0xad,
+	0xbe, 0xef, 0x01, 0x02,
+};
+
+enum {
+	SKB_LINEAR,
+	SKB_PAGED,
+	SKB_TRUNCATED,
+	SKB_MAX,
+};
+
+static struct sk_buff *__init test_skb_alloc(int type)
+{
+	unsigned int headlen = sizeof(test_pkt);
+	struct sk_buff *skb;
+
+	skb = alloc_skb(sizeof(test_pkt), GFP_KERNEL);
+	if (!skb)
+		return NULL;
+
+	if (type == SKB_PAGED)
+		headlen = 20;
+	else if (type == SKB_TRUNCATED)
+		headlen = 10;
+	memcpy(skb_put(skb, headlen), test_pkt, headlen);
+
+	if (type == SKB_PAGED) {
+		struct page *page = alloc_page(GFP_KERNEL);
+
+		if (!page) {
+			kfree_skb(skb);
+			return NULL;
+		}
+		memcpy(page_address(page), test_pkt + headlen,
+		       sizeof(test_pkt) - headlen);
+		skb_fill_page_desc(skb, 0, page, 0, sizeof(test_pkt) - headlen);
+		skb->len += sizeof(test_pkt) - headlen;
+		skb->data_len = sizeof(test_pkt) - headlen;
+		skb->truesize += PAGE_SIZE;
+	}
+
+	skb_reset_mac_header(skb);
+	skb_set_network_header(skb, ETH_HLEN);
+	skb->protocol = htons(ETH_P_IP);
+	skb->pkt_type = PACKET_HOST;
+	skb->mark = 0x1234;
+	skb->queue_mapping = 3;
+	skb->rxhash = 0xbeef;
+	skb->vlan_tci = VLAN_TAG_PRESENT | 42;
+
+	if (type == SKB_TRUNCATED) {
+		skb->pkt_type = PACKET_OUTGOING;
+		skb->vlan_tci = 0;
+		skb->dev = init_net.loopback_dev;
+	}
+	return skb;
+}
+
+static int __init test_bpf_run(struct bpf_test *t, struct sk_buff **skbs)
+{
+	struct sk_filter *fp;
+	int i, err = 0;
+
+	fp = kmalloc(sizeof(*fp) + t->len * sizeof(struct sock_filter),
+		     GFP_KERNEL);
+	if (!fp)
+		return -ENOMEM;
+
+	fp->len = t->len;
+	memcpy(fp->insns, t->insns, t->len * sizeof(struct sock_filter));
+	fp->bpf_func = sk_run_filter;
+
+	if (sk_chk_filter(fp->insns, fp->len)) {
+		pr_err("test_bpf: %s: rejected by sk_chk_filter\n", t->descr);
+		kfree(fp);
+		return -EINVAL;
+	}
+
+	bpf_jit_compile(fp);
+	if (fp->bpf_func == sk_run_filter) {
+		pr_err("test_bpf: %s: not compiled\n", t->descr);
+		bpf_jit_free(fp);
+		kfree(fp);
+		return -EINVAL;
+	}
+
+	for (i = 0; i < SKB_MAX; i++) {
+		unsigned int ret_interp, ret_jit;
+
+		/* SKF_AD_CPU must see the same cpu in both runs */
+		preempt_disable();
+		ret_interp = sk_run_filter(skbs[i], fp->insns, fp->len);
+		ret_jit = SK_RUN_FILTER(fp, skbs[i]);
+		preempt_enable();
+
+		if (ret_interp != ret_jit) {
+			pr_err("test_bpf: %s: skb %d: interpreter %u, jit %u\n",
+			       t->descr, i, ret_interp, ret_jit);
+			err = -EINVAL;
+		}
+	}
+
+	bpf_jit_free(fp);
+	kfree(fp);
+	return err;
+}
+
+static int __init test_bpf_init(void)
+{
+	struct sk_buff *skbs[SKB_MAX] = { NULL };
+	int old_enable = bpf_jit_enable;
+	int i, failed = 0;
+
+	for (i = 0; i < SKB_MAX; i++) {
+		skbs[i] = test_skb_alloc(i);
+		if (!skbs[i]) {
+			failed = -ENOMEM;
+			goto out;
+		}
+	}
+
+	/* keep the debug dump mode if it was asked for */
+	if (!bpf_jit_enable)
+		bpf_jit_enable = 1;
+
+	for (i = 0; i < ARRAY_SIZE(tests); i++)
+		if (test_bpf_run(&tests[i], skbs))
+			failed++;
+
+	bpf_jit_enable = old_enable;
+
+	pr_info("test_bpf: %d tests, %d failed\n", (int)ARRAY_SIZE(tests),
+		failed);
+	if (failed)
+		failed = -EINVAL;
+out:
+	for (i = 0; i < SKB_MAX; i++)
+		kfree_skb(skbs[i]);
+	return failed;
+}
+
+static void __exit test_bpf_exit(void)
+{
+}
+
+module_init(test_bpf_init);
+module_exit(test_bpf_exit);
+MODULE_LICENSE("GPL");
@@ -343,6 +343,12 @@ static const struct net_device_ops br_netdev_ops = {
 #endif
 };
 
+static void br_dev_free(struct net_device *dev)
+{
+	br_fdb_free(netdev_priv(dev));
+	free_netdev(dev);
+}
+
 void br_dev_setup(struct net_device *dev)
 {
 	random_ether_addr(dev->dev_addr);
@@ -352,7 +358,8 @@ void br_dev_setup(struct net_device *dev)
 #ifdef CONFIG_NET_POLL_CONTROLLER
 	netdev_extended(dev)->netpoll_data.ndo_netpoll_setup = br_netpoll_setup;
 #endif
-	dev->destructor = free_netdev;
+	netdev_extended(dev)->ndo_fdb_dump = br_fdb_dump;
+	dev->destructor = br_dev_free;
 	SET_ETHTOOL_OPS(dev, &br_ethtool_ops);
 	dev->tx_queue_len = 0;
 	dev->priv_flags = IFF_EBRIDGE;
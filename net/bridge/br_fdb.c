@@ -20,6 +20,10 @@
 #include <linux/etherdevice.h>
 #include <linux/jhash.h>
 #include <linux/random.h>
+#include <linux/slab.h>
+#include <linux/neighbour.h>
+#include <net/netlink.h>
+#include <net/rtnetlink.h>
 #include <asm/atomic.h>
 #include <asm/unaligned.h>
 #include "br_private.h"
@@ -27,6 +31,8 @@
 static struct kmem_cache *br_fdb_cache __read_mostly;
 static int fdb_insert(struct net_bridge *br, struct net_bridge_port *source,
 		      const unsigned char *addr);
+static void fdb_notify(struct net_bridge *br,
+		       const struct net_bridge_fdb_entry *fdb, int type);
 
 static u32 fdb_salt __read_mostly;
 
@@ -64,11 +70,12 @@ static inline int has_expired(const struct net_bridge *br,
 		&& time_before_eq(fdb->ageing_timer + hold_time(br), jiffies);
 }
 
-static inline int br_mac_hash(const unsigned char *mac)
+static inline int br_mac_hash(const struct net_bridge_fdb_htable *tbl,
+			      const unsigned char *mac)
 {
 	/* use 1 byte of OUI cnd 3 bytes of NIC */
 	u32 key = get_unaligned((u32 *)(mac + 2));
-	return jhash_1word(key, fdb_salt) & (BR_HASH_SIZE - 1);
+	return jhash_1word(key, fdb_salt) & (tbl->max - 1);
 }
 
 static void fdb_rcu_free(struct rcu_head *head)
@@ -78,26 +85,141 @@ static void fdb_rcu_free(struct rcu_head *head)
 	kmem_cache_free(br_fdb_cache, ent);
 }
 
-static inline void fdb_delete(struct net_bridge_fdb_entry *f)
+static inline void fdb_delete(struct net_bridge *br,
+			      struct net_bridge_fdb_entry *f)
 {
-	hlist_del_rcu(&f->hlist);
+	struct net_bridge_fdb_htable *tbl = br->fdb;
+
+	fdb_notify(br, f, RTM_DELNEIGH);
+	hlist_del_rcu(&f->hlist[tbl->ver]);
+	tbl->size--;
 	call_rcu(&f->rcu, fdb_rcu_free);
 }
 
+static struct net_bridge_fdb_htable *fdb_htable_alloc(u32 max, gfp_t flags)
+{
+	struct net_bridge_fdb_htable *tbl;
+
+	tbl = kzalloc(sizeof(*tbl), flags);
+	if (!tbl)
+		return NULL;
+
+	tbl->hash = kcalloc(max, sizeof(*tbl->hash), flags);
+	if (!tbl->hash) {
+		kfree(tbl);
+		return NULL;
+	}
+	tbl->max = max;
+
+	return tbl;
+}
+
+static void fdb_htable_free_old(struct rcu_head *head)
+{
+	struct net_bridge_fdb_htable *tbl =
+		container_of(head, struct net_bridge_fdb_htable, rcu);
+	struct net_bridge_fdb_htable *old = tbl->old;
+
+	tbl->old = NULL;
+	kfree(old->hash);
+	kfree(old);
+}
+
+int br_fdb_alloc(struct net_bridge *br)
+{
+	br->fdb = fdb_htable_alloc(BR_HASH_SIZE, GFP_KERNEL);
+	return br->fdb ? 0 : -ENOMEM;
+}
+
+/* Called from the bridge device destructor, all entries are gone. */
+void br_fdb_free(struct net_bridge *br)
+{
+	struct net_bridge_fdb_htable *tbl = br->fdb;
+
+	if (!tbl)
+		return;
+
+	/* wait for the previous table of a recent resize to be freed */
+	if (tbl->old)
+		rcu_barrier();
+	kfree(tbl->hash);
+	kfree(tbl);
+	br->fdb = NULL;
+}
+
+/*
+ * Grow the hash table once it holds more entries than buckets.  The
+ * entries are linked into the new table through their second hlist
+ * node, so lookups racing with the resize keep walking the old table
+ * undisturbed until the new one is published.
+ */
+void br_fdb_rehash(struct work_struct *work)
+{
+	struct net_bridge *br = container_of(work, struct net_bridge,
+					     fdb_rehash_work);
+	struct net_bridge_fdb_htable *old, *tbl;
+	struct net_bridge_fdb_entry *f;
+	struct hlist_node *h;
+	u32 max;
+	int i;
+
+	spin_lock_bh(&br->hash_lock);
+	old = br->fdb;
+	max = old->max;
+	while (max < old->size && max < BR_FDB_HASH_MAX)
+		max <<= 1;
+	if (max == old->max)
+		max = 0;
+	spin_unlock_bh(&br->hash_lock);
+
+	if (!max)
+		return;
+
+	tbl = fdb_htable_alloc(max, GFP_KERNEL);
+	if (!tbl)
+		return;
+
+	spin_lock_bh(&br->hash_lock);
+	old = br->fdb;
+	/* the previous resize is still in its grace period, retry later */
+	if (old->old || old->max >= max) {
+		spin_unlock_bh(&br->hash_lock);
+		kfree(tbl->hash);
+		kfree(tbl);
+		return;
+	}
+
+	tbl->size = old->size;
+	tbl->ver = old->ver ^ 1;
+	tbl->old = old;
+	for (i = 0; i < old->max; i++)
+		hlist_for_each_entry(f, h, &old->hash[i], hlist[old->ver])
+			hlist_add_head(&f->hlist[tbl->ver],
+				       &tbl->hash[br_mac_hash(tbl, f->addr.addr)]);
+
+	rcu_assign_pointer(br->fdb, tbl);
+	spin_unlock_bh(&br->hash_lock);
+
+	call_rcu(&tbl->rcu, fdb_htable_free_old);
+}
+
 void br_fdb_changeaddr(struct net_bridge_port *p, const unsigned char *newaddr)
 {
 	struct net_bridge *br = p->br;
+	struct net_bridge_fdb_htable *tbl;
 	int i;
 
 	spin_lock_bh(&br->hash_lock);
 
 	/* Search all chains since old address/hash is unknown */
-	for (i = 0; i < BR_HASH_SIZE; i++) {
+	tbl = br->fdb;
+	for (i = 0; i < tbl->max; i++) {
 		struct hlist_node *h;
-		hlist_for_each(h, &br->hash[i]) {
+		hlist_for_each(h, &tbl->hash[i]) {
 			struct net_bridge_fdb_entry *f;
 
-			f = hlist_entry(h, struct net_bridge_fdb_entry, hlist);
+			f = hlist_entry(h, struct net_bridge_fdb_entry,
+					hlist[tbl->ver]);
 			if (f->dst == p && f->is_local) {
 				/* maybe another port has same hw addr? */
 				struct net_bridge_port *op;
@@ -111,7 +233,7 @@ void br_fdb_changeaddr(struct net_bridge_port *p, const unsigned char *newaddr)
 				}
 
 				/* delete old one */
-				fdb_delete(f);
+				fdb_delete(br, f);
 				goto insert;
 			}
 		}
@@ -128,20 +250,23 @@ void br_fdb_cleanup(unsigned long _data)
 	struct net_bridge *br = (struct net_bridge *)_data;
 	unsigned long delay = hold_time(br);
 	unsigned long next_timer = jiffies + br->forward_delay;
+	struct net_bridge_fdb_htable *tbl;
 	int i;
 
 	spin_lock_bh(&br->hash_lock);
-	for (i = 0; i < BR_HASH_SIZE; i++) {
+	tbl = br->fdb;
+	for (i = 0; i < tbl->max; i++) {
 		struct net_bridge_fdb_entry *f;
 		struct hlist_node *h, *n;
 
-		hlist_for_each_entry_safe(f, h, n, &br->hash[i], hlist) {
+		hlist_for_each_entry_safe(f, h, n, &tbl->hash[i],
+					  hlist[tbl->ver]) {
 			unsigned long this_timer;
 			if (f->is_static)
 				continue;
 			this_timer = f->ageing_timer + delay;
 			if (time_before_eq(this_timer, jiffies))
-				fdb_delete(f);
+				fdb_delete(br, f);
 			else if (time_before(this_timer, next_timer))
 				next_timer = this_timer;
 		}
@@ -156,15 +281,18 @@ void br_fdb_cleanup(unsigned long _data)
 /* Completely flush all dynamic entries in forwarding database.*/
 void br_fdb_flush(struct net_bridge *br)
 {
+	struct net_bridge_fdb_htable *tbl;
 	int i;
 
 	spin_lock_bh(&br->hash_lock);
-	for (i = 0; i < BR_HASH_SIZE; i++) {
+	tbl = br->fdb;
+	for (i = 0; i < tbl->max; i++) {
 		struct net_bridge_fdb_entry *f;
 		struct hlist_node *h, *n;
-		hlist_for_each_entry_safe(f, h, n, &br->hash[i], hlist) {
+		hlist_for_each_entry_safe(f, h, n, &tbl->hash[i],
+					  hlist[tbl->ver]) {
 			if (!f->is_static)
-				fdb_delete(f);
+				fdb_delete(br, f);
 		}
 	}
 	spin_unlock_bh(&br->hash_lock);
@@ -177,15 +305,18 @@ void br_fdb_delete_by_port(struct net_bridge *br,
 			   const struct net_bridge_port *p,
 			   int do_all)
 {
+	struct net_bridge_fdb_htable *tbl;
 	int i;
 
 	spin_lock_bh(&br->hash_lock);
-	for (i = 0; i < BR_HASH_SIZE; i++) {
+	tbl = br->fdb;
+	for (i = 0; i < tbl->max; i++) {
 		struct hlist_node *h, *g;
 
-		hlist_for_each_safe(h, g, &br->hash[i]) {
+		hlist_for_each_safe(h, g, &tbl->hash[i]) {
 			struct net_bridge_fdb_entry *f
-				= hlist_entry(h, struct net_bridge_fdb_entry, hlist);
+				= hlist_entry(h, struct net_bridge_fdb_entry,
+					      hlist[tbl->ver]);
 			if (f->dst != p)
 				continue;
 
@@ -208,7 +339,7 @@ void br_fdb_delete_by_port(struct net_bridge *br,
 				}
 			}
 
-			fdb_delete(f);
+			fdb_delete(br, f);
 		skip_delete: ;
 		}
 	}
@@ -219,10 +350,12 @@ void br_fdb_delete_by_port(struct net_bridge *br,
 struct net_bridge_fdb_entry *__br_fdb_get(struct net_bridge *br,
 					  const unsigned char *addr)
 {
+	struct net_bridge_fdb_htable *tbl = rcu_dereference(br->fdb);
 	struct hlist_node *h;
 	struct net_bridge_fdb_entry *fdb;
 
-	hlist_for_each_entry_rcu(fdb, h, &br->hash[br_mac_hash(addr)], hlist) {
+	hlist_for_each_entry_rcu(fdb, h, &tbl->hash[br_mac_hash(tbl, addr)],
+				 hlist[tbl->ver]) {
 		if (!compare_ether_addr(fdb->addr.addr, addr)) {
 			if (unlikely(has_expired(br, fdb)))
 				break;
@@ -263,14 +396,17 @@ int br_fdb_fillbuf(struct net_bridge *br, void *buf,
 {
 	struct __fdb_entry *fe = buf;
 	int i, num = 0;
+	struct net_bridge_fdb_htable *tbl;
 	struct hlist_node *h;
 	struct net_bridge_fdb_entry *f;
 
 	memset(buf, 0, maxnum*sizeof(struct __fdb_entry));
 
 	rcu_read_lock();
-	for (i = 0; i < BR_HASH_SIZE; i++) {
-		hlist_for_each_entry_rcu(f, h, &br->hash[i], hlist) {
+	tbl = rcu_dereference(br->fdb);
+	for (i = 0; i < tbl->max; i++) {
+		hlist_for_each_entry_rcu(f, h, &tbl->hash[i],
+					 hlist[tbl->ver]) {
 			if (num >= maxnum)
 				goto out;
 
@@ -303,35 +439,42 @@ int br_fdb_fillbuf(struct net_bridge *br, void *buf,
 	return num;
 }
 
-static inline struct net_bridge_fdb_entry *fdb_find(struct hlist_head *head,
-						    const unsigned char *addr)
+static inline struct net_bridge_fdb_entry *fdb_find(
+	const struct net_bridge_fdb_htable *tbl, const unsigned char *addr)
 {
 	struct hlist_node *h;
 	struct net_bridge_fdb_entry *fdb;
 
-	hlist_for_each_entry_rcu(fdb, h, head, hlist) {
+	hlist_for_each_entry_rcu(fdb, h, &tbl->hash[br_mac_hash(tbl, addr)],
+				 hlist[tbl->ver]) {
 		if (!compare_ether_addr(fdb->addr.addr, addr))
 			return fdb;
 	}
 	return NULL;
 }
 
-static struct net_bridge_fdb_entry *fdb_create(struct hlist_head *head,
+/* Called with hash_lock held. */
+static struct net_bridge_fdb_entry *fdb_create(struct net_bridge *br,
 					       struct net_bridge_port *source,
 					       const unsigned char *addr,
 					       int is_local)
 {
+	struct net_bridge_fdb_htable *tbl = br->fdb;
 	struct net_bridge_fdb_entry *fdb;
 
 	fdb = kmem_cache_alloc(br_fdb_cache, GFP_ATOMIC);
 	if (fdb) {
 		memcpy(fdb->addr.addr, addr, ETH_ALEN);
-		hlist_add_head_rcu(&fdb->hlist, head);
-
 		fdb->dst = source;
 		fdb->is_local = is_local;
 		fdb->is_static = is_local;
 		fdb->ageing_timer = jiffies;
+		hlist_add_head_rcu(&fdb->hlist[tbl->ver],
+				   &tbl->hash[br_mac_hash(tbl, addr)]);
+
+		if (++tbl->size > tbl->max && tbl->max < BR_FDB_HASH_MAX)
+			schedule_work(&br->fdb_rehash_work);
+		fdb_notify(br, fdb, RTM_NEWNEIGH);
 	}
 	return fdb;
 }
@@ -339,13 +482,12 @@ static struct net_bridge_fdb_entry *fdb_create(struct hlist_head *head,
 static int fdb_insert(struct net_bridge *br, struct net_bridge_port *source,
 		  const unsigned char *addr)
 {
-	struct hlist_head *head = &br->hash[br_mac_hash(addr)];
 	struct net_bridge_fdb_entry *fdb;
 
 	if (!is_valid_ether_addr(addr))
 		return -EINVAL;
 
-	fdb = fdb_find(head, addr);
+	fdb = fdb_find(br->fdb, addr);
 	if (fdb) {
 		/* it is okay to have multiple ports with same
 		 * address, just use the first one.
@@ -356,10 +498,10 @@ static int fdb_insert(struct net_bridge *br, struct net_bridge_port *source,
 		printk(KERN_WARNING "%s adding interface with same address "
 		       "as a received packet\n",
 		       source->dev->name);
-		fdb_delete(fdb);
+		fdb_delete(br, fdb);
 	}
 
-	if (!fdb_create(head, source, addr, 1))
+	if (!fdb_create(br, source, addr, 1))
 		return -ENOMEM;
 
 	return 0;
@@ -379,7 +521,6 @@ int br_fdb_insert(struct net_bridge *br, struct net_bridge_port *source,
 void br_fdb_update(struct net_bridge *br, struct net_bridge_port *source,
 		   const unsigned char *addr)
 {
-	struct hlist_head *head = &br->hash[br_mac_hash(addr)];
 	struct net_bridge_fdb_entry *fdb;
 
 	/* some users want to always flood. */
@@ -391,7 +532,7 @@ void br_fdb_update(struct net_bridge *br, struct net_bridge_port *source,
 	      source->state == BR_STATE_FORWARDING))
 		return;
 
-	fdb = fdb_find(head, addr);
+	fdb = fdb_find(rcu_dereference(br->fdb), addr);
 	if (likely(fdb)) {
 		/* attempt to update an entry for a local interface */
 		if (unlikely(fdb->is_local)) {
@@ -400,17 +541,141 @@ void br_fdb_update(struct net_bridge *br, struct net_bridge_port *source,
 				       "own address as source address\n",
 				       source->dev->name);
 		} else {
-			/* fastpath: update of existing entry */
-			fdb->dst = source;
-			fdb->ageing_timer = jiffies;
+			unsigned long now = jiffies;
+
+			/*
+			 * fastpath: update of existing entry, written only
+			 * when it changes so that the cacheline of a busy
+			 * entry stays shared between the receiving CPUs
+			 */
+			if (unlikely(fdb->dst != source)) {
+				fdb->dst = source;
+				fdb_notify(br, fdb, RTM_NEWNEIGH);
+			}
+			if (unlikely(fdb->ageing_timer != now))
+				fdb->ageing_timer = now;
 		}
 	} else {
 		spin_lock(&br->hash_lock);
-		if (!fdb_find(head, addr))
-			fdb_create(head, source, addr, 0);
+		if (!fdb_find(br->fdb, addr))
+			fdb_create(br, source, addr, 0);
 		/* else  we lose race and someone else inserts
 		 * it first, don't bother updating
 		 */
 		spin_unlock(&br->hash_lock);
 	}
 }
+
+static inline u8 fdb_to_nud(const struct net_bridge_fdb_entry *fdb)
+{
+	if (fdb->is_local)
+		return NUD_PERMANENT;
+	else if (fdb->is_static)
+		return NUD_NOARP;
+	else
+		return NUD_REACHABLE;
+}
+
+static int fdb_fill_info(struct sk_buff *skb,
+			 const struct net_bridge_fdb_entry *fdb,
+			 u32 pid, u32 seq, int type, unsigned int flags)
+{
+	unsigned long now = jiffies;
+	struct nda_cacheinfo ci;
+	struct nlmsghdr *nlh;
+	struct ndmsg *ndm;
+
+	nlh = nlmsg_put(skb, pid, seq, type, sizeof(*ndm), flags);
+	if (nlh == NULL)
+		return -EMSGSIZE;
+
+	ndm = nlmsg_data(nlh);
+	ndm->ndm_family	 = AF_BRIDGE;
+	ndm->ndm_pad1    = 0;
+	ndm->ndm_pad2    = 0;
+	ndm->ndm_flags	 = NTF_MASTER;
+	ndm->ndm_type	 = 0;
+	ndm->ndm_ifindex = fdb->dst->dev->ifindex;
+	ndm->ndm_state   = fdb_to_nud(fdb);
+
+	NLA_PUT(skb, NDA_LLADDR, ETH_ALEN, &fdb->addr);
+
+	ci.ndm_used	 = jiffies_to_clock_t(now - fdb->ageing_timer);
+	ci.ndm_confirmed = 0;
+	ci.ndm_updated	 = ci.ndm_used;
+	ci.ndm_refcnt	 = 0;
+	NLA_PUT(skb, NDA_CACHEINFO, sizeof(ci), &ci);
+
+	return nlmsg_end(skb, nlh);
+
+nla_put_failure:
+	nlmsg_cancel(skb, nlh);
+	return -EMSGSIZE;
+}
+
+static inline size_t fdb_nlmsg_size(void)
+{
+	return NLMSG_ALIGN(sizeof(struct ndmsg))
+		+ nla_total_size(ETH_ALEN) /* NDA_LLADDR */
+		+ nla_total_size(sizeof(struct nda_cacheinfo));
+}
+
+/*
+ * Tell RTNLGRP_NEIGH listeners, e.g. a daemon mirroring the table into
+ * NIC or switch hardware, that an entry was added, moved or removed.
+ */
+static void fdb_notify(struct net_bridge *br,
+		       const struct net_bridge_fdb_entry *fdb, int type)
+{
+	struct net *net = dev_net(br->dev);
+	struct sk_buff *skb;
+	int err = -ENOBUFS;
+
+	skb = nlmsg_new(fdb_nlmsg_size(), GFP_ATOMIC);
+	if (skb == NULL)
+		goto errout;
+
+	err = fdb_fill_info(skb, fdb, 0, 0, type, 0);
+	if (err < 0) {
+		/* -EMSGSIZE implies BUG in fdb_nlmsg_size() */
+		WARN_ON(err == -EMSGSIZE);
+		kfree_skb(skb);
+		goto errout;
+	}
+	rtnl_notify(skb, net, 0, RTNLGRP_NEIGH, NULL, GFP_ATOMIC);
+	return;
+errout:
+	rtnl_set_sk_err(net, RTNLGRP_NEIGH, err);
+}
+
+/* Dump the forwarding table for RTM_GETNEIGH on PF_BRIDGE. */
+int br_fdb_dump(struct sk_buff *skb, struct netlink_callback *cb,
+		struct net_device *dev, int idx)
+{
+	struct net_bridge *br = netdev_priv(dev);
+	struct net_bridge_fdb_htable *tbl;
+	struct net_bridge_fdb_entry *f;
+	struct hlist_node *h;
+	int i;
+
+	rcu_read_lock();
+	tbl = rcu_dereference(br->fdb);
+	for (i = 0; i < tbl->max; i++) {
+		hlist_for_each_entry_rcu(f, h, &tbl->hash[i],
+					 hlist[tbl->ver]) {
+			if (idx < cb->args[0])
+				goto skip;
+
+			if (fdb_fill_info(skb, f, NETLINK_CB(cb->skb).pid,
+					  cb->nlh->nlmsg_seq, RTM_NEWNEIGH,
+					  NLM_F_MULTI) < 0)
+				goto out;
+skip:
+			++idx;
+		}
+	}
+out:
+	rcu_read_unlock();
+
+	return idx;
+}
@@ -20,6 +20,7 @@
 
 #define BR_HASH_BITS 8
 #define BR_HASH_SIZE (1 << BR_HASH_BITS)
+#define BR_FDB_HASH_MAX (1 << 14)
 
 #define BR_HOLD_TIME (1*HZ)
 
@@ -59,7 +60,7 @@ struct br_ip
 
 struct net_bridge_fdb_entry
 {
-	struct hlist_node		hlist;
+	struct hlist_node		hlist[2];
 	struct net_bridge_port		*dst;
 
 	struct rcu_head			rcu;
@@ -104,6 +105,16 @@ struct net_bridge_mdb_htable
 	u32				ver;
 };
 
+struct net_bridge_fdb_htable
+{
+	struct hlist_head		*hash;
+	struct rcu_head			rcu;
+	struct net_bridge_fdb_htable	*old;
+	u32				size;
+	u32				max;
+	u32				ver;
+};
+
 struct net_bridge_port
 {
 	struct net_bridge		*br;
@@ -158,7 +169,8 @@ struct net_bridge
 	struct list_head		port_list;
 	struct net_device		*dev;
 	spinlock_t			hash_lock;
-	struct hlist_head		hash[BR_HASH_SIZE];
+	struct net_bridge_fdb_htable	*fdb;
+	struct work_struct		fdb_rehash_work;
 	struct list_head		age_list;
 	unsigned long			feature_mask;
 #ifdef CONFIG_BRIDGE_NETFILTER
@@ -290,6 +302,9 @@ static inline void br_netpoll_disable(struct net_bridge_port *p)
 /* br_fdb.c */
 extern int br_fdb_init(void);
 extern void br_fdb_fini(void);
+extern int br_fdb_alloc(struct net_bridge *br);
+extern void br_fdb_free(struct net_bridge *br);
+extern void br_fdb_rehash(struct work_struct *work);
 extern void br_fdb_flush(struct net_bridge *br);
 extern void br_fdb_changeaddr(struct net_bridge_port *p,
 			      const unsigned char *newaddr);
@@ -304,6 +319,10 @@ extern int br_fdb_fillbuf(struct net_bridge *br, void *buf,
 extern int br_fdb_insert(struct net_bridge *br,
 			 struct net_bridge_port *source,
 			 const unsigned char *addr);
+extern int br_fdb_dump(struct sk_buff *skb,
+		       struct netlink_callback *cb,
+		       struct net_device *dev,
+		       int idx);
 extern void br_fdb_update(struct net_bridge *br,
 			  struct net_bridge_port *source,
 			  const unsigned char *addr);
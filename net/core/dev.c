@@ -181,6 +181,12 @@ static struct list_head ptype_base[PTYPE_HASH_SIZE] __read_mostly;
 static struct list_head ptype_all __read_mostly;	/* Taps */
 static struct list_head offload_base __read_mostly;
 
+/* protects napi_hash addition/deletion and napi_gen_id */
+static DEFINE_SPINLOCK(napi_hash_lock);
+
+static unsigned int napi_gen_id;
+static struct hlist_head napi_hash[256];
+
 /*
  * The @dev_base_head list is protected by @dev_base_lock and the rtnl
  * semaphore.
@@ -1693,6 +1699,12 @@ static void dev_queue_xmit_nit(struct sk_buff *skb, struct net_device *dev)
 
 			skb2->transport_header = skb2->network_header;
 			skb2->pkt_type = PACKET_OUTGOING;
+
+			/* Taps may keep the clone: no MSG_ZEROCOPY pages */
+			if (unlikely(skb_orphan_frags_rx(skb2, GFP_ATOMIC))) {
+				kfree_skb(skb2);
+				continue;
+			}
 			ptype->func(skb2, skb->dev, ptype, skb->dev);
 		}
 	}
@@ -2258,7 +2270,7 @@ int dev_hard_start_xmit(struct sk_buff *skb, struct net_device *dev,
 		 * features for the netdev
 		 */
 		if (skb->encapsulation)
-			features &= NETIF_F_SG;
+			features &= netdev_extended(dev)->hw_enc_features;
 
 		if (netif_needs_gso(skb, features)) {
 			if (unlikely(dev_gso_segment(skb, features)))
@@ -2336,7 +2348,7 @@ gso:
 			return rc;
 		}
 		txq_trans_update(txq);
-		if (unlikely(netif_tx_queue_stopped(txq) && skb->next))
+		if (unlikely(netif_xmit_stopped(txq) && skb->next))
 			return NETDEV_TX_BUSY;
 	} while (skb->next);
 
@@ -2611,7 +2623,7 @@ int dev_queue_xmit(struct sk_buff *skb)
 
 			HARD_TX_LOCK(dev, txq, cpu);
 
-			if (!netif_tx_queue_stopped(txq)) {
+			if (!netif_xmit_stopped(txq)) {
 				rc = NET_XMIT_SUCCESS;
 				if (!dev_hard_start_xmit(skb, dev, txq)) {
 					HARD_TX_UNLOCK(dev, txq);
@@ -2715,68 +2727,41 @@ set_rps_cpu(struct net_device *dev, struct sk_buff *skb,
 }
 
 /*
- * get_rps_cpu is called from netif_receive_skb and returns the target
- * CPU from the RPS map of the receiving queue for a given skb.
+ * Hash the addresses and ports of an IPv4/IPv6 packet whose network
+ * header starts @nhoff bytes into skb->data.  Returns 0 if the packet
+ * can not be hashed, never 0 otherwise.
  */
-static int get_rps_cpu(struct net_device *dev, struct sk_buff *skb,
-		       struct rps_dev_flow **rflowp)
+static u16 skb_flow_hash(struct sk_buff *skb, int nhoff)
 {
 	struct ipv6hdr *ip6;
 	struct iphdr *ip;
-	struct netdev_rx_queue *rxqueue;
-	struct rps_map *map;
-	struct rps_dev_flow_table *flow_table;
-	struct rps_sock_flow_table *sock_flow_table;
-	struct netdev_rps_info *rpinfo = &netdev_extended(dev)->rps_data;
-	int cpu = -1;
-	int tcpu;
 	u8 ip_proto;
 	u32 addr1, addr2, ports, ihl;
-
-	rcu_read_lock();
-
-	if (skb_rx_queue_recorded(skb)) {
-		u16 index = skb_get_rx_queue(skb);
-		if (unlikely(index >= netdev_extended(dev)->real_num_rx_queues)) {
-			WARN_ONCE(netdev_extended(dev)->real_num_rx_queues > 1,
-				  "%s received packet on queue %u, but number "
-				  "of RX queues is %u\n",
-				  dev->name, index, netdev_extended(dev)->real_num_rx_queues);
-			goto done;
-		}
-		rxqueue = rpinfo->_rx + index;
-	} else
-		rxqueue = rpinfo->_rx;
-
-	if (!rxqueue->rps_map && !rxqueue->rps_flow_table)
-		goto done;
-
-	if (skb->rxhash)
-		goto got_hash; /* Skip hash computation on packet header */
+	u16 hash;
 
 	switch (skb->protocol) {
 	case __constant_htons(ETH_P_IP):
-		if (!pskb_may_pull(skb, sizeof(*ip)))
-			goto done;
+		if (!pskb_may_pull(skb, nhoff + sizeof(*ip)))
+			return 0;
 
-		ip = (struct iphdr *) skb->data;
+		ip = (struct iphdr *) (skb->data + nhoff);
 		ip_proto = ip->protocol;
 		addr1 = ip->saddr;
 		addr2 = ip->daddr;
 		ihl = ip->ihl;
 		break;
 	case __constant_htons(ETH_P_IPV6):
-		if (!pskb_may_pull(skb, sizeof(*ip6)))
-			goto done;
+		if (!pskb_may_pull(skb, nhoff + sizeof(*ip6)))
+			return 0;
 
-		ip6 = (struct ipv6hdr *) skb->data;
+		ip6 = (struct ipv6hdr *) (skb->data + nhoff);
 		ip_proto = ip6->nexthdr;
 		addr1 = ip6->saddr.s6_addr32[3];
 		addr2 = ip6->daddr.s6_addr32[3];
 		ihl = (40 >> 2);
 		break;
 	default:
-		goto done;
+		return 0;
 	}
 	ports = 0;
 	switch (ip_proto) {
@@ -2787,17 +2772,72 @@ static int get_rps_cpu(struct net_device *dev, struct sk_buff *skb,
 	case IPPROTO_AH:
 	case IPPROTO_SCTP:
 	case IPPROTO_UDPLITE:
-		if (pskb_may_pull(skb, (ihl * 4) + 4))
-			ports = *((u32 *) (skb->data + (ihl * 4)));
+		if (pskb_may_pull(skb, nhoff + (ihl * 4) + 4))
+			ports = *((u32 *) (skb->data + nhoff + (ihl * 4)));
 		break;
 
 	default:
 		break;
 	}
 
-	skb->rxhash = jhash_3words(addr1, addr2, ports, hashrnd) >> 16;
+	hash = jhash_3words(addr1, addr2, ports, hashrnd) >> 16;
+	return hash ? hash : 1;
+}
+
+/**
+ *	__skb_get_rxhash - compute the flow hash of a packet
+ *	@skb: packet, with its network header set
+ *
+ *	Stores in skb->rxhash the same flow hash RPS uses to pick a cpu and
+ *	returns it, or 0 if the packet is neither IPv4 nor IPv6.
+ */
+u16 __skb_get_rxhash(struct sk_buff *skb)
+{
+	skb->rxhash = skb_flow_hash(skb, skb_network_offset(skb));
+	return skb->rxhash;
+}
+EXPORT_SYMBOL(__skb_get_rxhash);
+
+/*
+ * get_rps_cpu is called from netif_receive_skb and returns the target
+ * CPU from the RPS map of the receiving queue for a given skb.
+ */
+static int get_rps_cpu(struct net_device *dev, struct sk_buff *skb,
+		       struct rps_dev_flow **rflowp)
+{
+	struct netdev_rx_queue *rxqueue;
+	struct rps_map *map;
+	struct rps_dev_flow_table *flow_table;
+	struct rps_sock_flow_table *sock_flow_table;
+	struct netdev_rps_info *rpinfo = &netdev_extended(dev)->rps_data;
+	int cpu = -1;
+	int tcpu;
+
+	rcu_read_lock();
+
+	if (skb_rx_queue_recorded(skb)) {
+		u16 index = skb_get_rx_queue(skb);
+		if (unlikely(index >= netdev_extended(dev)->real_num_rx_queues)) {
+			WARN_ONCE(netdev_extended(dev)->real_num_rx_queues > 1,
+				  "%s received packet on queue %u, but number "
+				  "of RX queues is %u\n",
+				  dev->name, index, netdev_extended(dev)->real_num_rx_queues);
+			goto done;
+		}
+		rxqueue = rpinfo->_rx + index;
+	} else
+		rxqueue = rpinfo->_rx;
+
+	if (!rxqueue->rps_map && !rxqueue->rps_flow_table)
+		goto done;
+
+	if (skb->rxhash)
+		goto got_hash; /* Skip hash computation on packet header */
+
+	/* the network header is at skb->data, it is not set yet */
+	skb->rxhash = skb_flow_hash(skb, 0);
 	if (!skb->rxhash)
-		skb->rxhash = 1;
+		goto done;
 
 got_hash:
 	flow_table = rcu_dereference(rxqueue->rps_flow_table);
@@ -3079,6 +3119,8 @@ static inline int deliver_skb(struct sk_buff *skb,
 			      struct packet_type *pt_prev,
 			      struct net_device *orig_dev)
 {
+	if (unlikely(skb_orphan_frags_rx(skb, GFP_ATOMIC)))
+		return -ENOMEM;
 	atomic_inc(&skb->users);
 	return pt_prev->func(skb, skb->dev, pt_prev, orig_dev);
 }
@@ -3397,7 +3439,12 @@ ncls:
 	}
 
 	if (pt_prev) {
-		ret = pt_prev->func(skb, skb->dev, pt_prev, orig_dev);
+		/* Do not let a local reader pin MSG_ZEROCOPY buffers */
+		if (unlikely(skb_orphan_frags_rx(skb, GFP_ATOMIC))) {
+			kfree_skb(skb);
+			ret = NET_RX_DROP;
+		} else
+			ret = pt_prev->func(skb, skb->dev, pt_prev, orig_dev);
 	} else {
 		kfree_skb(skb);
 		/* Jamal, now you will not able to escape explaining
@@ -3470,6 +3517,8 @@ static int napi_gro_complete(struct sk_buff *skb)
 		goto out;
 	}
 
+	NAPI_GRO_CB(skb)->nhoff = 0;
+
 	rcu_read_lock();
 	list_for_each_entry_rcu(ptype, head, list) {
 		if (ptype->type != type || !ptype->gro_complete)
@@ -3551,6 +3600,7 @@ gro_result_t dev_gro_receive(struct napi_struct *napi, struct sk_buff *skb)
 		NAPI_GRO_CB(skb)->same_flow = 0;
 		NAPI_GRO_CB(skb)->flush = 0;
 		NAPI_GRO_CB(skb)->free = 0;
+		NAPI_GRO_CB(skb)->encap_mark = 0;
 		found = true;
 
 		pp = ptype->gro_receive(&napi->gro_list, skb);
@@ -3571,6 +3621,7 @@ gro_result_t dev_gro_receive(struct napi_struct *napi, struct sk_buff *skb)
 			NAPI_GRO_CB(skb)->same_flow = 0;
 			NAPI_GRO_CB(skb)->flush = 0;
 			NAPI_GRO_CB(skb)->free = 0;
+			NAPI_GRO_CB(skb)->encap_mark = 0;
 			found = true;
 
 			pp = pkt_type->gro_receive(&napi->gro_list, skb);
@@ -3638,6 +3689,37 @@ normal:
 }
 EXPORT_SYMBOL(dev_gro_receive);
 
+/* Used by tunnel gro_receive/gro_complete handlers to hand the inner
+ * packet to the offload of its ethertype.  Called under rcu_read_lock().
+ */
+struct packet_offload *gro_find_receive_by_type(__be16 type)
+{
+	struct list_head *offload_head = &offload_base;
+	struct packet_offload *ptype;
+
+	list_for_each_entry_rcu(ptype, offload_head, list) {
+		if (ptype->type != type || !ptype->gro_receive)
+			continue;
+		return ptype;
+	}
+	return NULL;
+}
+EXPORT_SYMBOL(gro_find_receive_by_type);
+
+struct packet_offload *gro_find_complete_by_type(__be16 type)
+{
+	struct list_head *offload_head = &offload_base;
+	struct packet_offload *ptype;
+
+	list_for_each_entry_rcu(ptype, offload_head, list) {
+		if (ptype->type != type || !ptype->gro_complete)
+			continue;
+		return ptype;
+	}
+	return NULL;
+}
+EXPORT_SYMBOL(gro_find_complete_by_type);
+
 static gro_result_t
 __napi_gro_receive(struct napi_struct *napi, struct sk_buff *skb)
 {
@@ -3940,6 +4022,59 @@ void napi_complete(struct napi_struct *n)
 }
 EXPORT_SYMBOL(napi_complete);
 
+/* must be called under rcu_read_lock(), as we dont take a reference */
+struct napi_struct *napi_by_id(unsigned int napi_id)
+{
+	unsigned int hash = napi_id % ARRAY_SIZE(napi_hash);
+	struct napi_struct *napi;
+	struct hlist_node *node;
+
+	hlist_for_each_entry_rcu(napi, node, &napi_hash[hash], napi_hash_node)
+		if (napi->napi_id == napi_id)
+			return napi;
+
+	return NULL;
+}
+EXPORT_SYMBOL_GPL(napi_by_id);
+
+void napi_hash_add(struct napi_struct *napi)
+{
+	if (!test_and_set_bit(NAPI_STATE_HASHED, &napi->state)) {
+
+		spin_lock(&napi_hash_lock);
+
+		/* 0 is not a valid id, we also skip an id that is taken
+		 * we expect both events to be extremely rare
+		 */
+		napi->napi_id = 0;
+		while (!napi->napi_id) {
+			napi->napi_id = ++napi_gen_id;
+			if (napi_by_id(napi->napi_id))
+				napi->napi_id = 0;
+		}
+
+		hlist_add_head_rcu(&napi->napi_hash_node,
+			&napi_hash[napi->napi_id % ARRAY_SIZE(napi_hash)]);
+
+		spin_unlock(&napi_hash_lock);
+	}
+}
+EXPORT_SYMBOL_GPL(napi_hash_add);
+
+/* Warning : caller is responsible to make sure rcu grace period
+ * is respected before freeing memory containing @napi
+ */
+void napi_hash_del(struct napi_struct *napi)
+{
+	spin_lock(&napi_hash_lock);
+
+	if (test_and_clear_bit(NAPI_STATE_HASHED, &napi->state))
+		hlist_del_rcu(&napi->napi_hash_node);
+
+	spin_unlock(&napi_hash_lock);
+}
+EXPORT_SYMBOL_GPL(napi_hash_del);
+
 void netif_napi_add(struct net_device *dev, struct napi_struct *napi,
 		    int (*poll)(struct napi_struct *, int), int weight)
 {
@@ -6129,6 +6264,9 @@ int register_netdevice(struct net_device *dev)
 	 */
 	dev->vlan_features |= NETIF_F_GRO;
 
+	/* Make NETIF_F_SG inheritable to tunnel devices. */
+	netdev_extended(dev)->hw_enc_features |= NETIF_F_SG;
+
 	netdev_initialize_kobject(dev);
 
 	ret = call_netdevice_notifiers(NETDEV_POST_INIT, dev);
@@ -6558,8 +6696,12 @@ struct net_device *alloc_netdev_mqs(int sizeof_priv, const char *name,
 		       "extensions for tx qdiscs.\n");
 		goto free_tx;
 	}
-	for (i = 0; i < txqs; i++)
+	for (i = 0; i < txqs; i++) {
 		tx_ext[i].q = &tx[i];
+#ifdef CONFIG_BQL
+		dql_init(&tx_ext[i].dql, HZ);
+#endif
+	}
 
 	dev_ext_frozen = PTR_ALIGN(p, NETDEV_ALIGN);
 	dev = netdev_extended_frozen_get_dev(dev_ext_frozen);
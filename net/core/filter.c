@@ -38,11 +38,18 @@
 #include <linux/filter.h>
 #include <linux/if_vlan.h>
 
-/* No hurry in this branch */
-static void *__load_pointer(struct sk_buff *skb, int k)
+/* No hurry in this branch
+ *
+ * Exported for the JIT helpers, which call it for negative offsets.
+ */
+void *bpf_internal_load_pointer_neg_helper(const struct sk_buff *skb,
+					  int k, unsigned int size)
 {
 	u8 *ptr = NULL;
 
+	if (k >= SKF_AD_OFF)
+		return NULL;
+
 	if (k >= SKF_NET_OFF)
 		ptr = skb_network_header(skb) + k - SKF_NET_OFF;
 	else if (k >= SKF_LL_OFF)
@@ -58,11 +65,7 @@ static inline void *load_pointer(struct sk_buff *skb, int k,
 {
 	if (k >= 0)
 		return skb_header_pointer(skb, k, size, buffer);
-	else {
-		if (k >= SKF_AD_OFF)
-			return NULL;
-		return __load_pointer(skb, k);
-	}
+	return bpf_internal_load_pointer_neg_helper(skb, k, size);
 }
 
 /**
@@ -89,8 +92,7 @@ int sk_filter(struct sock *sk, struct sk_buff *skb)
 	rcu_read_lock_bh();
 	filter = rcu_dereference(sk->sk_filter);
 	if (filter) {
-		unsigned int pkt_len = sk_run_filter(skb, filter->insns,
-				filter->len);
+		unsigned int pkt_len = SK_RUN_FILTER(filter, skb);
 		err = pkt_len ? pskb_trim(skb, pkt_len) : -EPERM;
 	}
 	rcu_read_unlock_bh();
@@ -212,7 +214,6 @@ unsigned int sk_run_filter(struct sk_buff *skb, struct sock_filter *filter, int
 			continue;
 		case BPF_LD|BPF_W|BPF_ABS:
 			k = f_k;
-load_w:
 			ptr = load_pointer(skb, k, 4, &tmp);
 			if (ptr != NULL) {
 				A = get_unaligned_be32(ptr);
@@ -221,7 +222,6 @@ load_w:
 			break;
 		case BPF_LD|BPF_H|BPF_ABS:
 			k = f_k;
-load_h:
 			ptr = load_pointer(skb, k, 2, &tmp);
 			if (ptr != NULL) {
 				A = get_unaligned_be16(ptr);
@@ -230,7 +230,6 @@ load_h:
 			break;
 		case BPF_LD|BPF_B|BPF_ABS:
 			k = f_k;
-load_b:
 			ptr = load_pointer(skb, k, 1, &tmp);
 			if (ptr != NULL) {
 				A = *(u8 *)ptr;
@@ -243,15 +242,31 @@ load_b:
 		case BPF_LDX|BPF_W|BPF_LEN:
 			X = skb->len;
 			continue;
+		/*
+		 * Indirect loads never reach the ancillary data below:
+		 * a failed load ends the filter, as in the JIT.
+		 */
 		case BPF_LD|BPF_W|BPF_IND:
-			k = X + f_k;
-			goto load_w;
+			ptr = load_pointer(skb, X + f_k, 4, &tmp);
+			if (ptr != NULL) {
+				A = get_unaligned_be32(ptr);
+				continue;
+			}
+			return 0;
 		case BPF_LD|BPF_H|BPF_IND:
-			k = X + f_k;
-			goto load_h;
+			ptr = load_pointer(skb, X + f_k, 2, &tmp);
+			if (ptr != NULL) {
+				A = get_unaligned_be16(ptr);
+				continue;
+			}
+			return 0;
 		case BPF_LD|BPF_B|BPF_IND:
-			k = X + f_k;
-			goto load_b;
+			ptr = load_pointer(skb, X + f_k, 1, &tmp);
+			if (ptr != NULL) {
+				A = *(u8 *)ptr;
+				continue;
+			}
+			return 0;
 		case BPF_LDX|BPF_B|BPF_MSH:
 			ptr = load_pointer(skb, f_k, 1, &tmp);
 			if (ptr != NULL) {
@@ -551,12 +566,16 @@ int sk_attach_filter(struct sock_fprog *fprog, struct sock *sk)
 	atomic_set(&fp->refcnt, 1);
 	fp->len = fprog->len;
 
+	fp->bpf_func = sk_run_filter;
+
 	err = sk_chk_filter(fp->insns, fp->len);
 	if (err) {
 		sk_filter_uncharge(sk, fp);
 		return err;
 	}
 
+	bpf_jit_compile(fp);
+
 	rcu_read_lock_bh();
 	old_fp = rcu_dereference(sk->sk_filter);
 	rcu_assign_pointer(sk->sk_filter, fp);
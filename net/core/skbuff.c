@@ -241,11 +241,13 @@ nodata:
 EXPORT_SYMBOL(__alloc_skb);
 
 /**
- * build_skb - build a network buffer
+ * __build_skb - build a network buffer
  * @data: data buffer provided by caller
+ * @frag_size: size of fragment, or 0 if head was kmalloced
  *
  * Allocate a new &sk_buff. Caller provides space holding head and
- * skb_shared_info. @data must have been allocated by kmalloc()
+ * skb_shared_info. @data must have been allocated by kmalloc() or
+ * netdev_alloc_frag().
  * The return is the new skb buffer.
  * On a failure the return is %NULL, and @data is not freed.
  * Notes :
@@ -256,20 +258,21 @@ EXPORT_SYMBOL(__alloc_skb);
  *  before giving packet to stack.
  *  RX rings only contains data buffers, not full skbs.
  */
-struct sk_buff *build_skb(void *data)
+struct sk_buff *__build_skb(void *data, unsigned int frag_size)
 {
 	struct skb_shared_info *shinfo;
 	struct sk_buff *skb;
-	unsigned int size;
+	unsigned int size = frag_size ? : ksize(data);
 
 	skb = kmem_cache_alloc(skbuff_head_cache, GFP_ATOMIC);
 	if (!skb)
 		return NULL;
 
-	size = ksize(data) - SKB_DATA_ALIGN(sizeof(struct skb_shared_info));
+	size -= SKB_DATA_ALIGN(sizeof(struct skb_shared_info));
 
 	memset(skb, 0, offsetof(struct sk_buff, tail));
 	skb->truesize = SKB_TRUESIZE(size);
+	skb->head_frag = frag_size != 0;
 	atomic_set(&skb->users, 1);
 	skb->head = data;
 	skb->data = data;
@@ -293,8 +296,92 @@ struct sk_buff *build_skb(void *data)
 
 	return skb;
 }
+EXPORT_SYMBOL(__build_skb);
+
+/* @data must have been allocated by kmalloc(). */
+struct sk_buff *build_skb(void *data)
+{
+	return __build_skb(data, 0);
+}
 EXPORT_SYMBOL(build_skb);
 
+struct netdev_alloc_cache {
+	struct page *page;
+	unsigned int offset;
+	unsigned int size;
+	unsigned int pagecnt_bias;
+};
+static DEFINE_PER_CPU(struct netdev_alloc_cache, netdev_alloc_cache);
+
+#define NETDEV_FRAG_PAGE_MAX_ORDER get_order(32768)
+#define NETDEV_FRAG_PAGE_MAX_SIZE  (PAGE_SIZE << NETDEV_FRAG_PAGE_MAX_ORDER)
+#define NETDEV_PAGECNT_MAX_BIAS	   NETDEV_FRAG_PAGE_MAX_SIZE
+
+/*
+ * Fragments are carved out of a per-cpu order-3 page (order-0 when memory
+ * is fragmented).  Rather than taking a page reference per fragment, the
+ * page count is raised once to NETDEV_PAGECNT_MAX_BIAS and pagecnt_bias
+ * tracks how much of it has not been handed out yet.  Once the page is
+ * used up it is recycled in place if every fragment has been freed.
+ */
+static void *__netdev_alloc_frag(unsigned int fragsz, gfp_t gfp_mask)
+{
+	struct netdev_alloc_cache *nc;
+	void *data = NULL;
+	int order;
+	unsigned long flags;
+
+	local_irq_save(flags);
+	nc = &__get_cpu_var(netdev_alloc_cache);
+	if (unlikely(!nc->page)) {
+refill:
+		for (order = NETDEV_FRAG_PAGE_MAX_ORDER; ;) {
+			gfp_t gfp = gfp_mask;
+
+			if (order)
+				gfp |= __GFP_COMP | __GFP_NOWARN;
+			nc->page = alloc_pages(gfp, order);
+			if (likely(nc->page))
+				break;
+			if (--order < 0)
+				goto end;
+		}
+		nc->size = PAGE_SIZE << order;
+recycle:
+		atomic_set(&nc->page->_count, NETDEV_PAGECNT_MAX_BIAS);
+		nc->pagecnt_bias = NETDEV_PAGECNT_MAX_BIAS;
+		nc->offset = 0;
+	}
+
+	if (nc->offset + fragsz > nc->size) {
+		/* avoid unnecessary locked operations if possible */
+		if ((atomic_read(&nc->page->_count) == nc->pagecnt_bias) ||
+		    atomic_sub_and_test(nc->pagecnt_bias, &nc->page->_count))
+			goto recycle;
+		goto refill;
+	}
+
+	data = page_address(nc->page) + nc->offset;
+	nc->offset += fragsz;
+	nc->pagecnt_bias--;
+end:
+	local_irq_restore(flags);
+	return data;
+}
+
+/**
+ * netdev_alloc_frag - allocate a page fragment
+ * @fragsz: fragment size
+ *
+ * Allocates a frag from a page for receive buffer.
+ * Uses GFP_ATOMIC allocations.
+ */
+void *netdev_alloc_frag(unsigned int fragsz)
+{
+	return __netdev_alloc_frag(fragsz, GFP_ATOMIC | __GFP_COLD);
+}
+EXPORT_SYMBOL(netdev_alloc_frag);
+
 /**
  *	__netdev_alloc_skb - allocate an skbuff for rx on a specific device
  *	@dev: network device to receive on
@@ -311,9 +398,21 @@ EXPORT_SYMBOL(build_skb);
 struct sk_buff *__netdev_alloc_skb(struct net_device *dev,
 		unsigned int length, gfp_t gfp_mask)
 {
-	struct sk_buff *skb;
+	struct sk_buff *skb = NULL;
+	unsigned int fragsz = SKB_DATA_ALIGN(length + NET_SKB_PAD) +
+			      SKB_DATA_ALIGN(sizeof(struct skb_shared_info));
+
+	if (fragsz <= PAGE_SIZE && !(gfp_mask & (__GFP_WAIT | GFP_DMA))) {
+		void *data = __netdev_alloc_frag(fragsz, gfp_mask);
 
-	skb = __alloc_skb(length + NET_SKB_PAD, gfp_mask, 0, NUMA_NO_NODE);
+		if (likely(data)) {
+			skb = __build_skb(data, fragsz);
+			if (unlikely(!skb))
+				put_page(virt_to_head_page(data));
+		}
+	} else {
+		skb = __alloc_skb(length + NET_SKB_PAD, gfp_mask, 0, NUMA_NO_NODE);
+	}
 	if (likely(skb)) {
 		skb_reserve(skb, NET_SKB_PAD);
 		skb->dev = dev;
@@ -386,6 +485,14 @@ static void skb_clone_fraglist(struct sk_buff *skb)
 		skb_get(list);
 }
 
+static void skb_free_head(struct sk_buff *skb)
+{
+	if (skb->head_frag)
+		put_page(virt_to_head_page(skb->head));
+	else
+		kfree(skb->head);
+}
+
 static void skb_release_data(struct sk_buff *skb)
 {
 	if (!skb->cloned ||
@@ -412,7 +519,7 @@ static void skb_release_data(struct sk_buff *skb)
 		if (skb_has_frag_list(skb))
 			skb_drop_fraglist(skb);
 
-		kfree(skb->head);
+		skb_free_head(skb);
 	}
 }
 
@@ -562,6 +669,10 @@ int skb_recycle_check(struct sk_buff *skb, int skb_size)
 	if (skb_is_nonlinear(skb) || skb->fclone != SKB_FCLONE_UNAVAILABLE)
 		return 0;
 
+	/* the memset below would forget where the head came from */
+	if (skb->head_frag)
+		return 0;
+
 	skb_size = SKB_DATA_ALIGN(skb_size + NET_SKB_PAD);
 	if (skb_end_pointer(skb) - skb->head < skb_size)
 		return 0;
@@ -630,6 +741,10 @@ static void __copy_skb_header(struct sk_buff *new, const struct sk_buff *old)
 	new->vlan_tci		= old->vlan_tci;
 
 	skb_copy_secmark(new, old);
+
+#ifdef CONFIG_NET_RX_BUSY_POLL
+	new->napi_id	= old->napi_id;
+#endif
 }
 
 /*
@@ -655,6 +770,7 @@ static struct sk_buff *__skb_clone(struct sk_buff *n, struct sk_buff *skb)
 	C(tail);
 	C(end);
 	C(head);
+	C(head_frag);
 	C(data);
 	C(truesize);
 	atomic_set(&n->users, 1);
@@ -716,6 +832,8 @@ static int skb_copy_ubufs(struct sk_buff *skb, gfp_t gfp_mask)
 	for (i = 0; i < skb_shinfo(skb)->nr_frags; i++)
 		put_page(skb_shinfo(skb)->frags[i].page);
 
+	if (uarg->callback == sock_zerocopy_callback)
+		uarg_to_msgzc(uarg)->zerocopy = 0;
 	uarg->callback(uarg);
 
 	/* skb frags point to kernel buffers */
@@ -727,6 +845,311 @@ static int skb_copy_ubufs(struct sk_buff *skb, gfp_t gfp_mask)
 	return 0;
 }
 
+/*
+ * Frags pinned by MSG_ZEROCOPY may stay shared: their owner learns about
+ * the release through the socket error queue, however long that takes.
+ * Other userspace frags are copied to kernel pages before the skb data
+ * can be referenced from somewhere we do not control.
+ */
+static int skb_orphan_frags(struct sk_buff *skb, gfp_t gfp_mask)
+{
+	if (likely(!skb_tx(skb)->dev_zerocopy) || skb_zcopy_sock(skb))
+		return 0;
+
+	if (skb_copy_ubufs(skb, gfp_mask))
+		return -ENOMEM;
+
+	skb_tx(skb)->dev_zerocopy = 0;
+	return 0;
+}
+
+/**
+ *	skb_orphan_frags_rx - release userspace frags of a looped back skb
+ *	@skb: buffer turning from transmit into receive
+ *	@gfp_mask: allocation priority
+ *
+ *	A local reader may keep the data queued for as long as it likes, so
+ *	userspace pages are copied here and their owners, MSG_ZEROCOPY
+ *	senders included, are told that the buffers may be reused.
+ *
+ *	The frags live in skb_shinfo(), which a clone shares with the
+ *	sender's copy (the TCP write queue, a retransmission): the skb
+ *	gets a private one first, holding its own page and uarg references.
+ */
+int skb_orphan_frags_rx(struct sk_buff *skb, gfp_t gfp_mask)
+{
+	if (likely(!skb_tx(skb)->dev_zerocopy))
+		return 0;
+
+	if (skb_shared(skb) || skb_unclone(skb, gfp_mask))
+		return -EINVAL;
+
+	if (skb_copy_ubufs(skb, gfp_mask))
+		return -ENOMEM;
+
+	skb_tx(skb)->dev_zerocopy = 0;
+	return 0;
+}
+EXPORT_SYMBOL_GPL(skb_orphan_frags_rx);
+
+static inline struct sk_buff *skb_from_uarg(struct ubuf_info_msgzc *uarg)
+{
+	return container_of((void *)uarg, struct sk_buff, cb);
+}
+
+static void sock_zerocopy_ofree(struct sk_buff *skb)
+{
+	atomic_sub(skb->truesize, &skb->sk->sk_omem_alloc);
+}
+
+struct ubuf_info_msgzc *sock_zerocopy_alloc(struct sock *sk, size_t size)
+{
+	struct ubuf_info_msgzc *uarg;
+	struct sk_buff *skb;
+
+	/* The notification skb is charged to the socket option memory. */
+	skb = alloc_skb(0, sk->sk_allocation);
+	if (!skb)
+		return NULL;
+
+	if (atomic_read(&sk->sk_omem_alloc) + skb->truesize >
+	    sysctl_optmem_max) {
+		kfree_skb(skb);
+		return NULL;
+	}
+	atomic_add(skb->truesize, &sk->sk_omem_alloc);
+	skb->sk = sk;
+	skb->destructor = sock_zerocopy_ofree;
+
+	BUILD_BUG_ON(sizeof(*uarg) > sizeof(skb->cb));
+	uarg = (void *)skb->cb;
+
+	uarg->ubuf.callback = sock_zerocopy_callback;
+	uarg->ubuf.arg = NULL;
+	uarg->ubuf.desc = 0;
+	uarg->id = ((u32)atomic_inc_return(&sk_extended(sk)->sk_zckey)) - 1;
+	uarg->len = 1;
+	uarg->bytelen = size;
+	uarg->zerocopy = 1;
+	atomic_set(&uarg->refcnt, 1);
+	sock_hold(sk);
+
+	return uarg;
+}
+EXPORT_SYMBOL_GPL(sock_zerocopy_alloc);
+
+/*
+ * Extend the notification range of @uarg, attached to the tail of the write
+ * queue, if the previous send was the last one on this socket, so that back
+ * to back sends complete with a single error queue entry.
+ */
+struct ubuf_info_msgzc *sock_zerocopy_realloc(struct sock *sk, size_t size,
+					      struct ubuf_info_msgzc *uarg)
+{
+	if (uarg) {
+		const u32 byte_limit = 1 << 19;		/* limit to a few TSO */
+		u32 bytelen, next;
+
+		/* realloc only when socket is locked (TCP), so uarg->len
+		 * and sk_zckey access is serialized
+		 */
+		if (!sock_owned_by_user(sk)) {
+			WARN_ON_ONCE(1);
+			return NULL;
+		}
+
+		bytelen = uarg->bytelen + size;
+		if (uarg->len == USHORT_MAX - 1 || bytelen > byte_limit)
+			goto new_alloc;
+
+		next = (u32)atomic_read(&sk_extended(sk)->sk_zckey);
+		if ((u32)(uarg->id + uarg->len) == next) {
+			uarg->len++;
+			uarg->bytelen = bytelen;
+			atomic_set(&sk_extended(sk)->sk_zckey, ++next);
+			sock_zerocopy_get(uarg);
+			return uarg;
+		}
+	}
+
+new_alloc:
+	return sock_zerocopy_alloc(sk, size);
+}
+EXPORT_SYMBOL_GPL(sock_zerocopy_realloc);
+
+static bool skb_zerocopy_notify_extend(struct sk_buff *skb, u32 lo, u16 len,
+				       u8 code)
+{
+	struct sock_exterr_skb *serr = SKB_EXT_ERR(skb);
+	u32 old_lo, old_hi;
+	u64 sum_len;
+
+	old_lo = serr->ee.ee_info;
+	old_hi = serr->ee.ee_data;
+	sum_len = old_hi - old_lo + 1ULL + len;
+
+	if (sum_len >= (1ULL << 32))
+		return false;
+
+	if (lo != old_hi + 1 || serr->ee.ee_code != code)
+		return false;
+
+	serr->ee.ee_data += len;
+	return true;
+}
+
+static void sock_zerocopy_notify(struct ubuf_info_msgzc *uarg)
+{
+	struct sk_buff *tail, *skb = skb_from_uarg(uarg);
+	struct sock_exterr_skb *serr;
+	struct sock *sk = skb->sk;
+	struct sk_buff_head *q;
+	unsigned long flags;
+	u32 lo, hi;
+	u16 len;
+	u8 code;
+
+	/* if !len, there was only 1 call, and it was aborted
+	 * so do not queue a completion notification
+	 */
+	if (!uarg->len || sock_flag(sk, SOCK_DEAD))
+		goto release;
+
+	len = uarg->len;
+	lo = uarg->id;
+	hi = uarg->id + len - 1;
+	code = uarg->zerocopy ? 0 : SO_EE_CODE_ZEROCOPY_COPIED;
+
+	serr = SKB_EXT_ERR(skb);
+	memset(serr, 0, sizeof(*serr));
+	serr->ee.ee_errno = 0;
+	serr->ee.ee_origin = SO_EE_ORIGIN_ZEROCOPY;
+	serr->ee.ee_data = hi;
+	serr->ee.ee_info = lo;
+	serr->ee.ee_code = code;
+
+	q = &sk->sk_error_queue;
+	spin_lock_irqsave(&q->lock, flags);
+	tail = skb_peek_tail(q);
+	if (!tail || SKB_EXT_ERR(tail)->ee.ee_origin != SO_EE_ORIGIN_ZEROCOPY ||
+	    !skb_zerocopy_notify_extend(tail, lo, len, code)) {
+		__skb_queue_tail(q, skb);
+		skb = NULL;
+	}
+	spin_unlock_irqrestore(&q->lock, flags);
+
+	sk->sk_error_report(sk);
+
+release:
+	consume_skb(skb);
+	sock_put(sk);
+}
+
+void sock_zerocopy_put(struct ubuf_info_msgzc *uarg)
+{
+	if (uarg && atomic_dec_and_test(&uarg->refcnt))
+		sock_zerocopy_notify(uarg);
+}
+EXPORT_SYMBOL_GPL(sock_zerocopy_put);
+
+/* ubuf_info callback, run as each skb lets go of the pinned pages */
+void sock_zerocopy_callback(void *arg)
+{
+	sock_zerocopy_put(uarg_to_msgzc((struct ubuf_info *)arg));
+}
+EXPORT_SYMBOL_GPL(sock_zerocopy_callback);
+
+/* Undo the sendmsg() reference and id of a call that sent nothing. */
+void sock_zerocopy_put_abort(struct ubuf_info_msgzc *uarg)
+{
+	if (uarg) {
+		struct sock *sk = skb_from_uarg(uarg)->sk;
+
+		atomic_dec(&sk_extended(sk)->sk_zckey);
+		uarg->len--;
+
+		sock_zerocopy_put(uarg);
+	}
+}
+EXPORT_SYMBOL_GPL(sock_zerocopy_put_abort);
+
+/**
+ *	skb_zerocopy_iter_stream - pin user memory into the frags of an skb
+ *	@sk: socket the data is sent on, charged for the pinned bytes
+ *	@skb: buffer to append to
+ *	@from: user address
+ *	@len: number of bytes wanted
+ *	@uarg: notification state the pages are tracked by
+ *
+ *	Returns the number of bytes appended, -EEXIST if @skb already tracks
+ *	other buffers, -EMSGSIZE if it has no frag slot left, or the error
+ *	from pinning the first page.  The caller must have reserved the
+ *	socket memory with sk_wmem_schedule().
+ */
+int skb_zerocopy_iter_stream(struct sock *sk, struct sk_buff *skb,
+			     const void __user *from, int len,
+			     struct ubuf_info_msgzc *uarg)
+{
+	struct ubuf_info_msgzc *orig_uarg = skb_zcopy_sock(skb);
+	unsigned long addr = (unsigned long)from;
+	struct page *pages[MAX_SKB_FRAGS];
+	int copied = 0, err = -EMSGSIZE;
+
+	if (orig_uarg ? orig_uarg != uarg : skb_tx(skb)->dev_zerocopy)
+		return -EEXIST;
+
+	while (len > 0) {
+		int off = addr & ~PAGE_MASK;
+		int i = skb_shinfo(skb)->nr_frags;
+		int k, n;
+
+		n = min_t(int, MAX_SKB_FRAGS - i,
+			  DIV_ROUND_UP(off + len, PAGE_SIZE));
+		if (n <= 0)
+			break;
+
+		n = get_user_pages_fast(addr & PAGE_MASK, n, 0, pages);
+		if (n <= 0) {
+			err = n ? n : -EFAULT;
+			break;
+		}
+
+		for (k = 0; k < n; k++) {
+			int size = min_t(int, PAGE_SIZE - off, len);
+
+			i = skb_shinfo(skb)->nr_frags;
+			if (skb_can_coalesce(skb, i, pages[k], off)) {
+				skb_shinfo(skb)->frags[i - 1].size += size;
+				put_page(pages[k]);
+			} else {
+				skb_fill_page_desc(skb, i, pages[k], off, size);
+			}
+
+			addr += size;
+			len -= size;
+			copied += size;
+			off = 0;
+		}
+	}
+
+	if (!copied)
+		return err;
+
+	skb->len += copied;
+	skb->data_len += copied;
+	skb->truesize += copied;
+	sk->sk_wmem_queued += copied;
+	sk_mem_charge(sk, copied);
+
+	if (!orig_uarg)
+		skb_zcopy_set(skb, uarg);
+	/* userspace may write to the pages while they are in flight */
+	skb_tx(skb)->shared_frag = 1;
+
+	return copied;
+}
+EXPORT_SYMBOL_GPL(skb_zerocopy_iter_stream);
+
 
 /**
  *	skb_clone	-	duplicate an sk_buff
@@ -746,11 +1169,8 @@ struct sk_buff *skb_clone(struct sk_buff *skb, gfp_t gfp_mask)
 {
 	struct sk_buff *n;
 
-	if (skb_tx(skb)->dev_zerocopy) {
-		if (skb_copy_ubufs(skb, gfp_mask))
-			return NULL;
-		skb_tx(skb)->dev_zerocopy = 0;
-	}
+	if (skb_orphan_frags(skb, gfp_mask))
+		return NULL;
 
 	n = skb + 1;
 	if (skb->fclone == SKB_FCLONE_ORIG &&
@@ -870,19 +1290,18 @@ struct sk_buff *__pskb_copy(struct sk_buff *skb, int headroom, gfp_t gfp_mask)
 	if (skb_shinfo(skb)->nr_frags) {
 		int i;
 
-		if (skb_tx(skb)->dev_zerocopy) {
-			if (skb_copy_ubufs(skb, gfp_mask)) {
-				kfree_skb(n);
-				n = NULL;
-				goto out;
-			}
-			skb_tx(skb)->dev_zerocopy = 0;
+		if (skb_orphan_frags(skb, gfp_mask)) {
+			kfree_skb(n);
+			n = NULL;
+			goto out;
 		}
 		for (i = 0; i < skb_shinfo(skb)->nr_frags; i++) {
 			skb_shinfo(n)->frags[i] = skb_shinfo(skb)->frags[i];
 			get_page(skb_shinfo(n)->frags[i].page);
 		}
 		skb_shinfo(n)->nr_frags = i;
+		if (skb_zcopy_sock(skb))
+			skb_zcopy_set(n, skb_zcopy_sock(skb));
 	}
 
 	if (skb_has_frag_list(skb)) {
@@ -937,10 +1356,6 @@ int pskb_expand_head(struct sk_buff *skb, int nhead, int ntail,
 	 */
 	memcpy(data + nhead, skb->head, skb_tail_pointer(skb) - skb->head);
 
-	memcpy((struct skb_shared_info *)(data + size),
-	       skb_shinfo(skb),
-	       sizeof(struct skb_shared_info));
-
 	/* Check if we can avoid taking references on fragments if we own
 	 * the last reference on skb->head. (see skb_release_data())
 	 */
@@ -951,15 +1366,20 @@ int pskb_expand_head(struct sk_buff *skb, int nhead, int ntail,
 		fastpath = atomic_read(&skb_shinfo(skb)->dataref) == delta;
 	}
 
+	/* copy this zero copy skb frags, before the frags are duplicated */
+	if (!fastpath && skb_orphan_frags(skb, gfp_mask))
+		goto nofrags;
+
+	memcpy((struct skb_shared_info *)(data + size),
+	       skb_shinfo(skb),
+	       sizeof(struct skb_shared_info));
+
 	if (fastpath) {
-		kfree(skb->head);
+		skb_free_head(skb);
 	} else {
-		/* copy this zero copy skb frags */
-		if (skb_tx(skb)->dev_zerocopy) {
-			if (skb_copy_ubufs(skb, gfp_mask))
-				goto nofrags;
-			skb_tx(skb)->dev_zerocopy = 0;
-		}
+		/* the new shinfo holds its own MSG_ZEROCOPY reference */
+		if (skb_zcopy_sock(skb))
+			sock_zerocopy_get(skb_zcopy_sock(skb));
 		for (i = 0; i < skb_shinfo(skb)->nr_frags; i++)
 			get_page(skb_shinfo(skb)->frags[i].page);
 
@@ -971,6 +1391,7 @@ int pskb_expand_head(struct sk_buff *skb, int nhead, int ntail,
 	off = (data + nhead) - skb->head;
 
 	skb->head     = data;
+	skb->head_frag = 0;
 	skb->data    += off;
 #ifdef NET_SKBUFF_DATA_USES_OFFSET
 	skb->end      = size;
@@ -2221,6 +2642,8 @@ void skb_split(struct sk_buff *skb, struct sk_buff *skb1, const u32 len)
 	int pos = skb_headlen(skb);
 
 	skb_tx(skb1)->shared_frag = skb_tx(skb)->shared_frag;
+	if (skb_zcopy_sock(skb))
+		skb_zcopy_set(skb1, skb_zcopy_sock(skb));
 	if (len < pos)	/* Split line is inside header. */
 		skb_split_inside_header(skb, skb1, len, pos);
 	else		/* Second chunk has no header, nothing to copy. */
@@ -2263,6 +2686,10 @@ int skb_shift(struct sk_buff *tgt, struct sk_buff *skb, int shiftlen)
 	BUG_ON(shiftlen > skb->len);
 	BUG_ON(skb_headlen(skb));	/* Would corrupt stream */
 
+	/* Pinned user pages must stay with their notification state */
+	if (skb_zcopy_sock(tgt) != skb_zcopy_sock(skb))
+		return 0;
+
 	todo = shiftlen;
 	from = 0;
 	to = skb_shinfo(tgt)->nr_frags;
@@ -2750,6 +3177,8 @@ struct sk_buff *skb_segment(struct sk_buff *skb, int features)
 						 skb_put(nskb, hsize), hsize);
 
 		skb_tx(nskb)->shared_frag = skb_tx(skb)->shared_frag;
+		if (skb_zcopy_sock(skb))
+			skb_zcopy_set(nskb, skb_zcopy_sock(skb));
 
 		while (pos < offset + len && i < nfrags) {
 			*frag = skb_shinfo(skb)->frags[i];
@@ -133,6 +133,8 @@
 
 #include <trace/events/sock.h>
 
+#include <net/busy_poll.h>
+
 #ifdef CONFIG_INET
 #include <net/tcp.h>
 #endif
@@ -226,6 +228,11 @@ __u32 sysctl_rmem_default __read_mostly = SK_RMEM_MAX;
 int sysctl_optmem_max __read_mostly = sizeof(unsigned long)*(2*UIO_MAXIOV+512);
 EXPORT_SYMBOL(sysctl_optmem_max);
 
+#ifdef CONFIG_NET_RX_BUSY_POLL
+unsigned int sysctl_net_busy_read __read_mostly;
+unsigned int sysctl_net_busy_poll __read_mostly;
+#endif
+
 #if defined(CONFIG_CGROUPS)
 #if !defined(CONFIG_NET_CLS_CGROUP)
 int net_cls_subsys_id = -1;
@@ -237,12 +244,6 @@ EXPORT_SYMBOL_GPL(net_prio_subsys_id);
 #endif
 #endif
 
-static bool proto_has_rhel_ext(const struct proto *prot, int flag)
-{
-	return (prot->slab_flags & RHEL_EXTENDED_PROTO) &&
-	       (prot->rhel_flags & flag);
-}
-
 static int proto_slab_flags(const struct proto *prot)
 {
 	return prot->slab_flags & ~RHEL_EXTENDED_PROTO;
@@ -753,6 +754,32 @@ set_rcvbuf:
 		else
 			sock_reset_flag(sk, SOCK_RXQ_OVFL);
 		break;
+
+#ifdef CONFIG_NET_RX_BUSY_POLL
+	case SO_BUSY_POLL:
+		/* allow unprivileged users to decrease the value */
+		if ((val > sk_extended(sk)->sk_ll_usec) &&
+		    !capable(CAP_NET_ADMIN))
+			ret = -EPERM;
+		else {
+			if (val < 0)
+				ret = -EINVAL;
+			else
+				sk_extended(sk)->sk_ll_usec = val;
+		}
+		break;
+#endif
+
+	case SO_ZEROCOPY:
+		if ((sk->sk_family != PF_INET && sk->sk_family != PF_INET6) ||
+		    sk->sk_protocol != IPPROTO_TCP)
+			ret = -EOPNOTSUPP;
+		else if (valbool)
+			sock_set_flag(sk, SOCK_ZEROCOPY);
+		else
+			sock_reset_flag(sk, SOCK_ZEROCOPY);
+		break;
+
 	default:
 		ret = -ENOPROTOOPT;
 		break;
@@ -982,6 +1009,16 @@ int sock_getsockopt(struct socket *sock, int level, int optname,
 		v.val = bpf_tell_extensions();
 		break;
 
+#ifdef CONFIG_NET_RX_BUSY_POLL
+	case SO_BUSY_POLL:
+		v.val = sk_extended(sk)->sk_ll_usec;
+		break;
+#endif
+
+	case SO_ZEROCOPY:
+		v.val = !!sock_flag(sk, SOCK_ZEROCOPY);
+		break;
+
 	default:
 		return -ENOPROTOOPT;
 	}
@@ -1233,6 +1270,7 @@ struct sock *sk_clone(const struct sock *sk, const gfp_t priority)
 		bh_lock_sock(newsk);
 		newsk->sk_backlog.head	= newsk->sk_backlog.tail = NULL;
 		sk_extended(newsk)->sk_backlog.len = 0;
+		atomic_set(&sk_extended(newsk)->sk_zckey, 0);
 
 		atomic_set(&newsk->sk_rmem_alloc, 0);
 		/*
@@ -2004,6 +2042,13 @@ void sock_init_data(struct socket *sock, struct sock *sk)
 
 	sk->sk_stamp = ktime_set(-1L, 0);
 
+	sk_extended(sk)->sk_pacing_rate = ~0U;
+
+#ifdef CONFIG_NET_RX_BUSY_POLL
+	sk_extended(sk)->sk_napi_id	=	0;
+	sk_extended(sk)->sk_ll_usec	=	sysctl_net_busy_read;
+#endif
+
 	/*
 	 * Before updating sk_refcnt, we must commit prior changes to memory
 	 * (Documentation/RCU/rculist_nulls.txt for details)
@@ -425,6 +425,95 @@ struct net_device *alloc_etherdev_mqs(int sizeof_priv, unsigned int txqs,
 }
 EXPORT_SYMBOL(alloc_etherdev_mqs);
 
+/*
+ * GRO of Ethernet frames carried in a tunnel (GRE ETH_P_TEB, VXLAN).
+ * The outer Ethernet header is handled by dev_gro_receive() itself.
+ */
+struct sk_buff **eth_gro_receive(struct sk_buff **head, struct sk_buff *skb)
+{
+	struct packet_offload *ptype;
+	struct sk_buff **pp = NULL;
+	struct sk_buff *p;
+	struct ethhdr *eh;
+	unsigned int hlen, off;
+	int flush = 1;
+	__wsum csum;
+
+	off = skb_gro_offset(skb);
+	hlen = off + sizeof(*eh);
+	eh = skb_gro_header_fast(skb, off);
+	if (skb_gro_header_hard(skb, hlen)) {
+		eh = skb_gro_header_slow(skb, hlen, off);
+		if (unlikely(!eh))
+			goto out;
+	}
+
+	rcu_read_lock();
+	ptype = gro_find_receive_by_type(eh->h_proto);
+	if (!ptype)
+		goto out_unlock;
+
+	flush = 0;
+
+	for (p = *head; p; p = p->next) {
+		if (!NAPI_GRO_CB(p)->same_flow)
+			continue;
+
+		if (compare_ether_header(eh, skb_gro_held_header(p, skb, off)))
+			NAPI_GRO_CB(p)->same_flow = 0;
+	}
+
+	skb_gro_pull(skb, sizeof(*eh));
+
+	csum = skb->csum;
+	skb_postpull_rcsum(skb, eh, sizeof(*eh));
+
+	pp = ptype->gro_receive(head, skb);
+
+	skb->csum = csum;
+
+out_unlock:
+	rcu_read_unlock();
+out:
+	NAPI_GRO_CB(skb)->flush |= flush;
+
+	return pp;
+}
+EXPORT_SYMBOL(eth_gro_receive);
+
+int eth_gro_complete(struct sk_buff *skb)
+{
+	int nhoff = NAPI_GRO_CB(skb)->nhoff;
+	struct ethhdr *eh = (struct ethhdr *)(skb->data + nhoff);
+	struct packet_offload *ptype;
+	int err = -ENOSYS;
+
+	rcu_read_lock();
+	ptype = gro_find_complete_by_type(eh->h_proto);
+	if (ptype) {
+		NAPI_GRO_CB(skb)->nhoff = nhoff + sizeof(*eh);
+		err = ptype->gro_complete(skb);
+	}
+	rcu_read_unlock();
+
+	return err;
+}
+EXPORT_SYMBOL(eth_gro_complete);
+
+static struct packet_offload eth_packet_offload __read_mostly = {
+	.type = cpu_to_be16(ETH_P_TEB),
+	.gro_receive = eth_gro_receive,
+	.gro_complete = eth_gro_complete,
+};
+
+static int __init eth_offload_init(void)
+{
+	dev_add_offload(&eth_packet_offload);
+	return 0;
+}
+
+fs_initcall(eth_offload_init);
+
 static size_t _format_mac_addr(char *buf, int buflen,
 				const unsigned char *addr, int len)
 {
@@ -110,6 +110,7 @@ struct leaf_info {
 	struct hlist_node hlist;
 	struct rcu_head rcu;
 	int plen;
+	u32 mask_plen; /* ntohl(inet_make_mask(plen)) */
 	struct list_head falh;
 };
 
@@ -435,6 +436,7 @@ static struct leaf_info *leaf_info_new(int plen)
 	struct leaf_info *li = kmalloc(sizeof(struct leaf_info),  GFP_KERNEL);
 	if (li) {
 		li->plen = plen;
+		li->mask_plen = ntohl(inet_make_mask(plen));
 		INIT_LIST_HEAD(&li->falh);
 	}
 	return li;
@@ -1352,13 +1354,11 @@ static int check_leaf(struct trie *t, struct leaf *l,
 
 	hlist_for_each_entry_rcu(li, node, hhead, hlist) {
 		int err;
-		int plen = li->plen;
-		__be32 mask = inet_make_mask(plen);
 
-		if (l->key != (key & ntohl(mask)))
+		if (l->key != (key & li->mask_plen))
 			continue;
 
-		err = fib_semantic_match(&li->falh, flp, res, plen);
+		err = fib_semantic_match(&li->falh, flp, res, li->plen);
 
 #ifdef CONFIG_IP_FIB_TRIE_STATS
 		if (err <= 0)
@@ -1434,6 +1434,15 @@ static int fn_trie_lookup(struct fib_table *tb, const struct flowi *flp,
 
 		cn = (struct tnode *)n;
 
+		/*
+		 * The child slot we are most likely to read next sits in
+		 * a different cache line for all but the smallest tnodes;
+		 * start loading it while the skipped bits are checked.
+		 */
+		prefetch(&cn->child[tkey_extract_bits(mask_pfx(key,
+						current_prefix_length),
+						cn->pos, cn->bits)]);
+
 		/*
 		 * It's a tnode, and we can do some extra checks here if we
 		 * like, to avoid descending into a dead-end branch.
@@ -1513,10 +1522,8 @@ static int fn_trie_lookup(struct fib_table *tb, const struct flowi *flp,
 		 * state.directly.
 		 */
 		if (pref_mismatch) {
-			while (!(pref_mismatch & (1<<(KEYLENGTH-1)))) {
-				mp++;
-				pref_mismatch = pref_mismatch << 1;
-			}
+			/* mp is the number of leading bits that match */
+			mp = KEYLENGTH - fls(pref_mismatch);
 			key_prefix = tkey_extract_bits(cn->key, mp, cn->pos-mp);
 
 			if (key_prefix != 0)
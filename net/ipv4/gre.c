@@ -445,6 +445,124 @@ static int gre_gso_send_check(struct sk_buff *skb)
 	return 0;
 }
 
+static struct sk_buff **gre_gro_receive(struct sk_buff **head,
+					struct sk_buff *skb)
+{
+	struct packet_offload *ptype;
+	struct sk_buff **pp = NULL;
+	struct gre_base_hdr *greh;
+	struct sk_buff *p;
+	unsigned int hlen, off;
+	int grehlen = GRE_HEADER_SECTION;
+	int flush = 1;
+	__wsum csum;
+
+	if (NAPI_GRO_CB(skb)->encap_mark)
+		goto out;
+
+	/* A device validated checksum only covers the inner headers
+	 * when the device says so through skb->encapsulation.
+	 */
+	if (skb->ip_summed == CHECKSUM_UNNECESSARY && !skb->encapsulation)
+		goto out;
+
+	off = skb_gro_offset(skb);
+	hlen = off + sizeof(*greh);
+	greh = skb_gro_header_fast(skb, off);
+	if (skb_gro_header_hard(skb, hlen)) {
+		greh = skb_gro_header_slow(skb, hlen, off);
+		if (unlikely(!greh))
+			goto out;
+	}
+
+	/* Only version 0 with an optional key is aggregated.  A checksum
+	 * would not cover the merged packet, and sequence numbers can not
+	 * be rebuilt by gre_gso_segment() if the packet gets forwarded.
+	 */
+	if (greh->flags & ~GRE_KEY)
+		goto out;
+
+	if (greh->flags & GRE_KEY)
+		grehlen += GRE_HEADER_SECTION;
+
+	hlen = off + grehlen;
+	if (skb_gro_header_hard(skb, hlen)) {
+		greh = skb_gro_header_slow(skb, hlen, off);
+		if (unlikely(!greh))
+			goto out;
+	}
+
+	rcu_read_lock();
+	ptype = gro_find_receive_by_type(greh->protocol);
+	if (!ptype)
+		goto out_unlock;
+
+	flush = 0;
+
+	for (p = *head; p; p = p->next) {
+		struct gre_base_hdr *greh2;
+
+		if (!NAPI_GRO_CB(p)->same_flow)
+			continue;
+
+		/* Same tunnel: same flags, protocol and key. */
+		greh2 = skb_gro_held_header(p, skb, off);
+		if (greh2->flags != greh->flags ||
+		    greh2->protocol != greh->protocol ||
+		    ((greh->flags & GRE_KEY) &&
+		     *(__be32 *)(greh2 + 1) != *(__be32 *)(greh + 1))) {
+			NAPI_GRO_CB(p)->same_flow = 0;
+			continue;
+		}
+	}
+
+	NAPI_GRO_CB(skb)->encap_mark = 1;
+	skb_gro_pull(skb, grehlen);
+
+	csum = skb->csum;
+	skb_postpull_rcsum(skb, greh, grehlen);
+
+	pp = ptype->gro_receive(head, skb);
+
+	skb->csum = csum;
+
+out_unlock:
+	rcu_read_unlock();
+out:
+	NAPI_GRO_CB(skb)->flush |= flush;
+
+	return pp;
+}
+
+static int gre_gro_complete(struct sk_buff *skb)
+{
+	int nhoff = NAPI_GRO_CB(skb)->nhoff;
+	struct gre_base_hdr *greh = (struct gre_base_hdr *)(skb->data + nhoff);
+	struct packet_offload *ptype;
+	int grehlen = GRE_HEADER_SECTION;
+	int err = -ENOENT;
+
+	if (greh->flags & GRE_KEY)
+		grehlen += GRE_HEADER_SECTION;
+
+	rcu_read_lock();
+	ptype = gro_find_complete_by_type(greh->protocol);
+	if (ptype) {
+		NAPI_GRO_CB(skb)->nhoff = nhoff + grehlen;
+		err = ptype->gro_complete(skb);
+	}
+	rcu_read_unlock();
+
+	/* Let the packet be segmented again if it gets forwarded,
+	 * iptunnel_pull_header() clears this on local delivery.
+	 */
+	if (!err) {
+		skb->encapsulation = 1;
+		skb_shinfo(skb)->gso_type |= SKB_GSO_GRE;
+	}
+	return err;
+}
+
 static const struct net_protocol net_gre_protocol = {
 	.handler     = gre_rcv,
 	.err_handler = gre_err,
@@ -454,6 +572,8 @@ static const struct net_protocol net_gre_protocol = {
 static const struct net_offload gre_offload = {
 	.gso_send_check =	gre_gso_send_check,
 	.gso_segment    =	gre_gso_segment,
+	.gro_receive	=	gre_gro_receive,
+	.gro_complete	=	gre_gro_complete,
 };
 
 static const struct gre_protocol ipgre_protocol = {
@@ -407,8 +407,13 @@ int ip_recv_error(struct sock *sk, struct msghdr *msg, int len, int *addr_len)
 	sin = (struct sockaddr_in *)msg->msg_name;
 	if (sin) {
 		sin->sin_family = AF_INET;
-		sin->sin_addr.s_addr = *(__be32 *)(skb_network_header(skb) +
-						   serr->addr_offset);
+		/* zerocopy notifications carry no packet to take it from */
+		if (serr->ee.ee_origin == SO_EE_ORIGIN_ZEROCOPY)
+			sin->sin_addr.s_addr = 0;
+		else
+			sin->sin_addr.s_addr =
+				*(__be32 *)(skb_network_header(skb) +
+					    serr->addr_offset);
 		sin->sin_port = serr->port;
 		memset(&sin->sin_zero, 0, sizeof(sin->sin_zero));
 		*addr_len = sizeof(*sin);
@@ -435,12 +440,16 @@ int ip_recv_error(struct sock *sk, struct msghdr *msg, int len, int *addr_len)
 	msg->msg_flags |= MSG_ERRQUEUE;
 	err = copied;
 
-	/* Reset and regenerate socket error */
+	/* Reset and regenerate socket error.  Zerocopy completions are
+	 * not errors and leave sk_err alone.
+	 */
 	spin_lock_bh(&sk->sk_error_queue.lock);
-	sk->sk_err = 0;
+	if (serr->ee.ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+		sk->sk_err = 0;
 	skb2 = skb_peek(&sk->sk_error_queue);
 	if (skb2 != NULL) {
-		sk->sk_err = SKB_EXT_ERR(skb2)->ee.ee_errno;
+		if (SKB_EXT_ERR(skb2)->ee.ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+			sk->sk_err = SKB_EXT_ERR(skb2)->ee.ee_errno;
 		spin_unlock_bh(&sk->sk_error_queue.lock);
 		sk->sk_error_report(sk);
 	} else
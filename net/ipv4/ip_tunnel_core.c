@@ -95,6 +95,13 @@ int iptunnel_pull_header(struct sk_buff *skb, int hdr_len, __be16 inner_proto)
 
 	skb_pull_rcsum(skb, hdr_len);
 
+	/* A GRO aggregated tunnel packet is plain GSO once decapsulated. */
+	if (skb_is_gso(skb) &&
+	    skb_shinfo(skb)->gso_type & (SKB_GSO_GRE | SKB_GSO_UDP_TUNNEL)) {
+		skb_shinfo(skb)->gso_type &= ~(SKB_GSO_GRE | SKB_GSO_UDP_TUNNEL);
+		skb->encapsulation = 0;
+	}
+
 	if (inner_proto == htons(ETH_P_TEB)) {
 		struct ethhdr *eh = (struct ethhdr *)skb->data;
 
@@ -1866,6 +1866,147 @@ static void rt_set_nexthop(struct rtable *rt, struct fib_result *res, u32 itag)
 	rt->rt_type = res->type;
 }
 
+/*
+ * Forwarding does not depend on the source address: through a gateway
+ * the nexthop, the metrics and the neighbour are the same for every
+ * flow, and to a directly connected host they only depend on the
+ * destination.  Such routes are cached on the fib nexthop itself, one
+ * per input device (and destination, for connected hosts), and never
+ * enter rt_hash_table.  A forwarding lookup is then a fib lookup plus a
+ * reference on the cached entry, however many sources send through the
+ * router.
+ *
+ * Anything that would make the entry depend on the flow keeps the old
+ * per-flow route: redirects, directly connected sources, route
+ * classification tags, and IP options, which read rt_spec_dst.
+ * Route queries from rtnetlink (skb->iif == 0) also stay per-flow, they
+ * report and modify the per-flow fields of the entry.
+ */
+static bool rt_nh_cacheable(const struct sk_buff *skb,
+			    struct fib_result *res,
+			    unsigned flags, u32 itag)
+{
+	if (!res->fi || flags || itag || !skb->iif)
+		return false;
+	if (FIB_RES_NH(*res).nh_scope !=
+	    (FIB_RES_GW(*res) ? RT_SCOPE_LINK : RT_SCOPE_HOST))
+		return false;
+	if (skb->protocol != htons(ETH_P_IP) ||
+	    ip_hdr(skb)->ihl != sizeof(struct iphdr) >> 2)
+		return false;
+#if defined(CONFIG_NET_CLS_ROUTE) && defined(CONFIG_IP_MULTIPLE_TABLES)
+	if (fib_rules_tclass(res))
+		return false;
+#endif
+	return true;
+}
+
+/*
+ * Each nexthop slot is an RCU chain through u.dst.rt_next, which these
+ * entries do not otherwise use.  Chains are changed under rt_nh_lock
+ * and kept to RT_NH_CHAIN_MAX entries.
+ */
+#define RT_NH_CHAIN_MAX		8
+
+static DEFINE_SPINLOCK(rt_nh_lock);
+
+/* Only routes to directly connected hosts depend on the destination. */
+static inline __be32 rt_nh_key(const struct fib_nh *nh, __be32 daddr)
+{
+	return nh->nh_gw ? 0 : daddr;
+}
+
+static inline struct rtable **rt_nh_slot(struct fib_nh *nh, __be32 key,
+					 int iif)
+{
+	u32 hash = jhash_2words((__force u32)key, iif, 0);
+
+	return &nh->nh_rth_input[hash & (FIB_NH_RTH_INPUT - 1)];
+}
+
+static inline bool rt_nh_match(const struct rtable *rth, __be32 key, int iif)
+{
+	return rth->fl.iif == iif && (!key || rth->fl.fl4_dst == key);
+}
+
+static inline bool rt_nh_stale(struct rtable *rth)
+{
+	return rt_is_expired(rth) ||
+	       (rth->u.dst.expires &&
+		time_after_eq(jiffies, rth->u.dst.expires));
+}
+
+static struct rtable *rt_nh_input_get(struct fib_nh *nh,
+				      struct in_device *in_dev, __be32 daddr)
+{
+	__be32 key = rt_nh_key(nh, daddr);
+	int iif = in_dev->dev->ifindex;
+	struct rtable *rth;
+
+	rcu_read_lock_bh();
+	for (rth = rcu_dereference(*rt_nh_slot(nh, key, iif)); rth;
+	     rth = rcu_dereference(rth->u.dst.rt_next))
+		if (rt_nh_match(rth, key, iif))
+			break;
+	if (rth &&
+	    !rt_nh_stale(rth) &&
+	    !(rth->u.dst.flags & DST_NOPOLICY) ==
+	    !IN_DEV_CONF_GET(in_dev, NOPOLICY))
+		dst_use(&rth->u.dst, jiffies);
+	else
+		rth = NULL;
+	rcu_read_unlock_bh();
+
+	return rth;
+}
+
+/*
+ * Put rth at the head of its chain, dropping the entry it replaces,
+ * stale ones and those beyond RT_NH_CHAIN_MAX.
+ */
+static void rt_nh_input_set(struct fib_nh *nh, struct rtable *rth)
+{
+	__be32 key = rt_nh_key(nh, rth->fl.fl4_dst);
+	int iif = rth->fl.iif;
+	struct rtable **slot, **rthp, *aux;
+	int len = 1;
+
+	dst_hold(&rth->u.dst);
+
+	spin_lock_bh(&rt_nh_lock);
+	slot = rt_nh_slot(nh, key, iif);
+	rthp = slot;
+	while ((aux = *rthp) != NULL) {
+		if (rt_nh_match(aux, key, iif) || rt_nh_stale(aux) ||
+		    ++len > RT_NH_CHAIN_MAX) {
+			*rthp = aux->u.dst.rt_next;
+			rt_drop(aux);
+			continue;
+		}
+		rthp = &aux->u.dst.rt_next;
+	}
+	rth->u.dst.rt_next = *slot;
+	rcu_assign_pointer(*slot, rth);
+	spin_unlock_bh(&rt_nh_lock);
+}
+
+/* Called when the fib_info owning the nexthop is freed. */
+void rt_nh_release(struct fib_nh *nh)
+{
+	int i;
+
+	for (i = 0; i < FIB_NH_RTH_INPUT; i++) {
+		struct rtable *rth = xchg(&nh->nh_rth_input[i], NULL);
+
+		while (rth) {
+			struct rtable *next = rth->u.dst.rt_next;
+
+			rt_drop(rth);
+			rth = next;
+		}
+	}
+}
+
 static int ip_route_input_mc(struct sk_buff *skb, __be32 daddr, __be32 saddr,
 				u8 tos, struct net_device *dev, int our)
 {
@@ -1995,6 +2136,7 @@ static int __mkroute_input(struct sk_buff *skb,
 	unsigned flags = 0;
 	__be32 spec_dst;
 	u32 itag;
+	bool nh_cache;
 
 	/* get a working reference to the output device */
 	out_dev = in_dev_get(FIB_RES_DEV(*res));
@@ -2039,6 +2181,17 @@ static int __mkroute_input(struct sk_buff *skb,
 		}
 	}
 
+	nh_cache = rt_nh_cacheable(skb, res, flags, itag);
+	if (nh_cache) {
+		rth = rt_nh_input_get(&FIB_RES_NH(*res), in_dev, daddr);
+		if (rth) {
+			RT_CACHE_STAT_INC(in_hit);
+			skb_dst_set(skb, &rth->u.dst);
+			*result = NULL;
+			err = 0;
+			goto cleanup;
+		}
+	}
 
 	rth = dst_alloc(&ipv4_dst_ops);
 	if (!rth) {
@@ -2076,6 +2229,17 @@ static int __mkroute_input(struct sk_buff *skb,
 
 	rth->rt_flags = flags;
 
+	if (nh_cache) {
+		err = arp_bind_neighbour(&rth->u.dst);
+		if (err) {
+			rt_drop(rth);
+			goto cleanup;
+		}
+		rt_nh_input_set(&FIB_RES_NH(*res), rth);
+		skb_dst_set(skb, &rth->u.dst);
+		rth = NULL;
+	}
+
 	*result = rth;
 	err = 0;
  cleanup:
@@ -2104,6 +2268,10 @@ static int ip_mkroute_input(struct sk_buff *skb,
 	if (err)
 		return err;
 
+	/* attached from the nexthop cache, nothing to hash */
+	if (!rth)
+		return 0;
+
 	/* put it into the cache */
 	hash = rt_hash(daddr, saddr, fl->iif,
 		       rt_genid(dev_net(rth->u.dst.dev)));
@@ -291,6 +291,8 @@ struct sock *cookie_v4_check(struct sock *sk, struct sk_buff *skb,
 	ireq = inet_rsk(req);
 	treq = tcp_rsk(req);
 	treq->rcv_isn		= ntohl(th->seq) - 1;
+	treq->rcv_nxt		= ntohl(th->seq);
+	treq->listener		= NULL;
 	treq->snt_isn		= cookie;
 	req->mss		= mss;
 	ireq->loc_port		= th->dest;
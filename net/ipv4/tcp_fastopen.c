@@ -0,0 +1,256 @@
+/*
+ * TCP Fast Open: cookie generation and client side cookie cache.
+ *
+ *		This program is free software; you can redistribute it and/or
+ *		modify it under the terms of the GNU General Public License
+ *		as published by the Free Software Foundation; either version
+ *		2 of the License, or (at your option) any later version.
+ */
+
+#include <linux/init.h>
+#include <linux/kernel.h>
+#include <linux/list.h>
+#include <linux/slab.h>
+#include <linux/crypto.h>
+#include <linux/jhash.h>
+#include <linux/random.h>
+#include <linux/spinlock.h>
+#include <linux/rcupdate.h>
+#include <linux/mutex.h>
+#include <net/tcp.h>
+#if defined(CONFIG_IPV6) || defined(CONFIG_IPV6_MODULE)
+#include <net/ipv6.h>
+#endif
+
+int sysctl_tcp_fastopen __read_mostly = TFO_CLIENT_ENABLE;
+
+struct tcp_fastopen_context *tcp_fastopen_ctx;
+
+static DEFINE_SPINLOCK(tcp_fastopen_ctx_lock);
+static DEFINE_MUTEX(tcp_fastopen_key_mutex);
+
+static void tcp_fastopen_ctx_free(struct rcu_head *head)
+{
+	struct tcp_fastopen_context *ctx =
+	    container_of(head, struct tcp_fastopen_context, rcu);
+
+	crypto_free_cipher(ctx->tfm);
+	kfree(ctx);
+}
+
+int tcp_fastopen_reset_cipher(void *key, unsigned int len)
+{
+	int err;
+	struct tcp_fastopen_context *ctx, *octx;
+
+	ctx = kmalloc(sizeof(*ctx), GFP_KERNEL);
+	if (!ctx)
+		return -ENOMEM;
+	ctx->tfm = crypto_alloc_cipher("aes", 0, 0);
+
+	if (IS_ERR(ctx->tfm)) {
+		err = PTR_ERR(ctx->tfm);
+error:		kfree(ctx);
+		pr_err("TCP: TCP Fast Open cipher setup failed: %d\n", err);
+		return err;
+	}
+	err = crypto_cipher_setkey(ctx->tfm, key, len);
+	if (err) {
+		pr_err("TCP: TCP Fast Open cipher setkey failed: %d\n", err);
+		crypto_free_cipher(ctx->tfm);
+		goto error;
+	}
+	memcpy(ctx->key, key, len);
+
+	spin_lock(&tcp_fastopen_ctx_lock);
+
+	octx = tcp_fastopen_ctx;
+	rcu_assign_pointer(tcp_fastopen_ctx, ctx);
+	spin_unlock(&tcp_fastopen_ctx_lock);
+
+	if (octx)
+		call_rcu(&octx->rcu, tcp_fastopen_ctx_free);
+	return err;
+}
+
+/* The AES implementation may be modular, so the first key is installed
+ * lazily, from process context, the first time Fast Open is used.
+ */
+void tcp_fastopen_init_key_once(void)
+{
+	u8 key[TCP_FASTOPEN_KEY_LENGTH];
+
+	if (likely(tcp_fastopen_ctx != NULL))
+		return;
+
+	mutex_lock(&tcp_fastopen_key_mutex);
+	if (tcp_fastopen_ctx == NULL) {
+		get_random_bytes(key, sizeof(key));
+		tcp_fastopen_reset_cipher(key, sizeof(key));
+	}
+	mutex_unlock(&tcp_fastopen_key_mutex);
+}
+
+/* Computes the fastopen cookie for the peer.
+ * The peer address is a 128 bits long (pad with zeros for IPv4).
+ *
+ * The caller must check foc->len to determine if a valid cookie
+ * has been generated successfully.
+ */
+void tcp_fastopen_cookie_gen(__be32 addr, struct tcp_fastopen_cookie *foc)
+{
+	__be32 peer_addr[4] = { addr, 0, 0, 0 };
+	struct tcp_fastopen_context *ctx;
+
+	rcu_read_lock();
+	ctx = rcu_dereference(tcp_fastopen_ctx);
+	if (ctx) {
+		crypto_cipher_encrypt_one(ctx->tfm,
+					  foc->val,
+					  (__u8 *)peer_addr);
+		foc->len = TCP_FASTOPEN_COOKIE_SIZE;
+	}
+	rcu_read_unlock();
+}
+
+/*
+ * Client side cookie cache.
+ *
+ * There is no per-destination metrics cache in this tree, so the cookies
+ * (together with the MSS and the SYN loss history) learnt from servers are
+ * kept in a small direct mapped table keyed by the destination address.
+ * A colliding destination simply evicts the previous entry; the worst case
+ * is one extra round trip to fetch a new cookie.
+ */
+#define TCP_FASTOPEN_CACHE_BITS	8
+#define TCP_FASTOPEN_CACHE_SIZE	(1 << TCP_FASTOPEN_CACHE_BITS)
+
+struct tcp_fastopen_cache_entry {
+	struct net			*net;
+	unsigned short			family;
+	__be32				daddr[4];
+	u16				mss;
+	u16				syn_loss;
+	unsigned long			last_syn_loss;
+	struct tcp_fastopen_cookie	cookie;
+};
+
+static struct tcp_fastopen_cache_entry
+	tcp_fastopen_cache[TCP_FASTOPEN_CACHE_SIZE];
+static DEFINE_SPINLOCK(tcp_fastopen_cache_lock);
+
+static bool tcp_fastopen_cache_key(struct sock *sk, __be32 *daddr)
+{
+	memset(daddr, 0, 4 * sizeof(__be32));
+
+	switch (sk->sk_family) {
+	case AF_INET:
+		daddr[0] = inet_sk(sk)->daddr;
+		return true;
+#if defined(CONFIG_IPV6) || defined(CONFIG_IPV6_MODULE)
+	case AF_INET6:
+		memcpy(daddr, &inet6_sk(sk)->daddr, sizeof(struct in6_addr));
+		return true;
+#endif
+	}
+	return false;
+}
+
+static struct tcp_fastopen_cache_entry *tcp_fastopen_cache_slot(struct sock *sk,
+								 const __be32 *daddr)
+{
+	u32 hash = jhash2((const u32 *)daddr, 4,
+			  (u32)(unsigned long)sock_net(sk) ^ sk->sk_family);
+
+	return &tcp_fastopen_cache[hash & (TCP_FASTOPEN_CACHE_SIZE - 1)];
+}
+
+static bool tcp_fastopen_cache_match(const struct tcp_fastopen_cache_entry *e,
+				     struct sock *sk, const __be32 *daddr)
+{
+	return net_eq(e->net, sock_net(sk)) && e->family == sk->sk_family &&
+	       !memcmp(e->daddr, daddr, sizeof(e->daddr));
+}
+
+void tcp_fastopen_cache_get(struct sock *sk, u16 *mss,
+			    struct tcp_fastopen_cookie *cookie,
+			    int *syn_loss, unsigned long *last_syn_loss)
+{
+	struct tcp_fastopen_cache_entry *e;
+	__be32 daddr[4];
+
+	*syn_loss = 0;
+	if (!tcp_fastopen_cache_key(sk, daddr))
+		return;
+
+	e = tcp_fastopen_cache_slot(sk, daddr);
+	spin_lock_bh(&tcp_fastopen_cache_lock);
+	if (tcp_fastopen_cache_match(e, sk, daddr)) {
+		if (e->mss)
+			*mss = e->mss;
+		*cookie = e->cookie;
+		*syn_loss = e->syn_loss;
+		*last_syn_loss = *syn_loss ? e->last_syn_loss : 0;
+	}
+	spin_unlock_bh(&tcp_fastopen_cache_lock);
+}
+
+void tcp_fastopen_cache_set(struct sock *sk, u16 mss,
+			    struct tcp_fastopen_cookie *cookie, bool syn_lost)
+{
+	struct tcp_fastopen_cache_entry *e;
+	__be32 daddr[4];
+
+	if (!tcp_fastopen_cache_key(sk, daddr))
+		return;
+
+	e = tcp_fastopen_cache_slot(sk, daddr);
+	spin_lock_bh(&tcp_fastopen_cache_lock);
+	if (!tcp_fastopen_cache_match(e, sk, daddr)) {
+		memset(e, 0, sizeof(*e));
+		e->net = sock_net(sk);
+		e->family = sk->sk_family;
+		memcpy(e->daddr, daddr, sizeof(e->daddr));
+	}
+	if (mss)
+		e->mss = mss;
+	if (cookie && cookie->len > 0)
+		e->cookie = *cookie;
+	if (syn_lost) {
+		e->syn_loss++;
+		e->last_syn_loss = jiffies;
+	} else {
+		e->syn_loss = 0;
+	}
+	spin_unlock_bh(&tcp_fastopen_cache_lock);
+}
+
+/*
+ * Entries are keyed by the struct net pointer: forget those of a dying
+ * namespace, so that one allocated later at the same address does not
+ * inherit its cookies.
+ */
+static void __net_exit tcp_fastopen_net_exit(struct net *net)
+{
+	int i;
+
+	spin_lock_bh(&tcp_fastopen_cache_lock);
+	for (i = 0; i < TCP_FASTOPEN_CACHE_SIZE; i++) {
+		struct tcp_fastopen_cache_entry *e = &tcp_fastopen_cache[i];
+
+		if (e->net == net)
+			memset(e, 0, sizeof(*e));
+	}
+	spin_unlock_bh(&tcp_fastopen_cache_lock);
+}
+
+static struct pernet_operations tcp_fastopen_net_ops = {
+	.exit = tcp_fastopen_net_exit,
+};
+
+static int __init tcp_fastopen_init(void)
+{
+	return register_pernet_subsys(&tcp_fastopen_net_ops);
+}
+
+late_initcall(tcp_fastopen_init);
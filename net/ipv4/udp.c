@@ -105,7 +105,9 @@
 #include <net/route.h>
 #include <net/checksum.h>
 #include <net/xfrm.h>
+#include <net/busy_poll.h>
 #include <trace/events/udp.h>
+#include <linux/jhash.h>
 #include "udp_impl.h"
 
 struct udp_table udp_table;
@@ -125,6 +127,8 @@ EXPORT_SYMBOL(udp_memory_allocated);
 
 #define PORTS_PER_CHAIN (65536 / UDP_HTABLE_SIZE)
 
+#define UDP_HTABLE2_SIZE_MIN	UDP_HTABLE_SIZE
+
 static int udp_lib_lport_inuse(struct net *net, __u16 num,
 			       const struct udp_hslot *hslot,
 			       unsigned long *bitmap,
@@ -219,8 +223,20 @@ found:
 	inet_sk(sk)->num = snum;
 	sk->sk_hash = snum;
 	if (sk_unhashed(sk)) {
+		struct udp_hslot *hslot2;
+
 		sk_nulls_add_node_rcu(sk, &hslot->head);
+		hslot->count++;
 		sock_prot_inuse_add(sock_net(sk), sk->sk_prot, 1);
+
+		/* udp_portaddr_hash holds the address part, see get_port */
+		udp_sk(sk)->udp_portaddr_hash ^= snum;
+		hslot2 = udp_hashslot2(udptable, udp_sk(sk)->udp_portaddr_hash);
+		spin_lock(&hslot2->lock);
+		hlist_nulls_add_head_rcu(&udp_sk(sk)->udp_portaddr_node,
+					 &hslot2->head);
+		hslot2->count++;
+		spin_unlock(&hslot2->lock);
 	}
 	error = 0;
 fail_unlock:
@@ -239,8 +255,18 @@ static int ipv4_rcv_saddr_equal(const struct sock *sk1, const struct sock *sk2)
 		   inet1->rcv_saddr == inet2->rcv_saddr));
 }
 
+static unsigned int udp4_portaddr_hash(struct net *net, __be32 saddr,
+				       unsigned int port)
+{
+	return jhash_1word((__force u32)saddr, net_hash_mix(net)) ^ port;
+}
+
 int udp_v4_get_port(struct sock *sk, unsigned short snum)
 {
+	/* precompute partial secondary hash, the port is mixed in later */
+	udp_sk(sk)->udp_portaddr_hash =
+		udp4_portaddr_hash(sock_net(sk), inet_sk(sk)->rcv_saddr, 0);
+
 	return udp_lib_get_port(sk, snum, ipv4_rcv_saddr_equal);
 }
 
@@ -279,6 +305,98 @@ static inline int compute_score(struct sock *sk, struct net *net, __be32 saddr,
 	return score;
 }
 
+/*
+ * In this second variant, we check (daddr, dport) matches (inet_rcv_sadd, inet_num)
+ */
+static inline int compute_score2(struct sock *sk, struct net *net,
+				 __be32 saddr, __be16 sport,
+				 __be32 daddr, unsigned int hnum, int dif)
+{
+	int score = -1;
+
+	if (net_eq(sock_net(sk), net) && !ipv6_only_sock(sk)) {
+		struct inet_sock *inet = inet_sk(sk);
+
+		if (inet->rcv_saddr != daddr)
+			return -1;
+		if (inet->num != hnum)
+			return -1;
+
+		score = (sk->sk_family == PF_INET ? 2 : 1);
+		if (inet->daddr) {
+			if (inet->daddr != saddr)
+				return -1;
+			score += 4;
+		}
+		if (inet->dport) {
+			if (inet->dport != sport)
+				return -1;
+			score += 4;
+		}
+		if (sk->sk_bound_dev_if) {
+			if (sk->sk_bound_dev_if != dif)
+				return -1;
+			score += 4;
+		}
+	}
+	return score;
+}
+
+/* called with rcu_read_lock() */
+static struct sock *udp4_lib_lookup2(struct net *net,
+		__be32 saddr, __be16 sport,
+		__be32 daddr, unsigned int hnum, int dif,
+		struct udp_hslot *hslot2, unsigned int slot2)
+{
+	struct sock *sk, *result;
+	struct udp_sock *up;
+	struct hlist_nulls_node *node;
+	int score, badness, matches = 0, reuseport = 0;
+	u32 hash = 0;
+
+begin:
+	result = NULL;
+	badness = -1;
+	udp_portaddr_for_each_entry_rcu(up, node, &hslot2->head) {
+		sk = (struct sock *)up;
+		score = compute_score2(sk, net, saddr, sport,
+				      daddr, hnum, dif);
+		if (score > badness) {
+			result = sk;
+			badness = score;
+			reuseport = sk->sk_reuseport;
+			if (reuseport) {
+				hash = inet_ehashfn(net, daddr, hnum,
+						    saddr, htons(sport));
+				matches = 1;
+			}
+		} else if (score == badness && reuseport) {
+			matches++;
+			if (((u64)hash * matches) >> 32 == 0)
+				result = sk;
+			hash = next_pseudo_random32(hash);
+		}
+	}
+	/*
+	 * if the nulls value we got at the end of this lookup is
+	 * not the expected one, we must restart lookup.
+	 * We probably met an item that was moved to another chain.
+	 */
+	if (get_nulls_value(node) != slot2)
+		goto begin;
+
+	if (result) {
+		if (unlikely(!atomic_inc_not_zero(&result->sk_refcnt)))
+			result = NULL;
+		else if (unlikely(compute_score2(result, net, saddr, sport,
+				  daddr, hnum, dif) < badness)) {
+			sock_put(result);
+			goto begin;
+		}
+	}
+	return result;
+}
+
 /* UDP is nearly always wildcards out the wazoo, it makes no sense to try
  * harder than this. -DaveM
  */
@@ -289,12 +407,36 @@ static struct sock *__udp4_lib_lookup(struct net *net, __be32 saddr,
 	struct sock *sk, *result;
 	struct hlist_nulls_node *node;
 	unsigned short hnum = ntohs(dport);
-	unsigned int slot = udp_hashfn(net, hnum);
-	struct udp_hslot *hslot = &udptable->hash[slot];
+	unsigned int hash2, slot2, slot = udp_hashfn(net, hnum);
+	struct udp_hslot *hslot2, *hslot = &udptable->hash[slot];
 	int score, badness, matches = 0, reuseport = 0;
 	u32 hash = 0;
 
 	rcu_read_lock();
+	if (hslot->count > UDP_HSLOT2_THRESHOLD) {
+		hash2 = udp4_portaddr_hash(net, daddr, hnum);
+		slot2 = hash2 & udptable->mask2;
+		hslot2 = &udptable->hash2[slot2];
+		if (hslot->count < hslot2->count)
+			goto begin;
+
+		result = udp4_lib_lookup2(net, saddr, sport,
+					  daddr, hnum, dif,
+					  hslot2, slot2);
+		if (!result) {
+			hash2 = udp4_portaddr_hash(net, htonl(INADDR_ANY), hnum);
+			slot2 = hash2 & udptable->mask2;
+			hslot2 = &udptable->hash2[slot2];
+			if (hslot->count < hslot2->count)
+				goto begin;
+
+			result = udp4_lib_lookup2(net, saddr, sport,
+						  htonl(INADDR_ANY), hnum, dif,
+						  hslot2, slot2);
+		}
+		rcu_read_unlock();
+		return result;
+	}
 begin:
 	result = NULL;
 	badness = 0;
@@ -1084,8 +1226,11 @@ int udp_disconnect(struct sock *sk, int flags)
 	inet->dport = 0;
 	inet_rps_save_rxhash(sk, 0);
 	sk->sk_bound_dev_if = 0;
-	if (!(sk->sk_userlocks & SOCK_BINDADDR_LOCK))
+	if (!(sk->sk_userlocks & SOCK_BINDADDR_LOCK)) {
 		inet_reset_saddr(sk);
+		if (sk->sk_userlocks & SOCK_BINDPORT_LOCK)
+			sk_rehash_local(sk);
+	}
 
 	if (!(sk->sk_userlocks & SOCK_BINDPORT_LOCK)) {
 		sk->sk_prot->unhash(sk);
@@ -1102,23 +1247,77 @@ void udp_lib_unhash(struct sock *sk)
 		struct udp_table *udptable = sk->sk_prot->h.udp_table;
 		unsigned int hash = udp_hashfn(sock_net(sk), sk->sk_hash);
 		struct udp_hslot *hslot = &udptable->hash[hash];
+		struct udp_hslot *hslot2;
+
+		hslot2 = udp_hashslot2(udptable, udp_sk(sk)->udp_portaddr_hash);
 
 		spin_lock_bh(&hslot->lock);
 		if (sk_nulls_del_node_init_rcu(sk)) {
+			hslot->count--;
 			inet_sk(sk)->num = 0;
 			sock_prot_inuse_add(sock_net(sk), sk->sk_prot, -1);
+
+			spin_lock(&hslot2->lock);
+			hlist_nulls_del_init_rcu(&udp_sk(sk)->udp_portaddr_node);
+			hslot2->count--;
+			spin_unlock(&hslot2->lock);
 		}
 		spin_unlock_bh(&hslot->lock);
 	}
 }
 EXPORT_SYMBOL(udp_lib_unhash);
 
+/*
+ * inet_rcv_saddr was changed, deal with secondary hash
+ */
+void udp_lib_rehash(struct sock *sk, unsigned int newhash)
+{
+	if (sk_hashed(sk)) {
+		struct udp_table *udptable = sk->sk_prot->h.udp_table;
+		struct udp_hslot *hslot, *hslot2, *nhslot2;
+
+		hslot2 = udp_hashslot2(udptable, udp_sk(sk)->udp_portaddr_hash);
+		nhslot2 = udp_hashslot2(udptable, newhash);
+		udp_sk(sk)->udp_portaddr_hash = newhash;
+		if (hslot2 != nhslot2) {
+			hslot = &udptable->hash[udp_hashfn(sock_net(sk),
+							   sk->sk_hash)];
+			/* we must lock primary chain too */
+			spin_lock_bh(&hslot->lock);
+
+			spin_lock(&hslot2->lock);
+			hlist_nulls_del_init_rcu(&udp_sk(sk)->udp_portaddr_node);
+			hslot2->count--;
+			spin_unlock(&hslot2->lock);
+
+			spin_lock(&nhslot2->lock);
+			hlist_nulls_add_head_rcu(&udp_sk(sk)->udp_portaddr_node,
+						 &nhslot2->head);
+			nhslot2->count++;
+			spin_unlock(&nhslot2->lock);
+
+			spin_unlock_bh(&hslot->lock);
+		}
+	}
+}
+EXPORT_SYMBOL(udp_lib_rehash);
+
+void udp_v4_rehash(struct sock *sk)
+{
+	unsigned int new_hash = udp4_portaddr_hash(sock_net(sk),
+						   inet_sk(sk)->rcv_saddr,
+						   inet_sk(sk)->num);
+	udp_lib_rehash(sk, new_hash);
+}
+
 static int __udp_queue_rcv_skb(struct sock *sk, struct sk_buff *skb)
 {
 	int rc;
 
-	if (inet_sk(sk)->daddr)
+	if (inet_sk(sk)->daddr) {
 		sock_rps_save_rxhash(sk, skb->rxhash);
+		sk_mark_napi_id(sk, skb);
+	}
 
 	rc = sock_queue_rcv_skb(sk, skb);
 	if (rc < 0) {
@@ -1319,7 +1518,11 @@ static inline int udp4_csum_init(struct sk_buff *skb, struct udphdr *uh,
 
 	iph = ip_hdr(skb);
 	if (uh->check == 0) {
-		skb->ip_summed = CHECKSUM_UNNECESSARY;
+		/* GRO aggregated tunnel frames keep CHECKSUM_PARTIAL for
+		 * their inner headers, see udp4_gro_complete().
+		 */
+		if (skb->ip_summed != CHECKSUM_PARTIAL)
+			skb->ip_summed = CHECKSUM_UNNECESSARY;
 	} else if (skb->ip_summed == CHECKSUM_COMPLETE) {
 		if (!csum_tcpudp_magic(iph->saddr, iph->daddr, skb->len,
 				      proto, skb->csum))
@@ -1669,12 +1872,14 @@ struct proto udp_prot = {
 	.sysctl_wmem	   = &sysctl_udp_wmem_min,
 	.sysctl_rmem	   = &sysctl_udp_rmem_min,
 	.obj_size	   = sizeof(struct udp_sock),
-	.slab_flags	   = SLAB_DESTROY_BY_RCU,
+	.slab_flags	   = SLAB_DESTROY_BY_RCU | RHEL_EXTENDED_PROTO,
 	.h.udp_table	   = &udp_table,
 #ifdef CONFIG_COMPAT
 	.compat_setsockopt = compat_udp_setsockopt,
 	.compat_getsockopt = compat_udp_getsockopt,
 #endif
+	.rhel_flags	   = RHEL_PROTO_HAS_REHASH,
+	.rehash		   = udp_v4_rehash,
 };
 EXPORT_SYMBOL(udp_prot);
 
@@ -1882,21 +2087,59 @@ void udp4_proc_exit(void)
 }
 #endif /* CONFIG_PROC_FS */
 
-void __init udp_table_init(struct udp_table *table)
+static __initdata unsigned long uhash_entries;
+static int __init set_uhash_entries(char *str)
 {
-	int i;
+	if (!str)
+		return 0;
+	uhash_entries = simple_strtoul(str, &str, 0);
+	if (uhash_entries && uhash_entries < UDP_HTABLE2_SIZE_MIN)
+		uhash_entries = UDP_HTABLE2_SIZE_MIN;
+	return 1;
+}
+__setup("uhash_entries=", set_uhash_entries);
+
+void __init udp_table_init(struct udp_table *table, const char *name)
+{
+	unsigned int i, log;
+
+	if (!CONFIG_BASE_SMALL)
+		table->hash2 = alloc_large_system_hash(name,
+			sizeof(struct udp_hslot),
+			uhash_entries,
+			21, /* one slot per 2 MB */
+			0,
+			&log,
+			&table->mask2,
+			64 * 1024);
+	/*
+	 * Make sure hash table has the minimum size
+	 */
+	if (CONFIG_BASE_SMALL || table->mask2 < UDP_HTABLE2_SIZE_MIN - 1) {
+		table->hash2 = kmalloc(UDP_HTABLE2_SIZE_MIN *
+				       sizeof(struct udp_hslot), GFP_KERNEL);
+		if (!table->hash2)
+			panic(name);
+		table->mask2 = UDP_HTABLE2_SIZE_MIN - 1;
+	}
 
 	for (i = 0; i < UDP_HTABLE_SIZE; i++) {
 		INIT_HLIST_NULLS_HEAD(&table->hash[i].head, i);
+		table->hash[i].count = 0;
 		spin_lock_init(&table->hash[i].lock);
 	}
+	for (i = 0; i <= table->mask2; i++) {
+		INIT_HLIST_NULLS_HEAD(&table->hash2[i].head, i);
+		table->hash2[i].count = 0;
+		spin_lock_init(&table->hash2[i].lock);
+	}
 }
 
 void __init udp_init(void)
 {
 	unsigned long nr_pages, limit;
 
-	udp_table_init(&udp_table);
+	udp_table_init(&udp_table, "UDP");
 	/* Set the pressure threshold up by the same strategy of TCP. It is a
 	 * fraction of global memory that is up to 1/2 at 256 MB, decreasing
 	 * toward zero with the amount of memory, with a floor of 128 pages,
@@ -2065,3 +2308,144 @@ struct sk_buff *udp4_ufo_fragment(struct sk_buff *skb, int features)
 out:
 	return segs;
 }
+
+/*
+ * GRO for UDP encapsulations.  Plain UDP is never aggregated, only
+ * datagrams to a port an encapsulation registered with udp_add_offload()
+ * are handed to its handlers.  Registration happens from process context.
+ */
+static LIST_HEAD(udp_offload_base);
+static DEFINE_SPINLOCK(udp_offload_lock);
+
+void udp_add_offload(struct udp_offload *uo)
+{
+	spin_lock(&udp_offload_lock);
+	list_add_rcu(&uo->list, &udp_offload_base);
+	spin_unlock(&udp_offload_lock);
+}
+EXPORT_SYMBOL(udp_add_offload);
+
+void udp_del_offload(struct udp_offload *uo)
+{
+	spin_lock(&udp_offload_lock);
+	list_del_rcu(&uo->list);
+	spin_unlock(&udp_offload_lock);
+
+	synchronize_net();
+}
+EXPORT_SYMBOL(udp_del_offload);
+
+static struct udp_offload *udp_find_offload(__be16 port)
+{
+	struct udp_offload *uo;
+
+	list_for_each_entry_rcu(uo, &udp_offload_base, list) {
+		if (uo->port == port)
+			return uo;
+	}
+	return NULL;
+}
+
+struct sk_buff **udp4_gro_receive(struct sk_buff **head, struct sk_buff *skb)
+{
+	struct sk_buff **pp = NULL;
+	struct udp_offload *uo;
+	struct sk_buff *p;
+	struct iphdr *iph;
+	struct udphdr *uh;
+	unsigned int hlen;
+	unsigned int off;
+	int flush = 1;
+	__wsum csum;
+
+	if (NAPI_GRO_CB(skb)->encap_mark)
+		goto out;
+
+	/* A device validated checksum only covers the inner headers
+	 * when the device says so through skb->encapsulation.
+	 */
+	if (skb->ip_summed == CHECKSUM_UNNECESSARY && !skb->encapsulation)
+		goto out;
+
+	off = skb_gro_offset(skb);
+	hlen = off + sizeof(*uh);
+	uh = skb_gro_header_fast(skb, off);
+	if (skb_gro_header_hard(skb, hlen)) {
+		uh = skb_gro_header_slow(skb, hlen, off);
+		if (unlikely(!uh))
+			goto out;
+	}
+
+	rcu_read_lock();
+	uo = udp_find_offload(uh->dest);
+	if (!uo || !uo->gro_receive)
+		goto out_unlock;
+
+	/* The outer checksum no longer covers an aggregated datagram,
+	 * so it has to be verified here, udp4_gro_complete() clears it.
+	 */
+	if (uh->check && skb->ip_summed != CHECKSUM_UNNECESSARY) {
+		iph = skb_gro_network_header(skb);
+		if (skb->ip_summed != CHECKSUM_COMPLETE ||
+		    csum_tcpudp_magic(iph->saddr, iph->daddr, skb_gro_len(skb),
+				      IPPROTO_UDP, skb->csum))
+			goto out_unlock;
+	}
+
+	flush = 0;
+
+	for (p = *head; p; p = p->next) {
+		struct udphdr *uh2;
+
+		if (!NAPI_GRO_CB(p)->same_flow)
+			continue;
+
+		uh2 = skb_gro_held_header(p, skb, off);
+		if (*(u32 *)&uh->source != *(u32 *)&uh2->source) {
+			NAPI_GRO_CB(p)->same_flow = 0;
+			continue;
+		}
+	}
+
+	NAPI_GRO_CB(skb)->encap_mark = 1;
+	skb_gro_pull(skb, sizeof(*uh));
+
+	csum = skb->csum;
+	skb_postpull_rcsum(skb, uh, sizeof(*uh));
+
+	pp = uo->gro_receive(head, skb);
+
+	skb->csum = csum;
+
+out_unlock:
+	rcu_read_unlock();
+out:
+	NAPI_GRO_CB(skb)->flush |= flush;
+
+	return pp;
+}
+
+int udp4_gro_complete(struct sk_buff *skb)
+{
+	int nhoff = NAPI_GRO_CB(skb)->nhoff;
+	struct udphdr *uh = (struct udphdr *)(skb->data + nhoff);
+	struct udp_offload *uo;
+	int err = -ENOSYS;
+
+	uh->len = htons(skb->len - nhoff);
+	uh->check = 0;
+
+	rcu_read_lock();
+	uo = udp_find_offload(uh->dest);
+	if (uo && uo->gro_complete) {
+		NAPI_GRO_CB(skb)->nhoff = nhoff + sizeof(*uh);
+		err = uo->gro_complete(skb);
+	}
+	rcu_read_unlock();
+
+	if (!err) {
+		skb->encapsulation = 1;
+		skb_shinfo(skb)->gso_type |= SKB_GSO_UDP_TUNNEL;
+	}
+	return err;
+}
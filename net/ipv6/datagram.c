@@ -115,6 +115,7 @@ ipv4_connected:
 		    ipv6_mapped_addr_any(&np->rcv_saddr)) {
 			ipv6_addr_set(&np->rcv_saddr, 0, 0, htonl(0x0000ffff),
 				      inet->rcv_saddr);
+			sk_rehash_local(sk);
 		}
 		goto out;
 	}
@@ -198,6 +199,7 @@ ipv4_connected:
 	if (ipv6_addr_any(&np->rcv_saddr)) {
 		ipv6_addr_copy(&np->rcv_saddr, &fl.fl6_src);
 		inet->rcv_saddr = LOOPBACK4_IPV6;
+		sk_rehash_local(sk);
 	}
 
 	ip6_dst_store(sk, dst,
@@ -326,7 +328,10 @@ int ipv6_recv_error(struct sock *sk, struct msghdr *msg, int len, int *addr_len)
 		sin->sin6_flowinfo = 0;
 		sin->sin6_port = serr->port;
 		sin->sin6_scope_id = 0;
-		if (serr->ee.ee_origin == SO_EE_ORIGIN_ICMP6) {
+		if (serr->ee.ee_origin == SO_EE_ORIGIN_ZEROCOPY) {
+			/* no packet behind a zerocopy notification */
+			ipv6_addr_set(&sin->sin6_addr, 0, 0, 0, 0);
+		} else if (serr->ee.ee_origin == SO_EE_ORIGIN_ICMP6) {
 			ipv6_addr_copy(&sin->sin6_addr,
 				  (struct in6_addr *)(nh + serr->addr_offset));
 			if (np->sndflow)
@@ -346,7 +351,8 @@ int ipv6_recv_error(struct sock *sk, struct msghdr *msg, int len, int *addr_len)
 	memcpy(&errhdr.ee, &serr->ee, sizeof(struct sock_extended_err));
 	sin = &errhdr.offender;
 	sin->sin6_family = AF_UNSPEC;
-	if (serr->ee.ee_origin != SO_EE_ORIGIN_LOCAL) {
+	if (serr->ee.ee_origin != SO_EE_ORIGIN_LOCAL &&
+	    serr->ee.ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
 		sin->sin6_family = AF_INET6;
 		sin->sin6_flowinfo = 0;
 		sin->sin6_port = 0;
@@ -374,11 +380,15 @@ int ipv6_recv_error(struct sock *sk, struct msghdr *msg, int len, int *addr_len)
 	msg->msg_flags |= MSG_ERRQUEUE;
 	err = copied;
 
-	/* Reset and regenerate socket error */
+	/* Reset and regenerate socket error.  Zerocopy completions are
+	 * not errors and leave sk_err alone.
+	 */
 	spin_lock_bh(&sk->sk_error_queue.lock);
-	sk->sk_err = 0;
+	if (serr->ee.ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+		sk->sk_err = 0;
 	if ((skb2 = skb_peek(&sk->sk_error_queue)) != NULL) {
-		sk->sk_err = SKB_EXT_ERR(skb2)->ee.ee_errno;
+		if (SKB_EXT_ERR(skb2)->ee.ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+			sk->sk_err = SKB_EXT_ERR(skb2)->ee.ee_errno;
 		spin_unlock_bh(&sk->sk_error_queue.lock);
 		sk->sk_error_report(sk);
 	} else {
@@ -232,6 +232,8 @@ struct sock *cookie_v6_check(struct sock *sk, struct sk_buff *skb)
 	req->ts_recent		= tcp_opt.saw_tstamp ? tcp_opt.rcv_tsval : 0;
 	treq->snt_synack	= tcp_opt.saw_tstamp ? tcp_opt.rcv_tsecr : 0;
 	treq->rcv_isn = ntohl(th->seq) - 1;
+	treq->rcv_nxt = ntohl(th->seq);
+	treq->listener = NULL;
 	treq->snt_isn = cookie;
 
 	/*
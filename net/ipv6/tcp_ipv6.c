@@ -61,6 +61,7 @@
 #include <net/netdma.h>
 #include <net/inet_common.h>
 #include <net/secure_seq.h>
+#include <net/busy_poll.h>
 
 #include <asm/uaccess.h>
 
@@ -1639,6 +1640,8 @@ process:
 
 	skb->dev = NULL;
 
+	sk_mark_napi_id(sk, skb);
+
 	bh_lock_sock_nested(sk);
 	ret = 0;
 	if (!sock_owned_by_user(sk)) {
@@ -1826,6 +1829,7 @@ static int tcp_v6_init_sock(struct sock *sk)
 	tp->mss_cache = 536;
 
 	tp->reordering = sysctl_tcp_reordering;
+	tcp_enable_early_retrans(tp);
 
 	sk->sk_state = TCP_CLOSE;
 
@@ -1909,7 +1913,9 @@ static void get_tcp6_sock(struct seq_file *seq, struct sock *sp, int i)
 	destp = ntohs(inet->dport);
 	srcp  = ntohs(inet->sport);
 
-	if (icsk->icsk_pending == ICSK_TIME_RETRANS) {
+	if (icsk->icsk_pending == ICSK_TIME_RETRANS ||
+	    icsk->icsk_pending == ICSK_TIME_EARLY_RETRANS ||
+	    icsk->icsk_pending == ICSK_TIME_LOSS_PROBE) {
 		timer_active	= 1;
 		timer_expires	= icsk->icsk_timeout;
 	} else if (icsk->icsk_pending == ICSK_TIME_PROBE0) {
@@ -2031,6 +2037,16 @@ void tcp6_proc_exit(struct net *net)
 }
 #endif
 
+static int tcp_v6_recvmsg(struct kiocb *iocb, struct sock *sk,
+			  struct msghdr *msg, size_t len, int nonblock,
+			  int flags, int *addr_len)
+{
+	if (unlikely(flags & MSG_ERRQUEUE))
+		return ipv6_recv_error(sk, msg, len, addr_len);
+
+	return tcp_recvmsg(iocb, sk, msg, len, nonblock, flags, addr_len);
+}
+
 struct proto tcpv6_prot = {
 	.name			= "TCPv6",
 	.owner			= THIS_MODULE,
@@ -2044,7 +2060,7 @@ struct proto tcpv6_prot = {
 	.shutdown		= tcp_shutdown,
 	.setsockopt		= tcp_setsockopt,
 	.getsockopt		= tcp_getsockopt,
-	.recvmsg		= tcp_recvmsg,
+	.recvmsg		= tcp_v6_recvmsg,
 	.backlog_rcv		= tcp_v6_do_rcv,
 	.release_cb		= tcp_release_cb,
 	.hash			= tcp_v6_hash,
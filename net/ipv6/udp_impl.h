@@ -12,6 +12,7 @@ extern void 	__udp6_lib_err(struct sk_buff *, struct inet6_skb_parm *,
 			       u8 , u8 , int , __be32 , struct udp_table *);
 
 extern int	udp_v6_get_port(struct sock *sk, unsigned short snum);
+extern void	udp_v6_rehash(struct sock *sk);
 
 extern int	udpv6_getsockopt(struct sock *sk, int level, int optname,
 				 char __user *optval, int __user *optlen);
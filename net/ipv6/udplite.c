@@ -49,12 +49,14 @@ struct proto udplitev6_prot = {
 	.unhash		   = udp_lib_unhash,
 	.get_port	   = udp_v6_get_port,
 	.obj_size	   = sizeof(struct udp6_sock),
-	.slab_flags	   = SLAB_DESTROY_BY_RCU,
+	.slab_flags	   = SLAB_DESTROY_BY_RCU | RHEL_EXTENDED_PROTO,
 	.h.udp_table	   = &udplite_table,
 #ifdef CONFIG_COMPAT
 	.compat_setsockopt = compat_udpv6_setsockopt,
 	.compat_getsockopt = compat_udpv6_getsockopt,
 #endif
+	.rhel_flags	   = RHEL_PROTO_HAS_REHASH,
+	.rehash		   = udp_v6_rehash,
 };
 
 static struct inet_protosw udplite6_protosw = {
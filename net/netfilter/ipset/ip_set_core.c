@@ -202,6 +202,8 @@ unlock:
 	ip_set_type_unlock();
 
 	synchronize_rcu();
+	/* Wait for the set data the type module frees by call_rcu_bh() */
+	rcu_barrier_bh();
 }
 EXPORT_SYMBOL_GPL(ip_set_type_unregister);
 
@@ -337,9 +339,17 @@ ip_set_test(ip_set_id_t index, const struct sk_buff *skb,
 	    !(family == set->family || set->family == AF_UNSPEC))
 		return 0;
 
-	read_lock_bh(&set->lock);
-	ret = set->variant->kadt(set, skb, IPSET_TEST, family, dim, flags);
-	read_unlock_bh(&set->lock);
+	if (set->variant->lockless_test) {
+		rcu_read_lock_bh();
+		ret = set->variant->kadt(set, skb, IPSET_TEST,
+					 family, dim, flags);
+		rcu_read_unlock_bh();
+	} else {
+		read_lock_bh(&set->lock);
+		ret = set->variant->kadt(set, skb, IPSET_TEST,
+					 family, dim, flags);
+		read_unlock_bh(&set->lock);
+	}
 
 	if (ret == -EAGAIN) {
 		/* Type requests element to be completed */
@@ -112,7 +112,7 @@ static int
 hash_ip4_kadt(struct ip_set *set, const struct sk_buff *skb,
 	      enum ipset_adt adt, u8 pf, u8 dim, u8 flags)
 {
-	const struct ip_set_hash *h = set->data;
+	struct ip_set_hash *h = set->data;
 	ipset_adtfn adtfn = set->variant->adt[adt];
 	__be32 ip;
 
@@ -121,6 +121,12 @@ hash_ip4_kadt(struct ip_set *set, const struct sk_buff *skb,
 	if (ip == 0)
 		return -EINVAL;
 
+	if (adt == IPSET_ADD)
+		ip_set_init_counter(&h->add_counter, 0, 0);
+
+	if (adt == IPSET_TEST && h->counters)
+		return hash_ip4_ctest(set, (struct hash_ip4_elem *)&ip, skb);
+
 	return adtfn(set, &ip, h->timeout, flags);
 }
 
@@ -128,7 +134,7 @@ static int
 hash_ip4_uadt(struct ip_set *set, struct nlattr *tb[],
 	      enum ipset_adt adt, u32 *lineno, u32 flags)
 {
-	const struct ip_set_hash *h = set->data;
+	struct ip_set_hash *h = set->data;
 	ipset_adtfn adtfn = set->variant->adt[adt];
 	u32 ip, ip_to, hosts, timeout = h->timeout;
 	__be32 nip;
@@ -153,6 +159,12 @@ hash_ip4_uadt(struct ip_set *set, struct nlattr *tb[],
 		timeout = ip_set_timeout_uget(tb[IPSET_ATTR_TIMEOUT]);
 	}
 
+	if (adt == IPSET_ADD) {
+		ret = ip_set_get_counter(tb, &h->add_counter);
+		if (ret)
+			return ret;
+	}
+
 	if (adt == IPSET_TEST) {
 		nip = htonl(ip);
 		if (nip == 0)
@@ -201,6 +213,7 @@ hash_ip_same_set(const struct ip_set *a, const struct ip_set *b)
 	/* Resizing changes htable_bits, so we ignore it */
 	return x->maxelem == y->maxelem &&
 	       x->timeout == y->timeout &&
+	       x->counters == y->counters &&
 	       x->netmask == y->netmask;
 }
 
@@ -285,7 +298,7 @@ static int
 hash_ip6_kadt(struct ip_set *set, const struct sk_buff *skb,
 	      enum ipset_adt adt, u8 pf, u8 dim, u8 flags)
 {
-	const struct ip_set_hash *h = set->data;
+	struct ip_set_hash *h = set->data;
 	ipset_adtfn adtfn = set->variant->adt[adt];
 	union nf_inet_addr ip;
 
@@ -294,6 +307,12 @@ hash_ip6_kadt(struct ip_set *set, const struct sk_buff *skb,
 	if (ipv6_addr_any(&ip.in6))
 		return -EINVAL;
 
+	if (adt == IPSET_ADD)
+		ip_set_init_counter(&h->add_counter, 0, 0);
+
+	if (adt == IPSET_TEST && h->counters)
+		return hash_ip6_ctest(set, (struct hash_ip6_elem *)&ip, skb);
+
 	return adtfn(set, &ip, h->timeout, flags);
 }
 
@@ -307,7 +326,7 @@ static int
 hash_ip6_uadt(struct ip_set *set, struct nlattr *tb[],
 	      enum ipset_adt adt, u32 *lineno, u32 flags)
 {
-	const struct ip_set_hash *h = set->data;
+	struct ip_set_hash *h = set->data;
 	ipset_adtfn adtfn = set->variant->adt[adt];
 	union nf_inet_addr ip;
 	u32 timeout = h->timeout;
@@ -336,6 +355,12 @@ hash_ip6_uadt(struct ip_set *set, struct nlattr *tb[],
 		timeout = ip_set_timeout_uget(tb[IPSET_ATTR_TIMEOUT]);
 	}
 
+	if (adt == IPSET_ADD) {
+		ret = ip_set_get_counter(tb, &h->add_counter);
+		if (ret)
+			return ret;
+	}
+
 	ret = adtfn(set, &ip, timeout, flags);
 
 	return ip_set_eexist(ret, flags) ? 0 : ret;
@@ -359,7 +384,8 @@ hash_ip_create(struct ip_set *set, struct nlattr *tb[], u32 flags)
 
 	if (unlikely(!ip_set_optattr_netorder(tb, IPSET_ATTR_HASHSIZE) ||
 		     !ip_set_optattr_netorder(tb, IPSET_ATTR_MAXELEM) ||
-		     !ip_set_optattr_netorder(tb, IPSET_ATTR_TIMEOUT)))
+		     !ip_set_optattr_netorder(tb, IPSET_ATTR_TIMEOUT) ||
+		     !ip_set_optattr_netorder(tb, IPSET_ATTR_CADT_FLAGS)))
 		return -IPSET_ERR_PROTOCOL;
 
 	if (tb[IPSET_ATTR_HASHSIZE]) {
@@ -388,6 +414,10 @@ hash_ip_create(struct ip_set *set, struct nlattr *tb[], u32 flags)
 	h->netmask = netmask;
 	get_random_bytes(&h->initval, sizeof(h->initval));
 	h->timeout = IPSET_NO_TIMEOUT;
+	if (tb[IPSET_ATTR_CADT_FLAGS] &&
+	    (ip_set_get_h32(tb[IPSET_ATTR_CADT_FLAGS]) &
+	     IPSET_FLAG_WITH_COUNTERS))
+		h->counters = true;
 
 	hbits = htable_bits(hashsize);
 	hsize = htable_size(hbits);
@@ -441,6 +471,7 @@ static struct ip_set_type hash_ip_type __read_mostly = {
 		[IPSET_ATTR_RESIZE]	= { .type = NLA_U8  },
 		[IPSET_ATTR_TIMEOUT]	= { .type = NLA_U32 },
 		[IPSET_ATTR_NETMASK]	= { .type = NLA_U8  },
+		[IPSET_ATTR_CADT_FLAGS]	= { .type = NLA_U32 },
 	},
 	.adt_policy	= {
 		[IPSET_ATTR_IP]		= { .type = NLA_NESTED },
@@ -448,6 +479,8 @@ static struct ip_set_type hash_ip_type __read_mostly = {
 		[IPSET_ATTR_CIDR]	= { .type = NLA_U8 },
 		[IPSET_ATTR_TIMEOUT]	= { .type = NLA_U32 },
 		[IPSET_ATTR_LINENO]	= { .type = NLA_U32 },
+		[IPSET_ATTR_BYTES]	= { .type = NLA_U64 },
+		[IPSET_ATTR_PACKETS]	= { .type = NLA_U64 },
 	},
 	.me		= THIS_MODULE,
 };
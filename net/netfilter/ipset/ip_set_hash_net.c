@@ -129,7 +129,7 @@ static int
 hash_net4_kadt(struct ip_set *set, const struct sk_buff *skb,
 	       enum ipset_adt adt, u8 pf, u8 dim, u8 flags)
 {
-	const struct ip_set_hash *h = set->data;
+	struct ip_set_hash *h = set->data;
 	ipset_adtfn adtfn = set->variant->adt[adt];
 	struct hash_net4_elem data = {
 		.cidr = h->nets[0].cidr ? h->nets[0].cidr : HOST_MASK
@@ -143,6 +143,12 @@ hash_net4_kadt(struct ip_set *set, const struct sk_buff *skb,
 	ip4addrptr(skb, flags & IPSET_DIM_ONE_SRC, &data.ip);
 	data.ip &= ip_set_netmask(data.cidr);
 
+	if (adt == IPSET_ADD)
+		ip_set_init_counter(&h->add_counter, 0, 0);
+
+	if (adt == IPSET_TEST && h->counters)
+		return hash_net4_ctest(set, &data, skb);
+
 	return adtfn(set, &data, h->timeout, flags);
 }
 
@@ -150,7 +156,7 @@ static int
 hash_net4_uadt(struct ip_set *set, struct nlattr *tb[],
 	       enum ipset_adt adt, u32 *lineno, u32 flags)
 {
-	const struct ip_set_hash *h = set->data;
+	struct ip_set_hash *h = set->data;
 	ipset_adtfn adtfn = set->variant->adt[adt];
 	struct hash_net4_elem data = { .cidr = HOST_MASK };
 	u32 timeout = h->timeout;
@@ -181,6 +187,12 @@ hash_net4_uadt(struct ip_set *set, struct nlattr *tb[],
 		timeout = ip_set_timeout_uget(tb[IPSET_ATTR_TIMEOUT]);
 	}
 
+	if (adt == IPSET_ADD) {
+		ret = ip_set_get_counter(tb, &h->add_counter);
+		if (ret)
+			return ret;
+	}
+
 	ret = adtfn(set, &data, timeout, flags);
 
 	return ip_set_eexist(ret, flags) ? 0 : ret;
@@ -194,7 +206,8 @@ hash_net_same_set(const struct ip_set *a, const struct ip_set *b)
 
 	/* Resizing changes htable_bits, so we ignore it */
 	return x->maxelem == y->maxelem &&
-	       x->timeout == y->timeout;
+	       x->timeout == y->timeout &&
+	       x->counters == y->counters;
 }
 
 /* The type variant functions: IPv6 */
@@ -296,7 +309,7 @@ static int
 hash_net6_kadt(struct ip_set *set, const struct sk_buff *skb,
 	       enum ipset_adt adt, u8 pf, u8 dim, u8 flags)
 {
-	const struct ip_set_hash *h = set->data;
+	struct ip_set_hash *h = set->data;
 	ipset_adtfn adtfn = set->variant->adt[adt];
 	struct hash_net6_elem data = {
 		.cidr = h->nets[0].cidr ? h->nets[0].cidr : HOST_MASK
@@ -310,6 +323,12 @@ hash_net6_kadt(struct ip_set *set, const struct sk_buff *skb,
 	ip6addrptr(skb, flags & IPSET_DIM_ONE_SRC, &data.ip.in6);
 	ip6_netmask(&data.ip, data.cidr);
 
+	if (adt == IPSET_ADD)
+		ip_set_init_counter(&h->add_counter, 0, 0);
+
+	if (adt == IPSET_TEST && h->counters)
+		return hash_net6_ctest(set, &data, skb);
+
 	return adtfn(set, &data, h->timeout, flags);
 }
 
@@ -317,7 +336,7 @@ static int
 hash_net6_uadt(struct ip_set *set, struct nlattr *tb[],
 	       enum ipset_adt adt, u32 *lineno, u32 flags)
 {
-	const struct ip_set_hash *h = set->data;
+	struct ip_set_hash *h = set->data;
 	ipset_adtfn adtfn = set->variant->adt[adt];
 	struct hash_net6_elem data = { .cidr = HOST_MASK };
 	u32 timeout = h->timeout;
@@ -348,6 +367,12 @@ hash_net6_uadt(struct ip_set *set, struct nlattr *tb[],
 		timeout = ip_set_timeout_uget(tb[IPSET_ATTR_TIMEOUT]);
 	}
 
+	if (adt == IPSET_ADD) {
+		ret = ip_set_get_counter(tb, &h->add_counter);
+		if (ret)
+			return ret;
+	}
+
 	ret = adtfn(set, &data, timeout, flags);
 
 	return ip_set_eexist(ret, flags) ? 0 : ret;
@@ -368,7 +393,8 @@ hash_net_create(struct ip_set *set, struct nlattr *tb[], u32 flags)
 
 	if (unlikely(!ip_set_optattr_netorder(tb, IPSET_ATTR_HASHSIZE) ||
 		     !ip_set_optattr_netorder(tb, IPSET_ATTR_MAXELEM) ||
-		     !ip_set_optattr_netorder(tb, IPSET_ATTR_TIMEOUT)))
+		     !ip_set_optattr_netorder(tb, IPSET_ATTR_TIMEOUT) ||
+		     !ip_set_optattr_netorder(tb, IPSET_ATTR_CADT_FLAGS)))
 		return -IPSET_ERR_PROTOCOL;
 
 	if (tb[IPSET_ATTR_HASHSIZE]) {
@@ -389,6 +415,10 @@ hash_net_create(struct ip_set *set, struct nlattr *tb[], u32 flags)
 	h->maxelem = maxelem;
 	get_random_bytes(&h->initval, sizeof(h->initval));
 	h->timeout = IPSET_NO_TIMEOUT;
+	if (tb[IPSET_ATTR_CADT_FLAGS] &&
+	    (ip_set_get_h32(tb[IPSET_ATTR_CADT_FLAGS]) &
+	     IPSET_FLAG_WITH_COUNTERS))
+		h->counters = true;
 
 	hbits = htable_bits(hashsize);
 	hsize = htable_size(hbits);
@@ -441,11 +471,14 @@ static struct ip_set_type hash_net_type __read_mostly = {
 		[IPSET_ATTR_PROBES]	= { .type = NLA_U8 },
 		[IPSET_ATTR_RESIZE]	= { .type = NLA_U8  },
 		[IPSET_ATTR_TIMEOUT]	= { .type = NLA_U32 },
+		[IPSET_ATTR_CADT_FLAGS]	= { .type = NLA_U32 },
 	},
 	.adt_policy	= {
 		[IPSET_ATTR_IP]		= { .type = NLA_NESTED },
 		[IPSET_ATTR_CIDR]	= { .type = NLA_U8 },
 		[IPSET_ATTR_TIMEOUT]	= { .type = NLA_U32 },
+		[IPSET_ATTR_BYTES]	= { .type = NLA_U64 },
+		[IPSET_ATTR_PACKETS]	= { .type = NLA_U64 },
 	},
 	.me		= THIS_MODULE,
 };
@@ -505,6 +505,18 @@ ip_vs_service_get(int af, __u32 fwmark, __u16 protocol,
 }
 
 
+static void ip_vs_service_free(struct ip_vs_service *svc)
+{
+	free_percpu(svc->stats.cpustats);
+	kfree(svc);
+}
+
+static void ip_vs_dest_free(struct ip_vs_dest *dest)
+{
+	free_percpu(dest->stats.cpustats);
+	kfree(dest);
+}
+
 static inline void
 __ip_vs_bind_svc(struct ip_vs_dest *dest, struct ip_vs_service *svc)
 {
@@ -519,7 +531,7 @@ __ip_vs_unbind_svc(struct ip_vs_dest *dest)
 
 	dest->svc = NULL;
 	if (atomic_dec_and_test(&svc->refcnt))
-		kfree(svc);
+		ip_vs_service_free(svc);
 }
 
 
@@ -725,7 +737,7 @@ ip_vs_trash_get_dest(struct ip_vs_service *svc, const union nf_inet_addr *daddr,
 			list_del(&dest->n_list);
 			ip_vs_dst_reset(dest);
 			__ip_vs_unbind_svc(dest);
-			kfree(dest);
+			ip_vs_dest_free(dest);
 		}
 	}
 
@@ -750,7 +762,7 @@ static void ip_vs_trash_cleanup(void)
 		list_del(&dest->n_list);
 		ip_vs_dst_reset(dest);
 		__ip_vs_unbind_svc(dest);
-		kfree(dest);
+		ip_vs_dest_free(dest);
 	}
 }
 
@@ -861,6 +873,12 @@ ip_vs_new_dest(struct ip_vs_service *svc, struct ip_vs_dest_user_kern *udest,
 		pr_err("%s(): no memory.\n", __func__);
 		return -ENOMEM;
 	}
+	dest->stats.cpustats = alloc_percpu(struct ip_vs_cpu_stats);
+	if (dest->stats.cpustats == NULL) {
+		pr_err("%s(): no memory.\n", __func__);
+		kfree(dest);
+		return -ENOMEM;
+	}
 
 	dest->af = svc->af;
 	dest->protocol = svc->protocol;
@@ -1082,7 +1100,7 @@ static void __ip_vs_del_dest(struct ip_vs_dest *dest)
 		   and only one user context can update virtual service at a
 		   time, so the operation here is OK */
 		atomic_dec(&dest->svc->refcnt);
-		kfree(dest);
+		ip_vs_dest_free(dest);
 	} else {
 		IP_VS_DBG_BUF(3, "Moving dest %s:%u into trash, "
 			      "dest->refcnt=%d\n",
@@ -1207,6 +1225,12 @@ ip_vs_add_service(struct ip_vs_service_user_kern *u,
 		ret = -ENOMEM;
 		goto out_err;
 	}
+	svc->stats.cpustats = alloc_percpu(struct ip_vs_cpu_stats);
+	if (svc->stats.cpustats == NULL) {
+		IP_VS_DBG(1, "%s(): no memory\n", __func__);
+		ret = -ENOMEM;
+		goto out_err;
+	}
 
 	/* I'm the first user of the service */
 	atomic_set(&svc->usecnt, 1);
@@ -1263,7 +1287,7 @@ ip_vs_add_service(struct ip_vs_service_user_kern *u,
 			ip_vs_app_inc_put(svc->inc);
 			local_bh_enable();
 		}
-		kfree(svc);
+		ip_vs_service_free(svc);
 	}
 	ip_vs_scheduler_put(sched);
 	ip_vs_pe_put(pe);
@@ -1427,7 +1451,7 @@ static void __ip_vs_del_service(struct ip_vs_service *svc)
 	 *    Free the service if nobody refers to it
 	 */
 	if (atomic_read(&svc->refcnt) == 0)
-		kfree(svc);
+		ip_vs_service_free(svc);
 
 	/* decrease the module use count */
 	ip_vs_use_count_dec();
@@ -2058,6 +2082,7 @@ static int ip_vs_stats_show(struct seq_file *seq, void *v)
 		   "   Conns  Packets  Packets            Bytes            Bytes\n");
 
 	spin_lock_bh(&ip_vs_stats.lock);
+	ip_vs_read_cpu_stats(&ip_vs_stats);
 	seq_printf(seq, "%8X %8X %8X %16LX %16LX\n\n", ip_vs_stats.ustats.conns,
 		   ip_vs_stats.ustats.inpkts, ip_vs_stats.ustats.outpkts,
 		   (unsigned long long) ip_vs_stats.ustats.inbytes,
@@ -2318,6 +2343,7 @@ static void
 ip_vs_copy_stats(struct ip_vs_stats_user *dst, struct ip_vs_stats *src)
 {
 	spin_lock_bh(&src->lock);
+	ip_vs_read_cpu_stats(src);
 	memcpy(dst, &src->ustats, sizeof(*dst));
 	spin_unlock_bh(&src->lock);
 }
@@ -2703,6 +2729,7 @@ static int ip_vs_genl_fill_stats(struct sk_buff *skb, int container_type,
 		return -EMSGSIZE;
 
 	spin_lock_bh(&stats->lock);
+	ip_vs_read_cpu_stats(stats);
 
 	NLA_PUT_U32(skb, IPVS_STATS_ATTR_CONNS, stats->ustats.conns);
 	NLA_PUT_U32(skb, IPVS_STATS_ATTR_INPKTS, stats->ustats.inpkts);
@@ -3533,6 +3560,16 @@ int __init ip_vs_control_init(void)
 		INIT_LIST_HEAD(&ip_vs_rtable[idx]);
 	}
 
+	ip_vs_stats.cpustats = alloc_percpu(struct ip_vs_cpu_stats);
+	if (!ip_vs_stats.cpustats) {
+		pr_err("cannot allocate statistics.\n");
+		unregister_sysctl_table(sysctl_header);
+		proc_net_remove(&init_net, "ip_vs_stats");
+		proc_net_remove(&init_net, "ip_vs");
+		ip_vs_genl_unregister();
+		nf_unregister_sockopt(&ip_vs_sockopts);
+		return -ENOMEM;
+	}
 	ip_vs_new_estimator(&ip_vs_stats);
 
 	/* Hook the defense timer */
@@ -3550,6 +3587,7 @@ void ip_vs_control_cleanup(void)
 	cancel_rearming_delayed_work(&defense_work);
 	cancel_work_sync(&defense_work.work);
 	ip_vs_kill_estimator(&ip_vs_stats);
+	free_percpu(ip_vs_stats.cpustats);
 	unregister_sysctl_table(sysctl_header);
 	proc_net_remove(&init_net, "ip_vs_stats");
 	proc_net_remove(&init_net, "ip_vs");
@@ -22,6 +22,7 @@
 #include <linux/interrupt.h>
 #include <linux/sysctl.h>
 #include <linux/list.h>
+#include <linux/percpu.h>
 
 #include <net/ip_vs.h>
 
@@ -46,11 +47,52 @@
     rate is ~2.15Gbits/s, average pps and cps are scaled by 2^10.
 
   * A lot code is taken from net/sched/estimator.c
+
+  * The packet path only touches the per cpu counters; they are summed
+    into ustats here and whenever the counters are reported.
  */
 
 
 static void estimation_timer(unsigned long arg);
 
+static void ip_vs_sum_cpu_stats(struct ip_vs_stats *s,
+				struct ip_vs_stats_user *sum)
+{
+	int i;
+
+	memset(sum, 0, sizeof(*sum));
+	for_each_possible_cpu(i) {
+		struct ip_vs_cpu_stats *c = per_cpu_ptr(s->cpustats, i);
+		unsigned int start;
+		u64 inbytes, outbytes;
+
+		do {
+			start = u64_stats_fetch_begin_bh(&c->syncp);
+			inbytes = c->ustats.inbytes;
+			outbytes = c->ustats.outbytes;
+		} while (u64_stats_fetch_retry_bh(&c->syncp, start));
+
+		sum->conns += c->ustats.conns;
+		sum->inpkts += c->ustats.inpkts;
+		sum->outpkts += c->ustats.outpkts;
+		sum->inbytes += inbytes;
+		sum->outbytes += outbytes;
+	}
+}
+
+/* Refresh the counters in s->ustats, caller must hold s->lock */
+void ip_vs_read_cpu_stats(struct ip_vs_stats *s)
+{
+	struct ip_vs_stats_user sum;
+
+	ip_vs_sum_cpu_stats(s, &sum);
+	s->ustats.conns = sum.conns - s->ustats0.conns;
+	s->ustats.inpkts = sum.inpkts - s->ustats0.inpkts;
+	s->ustats.outpkts = sum.outpkts - s->ustats0.outpkts;
+	s->ustats.inbytes = sum.inbytes - s->ustats0.inbytes;
+	s->ustats.outbytes = sum.outbytes - s->ustats0.outbytes;
+}
+
 static LIST_HEAD(est_list);
 static DEFINE_SPINLOCK(est_lock);
 static DEFINE_TIMER(est_timer, estimation_timer, 0, 0);
@@ -69,6 +111,7 @@ static void estimation_timer(unsigned long arg)
 		s = container_of(e, struct ip_vs_stats, est);
 
 		spin_lock(&s->lock);
+		ip_vs_read_cpu_stats(s);
 		n_conns = s->ustats.conns;
 		n_inpkts = s->ustats.inpkts;
 		n_outpkts = s->ustats.outpkts;
@@ -146,6 +189,7 @@ void ip_vs_zero_estimator(struct ip_vs_stats *stats)
 	struct ip_vs_estimator *est = &stats->est;
 
 	/* set counters zero, caller must hold the stats->lock lock */
+	ip_vs_sum_cpu_stats(stats, &stats->ustats0);
 	est->last_inbytes = 0;
 	est->last_outbytes = 0;
 	est->last_conns = 0;
@@ -24,17 +24,30 @@
 #include <linux/module.h>
 #include <linux/kernel.h>
 #include <linux/net.h>
+#include <linux/cache.h>
+#include <linux/smp.h>
 
 #include <net/ip_vs.h>
 
 /*
  * current destination pointer for weighted round-robin scheduling
+ *
+ * Every cpu walks its own round, so scheduling takes no lock and each
+ * cpu still hands out connections in proportion to the weights.  The
+ * service is only updated while no packet uses it (see usecnt), which
+ * is when the rounds are reset.  The marks are a plain array indexed by
+ * cpu id because the scheduler may be bound under __ip_vs_svc_lock,
+ * where alloc_percpu() cannot be used.
  */
 struct ip_vs_wrr_mark {
 	struct list_head *cl;	/* current list head */
 	int cw;			/* current weight */
+} ____cacheline_aligned_in_smp;
+
+struct ip_vs_wrr_data {
 	int mw;			/* maximum weight */
 	int di;			/* decreasing interval */
+	struct ip_vs_wrr_mark mark[0];	/* one per cpu */
 };
 
 
@@ -91,21 +104,25 @@ static int ip_vs_wrr_max_weight(struct ip_vs_service *svc)
 
 static int ip_vs_wrr_init_svc(struct ip_vs_service *svc)
 {
-	struct ip_vs_wrr_mark *mark;
+	struct ip_vs_wrr_data *data;
+	int cpu;
 
 	/*
-	 *    Allocate the mark variable for WRR scheduling
+	 *    Allocate the mark variables for WRR scheduling
 	 */
-	mark = kmalloc(sizeof(struct ip_vs_wrr_mark), GFP_ATOMIC);
-	if (mark == NULL) {
+	data = kmalloc(sizeof(struct ip_vs_wrr_data) +
+		       nr_cpu_ids * sizeof(struct ip_vs_wrr_mark), GFP_ATOMIC);
+	if (data == NULL) {
 		pr_err("%s(): no memory\n", __func__);
 		return -ENOMEM;
 	}
-	mark->cl = &svc->destinations;
-	mark->cw = 0;
-	mark->mw = ip_vs_wrr_max_weight(svc);
-	mark->di = ip_vs_wrr_gcd_weight(svc);
-	svc->sched_data = mark;
+	for (cpu = 0; cpu < nr_cpu_ids; cpu++) {
+		data->mark[cpu].cl = &svc->destinations;
+		data->mark[cpu].cw = 0;
+	}
+	data->mw = ip_vs_wrr_max_weight(svc);
+	data->di = ip_vs_wrr_gcd_weight(svc);
+	svc->sched_data = data;
 
 	return 0;
 }
@@ -114,7 +131,7 @@ static int ip_vs_wrr_init_svc(struct ip_vs_service *svc)
 static int ip_vs_wrr_done_svc(struct ip_vs_service *svc)
 {
 	/*
-	 *    Release the mark variable
+	 *    Release the mark variables
 	 */
 	kfree(svc->sched_data);
 
@@ -124,13 +141,16 @@ static int ip_vs_wrr_done_svc(struct ip_vs_service *svc)
 
 static int ip_vs_wrr_update_svc(struct ip_vs_service *svc)
 {
-	struct ip_vs_wrr_mark *mark = svc->sched_data;
-
-	mark->cl = &svc->destinations;
-	mark->mw = ip_vs_wrr_max_weight(svc);
-	mark->di = ip_vs_wrr_gcd_weight(svc);
-	if (mark->cw > mark->mw)
-		mark->cw = 0;
+	struct ip_vs_wrr_data *data = svc->sched_data;
+	int cpu;
+
+	data->mw = ip_vs_wrr_max_weight(svc);
+	data->di = ip_vs_wrr_gcd_weight(svc);
+	for (cpu = 0; cpu < nr_cpu_ids; cpu++) {
+		data->mark[cpu].cl = &svc->destinations;
+		if (data->mark[cpu].cw > data->mw)
+			data->mark[cpu].cw = 0;
+	}
 	return 0;
 }
 
@@ -142,7 +162,8 @@ static struct ip_vs_dest *
 ip_vs_wrr_schedule(struct ip_vs_service *svc, const struct sk_buff *skb)
 {
 	struct ip_vs_dest *dest;
-	struct ip_vs_wrr_mark *mark = svc->sched_data;
+	struct ip_vs_wrr_data *data = svc->sched_data;
+	struct ip_vs_wrr_mark *mark = &data->mark[smp_processor_id()];
 	struct list_head *p;
 
 	IP_VS_DBG(6, "%s(): Scheduling...\n", __func__);
@@ -151,7 +172,6 @@ ip_vs_wrr_schedule(struct ip_vs_service *svc, const struct sk_buff *skb)
 	 * This loop will always terminate, because mark->cw in (0, max_weight]
 	 * and at least one server has its weight equal to max_weight.
 	 */
-	write_lock(&svc->sched_lock);
 	p = mark->cl;
 	while (1) {
 		if (mark->cl == &svc->destinations) {
@@ -166,9 +186,9 @@ ip_vs_wrr_schedule(struct ip_vs_service *svc, const struct sk_buff *skb)
 			}
 
 			mark->cl = svc->destinations.next;
-			mark->cw -= mark->di;
+			mark->cw -= data->di;
 			if (mark->cw <= 0) {
-				mark->cw = mark->mw;
+				mark->cw = data->mw;
 				/*
 				 * Still zero, which means no available servers.
 				 */
@@ -193,7 +213,7 @@ ip_vs_wrr_schedule(struct ip_vs_service *svc, const struct sk_buff *skb)
 			}
 		}
 
-		if (mark->cl == p && mark->cw == mark->di) {
+		if (mark->cl == p && mark->cw == data->di) {
 			/* back to the start, and no dest is found.
 			   It is only possible when all dests are OVERLOADED */
 			dest = NULL;
@@ -211,7 +231,6 @@ ip_vs_wrr_schedule(struct ip_vs_service *svc, const struct sk_buff *skb)
 		      atomic_read(&dest->weight));
 
   out:
-	write_unlock(&svc->sched_lock);
 	return dest;
 }
 
@@ -174,7 +174,9 @@ static void __nf_conntrack_helper_unregister(struct nf_conntrack_helper *me,
 	struct nf_conntrack_expect *exp;
 	const struct hlist_node *n, *next;
 	const struct hlist_nulls_node *nn;
+	spinlock_t *lockp;
 	unsigned int i;
+	int cpu;
 
 	/* Get rid of expectations */
 	for (i = 0; i < nf_ct_expect_hsize; i++) {
@@ -190,11 +192,23 @@ static void __nf_conntrack_helper_unregister(struct nf_conntrack_helper *me,
 	}
 
 	/* Get rid of expecteds, set helpers to NULL. */
-	hlist_nulls_for_each_entry(h, nn, &net->ct.unconfirmed, hnnode)
-		unhelp(h, me);
-	for (i = 0; i < net->ct.htable_size; i++) {
-		hlist_nulls_for_each_entry(h, nn, &net->ct.hash[i], hnnode)
+	for_each_possible_cpu(cpu) {
+		struct ct_pcpu *pcpu = per_cpu_ptr(net->ct_pcpu_lists, cpu);
+
+		spin_lock(&pcpu->lock);
+		hlist_nulls_for_each_entry(h, nn, &pcpu->unconfirmed, hnnode)
 			unhelp(h, me);
+		spin_unlock(&pcpu->lock);
+	}
+	for (i = 0; i < net->ct.htable_size; i++) {
+		lockp = &nf_conntrack_locks[i % CONNTRACK_LOCKS];
+		nf_conntrack_bucket_lock(lockp);
+		if (i < net->ct.htable_size) {
+			hlist_nulls_for_each_entry(h, nn, &net->ct.hash[i],
+						   hnnode)
+				unhelp(h, me);
+		}
+		spin_unlock(lockp);
 	}
 }
 
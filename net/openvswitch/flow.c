@@ -40,6 +40,7 @@
 #include <linux/icmp.h>
 #include <linux/icmpv6.h>
 #include <linux/rculist.h>
+#include <linux/percpu.h>
 #include <net/ip.h>
 #include <net/ip_tunnels.h>
 #include <net/ipv6.h>
@@ -264,7 +265,22 @@ static void free_buckets(struct flex_array *buckets)
 	flex_array_free(buckets);
 }
 
-struct flow_table *ovs_flow_tbl_alloc(int new_size)
+static struct mask_array *tbl_mask_array_alloc(int size)
+{
+	struct mask_array *ma;
+
+	ma = kzalloc(sizeof(*ma) + sizeof(struct sw_flow_mask *) * size,
+		     GFP_KERNEL);
+	if (!ma)
+		return NULL;
+
+	ma->count = 0;
+	ma->max = size;
+
+	return ma;
+}
+
+static struct flow_table *__flow_tbl_alloc(int new_size)
 {
 	struct flow_table *table = kmalloc(sizeof(*table), GFP_KERNEL);
 
@@ -282,12 +298,58 @@ struct flow_table *ovs_flow_tbl_alloc(int new_size)
 	table->node_ver = 0;
 	table->keep_flows = false;
 	get_random_bytes(&table->hash_seed, sizeof(u32));
+	RCU_INIT_POINTER(table->mask_array, NULL);
+	table->mask_cache = NULL;
+
+	return table;
+}
+
+struct flow_table *ovs_flow_tbl_alloc(int new_size)
+{
+	struct flow_table *table;
+	struct mask_array *ma;
+
+	table = __flow_tbl_alloc(new_size);
+	if (!table)
+		return NULL;
+
+	ma = tbl_mask_array_alloc(MASK_ARRAY_SIZE_MIN);
+	if (!ma)
+		goto free_table;
+	RCU_INIT_POINTER(table->mask_array, ma);
+
+	table->mask_cache = __alloc_percpu(sizeof(struct mask_cache_entry) *
+					   MC_HASH_ENTRIES,
+					   __alignof__(struct mask_cache_entry));
+	if (!table->mask_cache)
+		goto free_mask_array;
 
 	return table;
+
+free_mask_array:
+	kfree(ma);
+free_table:
+	free_buckets(table->buckets);
+	kfree(table);
+	return NULL;
+}
+
+static void flow_mask_free(struct sw_flow_mask *mask)
+{
+	free_percpu(mask->hit);
+	kfree(mask);
+}
+
+static void rcu_free_sw_flow_mask_cb(struct rcu_head *rcu)
+{
+	struct sw_flow_mask *mask = container_of(rcu, struct sw_flow_mask, rcu);
+
+	flow_mask_free(mask);
 }
 
 void ovs_flow_tbl_destroy(struct flow_table *table)
 {
+	struct mask_array *ma;
 	int i;
 
 	if (!table)
@@ -308,6 +370,19 @@ void ovs_flow_tbl_destroy(struct flow_table *table)
 		}
 	}
 
+	/* The masks and the mask cache are shared with any table this one
+	 * was rehashed into, so they go away together with the flows.
+	 */
+	ma = rcu_dereference(table->mask_array);
+	for (i = 0; i < ma->max; i++) {
+		struct sw_flow_mask *mask = rcu_dereference(ma->masks[i]);
+
+		if (mask)
+			flow_mask_free(mask);
+	}
+	kfree(ma);
+	free_percpu(table->mask_cache);
+
 skip_flows:
 	free_buckets(table->buckets);
 	kfree(table);
@@ -382,6 +457,9 @@ static void flow_table_copy_flows(struct flow_table *old, struct flow_table *new
 		hlist_for_each_entry(flow, n, head, hash_node[old_ver])
 			__flow_tbl_insert(new, flow);
 	}
+
+	RCU_INIT_POINTER(new->mask_array, ovsl_dereference(old->mask_array));
+	new->mask_cache = old->mask_cache;
 	old->keep_flows = true;
 }
 
@@ -389,7 +467,7 @@ static struct flow_table *__flow_tbl_rehash(struct flow_table *table, int n_buck
 {
 	struct flow_table *new_table;
 
-	new_table = ovs_flow_tbl_alloc(n_buckets);
+	new_table = __flow_tbl_alloc(n_buckets);
 	if (!new_table)
 		return ERR_PTR(-ENOMEM);
 
@@ -774,58 +852,468 @@ out:
 	return error;
 }
 
-static u32 ovs_flow_hash(const struct sw_flow_key *key, int key_start, int key_len)
+static size_t range_n_bytes(const struct sw_flow_key_range *range)
 {
-	return jhash2((u32 *)((u8 *)key + key_start),
-		      DIV_ROUND_UP(key_len - key_start, sizeof(u32)), 0);
+	return range->end - range->start;
 }
 
-static int flow_key_start(struct sw_flow_key *key)
+void ovs_flow_key_mask(struct sw_flow_key *dst, const struct sw_flow_key *src,
+		       const struct sw_flow_mask *mask)
 {
-	if (key->tun_key.ipv4_dst)
-		return 0;
-	else
-		return offsetof(struct sw_flow_key, phy);
+	const long *m = (const long *)((const u8 *)&mask->key + mask->range.start);
+	const long *s = (const long *)((const u8 *)src + mask->range.start);
+	long *d = (long *)((u8 *)dst + mask->range.start);
+	int i;
+
+	/* Bytes of 'dst' outside of 'mask->range' are left untouched, nothing
+	 * that operates on a masked key looks at them.
+	 */
+	for (i = 0; i < range_n_bytes(&mask->range); i += sizeof(long))
+		*d++ = *s++ & *m++;
 }
 
-struct sw_flow *ovs_flow_tbl_lookup(struct flow_table *table,
-				struct sw_flow_key *key, int key_len)
+static u32 ovs_flow_hash(const struct sw_flow_key *key, int key_start,
+			 int key_end)
+{
+	u32 *hash_key = (u32 *)((u8 *)key + key_start);
+	int hash_u32s = (key_end - key_start) >> 2;
+
+	/* Make sure number of hash bytes are multiple of u32. */
+	BUILD_BUG_ON(sizeof(long) % sizeof(u32));
+
+	return jhash2(hash_key, hash_u32s, 0);
+}
+
+static bool __cmp_key(const struct sw_flow_key *key1,
+		      const struct sw_flow_key *key2, int key_start, int key_end)
+{
+	const long *cp1 = (const long *)((const u8 *)key1 + key_start);
+	const long *cp2 = (const long *)((const u8 *)key2 + key_start);
+	long diffs = 0;
+	int i;
+
+	for (i = key_start; i < key_end;  i += sizeof(long))
+		diffs |= *cp1++ ^ *cp2++;
+
+	return diffs == 0;
+}
+
+bool ovs_flow_cmp_unmasked_key(const struct sw_flow *flow,
+			       const struct sw_flow_key *key,
+			       const struct sw_flow_key_range *range)
+{
+	return __cmp_key(&flow->unmasked_key, key, range->start, range->end);
+}
+
+static struct sw_flow *masked_flow_lookup(struct flow_table *table,
+					  const struct sw_flow_key *unmasked,
+					  const struct sw_flow_mask *mask)
 {
 	struct sw_flow *flow;
 	struct hlist_node *n;
 	struct hlist_head *head;
-	u8 *_key;
-	int key_start;
+	int key_start = mask->range.start;
+	int key_end = mask->range.end;
 	u32 hash;
+	struct sw_flow_key masked_key;
 
-	key_start = flow_key_start(key);
-	hash = ovs_flow_hash(key, key_start, key_len);
-
-	_key = (u8 *) key + key_start;
+	ovs_flow_key_mask(&masked_key, unmasked, mask);
+	hash = ovs_flow_hash(&masked_key, key_start, key_end);
 	head = find_bucket(table, hash);
 	hlist_for_each_entry_rcu(flow, n, head, hash_node[table->node_ver]) {
+		if (flow->mask == mask && flow->hash == hash &&
+		    __cmp_key(&flow->key, &masked_key, key_start, key_end))
+			return flow;
+	}
+	return NULL;
+}
+
+/* Tries the mask at '*index' first, then every other mask in array order.
+ * On success '*index' is updated to the mask that matched.
+ */
+static struct sw_flow *flow_lookup(struct flow_table *table,
+				   struct mask_array *ma,
+				   const struct sw_flow_key *key,
+				   u32 *n_mask_hit, u32 *index)
+{
+	struct sw_flow_mask *mask;
+	struct sw_flow *flow;
+	int i;
 
-		if (flow->hash == hash &&
-		    !memcmp((u8 *)&flow->key + key_start, _key, key_len - key_start)) {
+	if (*index < ma->max) {
+		mask = rcu_dereference(ma->masks[*index]);
+		if (mask) {
+			(*n_mask_hit)++;
+			flow = masked_flow_lookup(table, key, mask);
+			if (flow)
+				return flow;
+		}
+	}
+
+	for (i = 0; i < ma->max; i++) {
+		if (i == *index)
+			continue;
+
+		mask = rcu_dereference(ma->masks[i]);
+		if (!mask)
+			continue;
+
+		(*n_mask_hit)++;
+		flow = masked_flow_lookup(table, key, mask);
+		if (flow) {
+			*index = i;
 			return flow;
 		}
 	}
+
 	return NULL;
 }
 
-void ovs_flow_tbl_insert(struct flow_table *table, struct sw_flow *flow,
-			 struct sw_flow_key *key, int key_len)
+/*
+ * mask_cache maps a packet's rxhash to the index of the mask that matched
+ * it the last time around.  The rxhash is split into MC_HASH_SEGS segments
+ * of MC_HASH_SHIFT bits each, every segment naming one candidate entry;
+ * a new rxhash replaces the candidate with the lowest stored hash.
+ *
+ * Must be called with rcu_read_lock held and bottom halves disabled.
+ */
+struct sw_flow *ovs_flow_tbl_lookup_stats(struct flow_table *table,
+					  const struct sw_flow_key *key,
+					  u32 skb_hash, u32 *n_mask_hit,
+					  bool *cache_hit)
+{
+	struct mask_array *ma = rcu_dereference(table->mask_array);
+	struct mask_cache_entry *entries, *ce;
+	struct sw_flow *flow;
+	u32 hash = skb_hash;
+	u32 index = 0;
+	int seg;
+
+	*n_mask_hit = 0;
+	*cache_hit = false;
+	if (unlikely(!skb_hash)) {
+		flow = flow_lookup(table, ma, key, n_mask_hit, &index);
+		goto out;
+	}
+
+	ce = NULL;
+	entries = this_cpu_ptr(table->mask_cache);
+
+	for (seg = 0; seg < MC_HASH_SEGS; seg++) {
+		struct mask_cache_entry *e;
+
+		e = &entries[hash & (MC_HASH_ENTRIES - 1)];
+		if (e->skb_hash == skb_hash) {
+			flow = flow_lookup(table, ma, key, n_mask_hit,
+					   &e->mask_index);
+			if (!flow)
+				e->skb_hash = 0;
+			else if (*n_mask_hit == 1)
+				*cache_hit = true;
+			goto out;
+		}
+
+		if (!ce || e->skb_hash < ce->skb_hash)
+			ce = e;
+
+		hash >>= MC_HASH_SHIFT;
+	}
+
+	/* Cache miss, do a full lookup and remember the mask that hit. */
+	flow = flow_lookup(table, ma, key, n_mask_hit, &ce->mask_index);
+	if (flow)
+		ce->skb_hash = skb_hash;
+
+out:
+	if (flow)
+		(*this_cpu_ptr(flow->mask->hit))++;
+	return flow;
+}
+
+struct sw_flow *ovs_flow_tbl_lookup(struct flow_table *table,
+				    const struct sw_flow_key *key)
+{
+	struct mask_array *ma = rcu_dereference(table->mask_array);
+	u32 n_mask_hit;
+	u32 index = 0;
+
+	return flow_lookup(table, ma, key, &n_mask_hit, &index);
+}
+
+/* Finds the flow installed with exactly the key of 'match', whatever its
+ * mask.  Must be called with ovs_mutex held.
+ */
+struct sw_flow *ovs_flow_tbl_lookup_unmasked_key(struct flow_table *table,
+						 struct sw_flow_match *match)
 {
-	flow->hash = ovs_flow_hash(key, flow_key_start(key), key_len);
-	memcpy(&flow->key, key, sizeof(flow->key));
+	struct mask_array *ma = ovsl_dereference(table->mask_array);
+	int i;
+
+	for (i = 0; i < ma->max; i++) {
+		struct sw_flow_mask *mask = ovsl_dereference(ma->masks[i]);
+		struct sw_flow *flow;
+
+		if (!mask)
+			continue;
+
+		flow = masked_flow_lookup(table, match->key, mask);
+		if (flow && ovs_flow_cmp_unmasked_key(flow, match->key,
+						      &match->range))
+			return flow;
+	}
+
+	return NULL;
+}
+
+static struct sw_flow_mask *mask_alloc(void)
+{
+	struct sw_flow_mask *mask;
+
+	mask = kmalloc(sizeof(*mask), GFP_KERNEL);
+	if (!mask)
+		return NULL;
+
+	mask->hit = alloc_percpu(u64);
+	if (!mask->hit) {
+		kfree(mask);
+		return NULL;
+	}
+	mask->ref_count = 1;
+	mask->last_hit = 0;
+
+	return mask;
+}
+
+static bool mask_equal(const struct sw_flow_mask *a,
+		       const struct sw_flow_mask *b)
+{
+	const u8 *a_ = (const u8 *)&a->key + a->range.start;
+	const u8 *b_ = (const u8 *)&b->key + b->range.start;
+
+	return a->range.start == b->range.start &&
+	       a->range.end == b->range.end &&
+	       !memcmp(a_, b_, range_n_bytes(&a->range));
+}
+
+static struct sw_flow_mask *flow_mask_find(const struct flow_table *table,
+					   const struct sw_flow_mask *mask)
+{
+	struct mask_array *ma = ovsl_dereference(table->mask_array);
+	int i;
+
+	for (i = 0; i < ma->max; i++) {
+		struct sw_flow_mask *t = ovsl_dereference(ma->masks[i]);
+
+		if (t && mask_equal(mask, t))
+			return t;
+	}
+
+	return NULL;
+}
+
+/* Replaces the mask array with a compacted copy of 'size' slots. */
+static int tbl_mask_array_realloc(struct flow_table *table, int size)
+{
+	struct mask_array *old, *new;
+	int i;
+
+	new = tbl_mask_array_alloc(size);
+	if (!new)
+		return -ENOMEM;
+
+	old = ovsl_dereference(table->mask_array);
+	for (i = 0; i < old->max; i++) {
+		struct sw_flow_mask *mask = ovsl_dereference(old->masks[i]);
+
+		if (mask)
+			RCU_INIT_POINTER(new->masks[new->count++], mask);
+	}
+
+	rcu_assign_pointer(table->mask_array, new);
+	kfree_rcu(old, rcu);
+
+	return 0;
+}
+
+/* Adds a reference to the mask equal to 'new', creating it if needed. */
+static int flow_mask_insert(struct flow_table *table, struct sw_flow *flow,
+			    const struct sw_flow_mask *new)
+{
+	struct sw_flow_mask *mask;
+	struct mask_array *ma;
+	int i;
+
+	mask = flow_mask_find(table, new);
+	if (mask) {
+		BUG_ON(!mask->ref_count);
+		mask->ref_count++;
+		goto out;
+	}
+
+	mask = mask_alloc();
+	if (!mask)
+		return -ENOMEM;
+	mask->key = new->key;
+	mask->range = new->range;
+
+	ma = ovsl_dereference(table->mask_array);
+	if (ma->count >= ma->max) {
+		int err;
+
+		err = tbl_mask_array_realloc(table, ma->max * 2);
+		if (err) {
+			flow_mask_free(mask);
+			return err;
+		}
+		ma = ovsl_dereference(table->mask_array);
+	}
+
+	for (i = 0; i < ma->max; i++) {
+		if (!ovsl_dereference(ma->masks[i])) {
+			rcu_assign_pointer(ma->masks[i], mask);
+			ma->count++;
+			break;
+		}
+	}
+
+out:
+	flow->mask = mask;
+	return 0;
+}
+
+static void flow_mask_remove(struct flow_table *table,
+			     struct sw_flow_mask *mask)
+{
+	struct mask_array *ma;
+	int i;
+
+	ASSERT_OVSL();
+	BUG_ON(!mask->ref_count);
+
+	if (--mask->ref_count)
+		return;
+
+	ma = ovsl_dereference(table->mask_array);
+	for (i = 0; i < ma->max; i++) {
+		if (mask == ovsl_dereference(ma->masks[i])) {
+			RCU_INIT_POINTER(ma->masks[i], NULL);
+			ma->count--;
+			break;
+		}
+	}
+	call_rcu(&mask->rcu, rcu_free_sw_flow_mask_cb);
+}
+
+int ovs_flow_tbl_insert(struct flow_table *table, struct sw_flow *flow,
+			const struct sw_flow_mask *mask)
+{
+	int err;
+
+	err = flow_mask_insert(table, flow, mask);
+	if (err)
+		return err;
+
+	ovs_flow_key_mask(&flow->key, &flow->unmasked_key, flow->mask);
+	flow->hash = ovs_flow_hash(&flow->key, flow->mask->range.start,
+				   flow->mask->range.end);
 	__flow_tbl_insert(table, flow);
+
+	return 0;
 }
 
+/* The flow's mask reference is dropped here; the mask itself stays valid
+ * until the end of the current RCU grace period.
+ */
 void ovs_flow_tbl_remove(struct flow_table *table, struct sw_flow *flow)
 {
 	BUG_ON(table->count == 0);
 	hlist_del_rcu(&flow->hash_node[table->node_ver]);
 	table->count--;
+
+	flow_mask_remove(table, flow->mask);
+}
+
+int ovs_flow_tbl_num_masks(const struct flow_table *table)
+{
+	struct mask_array *ma = rcu_dereference(table->mask_array);
+
+	return ma->count;
+}
+
+static u64 flow_mask_hits(const struct sw_flow_mask *mask)
+{
+	u64 hits = 0;
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		hits += *per_cpu_ptr(mask->hit, cpu);
+
+	return hits;
+}
+
+struct mask_rank {
+	struct sw_flow_mask *mask;
+	u64 delta;
+};
+
+/* Reorders the mask array so that the masks that matched the most packets
+ * since the previous call are tried first, and squeezes out the slots left
+ * behind by deleted masks.  Must be called with ovs_mutex held.
+ */
+void ovs_flow_tbl_masks_rebalance(struct flow_table *table)
+{
+	struct mask_array *ma = ovsl_dereference(table->mask_array);
+	struct mask_array *new;
+	struct mask_rank *rank;
+	int count = 0;
+	int i, j;
+
+	if (!ma->count)
+		return;
+
+	rank = kmalloc(sizeof(*rank) * ma->count, GFP_KERNEL);
+	if (!rank)
+		return;
+
+	/* Insertion sort, stable so that equally hit masks keep their order
+	 * and an idle table is left alone.
+	 */
+	for (i = 0; i < ma->max; i++) {
+		struct sw_flow_mask *mask = ovsl_dereference(ma->masks[i]);
+		u64 hits, delta;
+
+		if (!mask)
+			continue;
+
+		hits = flow_mask_hits(mask);
+		delta = hits - mask->last_hit;
+		mask->last_hit = hits;
+
+		for (j = count; j > 0 && rank[j - 1].delta < delta; j--)
+			rank[j] = rank[j - 1];
+		rank[j].mask = mask;
+		rank[j].delta = delta;
+		count++;
+	}
+
+	for (i = 0; i < count; i++)
+		if (ovsl_dereference(ma->masks[i]) != rank[i].mask)
+			break;
+	if (i == count)
+		goto out;
+
+	new = tbl_mask_array_alloc(ma->max);
+	if (!new)
+		goto out;
+
+	for (i = 0; i < count; i++)
+		RCU_INIT_POINTER(new->masks[i], rank[i].mask);
+	new->count = count;
+
+	rcu_assign_pointer(table->mask_array, new);
+	kfree_rcu(ma, rcu);
+out:
+	kfree(rank);
 }
 
 /* The size of the argument for each %OVS_KEY_ATTR_* Netlink attribute.  */
@@ -983,8 +1471,9 @@ static int parse_flow_nlattrs(const struct nlattr *attr,
 	return 0;
 }
 
-int ovs_ipv4_tun_from_nlattr(const struct nlattr *attr,
-			     struct ovs_key_ipv4_tunnel *tun_key)
+static int __ipv4_tun_from_nlattr(const struct nlattr *attr,
+				  struct ovs_key_ipv4_tunnel *tun_key,
+				  bool is_mask)
 {
 	struct nlattr *a;
 	int rem;
@@ -1040,6 +1529,10 @@ int ovs_ipv4_tun_from_nlattr(const struct nlattr *attr,
 	if (rem > 0)
 		return -EINVAL;
 
+	/* A tunnel mask may wildcard the destination and the TTL. */
+	if (is_mask)
+		return 0;
+
 	if (!tun_key->ipv4_dst)
 		return -EINVAL;
 
@@ -1049,6 +1542,12 @@ int ovs_ipv4_tun_from_nlattr(const struct nlattr *attr,
 	return 0;
 }
 
+int ovs_ipv4_tun_from_nlattr(const struct nlattr *attr,
+			     struct ovs_key_ipv4_tunnel *tun_key)
+{
+	return __ipv4_tun_from_nlattr(attr, tun_key, false);
+}
+
 int ovs_ipv4_tun_to_nlattr(struct sk_buff *skb,
 			   const struct ovs_key_ipv4_tunnel *tun_key)
 {
@@ -1083,14 +1582,14 @@ int ovs_ipv4_tun_to_nlattr(struct sk_buff *skb,
 }
 
 /**
- * ovs_flow_from_nlattrs - parses Netlink attributes into a flow key.
+ * flow_key_from_nlattrs - parses Netlink attributes into a flow key.
  * @swkey: receives the extracted flow key.
  * @key_lenp: number of bytes used in @swkey.
  * @attr: Netlink attribute holding nested %OVS_KEY_ATTR_* Netlink attribute
  * sequence.
  */
-int ovs_flow_from_nlattrs(struct sw_flow_key *swkey, int *key_lenp,
-		      const struct nlattr *attr)
+static int flow_key_from_nlattrs(struct sw_flow_key *swkey, int *key_lenp,
+				 const struct nlattr *attr)
 {
 	const struct nlattr *a[OVS_KEY_ATTR_MAX + 1];
 	const struct ovs_key_ethernet *eth_key;
@@ -1256,10 +1755,357 @@ int ovs_flow_from_nlattrs(struct sw_flow_key *swkey, int *key_lenp,
 	return 0;
 }
 
+static bool is_all_zero(const u8 *p, size_t size)
+{
+	size_t i;
+
+	for (i = 0; i < size; i++)
+		if (p[i])
+			return false;
+
+	return true;
+}
+
+static int ipv4_mask_from_nlattrs(struct sw_flow_key *mask,
+				  const struct sw_flow_key *key,
+				  const struct nlattr *a[], u32 *attrs)
+{
+	if (*attrs & (1 << OVS_KEY_ATTR_TCP)) {
+		const struct ovs_key_tcp *tcp_mask;
+
+		if (key->ip.proto != IPPROTO_TCP)
+			return -EINVAL;
+		*attrs &= ~(1 << OVS_KEY_ATTR_TCP);
+
+		tcp_mask = nla_data(a[OVS_KEY_ATTR_TCP]);
+		mask->ipv4.tp.src = tcp_mask->tcp_src;
+		mask->ipv4.tp.dst = tcp_mask->tcp_dst;
+	}
+
+	if (*attrs & (1 << OVS_KEY_ATTR_UDP)) {
+		const struct ovs_key_udp *udp_mask;
+
+		if (key->ip.proto != IPPROTO_UDP)
+			return -EINVAL;
+		*attrs &= ~(1 << OVS_KEY_ATTR_UDP);
+
+		udp_mask = nla_data(a[OVS_KEY_ATTR_UDP]);
+		mask->ipv4.tp.src = udp_mask->udp_src;
+		mask->ipv4.tp.dst = udp_mask->udp_dst;
+	}
+
+	if (*attrs & (1 << OVS_KEY_ATTR_ICMP)) {
+		const struct ovs_key_icmp *icmp_mask;
+
+		if (key->ip.proto != IPPROTO_ICMP)
+			return -EINVAL;
+		*attrs &= ~(1 << OVS_KEY_ATTR_ICMP);
+
+		icmp_mask = nla_data(a[OVS_KEY_ATTR_ICMP]);
+		mask->ipv4.tp.src = htons(icmp_mask->icmp_type);
+		mask->ipv4.tp.dst = htons(icmp_mask->icmp_code);
+	}
+
+	return 0;
+}
+
+static int ipv6_mask_from_nlattrs(struct sw_flow_key *mask,
+				  const struct sw_flow_key *key,
+				  const struct nlattr *a[], u32 *attrs)
+{
+	if (*attrs & (1 << OVS_KEY_ATTR_TCP)) {
+		const struct ovs_key_tcp *tcp_mask;
+
+		if (key->ip.proto != IPPROTO_TCP)
+			return -EINVAL;
+		*attrs &= ~(1 << OVS_KEY_ATTR_TCP);
+
+		tcp_mask = nla_data(a[OVS_KEY_ATTR_TCP]);
+		mask->ipv6.tp.src = tcp_mask->tcp_src;
+		mask->ipv6.tp.dst = tcp_mask->tcp_dst;
+	}
+
+	if (*attrs & (1 << OVS_KEY_ATTR_UDP)) {
+		const struct ovs_key_udp *udp_mask;
+
+		if (key->ip.proto != IPPROTO_UDP)
+			return -EINVAL;
+		*attrs &= ~(1 << OVS_KEY_ATTR_UDP);
+
+		udp_mask = nla_data(a[OVS_KEY_ATTR_UDP]);
+		mask->ipv6.tp.src = udp_mask->udp_src;
+		mask->ipv6.tp.dst = udp_mask->udp_dst;
+	}
+
+	if (*attrs & (1 << OVS_KEY_ATTR_ICMPV6)) {
+		const struct ovs_key_icmpv6 *icmpv6_mask;
+
+		if (key->ip.proto != IPPROTO_ICMPV6)
+			return -EINVAL;
+		*attrs &= ~(1 << OVS_KEY_ATTR_ICMPV6);
+
+		icmpv6_mask = nla_data(a[OVS_KEY_ATTR_ICMPV6]);
+		mask->ipv6.tp.src = htons(icmpv6_mask->icmpv6_type);
+		mask->ipv6.tp.dst = htons(icmpv6_mask->icmpv6_code);
+	}
+
+	if (*attrs & (1 << OVS_KEY_ATTR_ND)) {
+		const struct ovs_key_nd *nd_mask;
+
+		if (key->ip.proto != IPPROTO_ICMPV6 ||
+		    (key->ipv6.tp.src != htons(NDISC_NEIGHBOUR_SOLICITATION) &&
+		     key->ipv6.tp.src != htons(NDISC_NEIGHBOUR_ADVERTISEMENT)))
+			return -EINVAL;
+		*attrs &= ~(1 << OVS_KEY_ATTR_ND);
+
+		nd_mask = nla_data(a[OVS_KEY_ATTR_ND]);
+		memcpy(&mask->ipv6.nd.target, nd_mask->nd_target,
+		       sizeof(mask->ipv6.nd.target));
+		memcpy(mask->ipv6.nd.sll, nd_mask->nd_sll, ETH_ALEN);
+		memcpy(mask->ipv6.nd.tll, nd_mask->nd_tll, ETH_ALEN);
+	}
+
+	return 0;
+}
+
+/**
+ * flow_mask_from_nlattrs - parses Netlink attributes into a flow mask.
+ * @mask: receives the mask, must be zeroed by the caller.
+ * @key: the flow key the mask applies to, already parsed.
+ * @attr: Netlink attribute holding nested %OVS_KEY_ATTR_* Netlink attribute
+ * sequence laid out like the flow key, with each value holding the bits of
+ * the corresponding key field that are significant.  Attributes left out
+ * are fully wildcarded.
+ */
+static int flow_mask_from_nlattrs(struct sw_flow_key *mask,
+				  const struct sw_flow_key *key,
+				  const struct nlattr *attr)
+{
+	const struct nlattr *a[OVS_KEY_ATTR_MAX + 1];
+	u32 attrs;
+	int err;
+
+	err = parse_flow_nlattrs(attr, a, &attrs);
+	if (err)
+		return err;
+
+	/* Metadata attributes. */
+	if (attrs & (1 << OVS_KEY_ATTR_PRIORITY)) {
+		mask->phy.priority = nla_get_u32(a[OVS_KEY_ATTR_PRIORITY]);
+		attrs &= ~(1 << OVS_KEY_ATTR_PRIORITY);
+	}
+	if (attrs & (1 << OVS_KEY_ATTR_IN_PORT)) {
+		mask->phy.in_port = nla_get_u32(a[OVS_KEY_ATTR_IN_PORT]);
+		attrs &= ~(1 << OVS_KEY_ATTR_IN_PORT);
+	}
+	if (attrs & (1 << OVS_KEY_ATTR_SKB_MARK)) {
+		mask->phy.skb_mark = nla_get_u32(a[OVS_KEY_ATTR_SKB_MARK]);
+		attrs &= ~(1 << OVS_KEY_ATTR_SKB_MARK);
+	}
+	if (attrs & (1 << OVS_KEY_ATTR_TUNNEL)) {
+		err = __ipv4_tun_from_nlattr(a[OVS_KEY_ATTR_TUNNEL],
+					     &mask->tun_key, true);
+		if (err)
+			return err;
+		attrs &= ~(1 << OVS_KEY_ATTR_TUNNEL);
+	}
+
+	/* Data attributes. */
+	if (attrs & (1 << OVS_KEY_ATTR_ETHERNET)) {
+		const struct ovs_key_ethernet *eth_mask;
+
+		eth_mask = nla_data(a[OVS_KEY_ATTR_ETHERNET]);
+		memcpy(mask->eth.src, eth_mask->eth_src, ETH_ALEN);
+		memcpy(mask->eth.dst, eth_mask->eth_dst, ETH_ALEN);
+		attrs &= ~(1 << OVS_KEY_ATTR_ETHERNET);
+	}
+
+	if (key->eth.tci || key->eth.type == htons(ETH_P_8021Q)) {
+		/* The outer ethertype of a VLAN flow is always 802.1Q, its
+		 * mask carries no information.
+		 */
+		attrs &= ~(1 << OVS_KEY_ATTR_ETHERTYPE);
+
+		if (attrs & (1 << OVS_KEY_ATTR_VLAN)) {
+			mask->eth.tci = nla_get_be16(a[OVS_KEY_ATTR_VLAN]);
+			attrs &= ~(1 << OVS_KEY_ATTR_VLAN);
+		}
+		if (!(mask->eth.tci & htons(VLAN_TAG_PRESENT)))
+			return -EINVAL;
+
+		if (attrs & (1 << OVS_KEY_ATTR_ENCAP)) {
+			const struct nlattr *encap = a[OVS_KEY_ATTR_ENCAP];
+
+			if (attrs != (1 << OVS_KEY_ATTR_ENCAP))
+				return -EINVAL;
+
+			if (!key->eth.tci) {
+				if (nla_len(encap))
+					return -EINVAL;
+				return 0;
+			}
+
+			err = parse_flow_nlattrs(encap, a, &attrs);
+			if (err)
+				return err;
+		}
+	} else {
+		/* A flow without a VLAN header must not match tagged packets. */
+		mask->eth.tci = htons(0xffff);
+	}
+
+	if (attrs & (1 << OVS_KEY_ATTR_ETHERTYPE)) {
+		mask->eth.type = nla_get_be16(a[OVS_KEY_ATTR_ETHERTYPE]);
+		attrs &= ~(1 << OVS_KEY_ATTR_ETHERTYPE);
+	}
+
+	if (key->eth.type == htons(ETH_P_IP)) {
+		if (attrs & (1 << OVS_KEY_ATTR_IPV4)) {
+			const struct ovs_key_ipv4 *ipv4_mask;
+
+			ipv4_mask = nla_data(a[OVS_KEY_ATTR_IPV4]);
+			mask->ip.proto = ipv4_mask->ipv4_proto;
+			mask->ip.tos = ipv4_mask->ipv4_tos;
+			mask->ip.ttl = ipv4_mask->ipv4_ttl;
+			mask->ip.frag = ipv4_mask->ipv4_frag;
+			mask->ipv4.addr.src = ipv4_mask->ipv4_src;
+			mask->ipv4.addr.dst = ipv4_mask->ipv4_dst;
+			attrs &= ~(1 << OVS_KEY_ATTR_IPV4);
+		}
+
+		err = ipv4_mask_from_nlattrs(mask, key, a, &attrs);
+		if (err)
+			return err;
+	} else if (key->eth.type == htons(ETH_P_IPV6)) {
+		if (attrs & (1 << OVS_KEY_ATTR_IPV6)) {
+			const struct ovs_key_ipv6 *ipv6_mask;
+
+			ipv6_mask = nla_data(a[OVS_KEY_ATTR_IPV6]);
+			mask->ipv6.label = ipv6_mask->ipv6_label;
+			mask->ip.proto = ipv6_mask->ipv6_proto;
+			mask->ip.tos = ipv6_mask->ipv6_tclass;
+			mask->ip.ttl = ipv6_mask->ipv6_hlimit;
+			mask->ip.frag = ipv6_mask->ipv6_frag;
+			memcpy(&mask->ipv6.addr.src, ipv6_mask->ipv6_src,
+			       sizeof(mask->ipv6.addr.src));
+			memcpy(&mask->ipv6.addr.dst, ipv6_mask->ipv6_dst,
+			       sizeof(mask->ipv6.addr.dst));
+			attrs &= ~(1 << OVS_KEY_ATTR_IPV6);
+		}
+
+		err = ipv6_mask_from_nlattrs(mask, key, a, &attrs);
+		if (err)
+			return err;
+	} else if (key->eth.type == htons(ETH_P_ARP) ||
+		   key->eth.type == htons(ETH_P_RARP)) {
+		if (attrs & (1 << OVS_KEY_ATTR_ARP)) {
+			const struct ovs_key_arp *arp_mask;
+
+			arp_mask = nla_data(a[OVS_KEY_ATTR_ARP]);
+			mask->ipv4.addr.src = arp_mask->arp_sip;
+			mask->ipv4.addr.dst = arp_mask->arp_tip;
+			mask->ip.proto = ntohs(arp_mask->arp_op) & 0xff;
+			memcpy(mask->ipv4.arp.sha, arp_mask->arp_sha, ETH_ALEN);
+			memcpy(mask->ipv4.arp.tha, arp_mask->arp_tha, ETH_ALEN);
+			attrs &= ~(1 << OVS_KEY_ATTR_ARP);
+		}
+	}
+
+	if (attrs)
+		return -EINVAL;
+
+	return 0;
+}
+
+/* Fields only make sense to match on when the fields that determine their
+ * meaning are matched exactly.
+ */
+static int flow_mask_validate(const struct sw_flow_key *key,
+			      const struct sw_flow_key *mask)
+{
+	size_t l3_start = offsetof(struct sw_flow_key, ip);
+	bool l4_masked = false;
+
+	if (!is_all_zero((const u8 *)mask + l3_start, sizeof(*mask) - l3_start) &&
+	    mask->eth.type != htons(0xffff))
+		return -EINVAL;
+
+	if (key->eth.type == htons(ETH_P_IP))
+		l4_masked = mask->ipv4.tp.src || mask->ipv4.tp.dst;
+	else if (key->eth.type == htons(ETH_P_IPV6))
+		l4_masked = mask->ipv6.tp.src || mask->ipv6.tp.dst ||
+			    !is_all_zero((const u8 *)&mask->ipv6.nd,
+					 sizeof(mask->ipv6.nd));
+
+	if (l4_masked && mask->ip.proto != 0xff)
+		return -EINVAL;
+
+	return 0;
+}
+
+static void flow_mask_set_range(struct sw_flow_mask *mask)
+{
+	const u8 *p = (const u8 *)&mask->key;
+	size_t start = 0, end = sizeof(mask->key);
+
+	while (start < end && !p[start])
+		start++;
+	while (end > start && !p[end - 1])
+		end--;
+
+	mask->range.start = rounddown(start, sizeof(long));
+	mask->range.end = roundup(end, sizeof(long));
+}
+
+/**
+ * ovs_match_from_nlattrs - parses Netlink attributes into a flow match.
+ * @match: receives the flow key in @match->key and, if @match->mask is
+ * not %NULL, the flow mask in @match->mask.  @match->range is set to the
+ * bytes of the key that are significant.
+ * @key: Netlink attribute holding nested %OVS_KEY_ATTR_* Netlink attribute
+ * sequence for the flow key.
+ * @mask: Optional Netlink attribute holding the same kind of sequence for
+ * the flow mask.  Without it the flow is an exact match on @key.
+ */
+int ovs_match_from_nlattrs(struct sw_flow_match *match,
+			   const struct nlattr *key,
+			   const struct nlattr *mask)
+{
+	struct sw_flow_key *mask_key;
+	int key_len;
+	int err;
+
+	err = flow_key_from_nlattrs(match->key, &key_len, key);
+	if (err)
+		return err;
+
+	match->range.start = 0;
+	match->range.end = roundup(key_len, sizeof(long));
+
+	if (!match->mask)
+		return 0;
+
+	mask_key = &match->mask->key;
+	memset(mask_key, 0, sizeof(*mask_key));
+	if (mask) {
+		err = flow_mask_from_nlattrs(mask_key, match->key, mask);
+		if (err)
+			return err;
+
+		err = flow_mask_validate(match->key, mask_key);
+		if (err)
+			return err;
+	} else {
+		memset(mask_key, 0xff, key_len);
+	}
+	flow_mask_set_range(match->mask);
+
+	return 0;
+}
+
 /**
  * ovs_flow_metadata_from_nlattrs - parses Netlink attributes into a flow key.
  * @flow: Receives extracted in_port, priority, tun_key and skb_mark.
- * @key_len: Length of key in @flow.  Used for calculating flow hash.
  * @attr: Netlink attribute holding nested %OVS_KEY_ATTR_* Netlink attribute
  * sequence.
  *
@@ -1268,7 +2114,7 @@ int ovs_flow_from_nlattrs(struct sw_flow_key *swkey, int *key_lenp,
  * get the metadata, that is, the parts of the flow key that cannot be
  * extracted from the packet itself.
  */
-int ovs_flow_metadata_from_nlattrs(struct sw_flow *flow, int key_len,
+int ovs_flow_metadata_from_nlattrs(struct sw_flow *flow,
 				   const struct nlattr *attr)
 {
 	struct ovs_key_ipv4_tunnel *tun_key = &flow->key.tun_key;
@@ -1315,43 +2161,59 @@ int ovs_flow_metadata_from_nlattrs(struct sw_flow *flow, int key_len,
 	if (rem)
 		return -EINVAL;
 
-	flow->hash = ovs_flow_hash(&flow->key,
-				   flow_key_start(&flow->key), key_len);
-
 	return 0;
 }
 
-int ovs_flow_to_nlattrs(const struct sw_flow_key *swkey, struct sk_buff *skb)
+/**
+ * ovs_flow_to_nlattrs - serializes a flow key or mask as Netlink attributes.
+ * @swkey: flow key that decides which attributes are emitted.
+ * @output: values to emit: @swkey itself for the key, or the flow's mask,
+ * in which case the attributes form the %OVS_FLOW_ATTR_MASK of @swkey.
+ * @skb: buffer to append the attributes to.
+ */
+int ovs_flow_to_nlattrs(const struct sw_flow_key *swkey,
+			const struct sw_flow_key *output, struct sk_buff *skb)
 {
 	struct ovs_key_ethernet *eth_key;
 	struct nlattr *nla, *encap;
+	bool is_mask = (swkey != output);
 
-	if (swkey->phy.priority &&
-	    nla_put_u32(skb, OVS_KEY_ATTR_PRIORITY, swkey->phy.priority))
+	if ((swkey->phy.priority || is_mask) &&
+	    nla_put_u32(skb, OVS_KEY_ATTR_PRIORITY, output->phy.priority))
 		goto nla_put_failure;
 
-	if (swkey->tun_key.ipv4_dst &&
-	    ovs_ipv4_tun_to_nlattr(skb, &swkey->tun_key))
+	if ((swkey->tun_key.ipv4_dst || is_mask) &&
+	    ovs_ipv4_tun_to_nlattr(skb, &output->tun_key))
 		goto nla_put_failure;
 
-	if (swkey->phy.in_port != DP_MAX_PORTS &&
-	    nla_put_u32(skb, OVS_KEY_ATTR_IN_PORT, swkey->phy.in_port))
-		goto nla_put_failure;
+	if (swkey->phy.in_port == DP_MAX_PORTS) {
+		if (is_mask && output->phy.in_port == 0xffff &&
+		    nla_put_u32(skb, OVS_KEY_ATTR_IN_PORT, 0xffffffff))
+			goto nla_put_failure;
+	} else {
+		u32 upper_u16 = is_mask ? 0xffff0000 : 0;
+
+		if (nla_put_u32(skb, OVS_KEY_ATTR_IN_PORT,
+				upper_u16 | output->phy.in_port))
+			goto nla_put_failure;
+	}
 
-	if (swkey->phy.skb_mark &&
-	    nla_put_u32(skb, OVS_KEY_ATTR_SKB_MARK, swkey->phy.skb_mark))
+	if ((swkey->phy.skb_mark || is_mask) &&
+	    nla_put_u32(skb, OVS_KEY_ATTR_SKB_MARK, output->phy.skb_mark))
 		goto nla_put_failure;
 
 	nla = nla_reserve(skb, OVS_KEY_ATTR_ETHERNET, sizeof(*eth_key));
 	if (!nla)
 		goto nla_put_failure;
 	eth_key = nla_data(nla);
-	memcpy(eth_key->eth_src, swkey->eth.src, ETH_ALEN);
-	memcpy(eth_key->eth_dst, swkey->eth.dst, ETH_ALEN);
+	memcpy(eth_key->eth_src, output->eth.src, ETH_ALEN);
+	memcpy(eth_key->eth_dst, output->eth.dst, ETH_ALEN);
 
 	if (swkey->eth.tci || swkey->eth.type == htons(ETH_P_8021Q)) {
-		if (nla_put_be16(skb, OVS_KEY_ATTR_ETHERTYPE, htons(ETH_P_8021Q)) ||
-		    nla_put_be16(skb, OVS_KEY_ATTR_VLAN, swkey->eth.tci))
+		__be16 eth_type = is_mask ? htons(0xffff) : htons(ETH_P_8021Q);
+
+		if (nla_put_be16(skb, OVS_KEY_ATTR_ETHERTYPE, eth_type) ||
+		    nla_put_be16(skb, OVS_KEY_ATTR_VLAN, output->eth.tci))
 			goto nla_put_failure;
 		encap = nla_nest_start(skb, OVS_KEY_ATTR_ENCAP);
 		if (!swkey->eth.tci)
@@ -1360,10 +2222,17 @@ int ovs_flow_to_nlattrs(const struct sw_flow_key *swkey, struct sk_buff *skb)
 		encap = NULL;
 	}
 
-	if (swkey->eth.type == htons(ETH_P_802_2))
+	if (swkey->eth.type == htons(ETH_P_802_2)) {
+		/* 802.2 frames have no %OVS_KEY_ATTR_ETHERTYPE in the key, the
+		 * mask still says whether the ethertype is matched at all.
+		 */
+		if (is_mask && output->eth.type &&
+		    nla_put_be16(skb, OVS_KEY_ATTR_ETHERTYPE, output->eth.type))
+			goto nla_put_failure;
 		goto unencap;
+	}
 
-	if (nla_put_be16(skb, OVS_KEY_ATTR_ETHERTYPE, swkey->eth.type))
+	if (nla_put_be16(skb, OVS_KEY_ATTR_ETHERTYPE, output->eth.type))
 		goto nla_put_failure;
 
 	if (swkey->eth.type == htons(ETH_P_IP)) {
@@ -1373,12 +2242,12 @@ int ovs_flow_to_nlattrs(const struct sw_flow_key *swkey, struct sk_buff *skb)
 		if (!nla)
 			goto nla_put_failure;
 		ipv4_key = nla_data(nla);
-		ipv4_key->ipv4_src = swkey->ipv4.addr.src;
-		ipv4_key->ipv4_dst = swkey->ipv4.addr.dst;
-		ipv4_key->ipv4_proto = swkey->ip.proto;
-		ipv4_key->ipv4_tos = swkey->ip.tos;
-		ipv4_key->ipv4_ttl = swkey->ip.ttl;
-		ipv4_key->ipv4_frag = swkey->ip.frag;
+		ipv4_key->ipv4_src = output->ipv4.addr.src;
+		ipv4_key->ipv4_dst = output->ipv4.addr.dst;
+		ipv4_key->ipv4_proto = output->ip.proto;
+		ipv4_key->ipv4_tos = output->ip.tos;
+		ipv4_key->ipv4_ttl = output->ip.ttl;
+		ipv4_key->ipv4_frag = output->ip.frag;
 	} else if (swkey->eth.type == htons(ETH_P_IPV6)) {
 		struct ovs_key_ipv6 *ipv6_key;
 
@@ -1386,15 +2255,15 @@ int ovs_flow_to_nlattrs(const struct sw_flow_key *swkey, struct sk_buff *skb)
 		if (!nla)
 			goto nla_put_failure;
 		ipv6_key = nla_data(nla);
-		memcpy(ipv6_key->ipv6_src, &swkey->ipv6.addr.src,
+		memcpy(ipv6_key->ipv6_src, &output->ipv6.addr.src,
 				sizeof(ipv6_key->ipv6_src));
-		memcpy(ipv6_key->ipv6_dst, &swkey->ipv6.addr.dst,
+		memcpy(ipv6_key->ipv6_dst, &output->ipv6.addr.dst,
 				sizeof(ipv6_key->ipv6_dst));
-		ipv6_key->ipv6_label = swkey->ipv6.label;
-		ipv6_key->ipv6_proto = swkey->ip.proto;
-		ipv6_key->ipv6_tclass = swkey->ip.tos;
-		ipv6_key->ipv6_hlimit = swkey->ip.ttl;
-		ipv6_key->ipv6_frag = swkey->ip.frag;
+		ipv6_key->ipv6_label = output->ipv6.label;
+		ipv6_key->ipv6_proto = output->ip.proto;
+		ipv6_key->ipv6_tclass = output->ip.tos;
+		ipv6_key->ipv6_hlimit = output->ip.ttl;
+		ipv6_key->ipv6_frag = output->ip.frag;
 	} else if (swkey->eth.type == htons(ETH_P_ARP) ||
 		   swkey->eth.type == htons(ETH_P_RARP)) {
 		struct ovs_key_arp *arp_key;
@@ -1404,11 +2273,11 @@ int ovs_flow_to_nlattrs(const struct sw_flow_key *swkey, struct sk_buff *skb)
 			goto nla_put_failure;
 		arp_key = nla_data(nla);
 		memset(arp_key, 0, sizeof(struct ovs_key_arp));
-		arp_key->arp_sip = swkey->ipv4.addr.src;
-		arp_key->arp_tip = swkey->ipv4.addr.dst;
-		arp_key->arp_op = htons(swkey->ip.proto);
-		memcpy(arp_key->arp_sha, swkey->ipv4.arp.sha, ETH_ALEN);
-		memcpy(arp_key->arp_tha, swkey->ipv4.arp.tha, ETH_ALEN);
+		arp_key->arp_sip = output->ipv4.addr.src;
+		arp_key->arp_tip = output->ipv4.addr.dst;
+		arp_key->arp_op = htons(output->ip.proto);
+		memcpy(arp_key->arp_sha, output->ipv4.arp.sha, ETH_ALEN);
+		memcpy(arp_key->arp_tha, output->ipv4.arp.tha, ETH_ALEN);
 	}
 
 	if ((swkey->eth.type == htons(ETH_P_IP) ||
@@ -1423,11 +2292,11 @@ int ovs_flow_to_nlattrs(const struct sw_flow_key *swkey, struct sk_buff *skb)
 				goto nla_put_failure;
 			tcp_key = nla_data(nla);
 			if (swkey->eth.type == htons(ETH_P_IP)) {
-				tcp_key->tcp_src = swkey->ipv4.tp.src;
-				tcp_key->tcp_dst = swkey->ipv4.tp.dst;
+				tcp_key->tcp_src = output->ipv4.tp.src;
+				tcp_key->tcp_dst = output->ipv4.tp.dst;
 			} else if (swkey->eth.type == htons(ETH_P_IPV6)) {
-				tcp_key->tcp_src = swkey->ipv6.tp.src;
-				tcp_key->tcp_dst = swkey->ipv6.tp.dst;
+				tcp_key->tcp_src = output->ipv6.tp.src;
+				tcp_key->tcp_dst = output->ipv6.tp.dst;
 			}
 		} else if (swkey->ip.proto == IPPROTO_UDP) {
 			struct ovs_key_udp *udp_key;
@@ -1437,11 +2306,11 @@ int ovs_flow_to_nlattrs(const struct sw_flow_key *swkey, struct sk_buff *skb)
 				goto nla_put_failure;
 			udp_key = nla_data(nla);
 			if (swkey->eth.type == htons(ETH_P_IP)) {
-				udp_key->udp_src = swkey->ipv4.tp.src;
-				udp_key->udp_dst = swkey->ipv4.tp.dst;
+				udp_key->udp_src = output->ipv4.tp.src;
+				udp_key->udp_dst = output->ipv4.tp.dst;
 			} else if (swkey->eth.type == htons(ETH_P_IPV6)) {
-				udp_key->udp_src = swkey->ipv6.tp.src;
-				udp_key->udp_dst = swkey->ipv6.tp.dst;
+				udp_key->udp_src = output->ipv6.tp.src;
+				udp_key->udp_dst = output->ipv6.tp.dst;
 			}
 		} else if (swkey->eth.type == htons(ETH_P_IP) &&
 			   swkey->ip.proto == IPPROTO_ICMP) {
@@ -1451,8 +2320,8 @@ int ovs_flow_to_nlattrs(const struct sw_flow_key *swkey, struct sk_buff *skb)
 			if (!nla)
 				goto nla_put_failure;
 			icmp_key = nla_data(nla);
-			icmp_key->icmp_type = ntohs(swkey->ipv4.tp.src);
-			icmp_key->icmp_code = ntohs(swkey->ipv4.tp.dst);
+			icmp_key->icmp_type = ntohs(output->ipv4.tp.src);
+			icmp_key->icmp_code = ntohs(output->ipv4.tp.dst);
 		} else if (swkey->eth.type == htons(ETH_P_IPV6) &&
 			   swkey->ip.proto == IPPROTO_ICMPV6) {
 			struct ovs_key_icmpv6 *icmpv6_key;
@@ -1462,21 +2331,21 @@ int ovs_flow_to_nlattrs(const struct sw_flow_key *swkey, struct sk_buff *skb)
 			if (!nla)
 				goto nla_put_failure;
 			icmpv6_key = nla_data(nla);
-			icmpv6_key->icmpv6_type = ntohs(swkey->ipv6.tp.src);
-			icmpv6_key->icmpv6_code = ntohs(swkey->ipv6.tp.dst);
+			icmpv6_key->icmpv6_type = ntohs(output->ipv6.tp.src);
+			icmpv6_key->icmpv6_code = ntohs(output->ipv6.tp.dst);
 
-			if (icmpv6_key->icmpv6_type == NDISC_NEIGHBOUR_SOLICITATION ||
-			    icmpv6_key->icmpv6_type == NDISC_NEIGHBOUR_ADVERTISEMENT) {
+			if (swkey->ipv6.tp.src == htons(NDISC_NEIGHBOUR_SOLICITATION) ||
+			    swkey->ipv6.tp.src == htons(NDISC_NEIGHBOUR_ADVERTISEMENT)) {
 				struct ovs_key_nd *nd_key;
 
 				nla = nla_reserve(skb, OVS_KEY_ATTR_ND, sizeof(*nd_key));
 				if (!nla)
 					goto nla_put_failure;
 				nd_key = nla_data(nla);
-				memcpy(nd_key->nd_target, &swkey->ipv6.nd.target,
+				memcpy(nd_key->nd_target, &output->ipv6.nd.target,
 							sizeof(nd_key->nd_target));
-				memcpy(nd_key->nd_sll, swkey->ipv6.nd.sll, ETH_ALEN);
-				memcpy(nd_key->nd_tll, swkey->ipv6.nd.tll, ETH_ALEN);
+				memcpy(nd_key->nd_sll, output->ipv6.nd.sll, ETH_ALEN);
+				memcpy(nd_key->nd_tll, output->ipv6.nd.tll, ETH_ALEN);
 			}
 		}
 	}
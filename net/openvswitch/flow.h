@@ -123,6 +123,30 @@ struct sw_flow_key {
 			} nd;
 		} ipv6;
 	};
+} __aligned(BITS_PER_LONG/8); /* Ensure that we can do comparisons as longs. */
+
+/* Bytes of a flow key covered by a mask, rounded out to whole longs. */
+struct sw_flow_key_range {
+	size_t start;
+	size_t end;
+};
+
+struct sw_flow_mask {
+	int ref_count;
+	struct rcu_head rcu;
+	/* Only ovs_flow_tbl_masks_rebalance() reads these: userspace gets
+	 * the per-datapath totals in struct ovs_dp_megaflow_stats.
+	 */
+	u64 __percpu *hit;	/* Lookups that found a flow through this mask. */
+	u64 last_hit;		/* Sum of 'hit' at the last rebalance. */
+	struct sw_flow_key_range range;
+	struct sw_flow_key key;
+};
+
+struct sw_flow_match {
+	struct sw_flow_key *key;
+	struct sw_flow_key_range range;
+	struct sw_flow_mask *mask;
 };
 
 struct sw_flow {
@@ -131,6 +155,8 @@ struct sw_flow {
 	u32 hash;
 
 	struct sw_flow_key key;
+	struct sw_flow_key unmasked_key;
+	struct sw_flow_mask *mask;
 	struct sw_flow_actions __rcu *sf_acts;
 
 	spinlock_t lock;	/* Lock for values below. */
@@ -169,19 +195,45 @@ int ovs_flow_extract(struct sk_buff *, u16 in_port, struct sw_flow_key *,
 void ovs_flow_used(struct sw_flow *, struct sk_buff *);
 u64 ovs_flow_used_time(unsigned long flow_jiffies);
 
-int ovs_flow_to_nlattrs(const struct sw_flow_key *, struct sk_buff *);
-int ovs_flow_from_nlattrs(struct sw_flow_key *swkey, int *key_lenp,
-		      const struct nlattr *);
-int ovs_flow_metadata_from_nlattrs(struct sw_flow *flow, int key_len,
-				  const struct nlattr *attr);
+int ovs_flow_to_nlattrs(const struct sw_flow_key *swkey,
+			const struct sw_flow_key *output, struct sk_buff *);
+int ovs_match_from_nlattrs(struct sw_flow_match *match,
+			   const struct nlattr *key, const struct nlattr *mask);
+int ovs_flow_metadata_from_nlattrs(struct sw_flow *flow,
+				   const struct nlattr *attr);
 
 #define MAX_ACTIONS_BUFSIZE    (32 * 1024)
 #define TBL_MIN_BUCKETS		1024
 
+/* Masks in use, in the order they are tried on lookup.  Slots freed by
+ * deleted masks stay NULL until the next rebalance compacts the array.
+ */
+struct mask_array {
+	struct rcu_head rcu;
+	int count, max;
+	struct sw_flow_mask __rcu *masks[];
+};
+
+#define MASK_ARRAY_SIZE_MIN	16
+
+/* Per-cpu cache mapping a packet's rxhash to the index of the mask that
+ * matched it last time, so most lookups only need to try one mask.
+ */
+struct mask_cache_entry {
+	u32 skb_hash;
+	u32 mask_index;
+};
+
+#define MC_HASH_SHIFT		8
+#define MC_HASH_ENTRIES		(1u << MC_HASH_SHIFT)
+#define MC_HASH_SEGS		((sizeof(u16) * 8) / MC_HASH_SHIFT)
+
 struct flow_table {
 	struct flex_array *buckets;
 	unsigned int count, n_buckets;
 	struct rcu_head rcu;
+	struct mask_array __rcu *mask_array;
+	struct mask_cache_entry __percpu *mask_cache;
 	int node_ver;
 	u32 hash_seed;
 	bool keep_flows;
@@ -197,16 +249,30 @@ static inline int ovs_flow_tbl_need_to_expand(struct flow_table *table)
 	return (table->count > table->n_buckets);
 }
 
+struct sw_flow *ovs_flow_tbl_lookup_stats(struct flow_table *table,
+					  const struct sw_flow_key *key,
+					  u32 skb_hash, u32 *n_mask_hit,
+					  bool *cache_hit);
 struct sw_flow *ovs_flow_tbl_lookup(struct flow_table *table,
-				    struct sw_flow_key *key, int len);
+				    const struct sw_flow_key *key);
+struct sw_flow *ovs_flow_tbl_lookup_unmasked_key(struct flow_table *table,
+						 struct sw_flow_match *match);
 void ovs_flow_tbl_destroy(struct flow_table *table);
 void ovs_flow_tbl_deferred_destroy(struct flow_table *table);
 struct flow_table *ovs_flow_tbl_alloc(int new_size);
 struct flow_table *ovs_flow_tbl_expand(struct flow_table *table);
 struct flow_table *ovs_flow_tbl_rehash(struct flow_table *table);
-void ovs_flow_tbl_insert(struct flow_table *table, struct sw_flow *flow,
-			 struct sw_flow_key *key, int key_len);
+int ovs_flow_tbl_insert(struct flow_table *table, struct sw_flow *flow,
+			const struct sw_flow_mask *mask);
 void ovs_flow_tbl_remove(struct flow_table *table, struct sw_flow *flow);
+void ovs_flow_tbl_masks_rebalance(struct flow_table *table);
+int ovs_flow_tbl_num_masks(const struct flow_table *table);
+
+bool ovs_flow_cmp_unmasked_key(const struct sw_flow *flow,
+			       const struct sw_flow_key *key,
+			       const struct sw_flow_key_range *range);
+void ovs_flow_key_mask(struct sw_flow_key *dst, const struct sw_flow_key *src,
+		       const struct sw_flow_mask *mask);
 
 struct sw_flow *ovs_flow_tbl_next(struct flow_table *table, u32 *bucket, u32 *idx);
 extern const int ovs_key_lens[OVS_KEY_ATTR_MAX + 1];